@@ -60,6 +60,7 @@ struct hash_table {
 static struct parameter *flip_parameters(struct parameter *, int *);
 static struct enumerator *flip_enumerators(struct enumerator *, int *);
 static struct element *flip_elements(struct element *, int *);
+static void assign_presence_bits(struct parameter *);
 static void dump_elements( struct element *head );
 
 static struct hash_table *hash_table_new(hash_func, comp_func);
@@ -235,13 +236,14 @@ void dump_elements( struct element *head ) {
         struct parameter *pp = ep->message.parameters;
         printf("Message %s (Ox%04X)\n", ep->message.name, ep->message.id);
         while (pp) {
-          printf("- parameter %s %s (%d) [%s]\n", 
+          printf("- parameter %s %s (%d) [%s%s]\n", 
             pp->type,
             pp->name,
             pp->id,
             (pp->optional)?
               (pp->repeated)? "optional,repeated" : "optional" :
-              (pp->repeated)? "required,repeated" : "required"
+              (pp->repeated)? "required,repeated" : "required",
+            (pp->key)? ",key" : ""
           );
           pp = pp->next;
         }
@@ -330,19 +332,39 @@ flip_enumerators(struct enumerator *head, int *nenumerators)
   return prev;
 }
 
+/*
+ * Presence bits are assigned in parameter id order, so that scanning the
+ * presence bitset visits parameters in the same order as the parameter map.
+ */
+void assign_presence_bits(struct parameter *head)
+{
+  struct parameter *pp, *qp;
+  int pos = 0;
+
+  for (pp = head; pp; pp = pp->next, pos++) {
+    int qpos = 0;
+    pp->bit = 0;
+    for (qp = head; qp; qp = qp->next, qpos++)
+      if (qp->id < pp->id || (qp->id == pp->id && qpos < pos))
+        pp->bit++;
+  }
+}
+
 struct {
   const char *out;
   const char *in;
   int dump;
+  int random; /* generate randomizers */
 } migpars;
 
-void mig_init(const char *in, const char *out, int dump) {
+void mig_init(const char *in, const char *out, int dump, int random) {
   type_table = hash_table_new(name2hash, namecmp);
   msg_table = hash_table_new(id2hash, idcmp);
 
   migpars.out = out;
   migpars.in = in;
   migpars.dump = dump;
+  migpars.random = random;
 }
 
 int mig_find_msg(int id)
@@ -419,6 +441,7 @@ mig_creat_message(const char *name, int id, struct parameter *parameters)
     ep->message.name = ep->name;
     ep->message.id = id;
     ep->message.parameters = flip_parameters(parameters, &ep->message.nparameters);
+    assign_presence_bits(ep->message.parameters);
   }
   
   return ep;
@@ -453,6 +476,7 @@ mig_creat_group(const char *name, struct parameter *parameters)
 
     ep->group.name = ep->name;
     ep->group.parameters = flip_parameters(parameters, &ep->group.nparameters);
+    assign_presence_bits(ep->group.parameters);
   }
 
   return ep;
@@ -477,7 +501,8 @@ mig_creat_parameter(const char *type,
                     const char *name,
                     int id,
                     int optional,
-                    int repeated )
+                    int repeated,
+                    int key )
 {
   struct parameter *ep = (struct parameter *)malloc(sizeof(*ep));
 
@@ -488,6 +513,8 @@ mig_creat_parameter(const char *type,
     ep->id = id;
     ep->optional = optional;
     ep->repeated = repeated;
+    ep->key = key;
+    ep->bit = -1;
   }
 
   return ep;
@@ -503,6 +530,33 @@ static void generate_m_params_vector(FILE *of, struct parameter *pp)
   fprintf(of, "    };\n");
 }
 
+static void generate_m_index_vector(FILE *of, struct parameter *head, int n) 
+{
+  int bit;
+
+  fprintf(of, "    const ::mig::parameter_index_t m_index = {\n");
+  for (bit = 0; bit < n; bit++) {
+    struct parameter *pp = head;
+    while (pp && pp->bit != bit)
+      pp = pp->next;
+    if (pp)
+      fprintf(of, "      &%s,\n", pp->name);
+  }
+  fprintf(of, "    };\n");
+}
+
+static void generate_required_mask(FILE *of, struct parameter *pp) 
+{
+  unsigned long long mask = 0;
+
+  while (pp) {
+    if (!pp->optional)
+      mask |= 1ULL << pp->bit;
+    pp = pp->next;
+  }
+  fprintf(of, "    static constexpr ::mig::presence_t required_mask() { return 0x%llxULL; }\n", mask);
+}
+
 static void generate_parameters(FILE *of, struct parameter *pp) 
 {
   if (pp)
@@ -517,19 +571,273 @@ static void generate_parameters(FILE *of, struct parameter *pp)
     const char *optional = (pp->optional)? ", ::mig::OPTIONAL" : "";
 
     if (ep->type == ET_GROUP)
-      partype = "Group";
+      partype = (pp->repeated)? "GroupArray" : "GroupParameter";
     else if (ep->type == ET_DATATYPE) {
       datatype = ep->datatype.type; 
-      partype = (ep->datatype.var)? "Var" : "Scalar";
-    } else if (ep->type == ET_ENUM) 
-      partype = "Enum";
+      if (!ep->datatype.var)
+        partype = (pp->repeated)? "ScalarArray" : "ScalarParameter";
+      else if (!pp->repeated)
+        partype = "VarParameter";
+    } else if (ep->type == ET_ENUM && !pp->repeated) 
+      partype = "EnumParameter";
 
     if (partype)
-      fprintf(of, "    ::mig::%sParameter<%s> %s{%d%s};\n",
+      fprintf(of, "    ::mig::%s<%s> %s{%d%s};\n",
         partype, datatype, pp->name, pp->id, optional);
+    else
+      fprintf(of, "#error \"%s: repeated %s parameters are not supported\"\n",
+        pp->name, (ep->type == ET_ENUM)? "enum" : "variable length");
+
+    pp = pp->next;
+  }
+}
+
+/*
+ * Fixed size scalar and enum parameters of a message can be overwritten
+ * directly in an encoded frame. The message's schema instance tells the
+ * wire format how to skip over the other parameters. Their typed field
+ * ids are for filters which read them from frames. Variable length and
+ * void parameters only get field ids, for columnar batches.
+ */
+static void generate_frame_updaters(FILE *of, const char *msgname, struct parameter *pp) 
+{
+  fprintf(of, "\n    //! blank instance describing the message layout\n");
+  fprintf(of, "    static const %s& schema() { static const %s m; return m; }\n",
+    msgname, msgname);
+
+  while (pp) {
+    union hash_key key = { .name = pp->type };
+    struct hash_node *np = hash_table_search(type_table, &key);
+    struct element *ep = (struct element *)np->item;
+
+    if (!pp->repeated && ep->type == ET_ENUM) {
+      fprintf(of, "    static int update_%s(::mig::WireFormat& w, %s value) ",
+        pp->name, pp->type);
+      fprintf(of, "{ return w.update(schema(), %d, (::mig::enum_t)value); }\n", pp->id);
+      fprintf(of, "    static constexpr ::mig::field_t<%s> field_%s() { return {%d}; }\n",
+        pp->type, pp->name, pp->id);
+    } else if (!pp->repeated && ep->type == ET_DATATYPE && !ep->datatype.var
+               && !strstr(ep->datatype.type, "void_t")) {
+      fprintf(of, "    static int update_%s(::mig::WireFormat& w, %s value) ",
+        pp->name, ep->datatype.type);
+      fprintf(of, "{ return w.update(schema(), %d, value); }\n", pp->id);
+      fprintf(of, "    static constexpr ::mig::field_t<%s> field_%s() { return {%d}; }\n",
+        ep->datatype.type, pp->name, pp->id);
+    } else if (!pp->repeated && ep->type == ET_DATATYPE) {
+      fprintf(of, "    static constexpr ::mig::field_t<%s> field_%s() { return {%d}; }\n",
+        ep->datatype.type, pp->name, pp->id);
+    }
+    pp = pp->next;
+  }
+}
+
+/*
+ * Synthetic content for load generation (see migrand.h). Each parameter
+ * is filled by the Random overload of its class, enums pick one of their
+ * enumerators and optional parameters are present by chance.
+ */
+static void generate_randomizer(FILE *of, struct parameter *pp)
+{
+  fprintf(of, "\n    //! fill parameters with random content\n");
+  fprintf(of, "    void randomize(::mig::Random& r) {\n");
+  if (!pp)
+    fprintf(of, "      (void)r;\n");
+
+  while (pp) {
+    union hash_key key = { .name = pp->type };
+    struct hash_node *np = hash_table_search(type_table, &key);
+    struct element *ep = (struct element *)np->item;
+
+    fprintf(of, "      ");
+    if (pp->optional)
+      fprintf(of, "if (r.chance(r.optional)) ");
+    if (ep->type == ET_ENUM) {
+      struct enumerator *e = ep->enumeration.enumerators;
+      fprintf(of, "r.fill(%s, {", pp->name);
+      for (; e; e = e->next)
+        fprintf(of, " %s::%s%s", pp->type, e->name, (e->next) ? "," : " ");
+      fprintf(of, "});");
+    } else
+      fprintf(of, "r.fill(%s);", pp->name);
+    if (pp->optional)
+      fprintf(of, " else %s.clear();", pp->name);
+    fprintf(of, "\n");
+    pp = pp->next;
+  }
+  fprintf(of, "    }\n");
+}
+
+/*
+ * Read only view of the aligned layout (see migmsg.h). Required fixed size
+ * scalars and enums are in the fixed block, others in the parameter table,
+ * both in presence bit order.
+ */
+static int is_layout_fixed(struct parameter *pp, struct element *ep)
+{
+  if (pp->optional || pp->repeated)
+    return 0;
+  if (ep->type == ET_ENUM)
+    return 1;
+  return (ep->type == ET_DATATYPE && !ep->datatype.var
+          && !strstr(ep->datatype.type, "void_t"));
+}
 
+/*
+ * Key parameters of a message are hashed in the order of their
+ * definition, from the message or straight from an encoded frame. Both
+ * give the same hash, so frames can be partitioned before decoding.
+ */
+static int has_key(struct parameter *pp)
+{
+  while (pp && !pp->key)
     pp = pp->next;
+  return pp != NULL;
+}
+
+static void generate_key(FILE *of, struct parameter *head)
+{
+  struct parameter *pp;
+
+  if (!has_key(head))
+    return;
+
+  fprintf(of, "\n    //! hash of the routing key\n");
+  fprintf(of, "    uint64_t key() const {\n");
+  fprintf(of, "      ::mig::KeyHash h;\n");
+  for (pp = head; pp; pp = pp->next)
+    if (pp->key)
+      fprintf(of, "      h.add(%s);\n", pp->name);
+  fprintf(of, "      return h.value();\n");
+  fprintf(of, "    }\n");
+
+  fprintf(of, "    //! hash of the routing key of an encoded frame, without decoding it\n");
+  fprintf(of, "    static int key(const ::mig::WireFormat& w, uint64_t& hash) {\n");
+  fprintf(of, "      ::mig::KeyHash h;\n");
+  for (pp = head; pp; pp = pp->next) {
+    union hash_key key = { .name = pp->type };
+    struct hash_node *np;
+    struct element *ep;
+    const char *type = NULL;
+
+    if (!pp->key)
+      continue;
+    np = hash_table_search(type_table, &key);
+    ep = (struct element *)np->item;
+    if (ep->type == ET_ENUM)
+      type = "::mig::enum_t";
+    else if (ep->type == ET_DATATYPE && !strstr(ep->datatype.type, "void_t"))
+      type = ep->datatype.type;
+
+    if (type)
+      fprintf(of, "      if (h.add<%s>(w, schema(), %d, %s) != 0)\n        return -1;\n",
+        type, pp->id, (pp->optional)? "true" : "false");
+    else
+      fprintf(of, "#error \"%s: key parameters must be scalars, enums or strings\"\n", pp->name);
+  }
+  fprintf(of, "      hash = h.value();\n");
+  fprintf(of, "      return 0;\n");
+  fprintf(of, "    }\n");
+}
+
+static void generate_layout_view(FILE *of, const char *name, struct parameter *head, 
+                                 int n, int id)
+{
+  int bit, nfixed = 0, nentries = 0;
+
+  fprintf(of, "//! Read only view of %s in the aligned layout\n", name);
+  fprintf(of, "class %sView : public ::mig::LayoutView {\n\n", name);
+  fprintf(of, "  public:\n");
+
+  for (bit = 0; bit < n; bit++) {
+    struct parameter *pp = head;
+    while (pp && pp->bit != bit)
+      pp = pp->next;
+    if (pp) {
+      union hash_key key = { .name = pp->type };
+      struct element *ep = (struct element *)hash_table_search(type_table, &key)->item;
+      if (is_layout_fixed(pp, ep))
+        nfixed++;
+      else
+        nentries++;
+    }
+  }
+
+  if (id >= 0)
+    fprintf(of, "    %sView(const uint8_t *p, size_t n) : "
+      "::mig::LayoutView(p, n, 0x%x, fixed_offset(%d), %d) {}\n", name, id, nfixed, nentries);
+  else
+    fprintf(of, "    %sView(const uint8_t *p, size_t n) : "
+      "::mig::LayoutView(p, n, fixed_offset(%d), %d) {}\n", name, nfixed, nentries);
+
+  fprintf(of, "    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({");
+  for (bit = 0; bit < n; bit++) {
+    struct parameter *pp = head;
+    while (pp && pp->bit != bit)
+      pp = pp->next;
+    if (pp) {
+      union hash_key key = { .name = pp->type };
+      struct element *ep = (struct element *)hash_table_search(type_table, &key)->item;
+      if (is_layout_fixed(pp, ep))
+        fprintf(of, " sizeof(%s),", 
+          (ep->type == ET_ENUM) ? "::mig::enum_t" : ep->datatype.type);
+    }
+  }
+  fprintf(of, " }, k); }\n\n");
+
+  nfixed = nentries = 0;
+  for (bit = 0; bit < n; bit++) {
+    struct parameter *pp = head;
+    while (pp && pp->bit != bit)
+      pp = pp->next;
+    if (!pp)
+      continue;
+
+    union hash_key key = { .name = pp->type };
+    struct element *ep = (struct element *)hash_table_search(type_table, &key)->item;
+    const char *type = (ep->type == ET_DATATYPE) ? ep->datatype.type : pp->type;
+    int is_void = (ep->type == ET_DATATYPE && strstr(type, "void_t"));
+
+    if (is_layout_fixed(pp, ep)) {
+      if (ep->type == ET_ENUM)
+        fprintf(of, "    %s %s() const { return static_cast<%s>(fixed<::mig::enum_t>(fixed_offset(%d))); }\n",
+          type, pp->name, type, nfixed);
+      else
+        fprintf(of, "    %s %s() const { return fixed<%s>(fixed_offset(%d)); }\n",
+          type, pp->name, type, nfixed);
+      nfixed++;
+      continue;
+    }
+
+    if (pp->repeated) {
+      if (ep->type == ET_GROUP)
+        fprintf(of, "    ::mig::group_array_view<%sView> %s() const { return groups<%sView>(%d); }\n",
+          type, pp->name, type, nentries);
+      else if (is_void)
+        fprintf(of, "    size_t %s() const { return count(%d); }\n", pp->name, nentries);
+      else if (ep->type == ET_DATATYPE && !ep->datatype.var)
+        fprintf(of, "    ::mig::array_view<%s> %s() const { return array<%s>(%d); }\n",
+          type, pp->name, type, nentries);
+      nentries++;
+      continue;
+    }
+
+    fprintf(of, "    bool has_%s() const { return has(%d); }\n", pp->name, nentries);
+    if (ep->type == ET_GROUP)
+      fprintf(of, "    %sView %s() const { return group<%sView>(%d); }\n",
+        type, pp->name, type, nentries);
+    else if (ep->type == ET_ENUM)
+      fprintf(of, "    %s %s() const { return static_cast<%s>(value<::mig::enum_t>(%d)); }\n",
+        type, pp->name, type, nentries);
+    else if (ep->datatype.var)
+      fprintf(of, "    %s %s() const { return var<%s>(%d); }\n",
+        type, pp->name, type, nentries);
+    else if (!is_void)
+      fprintf(of, "    %s %s() const { return value<%s>(%d); }\n",
+        type, pp->name, type, nentries);
+    nentries++;
   }
+
+  fprintf(of, "};\n\n");
 }
 
 void mig_generate_code( struct element *head ) {
@@ -558,6 +866,7 @@ void generate_cpp( struct element *ep, FILE *of)
   struct tm *tm = localtime(&t);
 
   struct element *head = ep;
+  int n;
   char *upper = strdup(migpars.in);
   char *c = upper;
 
@@ -581,7 +890,7 @@ void generate_cpp( struct element *ep, FILE *of)
   fprintf(of, "//  %s\n", asctime(tm));
   fprintf(of, "#ifndef _%s_H_\n", upper);
   fprintf(of, "#define _%s_H_\n\n", upper);
-  fprintf(of, "#include \"migmsg.h\"\n\n");
+  fprintf(of, "#include \"%s\"\n\n", (migpars.random) ? "migrand.h" : "migmsg.h");
 
   while (ep) {
  
@@ -591,17 +900,24 @@ void generate_cpp( struct element *ep, FILE *of)
         fprintf(of, "class %s : public ::mig::Message {\n\n", ep->message.name);
 
         fprintf(of, "  public:\n");
-        fprintf(of, "    %s() : ::mig::Message(0x%x, m_params) {}\n",
+        fprintf(of, "    %s() : ::mig::Message(0x%x, m_params, m_index, required_mask()) { bind(); }\n",
           ep->message.name, ep->message.id);
         fprintf(of, "    static ::mig::message_ptr_t create() ");
         fprintf(of, "{ return std::make_unique<%s>(); }\n", ep->message.name);
+        generate_required_mask(of, pp);
+        generate_frame_updaters(of, ep->message.name, pp);
+        generate_key(of, pp);
+        if (migpars.random)
+          generate_randomizer(of, pp);
         if (pp)
           generate_parameters(of, pp);
 
         fprintf(of, "\n  private:\n");
         generate_m_params_vector(of, pp);
+        generate_m_index_vector(of, pp, ep->message.nparameters);
 
         fprintf(of, "};\n\n");
+        generate_layout_view(of, ep->message.name, pp, ep->message.nparameters, ep->message.id);
         break;
     }
         
@@ -610,14 +926,23 @@ void generate_cpp( struct element *ep, FILE *of)
         fprintf(of, "struct %s : ::mig::Group {\n\n", ep->group.name);
 
         fprintf(of, "  public:\n");
-        fprintf(of, "    %s() : ::mig::Group(m_params) {}\n", ep->group.name);
+        fprintf(of, "    %s() : ::mig::Group(m_params, m_index, required_mask()) { bind(); }\n",
+          ep->group.name);
+        generate_required_mask(of, pp);
+        if (has_key(pp))
+          fprintf(of, "#error \"%s: only message parameters can be keys\"\n", ep->group.name);
+        if (migpars.random)
+          generate_randomizer(of, pp);
         if (pp)
           generate_parameters(of, pp);
 
         fprintf(of, "\n  private:\n");
         generate_m_params_vector(of, pp);
+        generate_m_index_vector(of, pp, ep->group.nparameters);
 
-        fprintf(of, "};\n\n\n");
+        fprintf(of, "};\n\n");
+        generate_layout_view(of, ep->group.name, pp, ep->group.nparameters, -1);
+        fprintf(of, "\n");
         break;
     }
         
@@ -656,6 +981,79 @@ void generate_cpp( struct element *ep, FILE *of)
     ep = ep->next;
   }
   fprintf(of, "  };\n\n");
+
+  // typed dispatch
+  ep = head;
+  n = 0;
+  fprintf(of, "//! position of a message id in MessageDispatcher, -1 if not in the schema\n");
+  fprintf(of, "inline int message_index(int id) {\n");
+  fprintf(of, "  switch (id) {\n");
+  while (ep) {
+    if (ep->type == ET_MESSAGE)
+      fprintf(of, "  case 0x%x: return %d;\n", ep->message.id, n++);
+    ep = ep->next;
+  }
+  fprintf(of, "  default: return -1;\n");
+  fprintf(of, "  }\n");
+  fprintf(of, "}\n\n");
+
+  if (n > 0) {
+    ep = head;
+    fprintf(of, "//! dispatcher of the messages in %s to typed handlers\n", migpars.in);
+    fprintf(of, "template <class Handler>\n");
+    fprintf(of, "using MessageDispatcher = ::mig::Dispatcher<message_index, Handler");
+    while (ep) {
+      if (ep->type == ET_MESSAGE)
+        fprintf(of, ",\n  %s", ep->message.name);
+      ep = ep->next;
+    }
+    fprintf(of, ">;\n\n");
+    fprintf(of, "template <class Handler>\n");
+    fprintf(of, "MessageDispatcher<Handler> make_dispatcher(Handler handler) {\n");
+    fprintf(of, "  return MessageDispatcher<Handler>(std::move(handler));\n");
+    fprintf(of, "}\n\n");
+  }
+
+  // routing keys of all keyed messages
+  ep = head;
+  fprintf(of, "//! hash of the routing key of a message, -1 if it has no key\n");
+  fprintf(of, "inline int message_key(const ::mig::Message& msg, uint64_t& hash) {\n");
+  fprintf(of, "  switch (msg.id()) {\n");
+  while (ep) {
+    if (ep->type == ET_MESSAGE && has_key(ep->message.parameters))
+      fprintf(of, "  case 0x%x: hash = static_cast<const %s&>(msg).key(); return 0;\n",
+        ep->message.id, ep->message.name);
+    ep = ep->next;
+  }
+  fprintf(of, "  default: return -1;\n");
+  fprintf(of, "  }\n");
+  fprintf(of, "}\n\n");
+
+  ep = head;
+  fprintf(of, "//! hash of the routing key of an encoded frame, -1 if it has no key\n");
+  fprintf(of, "inline int message_key(const ::mig::WireFormat& w, uint64_t& hash) {\n");
+  fprintf(of, "  switch (w.id()) {\n");
+  while (ep) {
+    if (ep->type == ET_MESSAGE && has_key(ep->message.parameters))
+      fprintf(of, "  case 0x%x: return %s::key(w, hash);\n", ep->message.id, ep->message.name);
+    ep = ep->next;
+  }
+  fprintf(of, "  default: return -1;\n");
+  fprintf(of, "  }\n");
+  fprintf(of, "}\n\n");
+
+  if (migpars.random) {
+    ep = head;
+    fprintf(of, "const std::map<int, mig::RandomizerFunc> mig::Random::randomizers {\n");
+    while (ep) {
+      if (ep->type == ET_MESSAGE)
+        fprintf(of, "  { 0x%x, [](mig::Message& m, mig::Random& r) "
+                "{ static_cast<%s&>(m).randomize(r); } },\n",
+                ep->message.id, ep->message.name);
+      ep = ep->next;
+    }
+    fprintf(of, "  };\n\n");
+  }
  
   fprintf(of, "#endif // ifndef _%s_H_\n", upper);
 
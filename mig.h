@@ -28,6 +28,9 @@
 
 /* top level elements in message definition file */
 
+#define MIG_MAX_PARAMETERS 64 /* one presence bit per parameter */
+#define MIG_MAX_PARAMETER_ID 0xFEFF /* ids from 0xFF00 are reserved marks on the wire */
+
 enum element_type {
   ET_DATATYPE,
   ET_MESSAGE,
@@ -42,6 +45,8 @@ struct parameter {
   const char *type; /*< native data type */
   int optional;
   int repeated;
+  int key; /*< part of the message's routing key */
+  int bit; /*< presence bit, parameters ordered by id */
 };
 
 struct enumerator {
@@ -94,9 +99,9 @@ struct element *mig_creat_message(const char *, int, struct parameter *);
 struct element *mig_creat_enumeration(const char *, struct enumerator *);
 struct element *mig_creat_group(const char *, struct parameter *);
 struct enumerator *mig_creat_enumerator(const char *, int);
-struct parameter *mig_creat_parameter(const char*, const char *, int, int, int);
+struct parameter *mig_creat_parameter(const char*, const char *, int, int, int, int);
 
-void mig_init(const char *, const char *, int);
+void mig_init(const char *, const char *, int, int);
 int mig_find_type(const char *);
 int mig_find_msg(int);
 int mig_add_element(const struct element *);
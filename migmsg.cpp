@@ -27,6 +27,14 @@
 #include <iostream>
 #include <iomanip>
 
+extern "C" {
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
 std::ostream& ::mig::operator<<(std::ostream& os, const ::mig::string_t& str) {
   os << str.data();
   return os;
@@ -34,6 +42,51 @@ std::ostream& ::mig::operator<<(std::ostream& os, const ::mig::string_t& str) {
 
 namespace mig {
 
+region_ptr_t file_region::map(int fd, size_t offset, size_t length) {
+
+// mmap() needs a page aligned file offset, the data pointer is adjusted
+
+  if (fd < 0 || length == 0)
+    return nullptr;
+  auto page = (size_t)sysconf(_SC_PAGESIZE);
+  auto start = offset / page * page;
+  auto size = offset - start + length;
+
+  void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, (off_t)start);
+  if (p == MAP_FAILED)
+    return nullptr;
+
+  auto r = std::shared_ptr<file_region>(new file_region());
+  r->m_map = p;
+  r->m_map_size = size;
+  r->m_data = (const uint8_t *)p + (offset - start);
+  r->m_size = length;
+  r->m_offset = offset;
+  r->m_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (r->m_fd < 0)
+    return nullptr;
+  return r;
+}
+
+region_ptr_t file_region::map(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  region_ptr_t r = nullptr;
+  if (fstat(fd, &st) == 0)
+    r = map(fd, 0, (size_t)st.st_size);
+  close(fd);
+  return r;
+}
+
+file_region::~file_region() {
+  if (m_map)
+    munmap(m_map, m_map_size);
+  if (m_fd >= 0)
+    close(m_fd);
+}
+
 int WireFormat::to_wire(uint8_t value) {
 
   return buf()->putc(value);
@@ -65,18 +118,9 @@ int WireFormat::to_wire(uint32_t value) {
 
 int WireFormat::to_wire(uint64_t value) {
 
-  union u {
-    uint64_t i64;
-    uint32_t i32[2];
-  };
-
-  union u v1, v2;
-
   if (byteorder() == ByteOrder::Network) {
-    v1.i64 = value;
-    v2.i32[1] = htonl(v1.i32[0]);
-    v2.i32[0] = htonl(v2.i32[1]);
-    return buf()->putp((uint8_t *)&v2, 8);
+    uint32_t v[2] = { htonl((uint32_t)(value >> 32)), htonl((uint32_t)value) };
+    return buf()->putp((uint8_t *)v, 8);
   } else {
     // TODO implement
     return -1;
@@ -98,6 +142,8 @@ int WireFormat::to_wire(const string_t& value) {
 
 int WireFormat::to_wire(const blob_t& value) {
     // TODO limit checks
+  if (value.region())
+    return buf()->putr(*value.region());
   return buf()->putp((uint8_t *)value.data(), value.size());
 }
 
@@ -121,57 +167,79 @@ int WireFormat::to_wire(int64_t value) {
   return to_wire((uint64_t)value);
 }
 
-// TODO limit checks
+// fixed size readers fail if the value does not fit in the buffer
 
 int WireFormat::from_wire(int8_t& data) const {
-  data = (int8_t)buf()->getc();
+  auto p = buf()->getp(1);
+  if (!p)
+    return -1;
+  data = (int8_t)*p;
+  buf()->advance(1);
   return 0;
 }
 
 int WireFormat::from_wire(int16_t& data) const {
-  data = (int16_t)ntohs(*(uint16_t*)(buf()->getp(2)));
-  buf()->advance(2);
-  return 0;
+  uint16_t x;
+  auto ret = from_wire(x);
+  data = (int16_t)x;
+  return ret;
 }
 
 int WireFormat::from_wire(int32_t& data) const {
-  data = (int32_t)ntohl(*(uint32_t*)(buf()->getp(4)));
-  buf()->advance(4);
-  return 0;
+  uint32_t x;
+  auto ret = from_wire(x);
+  data = (int32_t)x;
+  return ret;
 }
 
 int WireFormat::from_wire(int64_t& data) const {
-  data = 0; // TODO;
-  buf()->advance(8);
-  return 0;
+  uint64_t x;
+  auto ret = from_wire(x);
+  data = (int64_t)x;
+  return ret;
 }
 
 int WireFormat::from_wire(uint8_t& data) const {
-  data = buf()->getc();
+  auto p = buf()->getp(1);
+  if (!p)
+    return -1;
+  data = *p;
+  buf()->advance(1);
   return 0;
 }
 
 int WireFormat::from_wire(uint16_t& data) const {
-  data = ntohs(*(uint16_t*)(buf()->getp(2)));
+  auto p = buf()->getp(2);
+  if (!p)
+    return -1;
+  data = ntohs(*(uint16_t*)p);
   buf()->advance(2);
   return 0;
 }
 
 int WireFormat::from_wire(uint32_t& data) const {
-  data = ntohs(*(uint32_t*)(buf()->getp(4)));
+  auto p = buf()->getp(4);
+  if (!p)
+    return -1;
+  data = ntohl(*(uint32_t*)p);
   buf()->advance(4);
   return 0;
 }
 
 int WireFormat::from_wire(uint64_t& data) const {
-  data = 0; // TODO
+  auto p = (uint32_t *)(buf()->getp(8));
+  if (!p)
+    return -1;
+  data = ((uint64_t)ntohl(p[0]) << 32) | ntohl(p[1]);
   buf()->advance(8);
   return 0;
 }
 
 int WireFormat::from_wire(bool& data) const {
-  data = buf()->getc();
-  return 0;
+  uint8_t x;
+  auto ret = from_wire(x);
+  data = x;
+  return ret;
 }
 
 int WireFormat::from_wire(void_t& data) const {
@@ -179,18 +247,22 @@ int WireFormat::from_wire(void_t& data) const {
 }
 
 
+message_ptr_t Message::instance(int id) {
+  const auto& it = Message::creators.find(id);
+  if (it == Message::creators.end())
+    return nullptr;
+  return it->second();
+}
+
 message_ptr_t Message::factory(wire_format_ptr_t& w) {
 
-  if (w.get()) {
+  if (w.get() && !w->is_delta()) {
     const auto& it = Message::creators.find(w->id());
     if (it != Message::creators.end()) {
       MessageCreatorFunc f = it->second;
       auto m = f();
-      if (m.get()) {
-        m->set_wire_format(w); // proto object now owned by message 
-        m->wire_format()->from_wire(*m);
+      if (m.get() && m->decode(w) == 0) // proto object now owned by message
         return m;
-      }
     }
   }
 
@@ -31,8 +31,13 @@
 #include <string>
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <initializer_list>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
 
 namespace mig {
 
@@ -52,28 +57,91 @@ class Parameter;
 class Group;
 class WireFormat;
 class MsgBuf;
+class file_region;
 
 typedef uint8_t enum_t;
+typedef uint64_t presence_t; // one bit per group parameter
 typedef std::map<int, Parameter&> parameter_container_t;
+typedef std::vector<Parameter*> parameter_index_t; // parameters in presence bit order
 typedef std::unique_ptr<Message> message_ptr_t;
 typedef std::unique_ptr<WireFormat> wire_format_ptr_t;
 typedef std::unique_ptr<MsgBuf> msgbuf_ptr_t;
 typedef std::unique_ptr<uint8_t []> storage_ptr_t; // for dynamic storage areas
+typedef std::shared_ptr<const file_region> region_ptr_t; // for mapped file areas
 
 typedef message_ptr_t (*MessageCreatorFunc)(void);
 
 struct void_t {};
 
+//! location of an encoded frame in a buffer owned by someone else
+struct frame_ref {
+  const uint8_t *data;
+  size_t size;
+};
+
+//! typed id of a top level, not repeated parameter, generated as field_<name>()
+template <class T>
+struct field_t {
+  int id;
+};
+
+//! Return the index of the lowest set bit and clear it
+inline int pop_bit(presence_t& bits) {
+  int i = __builtin_ctzll(bits);
+  bits &= bits - 1;
+  return i;
+}
+
+//! Read only memory mapping of a file region
+//
+// The region keeps its own descriptor of the file, so the data can also
+// be sent with sendfile() after the original descriptor is closed.
+//
+class file_region {
+
+  public:
+    //! map length bytes at offset of an open file, nullptr on failure
+    static region_ptr_t map(int fd, size_t offset, size_t length);
+    //! map a whole file
+    static region_ptr_t map(const char *path);
+
+    file_region(const file_region&) = delete;
+    file_region& operator=(const file_region&) = delete;
+    ~file_region();
+
+    const uint8_t *data() const { return this->m_data; }
+    size_t size() const { return this->m_size; }
+    int fd() const { return this->m_fd; }
+    size_t offset() const { return this->m_offset; }
+
+  private:
+    file_region() {}
+
+    void *m_map = nullptr; //!< page aligned mapping
+    size_t m_map_size = 0;
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    int m_fd = -1;
+    size_t m_offset = 0; //!< file offset of the data
+};
+
 class blob_t {
 
   public:
     blob_t(storage_ptr_t& p, size_t n) { assign(p, n); }
     blob_t(const uint8_t *p, size_t n) { assign(p, n); }
-    blob_t(blob_t& b) { copy(b.m_data, b.m_size); }
+    blob_t(const region_ptr_t& r) { assign(r); }
+    blob_t(blob_t& b) {
+      if (b.m_region)
+        assign(b.m_region); // mapping is shared
+      else
+        copy(b.m_data, b.m_size);
+    }
     blob_t(blob_t&& b) noexcept { move(b); }
 
     void assign(storage_ptr_t& p, size_t n) { // move m_storage to new owner
       m_storage = std::move(p);
+      m_region = nullptr;
       m_data = m_storage.get();
       m_size = (m_data) ? n : 0;
     }
@@ -81,30 +149,53 @@ class blob_t {
     void assign(const uint8_t *p, size_t n) { // grab not owned pointer p
       m_data = p;
       m_storage = nullptr;
+      m_region = nullptr;
       m_size = (m_data) ? n : 0;
     }
 
+    void assign(const region_ptr_t& r) { // refer to a mapped file region
+      m_region = r;
+      m_storage = nullptr;
+      m_data = (r) ? r->data() : nullptr;
+      m_size = (m_data) ? r->size() : 0;
+    }
+
     void assign(blob_t& b) {
       if (b.m_storage != nullptr)
         assign(b.m_storage, b.m_size);
+      else if (b.m_region != nullptr)
+        assign(b.m_region);
       else
         assign(b.m_data, b.m_size);
     }
 
     void move(blob_t& b) { //! move blob to new owner
-      assign(b.m_storage, b.m_size); 
+      if (b.m_region != nullptr)
+        assign(b.m_region);
+      else
+        assign(b.m_storage, b.m_size); 
       b.m_data = nullptr;
       b.m_storage = nullptr;
+      b.m_region = nullptr;
       b.m_size = 0;
     }
 
     void copy(const uint8_t *p, size_t n) {
       m_storage = std::make_unique<uint8_t []>(n);
       memcpy(m_storage.get(), p, n);
+      m_region = nullptr;
       m_data = m_storage.get();
       m_size = n;
     }
 
+    void own() { // copy not owned data to private storage
+      if (m_storage == nullptr && m_region == nullptr && m_data != nullptr)
+        copy(m_data, m_size);
+    }
+
+    //! mapped file region the data refers to, if any
+    const region_ptr_t& region() const { return m_region; }
+
     bool equals(const blob_t& b) const {
       if (m_size != b.size())
         return false;
@@ -122,6 +213,7 @@ class blob_t {
   
   private:
     storage_ptr_t m_storage = nullptr;
+    region_ptr_t m_region = nullptr;
     const uint8_t *m_data = nullptr;
     size_t m_size = 0;
 };
@@ -168,13 +260,22 @@ class string_t {
       m_size = str.m_size;
     }
 
-    void copy(const std::string& str) {
-      auto size = str.size();
-      m_storage = std::make_unique<uint8_t []>(size+1);
-      memcpy((char *)m_storage.get(), str.c_str(), size);
-      m_storage[size] = '\0';
+    void copy(const std::string& str) { copy(str.data(), str.size()); }
+
+    void copy(const char *p, size_t n) { // copy n characters and add the terminator
+      m_storage = std::make_unique<uint8_t []>(n+1);
+      memcpy((char *)m_storage.get(), p, n);
+      m_storage[n] = '\0';
       m_data = (const char *)m_storage.get();
-      m_size = size+1;
+      m_size = n+1;
+    }
+
+    void own() { // copy not owned data to private storage
+      if (m_storage == nullptr && m_data != nullptr) {
+        m_storage = std::make_unique<uint8_t []>(m_size);
+        memcpy((char *)m_storage.get(), m_data, m_size);
+        m_data = (const char *)m_storage.get();
+      }
     }
 
     void copy(const char *p) {
@@ -228,10 +329,21 @@ class MsgBuf {
     virtual int putc(uint8_t c) = 0;
     //! put array of bytes and advance buffer pointer by n
     virtual int putp(const uint8_t *p, size_t n) = 0;
+    //! put mapped file data, buffers may refer to the file instead of copying
+    virtual int putr(const file_region& r) { return putp(r.data(), r.size()); }
     //! get one byte and advance buffer pointer by 1
     virtual uint8_t getc() = 0;
     //! get pointer to buffer data if available
     virtual uint8_t *getp(size_t) const = 0;
+    //! copy n bytes out of the buffer and advance buffer pointer by n
+    virtual int getn(uint8_t *p, size_t n) {
+      const uint8_t *q = getp(n);
+      if (!q)
+        return -1;
+      memcpy(p, q, n);
+      advance(n);
+      return 0;
+    }
     //! reset buffer pointer to the start of buffer
     virtual void reset() = 0; //
     //! advance buffer pointer
@@ -240,6 +352,8 @@ class MsgBuf {
     virtual int reverse(int) = 0;
     //! get internal buffer size
     virtual size_t size() const = 0;
+    //! get buffer pointer offset from the start of buffer
+    virtual size_t offset() const = 0;
 
     //! hexdump buffer contents to stream
     virtual void hexdump(std::ostream&) const = 0;
@@ -253,6 +367,8 @@ class WireFormat {
     static wire_format_ptr_t factory(Message&);
     //! instantiate wire formatter from byte buffer (incoming)
     static wire_format_ptr_t factory(storage_ptr_t&, size_t);
+    //! instantiate delta wire formatter, encodes differences to baseline
+    static wire_format_ptr_t factory(const Message& baseline, Message&);
 
     virtual ~WireFormat() { }
 
@@ -279,6 +395,36 @@ class WireFormat {
     virtual int from_wire(Message&) const = 0;
     virtual int from_wire(Group&) const = 0;
 
+    //! update modified parameters of the encoded message in place
+    //! returns non-zero if the message has to be re-serialized
+    virtual int patch(const Message&) { return -1; }
+    //! re-serialize message, unmodified parameters may be copied from this
+    virtual wire_format_ptr_t reencode(Message& msg) const { return factory(msg); }
+
+    //! buffer holds a delta, from_wire() applies it onto a baseline message
+    virtual bool is_delta() const { return false; }
+
+    //! buffer is consumed from a stream, it cannot be reused for encoding
+    virtual bool is_stream() const { return false; }
+
+    //! buffer offset of a top level parameter's data in the encoded message
+    //! schema message describes the layout, returns not_found if the
+    //! parameter is not in the message and unreadable if the message could
+    //! not be read up to the parameter
+    virtual int locate(const Message&, int) const { return unreadable; }
+    enum { not_found = -1, unreadable = -2 };
+
+    //! overwrite a fixed size top level parameter of the encoded message
+    template <class T>
+    int update(const Message& schema, int id, T value);
+    //! read a top level parameter of the encoded message without decoding
+    //! the rest, -1 if it is not in the message
+    template <class T>
+    int peek(const Message& schema, int id, T& value) const;
+    //! read a value at an offset returned by locate()
+    template <class T>
+    int read_at(int offset, T& value) const;
+
     virtual int to_wire(int8_t);
     virtual int to_wire(int16_t);
     virtual int to_wire(int32_t);
@@ -339,14 +485,37 @@ class Parameter {
         m_is_set(p.m_is_set) {}
     virtual ~Parameter() {}
 
-    void set() { this->m_is_set = true; }
+    void set(); // defined after Group
+    //! unset parameter and release its data
+    virtual void clear();
     bool is_optional() const { return this->m_optional; }
     bool is_repeated() const { return this->m_repeated; }
     int  id() const { return this->m_id; }
+    int  bit() const { return this->m_bit; }
+
+    //! attach parameter to the presence bitset of its owner group
+    virtual void bind(Group *owner, int bit) { m_owner = owner; m_bit = bit; }
+    Group *owner() const { return this->m_owner; }
+    //! clear modification tracking of nested groups
+    virtual void clear_modified() {}
+    //! make a private copy of data referring to a wire buffer
+    virtual void own_data() {}
+
+    //! location of the parameter in the last encoded or decoded buffer
+    //! offset is -1 if the parameter is not found in the buffer
+    int wire_offset() const { return this->m_wire_offset; }
+    int wire_length() const { return this->m_wire_length; }
+    void set_wire_span(int offset, int length) const {
+      this->m_wire_offset = offset;
+      this->m_wire_length = length;
+    }
 
     virtual bool is_scalar() const { return false; }
     virtual bool is_group() const { return false; }
     virtual const Group* group(int i=0) const { return nullptr; };
+    //! group describing the layout of the parameter's groups, also when
+    //! there are none
+    virtual const Group* layout() const { return group(0); }
     virtual int nrepeats() const { return 1; }
     virtual bool is_set() const { return this->m_is_set; }
     virtual std::size_t item_size() const = 0;
@@ -355,26 +524,42 @@ class Parameter {
     virtual int size_from_wire(const WireFormat&, int i=0) const { return 0; }
     virtual int data_to_wire(WireFormat&, int i=0) const = 0;
     virtual int data_from_wire(const WireFormat&) = 0;
+    //! compare state and value, parameter must be of the same type
+    virtual bool equals(const Parameter&) const = 0;
 
   private:
     const int m_id;
     const bool m_optional;
     const bool m_repeated;
     bool m_is_set;
+    Group *m_owner = nullptr;
+    int m_bit = -1;
+    mutable int m_wire_offset = -1; // encoding bookkeeping
+    mutable int m_wire_length = 0;
 };
 
 //! Base class for groups of parameters (messages and group parameters)
+//
+// Each parameter owns one bit of the group's presence bitset. The generator
+// assigns the bits in parameter id order and provides the mask of required
+// parameters, so validity is a single mask compare. A nested group reports
+// its validity to the presence bit of the owning group parameter.
 class Group {
 
   public:
     Group() = delete;
     virtual ~Group() {}
 
-    int nparams() { return this->m_params.size(); } 
+    int nparams() const { return this->m_params.size(); } 
     const parameter_container_t& params() const { return this->m_params; }
+    //! parameter owning presence bit i
+    Parameter& param(int i) const { return *this->m_index[i]; }
+    presence_t presence() const { return this->m_presence; }
+    presence_t required() const { return this->m_required; }
+    presence_t modified() const { return this->m_modified; }
+    bool is_modified() const { return this->m_modified != 0; }
     bool is_valid() const {
-        for (auto& it : this->m_params) if (!it.second.is_valid()) return false;
-        return true;
+        return (this->m_presence & this->m_required) == this->m_required;
     }
     std::size_t data_size() const {
         std::size_t s = 0;
@@ -383,19 +568,115 @@ class Group {
     } 
     bool is_set() const { return this->is_valid(); } // group is set if it is valid
 
+    //! mark presence bit, propagate a validity change to the parent group
+    void mark(int bit) {
+      auto was_valid = this->is_valid();
+      this->m_presence |= presence_t(1) << bit;
+      this->m_modified |= presence_t(1) << bit;
+      if (this->m_parent) {
+        if (this->m_parent_presence && !was_valid && this->is_valid())
+          this->m_parent->mark(this->m_parent_bit);
+        else
+          this->m_parent->modify(this->m_parent_bit);
+      }
+    }
+    //! mark parameter modified, propagate to the parent group
+    void modify(int bit) {
+      this->m_modified |= presence_t(1) << bit;
+      if (this->m_parent)
+        this->m_parent->modify(this->m_parent_bit);
+    }
+    //! unmark presence bit, propagate a validity change to the parent group
+    void unmark(int bit) {
+      auto was_valid = this->is_valid();
+      this->m_presence &= ~(presence_t(1) << bit);
+      this->m_modified |= presence_t(1) << bit;
+      if (this->m_parent) {
+        if (this->m_parent_presence && was_valid && !this->is_valid())
+          this->m_parent->unmark(this->m_parent_bit);
+        else
+          this->m_parent->modify(this->m_parent_bit);
+      }
+    }
+    //! unset all parameters
+    void clear() {
+      for (size_t i=0; i<this->m_index.size(); i++)
+        this->m_index[i]->clear();
+    }
+    //! compare parameter states and values, group must be of the same type
+    bool equals(const Group& group) const {
+      if (this->m_presence != group.m_presence)
+        return false;
+      for (size_t i=0; i<this->m_index.size(); i++)
+        if (!this->m_index[i]->equals(*group.m_index[i]))
+          return false;
+      return true;
+    }
+    //! forget modifications, called when the message has been encoded
+    void clear_modified() {
+      for (auto bits = this->m_modified; bits; )
+        this->param(pop_bit(bits)).clear_modified();
+      this->m_modified = 0;
+    }
+    //! link nested group to the presence bit of its group parameter
+    void set_parent(Group *parent, int bit) {
+      this->m_parent = parent;
+      this->m_parent_bit = bit;
+      if (this->is_valid())
+        parent->mark(bit);
+    }
+    //! link an element of a group array, only modifications propagate
+    //! to the parent as the array's presence is its number of elements
+    void set_array_parent(Group *parent, int bit) {
+      this->m_parent = parent;
+      this->m_parent_bit = bit;
+      this->m_parent_presence = false;
+    }
+
   protected:
-    Group(const parameter_container_t& params) : m_params(params)  {}
+    Group(const parameter_container_t& params,
+          const parameter_index_t& index,
+          presence_t required) :
+      m_params(params), m_index(index), m_required(required) {}
+
+    //! assign presence bits, called when parameters have been constructed
+    void bind() {
+      for (size_t i=0; i<this->m_index.size(); i++)
+        this->m_index[i]->bind(this, i);
+    }
 
   private:
     const parameter_container_t& m_params; // this is a reference to the actual map
+    const parameter_index_t& m_index; // this is a reference to the actual index
+    const presence_t m_required;
+    presence_t m_presence = 0;
+    presence_t m_modified = 0; // parameters set since the last encoding
+    Group *m_parent = nullptr;
+    int m_parent_bit = -1;
+    bool m_parent_presence = true; //!< validity drives the parent's presence bit
 };
 
+inline void Parameter::set() {
+  this->m_is_set = true;
+  if (this->m_owner)
+    this->m_owner->mark(this->m_bit);
+}
+
+inline void Parameter::clear() {
+  this->m_is_set = false;
+  this->set_wire_span(-1, 0);
+  if (this->m_owner)
+    this->m_owner->unmark(this->m_bit);
+}
 
 class Message : public Group {
 
   public:
-    //! Instantiate messages from incoming byte stream
+    //! Instantiate messages from incoming byte stream, nullptr if the
+    //! id is unknown or the frame does not decode
     static message_ptr_t factory(wire_format_ptr_t&);
+    //! Instantiate an empty message by id, nullptr if the id is unknown
+    static message_ptr_t instance(int id);
 
     Message() = delete;
     ~Message() {}
@@ -406,29 +687,130 @@ class Message : public Group {
       m_wire_format = std::move(wire_format);
     }
     WireFormat* wire_format() const { return m_wire_format.get(); }
+    //! serialize message, previous encoding or decoded frame is reused,
+    //! patched or spliced from if possible
     int to_wire() {
-      m_wire_format = WireFormat::factory(*this);
+      if (m_wire_format && !this->is_modified())
+        return 0; // unchanged since the last encoding
+      if (!m_wire_format)
+        m_wire_format = WireFormat::factory(*this);
+      else if (m_wire_format->patch(*this) != 0) {
+        auto w = m_wire_format->reencode(*this);
+        if (m_decoded && !m_source) // decoded data refers to the source frame
+          m_source = std::move(m_wire_format);
+        m_wire_format = std::move(w);
+      }
+      this->clear_modified();
       // TODO return value based on success
       return 0;
     }
 
+    //! decode a frame into this message, which is cleared first, and keep
+    //! the wire format like factory() does
+    int decode(wire_format_ptr_t& w) {
+      if (!w || w->is_delta() || w->id() != this->id())
+        return -1;
+      if (this->presence())
+        this->clear();
+      m_source = nullptr;
+      m_wire_format = std::move(w);
+      auto ret = m_wire_format->from_wire(*this);
+      m_decoded = true;
+      this->clear_modified(); // frame is the encoding of the decoded message
+      if (m_wire_format->is_stream())
+        m_wire_format = nullptr; // data was copied out of the stream
+      return ret;
+    }
+
+    //! decode a frame into this message, which is cleared first. The wire
+    //! format is not kept, decoded data may refer to its buffer.
+    int decode(const WireFormat& w) {
+      if (w.is_delta() || w.id() != this->id())
+        return -1;
+      this->clear();
+      m_wire_format = nullptr;
+      m_source = nullptr;
+      m_decoded = false;
+      auto ret = w.from_wire(*this);
+      this->clear_modified();
+      return ret;
+    }
+
+    //! release the encoding and the frame the message was decoded from,
+    //! decoded data may refer to them, so the message is cleared too
+    void drop_frames() {
+      this->clear();
+      this->clear_modified();
+      m_wire_format = nullptr;
+      m_source = nullptr;
+      m_decoded = false;
+    }
+
+    //! apply a delta encoded frame onto this message
+    int apply(const WireFormat& delta) {
+      if (!delta.is_delta() || delta.id() != this->id())
+        return -1;
+      return delta.from_wire(*this);
+    }
+
     void dump(std::ostream& os) const {
       if (this->wire_format())
         this->wire_format()->dump(os, *this);
     }
 
   protected:
-    Message(int id, const parameter_container_t& m_params) : 
-      Group(m_params), m_id(id) {}
+    Message(int id,
+            const parameter_container_t& params,
+            const parameter_index_t& index,
+            presence_t required) : 
+      Group(params, index, required), m_id(id) {}
 
   private:
     const int m_id;
+    bool m_decoded = false;
     wire_format_ptr_t m_wire_format = nullptr;
+    wire_format_ptr_t m_source = nullptr; //!< frame the message was decoded from
 
+    //! defined by the generated code, constant after static initialization
+    //! so factory() and instance() can be called from any thread
     static const std::map<int, MessageCreatorFunc> creators;
 
 };
 
+template <class T>
+int WireFormat::update(const Message& schema, int id, T value) {
+  if (this->id() != schema.id())
+    return -1;
+  auto offset = this->locate(schema, id);
+  if (offset < 0 || schema.params().count(id) == 0
+      || schema.params().at(id).item_size() != sizeof(T))
+    return -1;
+  this->buf()->reset();
+  this->buf()->advance(offset);
+  auto ret = this->to_wire(value);
+  this->buf()->reset();
+  return ret;
+}
+
+template <class T>
+int WireFormat::peek(const Message& schema, int id, T& value) const {
+  if (this->id() != schema.id())
+    return -1;
+  auto offset = this->locate(schema, id);
+  if (offset < 0)
+    return -1;
+  return this->read_at(offset, value);
+}
+
+template <class T>
+int WireFormat::read_at(int offset, T& value) const {
+  this->buf()->reset();
+  this->buf()->advance(offset);
+  auto ret = this->from_wire(value);
+  this->buf()->reset();
+  return ret;
+}
+
 template <class T>
 class ScalarParameter : public Parameter {
 
@@ -453,6 +835,10 @@ class ScalarParameter : public Parameter {
       Parameter::set(); 
       return w.from_wire(m_data); 
     }
+    bool equals(const Parameter& p) const override {
+      auto& other = static_cast<const ScalarParameter&>(p);
+      return this->is_set() == other.is_set() && (!this->is_set() || m_data == other.m_data);
+    }
 
   private:
     T m_data;
@@ -468,10 +854,16 @@ class ScalarArray : public Parameter {
     T& operator[](int i) { 
       if (m_data.size() == i) // a light hack: indexing end pos pushes new item
         m_data.push_back(0);  // TODO fix this
+      this->Parameter::set(); // writable reference, assume modified
       return m_data[i];
     }
-    void assign(int i, T value) { if (i < m_data.size()) this->m_data[i] = value; }
-    void append(T value) { this->m_data.push_back(value); }
+    void assign(int i, T value) {
+      if (i < m_data.size()) {
+        this->m_data[i] = value;
+        this->Parameter::set();
+      }
+    }
+    void append(T value) { this->m_data.push_back(value); this->Parameter::set(); }
 
     const T& data(int i) const { return this->m_data[i]; }
     const std::vector<T>& data() { return this->m_data; }
@@ -488,10 +880,16 @@ class ScalarArray : public Parameter {
     int data_from_wire(const WireFormat& w) override { 
       T data;
       auto ret = w.from_wire(data); 
-      if (ret  == 0) 
+      if (ret  == 0) {
         m_data.push_back(data);
+        Parameter::set();
+      }
       return ret; 
     }
+    void clear() override { this->m_data.clear(); Parameter::clear(); }
+    bool equals(const Parameter& p) const override {
+      return m_data == static_cast<const ScalarArray&>(p).m_data;
+    }
 
   private:
     std::vector<T> m_data;
@@ -509,6 +907,7 @@ class ScalarParameter <void_t> : public Parameter {
 
     int data_to_wire(WireFormat& w, int) const override { (void)w; return 0; }
     int data_from_wire(const WireFormat& w) override { (void)w; Parameter::set(); return 0; }
+    bool equals(const Parameter& p) const override { return this->is_set() == p.is_set(); }
 };
 
 template <>
@@ -517,7 +916,7 @@ class ScalarArray <void_t>: public Parameter {
   public:
     ScalarArray(int id, bool optional=false) : Parameter(id, optional, true) {}
 
-    void append() { void_t value; this->m_data.push_back(value); }
+    void append() { void_t value; this->m_data.push_back(value); this->Parameter::set(); }
 
     const std::vector<void_t>& data() { return this->m_data; }
     size_t item_size() const override { return 0; }
@@ -529,8 +928,11 @@ class ScalarArray <void_t>: public Parameter {
     int data_from_wire(const WireFormat& w) override { 
       void_t data;
       m_data.push_back(data);
+      Parameter::set();
       return 0; 
     }
+    void clear() override { this->m_data.clear(); Parameter::clear(); }
+    bool equals(const Parameter& p) const override { return this->nrepeats() == p.nrepeats(); }
 
   private:
     std::vector<void_t> m_data;
@@ -560,6 +962,10 @@ class EnumParameter : public Parameter {
       }
       return ret;
     }
+    bool equals(const Parameter& p) const override {
+      auto& other = static_cast<const EnumParameter&>(p);
+      return this->is_set() == other.is_set() && (!this->is_set() || m_data == other.m_data);
+    }
 
   private:
     T m_data = T(0);
@@ -578,6 +984,12 @@ class GroupParameter : public Parameter {
     bool is_group() const override { return true; }
     const Group* group(int) const override { return (const Group*)&m_data; }
 
+    void bind(Group *owner, int bit) override {
+      Parameter::bind(owner, bit);
+      this->m_data.set_parent(owner, bit); // group validity drives the presence bit
+    }
+    void clear_modified() override { this->m_data.clear_modified(); }
+
     bool is_set() const override { return this->m_data.is_set(); }
     bool is_valid() const override { return (this->m_data.is_valid() || this->is_optional()); }
 
@@ -587,6 +999,13 @@ class GroupParameter : public Parameter {
     int data_from_wire(const WireFormat& w) override { 
       return w.from_wire((Group&)(m_data));
     }
+    void clear() override { // presence follows the validity of the group
+      this->m_data.clear();
+      this->set_wire_span(-1, 0);
+    }
+    bool equals(const Parameter& p) const override {
+      return m_data.equals(static_cast<const GroupParameter&>(p).m_data);
+    }
 
   private:
     T m_data;
@@ -599,14 +1018,18 @@ class GroupArray : public Parameter {
   public:
     GroupArray(int id, bool optional=false) : Parameter(id, optional, true) {}
 
-    T& operator[](int i) { return m_data[i]; }
-    void assign(int i, const T* value) {
-      if (i < m_data.size())
-        this->m_data[i] = value;
+    // Changes to the groups mark the array modified
+    T& operator[](int i) { return *m_data[i]; }
+    //! replace group i, the array takes the ownership of value
+    void assign(int i, T* value) {
+      if (i < m_data.size()) {
+        this->m_data[i].reset(link(value));
+        this->Parameter::set();
+      }
     }
-    void append(const T* value) { this->m_data.push_back(value); }
-    const T& data(int i) const { return this->m_data[i]; }
-    const std::vector<T>& data() { return this->m_data; }
+    //! append a group, the array takes the ownership of value
+    void append(T* value) { this->m_data.emplace_back(link(value)); this->Parameter::set(); }
+    const T& data(int i) const { return *this->m_data[i]; }
     size_t item_size() const override { return 0; }
     size_t data_size() const override { 
       auto s = 0;
@@ -617,9 +1040,10 @@ class GroupArray : public Parameter {
     bool is_group() const override { return true; }
     const Group* group(int i) const override {
       if (i < m_data.size())
-        return (const Group*)m_data[i];
+        return m_data[i].get();
       return nullptr;
     }
+    const Group* layout() const override { static const T blank; return &blank; }
     bool is_set() const override { return this->nrepeats() > 0; }
     int nrepeats() const override { return m_data.size(); }
 
@@ -629,15 +1053,37 @@ class GroupArray : public Parameter {
       return -1;   
     }
     int data_from_wire(const WireFormat& w) override { 
-      T *data = new T; // TODO unique_ptr!
+      std::unique_ptr<T> data(link(new T));
       auto ret = w.from_wire(*data); 
-      if (ret  == 0) 
-        m_data.push_back(data);
+      if (ret  == 0) {
+        m_data.push_back(std::move(data));
+        Parameter::set();
+      }
       return ret; 
     }
+    void clear() override { this->m_data.clear(); Parameter::clear(); }
+    void clear_modified() override {
+      for (auto& g : this->m_data)
+        g->clear_modified();
+    }
+    bool equals(const Parameter& p) const override {
+      auto& other = static_cast<const GroupArray&>(p);
+      if (this->nrepeats() != other.nrepeats())
+        return false;
+      for (auto i=0; i<this->nrepeats(); i++)
+        if (!m_data[i]->equals(*other.m_data[i]))
+          return false;
+      return true;
+    }
 
   private:
-    std::vector<const T*> m_data;
+    T *link(T *g) {
+      if (g && this->owner())
+        g->set_array_parent(this->owner(), this->bit());
+      return g;
+    }
+
+    std::vector<std::unique_ptr<T>> m_data;
 };
 
 
@@ -652,7 +1098,7 @@ class VarParameter : public Parameter {
         m_data.assign(data);
         this->Parameter::set();
     }
-    const T& data() { return this->m_data; }
+    const T& data() const { return this->m_data; }
     std::size_t item_size() const override { return this->m_data.size(); }
 
     int data_to_wire(WireFormat& w, int) const override { return w.to_wire(m_data); }
@@ -660,6 +1106,12 @@ class VarParameter : public Parameter {
       Parameter::set();
       return w.from_wire(m_data); 
     }
+    void clear() override { this->m_data.assign(nullptr, 0); Parameter::clear(); }
+    void own_data() override { this->m_data.own(); }
+    bool equals(const Parameter& p) const override {
+      auto& other = static_cast<const VarParameter&>(p);
+      return this->is_set() == other.is_set() && (!this->is_set() || m_data.equals(other.m_data));
+    }
 
   private:
     T m_data = { nullptr, 0 };
@@ -677,6 +1129,7 @@ class VarParameter <std::string>: public Parameter
 
     void assign(const std::string& data) { this->m_data = data; this->Parameter::set(); }
     std::string& data() { return this->m_data; }
+    const std::string& data() const { return this->m_data; }
 
     std::size_t item_size() const override { return this->m_data.size()+1; }
     int data_to_wire(WireFormat& w, int) const override { return w.to_wire(m_data); }
@@ -684,11 +1137,450 @@ class VarParameter <std::string>: public Parameter
       Parameter::set(); 
       return w.from_wire(m_data);
     }
+    void clear() override { this->m_data.clear(); Parameter::clear(); }
+    bool equals(const Parameter& p) const override {
+      auto& other = static_cast<const VarParameter&>(p);
+      return this->is_set() == other.is_set() && (!this->is_set() || m_data == other.m_data);
+    }
 
   private:
     std::string m_data;
 };
 
+
+//
+// Aligned layout
+//
+// Message: | u16 id | u16 0 | u32 size | group block |
+// Block:   | fixed fields | table | data |
+//
+// Required fixed size scalars and enums are in the fixed block, larger
+// fields first, so every field is naturally aligned. The table has an
+// entry | u32 offset | u32 length | for each other parameter in id order,
+// offsets are relative to the start of the block and 0 means not present.
+// Data items are aligned to their size, groups to 8. A repeated void is
+// stored as u32 count and a repeated group as a table of its blocks.
+// Values are little endian.
+//
+namespace layout {
+
+const size_t header_size = 8;
+const size_t entry_size = 8;
+
+constexpr size_t align(size_t offset, size_t a) { return (offset + a - 1) / a * a; }
+
+//! parameter is stored in the fixed block
+inline bool is_fixed(const Parameter& p);
+
+//! alignment of a data item
+constexpr size_t item_align(size_t size) {
+  return (size >= 8) ? 8 : (size == 4 || size == 2) ? size : 1;
+}
+
+//! offset of the k:th fixed field, k == number of fields gives the block size
+template <class C>
+constexpr size_t fixed_offset(const C& sizes, size_t k) {
+  size_t offset = 0, i = 0;
+  for (auto s : sizes) {
+    if (k == sizes.size() || s > sizes.begin()[k] || (s == sizes.begin()[k] && i < k))
+      offset += s;
+    i++;
+  }
+  return (k == sizes.size()) ? align(offset, 4) : offset;
+}
+
+constexpr size_t fixed_offset(std::initializer_list<size_t> sizes, size_t k) {
+  return fixed_offset<std::initializer_list<size_t>>(sizes, k);
+}
+
+template <class T>
+inline T load(const uint8_t *p) {
+  T value;
+  memcpy(&value, p, sizeof(T));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  std::reverse((uint8_t *)&value, (uint8_t *)&value + sizeof(T));
+#endif
+  return value;
+}
+
+template <class T>
+inline void store(uint8_t *p, T value) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  std::reverse((uint8_t *)&value, (uint8_t *)&value + sizeof(T));
+#endif
+  memcpy(p, &value, sizeof(T));
+}
+
+} // namespace layout
+
+//! Repeated fixed size values in an aligned layout buffer
+template <class T>
+class array_view {
+
+  public:
+    array_view(const uint8_t *p, size_t n) : m_data(p), m_size(p ? n : 0) {}
+
+    size_t size() const { return m_size; }
+    T operator[](size_t i) const { return layout::load<T>(m_data + i * sizeof(T)); }
+
+  private:
+    const uint8_t *m_data;
+    size_t m_size;
+};
+
+//! Repeated groups in an aligned layout buffer
+template <class V>
+class group_array_view {
+
+  public:
+    group_array_view(const uint8_t *block, size_t block_size, const uint8_t *table, size_t n) :
+      m_block(block), m_block_size(block_size), m_table(table), m_size(table ? n : 0) {}
+
+    size_t size() const { return m_size; }
+    V operator[](size_t i) const {
+      auto p = m_table + i * layout::entry_size;
+      uint32_t offset = layout::load<uint32_t>(p);
+      uint32_t length = layout::load<uint32_t>(p + 4);
+      if (offset == 0 || (uint64_t)offset + length > m_block_size)
+        return V(nullptr, 0);
+      return V(m_block + offset, length);
+    }
+
+  private:
+    const uint8_t *m_block;
+    size_t m_block_size;
+    const uint8_t *m_table;
+    size_t m_size;
+};
+
+//! Base class for generated read only views of aligned layout buffers,
+//! parameters are read straight from the buffer without decoding
+class LayoutView {
+
+  public:
+    bool is_valid() const { return this->m_data != nullptr; }
+    const uint8_t *data() const { return this->m_data; }
+    size_t size() const { return this->m_size; }
+
+  protected:
+    //! view of a message frame
+    LayoutView(const uint8_t *p, size_t n, int id, size_t fixed, int nentries) {
+      if (p && n >= layout::header_size && layout::load<uint16_t>(p) == id) {
+        size_t size = layout::load<uint32_t>(p + 4);
+        if (size >= layout::header_size && size <= n)
+          init(p + layout::header_size, size - layout::header_size, fixed, nentries);
+      }
+    }
+    //! view of a group block
+    LayoutView(const uint8_t *p, size_t n, size_t fixed, int nentries) {
+      init(p, n, fixed, nentries);
+    }
+
+    struct Entry {
+      uint32_t offset;
+      uint32_t length;
+    };
+
+    Entry entry(int i) const {
+      Entry e = { 0, 0 };
+      if (this->m_data) {
+        auto p = this->m_data + this->m_table + i * layout::entry_size;
+        e.offset = layout::load<uint32_t>(p);
+        e.length = layout::load<uint32_t>(p + 4);
+        if ((uint64_t)e.offset + e.length > this->m_size)
+          e.offset = e.length = 0; // corrupted entry
+      }
+      return e;
+    }
+    const uint8_t *at(const Entry& e) const { return (e.offset) ? this->m_data + e.offset : nullptr; }
+
+    template <class T>
+    T fixed(size_t offset) const { return (this->m_data) ? layout::load<T>(this->m_data + offset) : T(); }
+
+    bool has(int i) const { return entry(i).offset != 0; }
+
+    template <class T>
+    T value(int i) const {
+      auto e = entry(i);
+      return (e.offset && e.length == sizeof(T)) ? layout::load<T>(at(e)) : T();
+    }
+
+    template <class T>
+    T var(int i) const;
+
+    template <class T>
+    array_view<T> array(int i) const {
+      auto e = entry(i);
+      return array_view<T>(at(e), e.length / sizeof(T));
+    }
+
+    size_t count(int i) const {
+      auto e = entry(i);
+      return (e.offset && e.length == 4) ? layout::load<uint32_t>(at(e)) : 0;
+    }
+
+    template <class V>
+    V group(int i) const {
+      auto e = entry(i);
+      return V(at(e), e.length);
+    }
+
+    template <class V>
+    group_array_view<V> groups(int i) const {
+      auto e = entry(i);
+      return group_array_view<V>(this->m_data, this->m_size, at(e), e.length / layout::entry_size);
+    }
+
+  private:
+    void init(const uint8_t *p, size_t n, size_t fixed, int nentries) {
+      if (p && n >= fixed + nentries * layout::entry_size) {
+        this->m_data = p;
+        this->m_size = n;
+        this->m_table = fixed;
+      }
+    }
+
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_table = 0; //!< offset of the parameter table
+};
+
+template <>
+inline blob_t LayoutView::var<blob_t>(int i) const {
+  auto e = entry(i);
+  return blob_t(at(e), e.length);
+}
+
+template <>
+inline string_t LayoutView::var<string_t>(int i) const {
+  auto e = entry(i);
+  return string_t((const char *)at(e), e.length);
+}
+
+template <>
+inline std::string LayoutView::var<std::string>(int i) const {
+  auto e = entry(i);
+  return (e.offset && e.length) ? std::string((const char *)at(e), e.length - 1) : std::string();
+}
+
+inline bool layout::is_fixed(const Parameter& p) {
+  return !p.is_optional() && !p.is_repeated() && p.is_scalar() && p.item_size() > 0;
+}
+
+//! Hash of the routing key parameters of a message
+//
+// Values are hashed as the same types whether they come from a message
+// or from its frame, an absent optional parameter as a marker. Frames
+// are read with WireFormat::locate(), a frame that cannot be read up to a
+// key is an error rather than a frame without the key.
+//
+class KeyHash {
+
+  public:
+    template <class T>
+    void add(const ScalarParameter<T>& p) {
+      if (p.is_set()) add(p.data()); else absent();
+    }
+    template <class T>
+    void add(const EnumParameter<T>& p) {
+      if (p.is_set()) add((enum_t)p.data()); else absent();
+    }
+    template <class T>
+    void add(const VarParameter<T>& p) {
+      if (p.is_set()) add(p.data()); else absent();
+    }
+
+    //! add a top level parameter of an encoded frame
+    template <class T>
+    int add(const WireFormat& w, const Message& schema, int id, bool optional) {
+      if (w.id() != schema.id())
+        return -1;
+      auto offset = w.locate(schema, id);
+      if (offset == WireFormat::not_found && optional) {
+        absent();
+        return 0;
+      }
+      if (offset < 0)
+        return -1;
+      auto value = blank<T>();
+      if (w.read_at(offset, value) != 0)
+        return -1;
+      add(value);
+      return 0;
+    }
+
+    template <class T, class = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+    void add(T value) { mix((uint64_t)value); }
+    void add(const blob_t& b) { bytes(b.data(), b.size()); }
+    void add(const string_t& s) { bytes(s.data(), s.size()); }
+    void add(const std::string& s) { bytes(s.data(), s.size()); }
+    void absent() { mix(0x9e3779b97f4a7c15ULL); }
+
+    uint64_t value() const {
+      // finalizer of MurmurHash3, spreads the bits for partitioning
+      auto h = m_hash;
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ULL;
+      h ^= h >> 33;
+      return h;
+    }
+
+  private:
+    template <class T>
+    static T blank() { return T(); }
+
+    void mix(uint64_t v) { m_hash = (m_hash ^ v) * 0x100000001b3ULL; }
+    void bytes(const void *p, size_t n) {
+      auto c = (const uint8_t *)p;
+      for (size_t i=0; i<n; i++)
+        m_hash = (m_hash ^ c[i]) * 0x100000001b3ULL;
+      mix(n);
+    }
+
+    uint64_t m_hash = 0xcbf29ce484222325ULL; //!< FNV-1a
+};
+
+template <>
+inline blob_t KeyHash::blank<blob_t>() { return blob_t((const uint8_t *)nullptr, 0); }
+
+template <>
+inline string_t KeyHash::blank<string_t>() { return string_t(nullptr, 0); }
+
+//! Overload set of handlers, e.g. of lambdas taking different messages
+template <class... Fs>
+struct overloaded;
+
+template <class F>
+struct overloaded<F> : F {
+  overloaded(F f) : F(std::move(f)) {}
+  using F::operator();
+};
+
+template <class F, class... Fs>
+struct overloaded<F, Fs...> : F, overloaded<Fs...> {
+  overloaded(F f, Fs... fs) : F(std::move(f)), overloaded<Fs...>(std::move(fs)...) {}
+  using F::operator();
+  using overloaded<Fs...>::operator();
+};
+
+template <class... Fs>
+overloaded<Fs...> overload(Fs... fs) { return overloaded<Fs...>(std::move(fs)...); }
+
+namespace detail {
+
+template <class H, class M, class = void>
+struct handles : std::false_type {};
+
+template <class H, class M>
+struct handles<H, M, decltype((void)std::declval<H&>()(std::declval<M&>()))> : std::true_type {};
+
+} // namespace detail
+
+//! Typed dispatch of messages
+//
+// Index maps a message id to the position of its type in Messages, or
+// to -1. mig generates both (MessageDispatcher and make_dispatcher) for
+// a schema. Handler is called with the concrete message type; ids of
+// types it takes no overload for are skipped, frames of them without
+// decoding.
+//
+// The dispatch functions return 0 when the handler was called, 1 when
+// the message was skipped and -1 if the id is unknown or the frame does
+// not decode.
+//
+template <int (*Index)(int), class Handler, class... Messages>
+class Dispatcher {
+
+  public:
+    explicit Dispatcher(Handler handler) : m_handler(std::move(handler)) {}
+
+    Handler& handler() { return this->m_handler; }
+
+    //! true if the handler takes messages of an id
+    bool handles(int id) const {
+      auto i = Index(id);
+      return i >= 0 && table[i] != nullptr;
+    }
+
+    int dispatch(Message& msg) {
+      auto i = Index(msg.id());
+      if (i < 0)
+        return -1;
+      if (!table[i])
+        return 1;
+      table[i](m_handler, msg);
+      return 0;
+    }
+
+    //! decode a frame into a message of this dispatcher, which keeps the
+    //! frame, and call the handler. The message is reused for the next
+    //! frame of its id.
+    int dispatch(wire_format_ptr_t& w) {
+      if (!w || w->is_delta())
+        return -1;
+      auto i = Index(w->id());
+      if (i < 0)
+        return -1;
+      if (!table[i])
+        return 1;
+      auto& msg = this->message(i, w->id());
+      if (msg->decode(w) != 0)
+        return -1;
+      table[i](m_handler, *msg);
+      return 0;
+    }
+
+    //! decode a frame, which must outlive the call, and call the handler
+    int dispatch(const WireFormat& w) {
+      if (w.is_delta())
+        return -1;
+      auto i = Index(w.id());
+      if (i < 0)
+        return -1;
+      if (!table[i])
+        return 1;
+      auto& msg = this->message(i, w.id());
+      if (msg->decode(w) != 0)
+        return -1;
+      table[i](m_handler, *msg);
+      return 0;
+    }
+
+  private:
+    using thunk_t = void (*)(Handler&, Message&);
+
+    template <class M>
+    static constexpr thunk_t thunk() {
+      return (detail::handles<Handler, M>::value) ? &Dispatcher::call<M> : nullptr;
+    }
+
+    template <class M>
+    static void call(Handler& h, Message& msg) { invoke<M>(h, msg, detail::handles<Handler, M>()); }
+    template <class M>
+    static void invoke(Handler& h, Message& msg, std::true_type) { h(static_cast<M&>(msg)); }
+    template <class M>
+    static void invoke(Handler&, Message&, std::false_type) {}
+
+    message_ptr_t& message(int i, int id) {
+      auto& msg = m_messages[i];
+      if (!msg)
+        msg = Message::instance(id);
+      return msg;
+    }
+
+    //! handler per message type, nullptr for skipped types
+    static constexpr thunk_t table[] = { thunk<Messages>()... };
+
+    Handler m_handler;
+    message_ptr_t m_messages[sizeof...(Messages)]; //!< decoded messages for reuse
+};
+
+template <int (*Index)(int), class Handler, class... Messages>
+constexpr typename Dispatcher<Index, Handler, Messages...>::thunk_t
+Dispatcher<Index, Handler, Messages...>::table[];
+
 } // end namespace mig
 
 #endif // ifndef _MIGMSG_H_
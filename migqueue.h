@@ -0,0 +1,305 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _MIGQUEUE_H_
+#define _MIGQUEUE_H_
+
+//
+// Bounded lock free queues for handing messages and frames between
+// threads, and a pool that takes decoded messages back to the thread
+// that made them
+//
+// Capacities are rounded up to a power of two. Producer and consumer
+// positions are on cache lines of their own. Batch operations move as
+// many elements as fit, or as are there, with one update of the shared
+// position.
+//
+
+#include "migmsg.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace mig {
+
+static const size_t cache_line = 64;
+
+inline size_t queue_capacity(size_t n) {
+  size_t c = 2;
+  while (c < n)
+    c <<= 1;
+  return c;
+}
+
+//! Single producer single consumer queue
+template <class T>
+class SpscQueue {
+
+  public:
+    explicit SpscQueue(size_t capacity) :
+      m_mask(queue_capacity(capacity) - 1), m_data(new T[m_mask + 1]) {}
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+    size_t size() const {
+      return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    //! producer: false if the queue is full, value is not moved then
+    bool push(T&& value) { return push(&value, 1) == 1; }
+    //! producer: move up to n values, returns how many
+    size_t push(T *values, size_t n) {
+      auto tail = m_tail.load(std::memory_order_relaxed);
+      if (tail + n - m_head_cache > capacity()) {
+        m_head_cache = m_head.load(std::memory_order_acquire);
+        n = std::min(n, capacity() - (tail - m_head_cache));
+      }
+      for (size_t i=0; i<n; i++)
+        m_data[(tail + i) & m_mask] = std::move(values[i]);
+      m_tail.store(tail + n, std::memory_order_release);
+      return n;
+    }
+
+    //! consumer: false if the queue is empty
+    bool pop(T& value) { return pop(&value, 1) == 1; }
+    //! consumer: move up to n values out, returns how many
+    size_t pop(T *values, size_t n) {
+      auto head = m_head.load(std::memory_order_relaxed);
+      if (head + n > m_tail_cache) {
+        m_tail_cache = m_tail.load(std::memory_order_acquire);
+        n = std::min(n, m_tail_cache - head);
+      }
+      for (size_t i=0; i<n; i++)
+        values[i] = std::move(m_data[(head + i) & m_mask]);
+      m_head.store(head + n, std::memory_order_release);
+      return n;
+    }
+
+  private:
+    const size_t m_mask;
+    const std::unique_ptr<T []> m_data;
+    alignas(cache_line) std::atomic<size_t> m_head{0};
+    size_t m_tail_cache = 0; //!< consumer's view of tail
+    alignas(cache_line) std::atomic<size_t> m_tail{0};
+    size_t m_head_cache = 0; //!< producer's view of head
+    char m_pad[cache_line - sizeof(size_t)];
+};
+
+//! Multiple producer multiple consumer queue
+//
+// Every cell has a sequence number that tells whose turn it is: a
+// producer at position p waits for p, the consumer at p for p + 1. A
+// position is claimed with a compare and swap of the shared producer
+// or consumer position, a batch claims consecutive ready cells at once.
+//
+template <class T>
+class MpmcQueue {
+
+  public:
+    explicit MpmcQueue(size_t capacity) :
+      m_mask(queue_capacity(capacity) - 1), m_cells(new cell[m_mask + 1]) {
+      for (size_t i=0; i<=m_mask; i++)
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+    //! approximate while other threads work on the queue
+    size_t size() const {
+      auto tail = m_tail.load(std::memory_order_acquire);
+      auto head = m_head.load(std::memory_order_acquire);
+      return (tail > head) ? tail - head : 0;
+    }
+
+    bool push(T&& value) { return push(&value, 1) == 1; }
+    size_t push(T *values, size_t n) {
+      auto pos = m_tail.load(std::memory_order_relaxed);
+      size_t k;
+      do {
+        k = ready(pos, n, 0);
+        if (k == 0)
+          return 0; // full
+      } while (!m_tail.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed));
+      for (size_t i=0; i<k; i++) {
+        auto& c = m_cells[(pos + i) & m_mask];
+        c.value = std::move(values[i]);
+        c.seq.store(pos + i + 1, std::memory_order_release);
+      }
+      return k;
+    }
+
+    bool pop(T& value) { return pop(&value, 1) == 1; }
+    size_t pop(T *values, size_t n) {
+      auto pos = m_head.load(std::memory_order_relaxed);
+      size_t k;
+      do {
+        k = ready(pos, n, 1);
+        if (k == 0)
+          return 0; // empty
+      } while (!m_head.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed));
+      for (size_t i=0; i<k; i++) {
+        auto& c = m_cells[(pos + i) & m_mask];
+        values[i] = std::move(c.value);
+        c.seq.store(pos + i + capacity(), std::memory_order_release);
+      }
+      return k;
+    }
+
+  private:
+    struct cell {
+      std::atomic<size_t> seq;
+      T value;
+    };
+
+    //! number of consecutive cells from pos, up to n, whose turn it is
+    size_t ready(size_t& pos, size_t n, size_t turn) {
+      for (;;) {
+        size_t k = 0;
+        for (; k < n; k++) {
+          auto seq = m_cells[(pos + k) & m_mask].seq.load(std::memory_order_acquire);
+          if (seq != pos + k + turn)
+            break;
+        }
+        if (k > 0)
+          return k;
+        // the first cell is not ready: empty, full, or pos is stale
+        auto& shared = (turn) ? m_head : m_tail;
+        auto now = shared.load(std::memory_order_relaxed);
+        if (now == pos)
+          return 0;
+        pos = now;
+      }
+    }
+
+    const size_t m_mask;
+    const std::unique_ptr<cell []> m_cells;
+    alignas(cache_line) std::atomic<size_t> m_tail{0}; //!< next position to produce
+    alignas(cache_line) std::atomic<size_t> m_head{0}; //!< next position to consume
+    char m_pad[cache_line - sizeof(size_t)];
+};
+
+//! Messages recycled by the thread that decodes them
+//
+// The owning thread gets messages from the pool, consumers on other
+// threads put them back when they are done. Returned messages are
+// queued to the owner, which reuses them for the next frames of their
+// id. So a message and its frame are freed or reused by the thread
+// that allocated them, and steady traffic decodes without allocating
+// messages. When the return queue is full, messages are put on a locked
+// overflow list, also collected by the owner. The owner keeps up to
+// max_free messages of each id and frees the rest.
+//
+class MessagePool {
+
+  public:
+    explicit MessagePool(size_t returns = 1024, size_t max_free = 256) :
+      m_returned(returns), m_max_free(max_free) {}
+
+    //! owner: a message of an id without parameters, nullptr if the id is
+    //! unknown
+    message_ptr_t get(int id) {
+      auto& list = m_free[id];
+      if (list.empty())
+        collect();
+      if (list.empty()) {
+        auto msg = Message::instance(id);
+        if (msg)
+          m_created++;
+        return msg;
+      }
+      auto msg = std::move(list.back());
+      list.pop_back();
+      m_reused++;
+      return msg;
+    }
+
+    //! owner: decode a frame into a pooled message
+    message_ptr_t decode(wire_format_ptr_t& w) {
+      if (!w || w->is_delta())
+        return nullptr;
+      auto msg = get(w->id());
+      if (msg && msg->decode(w) != 0) {
+        put(std::move(msg));
+        return nullptr;
+      }
+      return msg;
+    }
+
+    //! any thread: give a message back
+    void put(message_ptr_t msg) {
+      if (!msg || m_returned.push(std::move(msg)))
+        return;
+      std::lock_guard<std::mutex> lock(m_overflow_lock);
+      m_overflow.push_back(std::move(msg));
+      m_overflowed.store(true, std::memory_order_release);
+    }
+
+    uint64_t created() const { return this->m_created; }
+    uint64_t reused() const { return this->m_reused; }
+
+  private:
+    //! move returned messages to the owner's lists
+    void collect() {
+      message_ptr_t batch[64];
+      while (auto n = m_returned.pop(batch, 64))
+        for (size_t i=0; i<n; i++)
+          recycle(std::move(batch[i]));
+      if (m_overflowed.load(std::memory_order_acquire)) {
+        std::vector<message_ptr_t> overflow;
+        {
+          std::lock_guard<std::mutex> lock(m_overflow_lock);
+          overflow.swap(m_overflow);
+          m_overflowed.store(false, std::memory_order_relaxed);
+        }
+        for (auto& msg : overflow)
+          recycle(std::move(msg));
+      }
+    }
+
+    //! clear a returned message for reuse, or free it if there are enough
+    void recycle(message_ptr_t msg) {
+      auto& list = m_free[msg->id()];
+      if (list.size() >= m_max_free)
+        return;
+      msg->drop_frames(); // the old frame is not kept alive in the pool
+      list.push_back(std::move(msg));
+    }
+
+    MpmcQueue<message_ptr_t> m_returned;
+    const size_t m_max_free;
+    std::unordered_map<int, std::vector<message_ptr_t>> m_free;
+    std::mutex m_overflow_lock;
+    std::vector<message_ptr_t> m_overflow; //!< returned while the queue was full
+    std::atomic<bool> m_overflowed{false};
+    uint64_t m_created = 0;
+    uint64_t m_reused = 0;
+};
+
+} // namespace mig
+
+#endif // ifndef _MIGQUEUE_H_
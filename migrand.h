@@ -0,0 +1,194 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _MIGRAND_H_
+#define _MIGRAND_H_
+
+//
+// Synthetic message content
+//
+// mig -r generates randomize(Random&) for each message and group, and
+// a table of them by message id. Each parameter is filled according to
+// its type: enums with their enumerators, variable length data and
+// repeats with configurable size distributions. Optional parameters
+// are present with a given probability. The same seed gives the same
+// messages.
+//
+
+#include "migmsg.h"
+#include <cmath>
+
+namespace mig {
+
+class Random;
+
+typedef void (*RandomizerFunc)(Message&, Random&);
+
+//! Distribution of data lengths and repeat counts
+struct size_dist {
+  enum Kind { Fixed, Uniform, LogUniform };
+
+  Kind kind;
+  size_t min;
+  size_t max;
+};
+
+//! Seeded generator of message content (xoshiro256**)
+class Random {
+
+  public:
+    explicit Random(uint64_t seed = 1) { this->seed(seed); }
+
+    void seed(uint64_t seed) {
+      for (auto& s : m_state) { // splitmix64
+        seed += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        s = z ^ (z >> 31);
+      }
+    }
+
+    uint64_t next() {
+      auto result = rotl(m_state[1] * 5, 7) * 9;
+      auto t = m_state[1] << 17;
+      m_state[2] ^= m_state[0];
+      m_state[3] ^= m_state[1];
+      m_state[1] ^= m_state[2];
+      m_state[0] ^= m_state[3];
+      m_state[2] ^= t;
+      m_state[3] = rotl(m_state[3], 45);
+      return result;
+    }
+
+    //! uniform in [0, n)
+    uint64_t below(uint64_t n) { return (n) ? (uint64_t)(((unsigned __int128)next() * n) >> 64) : 0; }
+    //! uniform in [0, 1)
+    double real() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    bool chance(double p) { return real() < p; }
+
+    size_t size(const size_dist& d) {
+      if (d.max <= d.min || d.kind == size_dist::Fixed)
+        return d.min;
+      if (d.kind == size_dist::Uniform)
+        return d.min + below(d.max - d.min + 1);
+      // many short, few long
+      auto lo = std::log(d.min + 1.0), hi = std::log(d.max + 1.0);
+      auto n = (size_t)std::exp(lo + real() * (hi - lo)) - 1;
+      return std::min(std::max(n, d.min), d.max);
+    }
+
+    template <class T>
+    T value() { return (T)next(); }
+
+    // parameter fillers, called by the generated randomizers
+
+    template <class T>
+    void fill(ScalarParameter<T>& p) { p.assign(value<T>()); }
+    void fill(ScalarParameter<void_t>& p) { p.set(); }
+
+    template <class T>
+    void fill(ScalarArray<T>& p) {
+      p.clear();
+      for (auto n = size(repeats); n > 0; n--)
+        p.append(value<T>());
+    }
+    void fill(ScalarArray<void_t>& p) {
+      p.clear();
+      for (auto n = size(repeats); n > 0; n--)
+        p.append();
+    }
+
+    template <class T>
+    void fill(EnumParameter<T>& p, std::initializer_list<T> values) {
+      p.assign(values.begin()[below(values.size())]);
+    }
+
+    void fill(VarParameter<blob_t>& p) {
+      auto n = size(blob_sizes);
+      auto data = std::make_unique<uint8_t []>(n);
+      for (size_t i=0; i<n; i++)
+        data[i] = (uint8_t)next();
+      blob_t b(data, n);
+      p.assign(b);
+    }
+    void fill(VarParameter<string_t>& p) {
+      string_t s(text(size(string_sizes)));
+      p.assign(s);
+    }
+    void fill(VarParameter<std::string>& p) { p.assign(text(size(string_sizes))); }
+
+    template <class T>
+    void fill(GroupParameter<T>& p) { p.data().randomize(*this); }
+
+    template <class T>
+    void fill(GroupArray<T>& p) {
+      p.clear();
+      for (auto n = size(repeats); n > 0; n--) {
+        auto g = new T;
+        g->randomize(*this);
+        p.append(g);
+      }
+    }
+
+    //! create a message of a generated type with random content
+    message_ptr_t message(int id) {
+      auto it = randomizers.find(id);
+      if (it == randomizers.end())
+        return nullptr;
+      auto m = Message::instance(id);
+      if (m)
+        it->second(*m, *this);
+      return m;
+    }
+
+    //! probability of an optional parameter being present
+    double optional = 0.5;
+    size_dist repeats = { size_dist::Uniform, 0, 4 };
+    size_dist string_sizes = { size_dist::Uniform, 0, 32 };
+    size_dist blob_sizes = { size_dist::LogUniform, 0, 1024 };
+
+    //! randomizers by message id, generated with mig -r
+    static const std::map<int, RandomizerFunc> randomizers;
+
+  private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    std::string text(size_t n) {
+      std::string s(n, ' ');
+      for (auto& c : s)
+        c = 'a' + below(26);
+      return s;
+    }
+
+    uint64_t m_state[4];
+};
+
+template <>
+inline bool Random::value<bool>() { return next() >> 63; }
+
+} // namespace mig
+
+#endif // ifndef _MIGRAND_H_
@@ -34,7 +34,7 @@
   int yylex (void);
   void yyerror (char const *);
   extern FILE * yyin;
-  int optional, repeated, var;
+  int optional, repeated, var, key;
 %}
 
 %union {
@@ -48,7 +48,7 @@
 %token <string> IDENTIFIER SCOPED 
 %token <number> INTEGER
 %token <string> KW_MESSAGE KW_GROUP KW_ENUM KW_DATATYPE
-%token <number> KW_OPTIONAL KW_REPEATED KW_VAR
+%token <number> KW_OPTIONAL KW_REPEATED KW_VAR KW_KEY
 
 %type <parameter> parameter parameters
 %type <enumerator> enumerator enumerators
@@ -80,7 +80,7 @@ var_spec
   ;
 
 parameters
-  : /* empty */ { $$ = NULL }
+  : /* empty */ { $$ = NULL; }
   | parameters parameter { $2->next = $1; $$ = $2; }
   ;
 
@@ -89,12 +89,19 @@ parameter
     {
       if ( !mig_find_type($1) )
           yyerror("Unknown typename");
-      $$ = mig_creat_parameter( $1, $2, $4, optional, repeated );
+      if ( key && repeated )
+          yyerror("Key parameter cannot be repeated");
+      if ( $4 < 0 || $4 > MIG_MAX_PARAMETER_ID ) {
+          yyerror("Parameter id out of range");
+          YYABORT; /* would collide with the reserved marks of the wire format */
+      }
+      $$ = mig_creat_parameter( $1, $2, $4, optional, repeated, key );
+      optional = 0, repeated = 0, key = 0; /* attributes do not carry over */
     }
   ;
 
 attribute_spec
-  : /* empty */ { optional = 0, repeated = 0 } 
+  : /* empty */ { optional = 0, repeated = 0, key = 0; } 
   | '[' attributes ']' 
   ;
 
@@ -106,6 +113,7 @@ attributes
 attribute
   : opt_spec
   | rpt_spec 
+  | key_spec
   ;
 
 opt_spec
@@ -116,6 +124,10 @@ rpt_spec
   : KW_REPEATED { repeated = 1; }
   ;
 
+key_spec
+  : KW_KEY { key = 1; }
+  ;
+
 message
   : KW_MESSAGE IDENTIFIER '=' INTEGER '{' parameters '}' 
     {
@@ -124,6 +136,10 @@ message
       if ( mig_find_msg($4) )
           yyerror("Duplicate message id");
       $$ = mig_creat_message( $2, $4, $6 );
+      if ( $$->message.nparameters > MIG_MAX_PARAMETERS ) {
+          yyerror("Too many parameters");
+          YYABORT; /* no presence bit for the rest */
+      }
       mig_add_element($$);
     }
   ;
@@ -139,7 +155,7 @@ enumeration
   ;
 
 enumerators
-  : /* empty */ { $$ = NULL }
+  : /* empty */ { $$ = NULL; }
   | enumerators enumerator { $2->next = $1; $$ = $2; }
   ;
 
@@ -156,12 +172,16 @@ group
       if (mig_find_type($2))
           yyerror("Duplicate type name");
       $$ = mig_creat_group( $2, $4 );
+      if ( $$->group.nparameters > MIG_MAX_PARAMETERS ) {
+          yyerror("Too many parameters");
+          YYABORT; /* no presence bit for the rest */
+      }
       mig_add_element($$);
     }
   ;
 
 elements
-  : /* empty */          { $$ = NULL }
+  : /* empty */          { $$ = NULL; }
   | elements datatype    { $2->next = $1; $$ = $2; }
   | elements message     { $2->next = $1; $$ = $2; }
   | elements enumeration { $2->next = $1; $$ = $2; }
@@ -186,10 +206,11 @@ main (int argc, char *argv[])
 {
   int c;
   int dump = 0;
+  int random = 0;
   char *outname = NULL;
   FILE *inf;
 
-  while ((c = getopt (argc, argv, "dho:p")) != -1)
+  while ((c = getopt (argc, argv, "dho:pr")) != -1)
     switch (c) {
       case 'd':
         dump = 1;
@@ -200,6 +221,9 @@ main (int argc, char *argv[])
       case 'o':
         outname = optarg;
         break;
+      case 'r':
+        random = 1;
+        break;
       case '?':
         if (optopt == 'o')
           fprintf (stderr, "Option -%c requires an argument.\n", optopt);
@@ -211,9 +235,10 @@ main (int argc, char *argv[])
                    optopt);
         return 1;
       case 'h':
-          fprintf (stdout, "%s [-dp] [-o outfile] infile\n", argv[0]);
+          fprintf (stdout, "%s [-dpr] [-o outfile] infile\n", argv[0]);
           fprintf (stdout, "  -d dump parsed elements and exit\n");
           fprintf (stdout, "  -p lexical scanner debug output\n");
+          fprintf (stdout, "  -r generate randomizers for load generation (migrand.h)\n");
       default:
         goto error;
     }
@@ -229,10 +254,11 @@ main (int argc, char *argv[])
     goto error;
   }
 
-  mig_init(argv[optind], outname, dump);
+  mig_init(argv[optind], outname, dump, random);
 
   yyin = inf;
-  yyparse ();
+  if (yyparse () != 0)
+    goto error;
 
   return 0;
 
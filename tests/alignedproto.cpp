@@ -0,0 +1,360 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Aligned fixed layout protocol implementation
+//
+// - see the aligned layout in migmsg.h
+//
+
+#include "alignedproto.h"
+#include <iostream>
+#include <iomanip>
+
+namespace mig {
+
+AlignedProto::AlignedProto(Message& msg) {
+
+  auto size = wire_size(msg);
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(size); // zero filled
+
+  set_buf(buf);
+  set_size(size);
+  set_id(msg.id());
+
+  to_wire(msg);
+}
+
+AlignedProto::AlignedProto(storage_ptr_t& p, size_t n) {
+
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(p, n);
+  set_buf(buf);
+  set_size(n);
+  set_id(-1);
+
+  uint16_t id;
+  uint32_t size;
+  if (get(id) == 0 && seek(4) == 0 && get(size) == 0) {
+    set_id(id);
+    if (size < n)
+      set_size(size);
+  }
+}
+
+wire_format_ptr_t AlignedProto::reencode(Message& msg) const {
+  wire_format_ptr_t w = std::make_unique<AlignedProto>(msg);
+  return w;
+}
+
+int AlignedProto::seek(size_t offset) const {
+  buf()->reset();
+  if (offset > buf()->size())
+    return -1;
+  buf()->advance(offset);
+  return 0;
+}
+
+size_t AlignedProto::fixed_size(const Group& group, std::vector<size_t>& sizes) {
+  sizes.clear();
+  for (auto i=0; i<group.nparams(); i++)
+    if (layout::is_fixed(group.param(i)))
+      sizes.push_back(group.param(i).item_size());
+  return layout::fixed_offset(sizes, sizes.size());
+}
+
+int AlignedProto::table_size(const Group& group) {
+  int n = 0;
+  for (auto i=0; i<group.nparams(); i++)
+    if (!layout::is_fixed(group.param(i)))
+      n++;
+  return n;
+}
+
+size_t AlignedProto::align_of(const Parameter& par) {
+  if (par.is_group())
+    return 8;
+  if (par.is_scalar())
+    return (par.item_size() > 0) ? layout::item_align(par.item_size()) : 4;
+  return 1;
+}
+
+size_t AlignedProto::data_size(const Parameter& par) const {
+
+  if (par.is_group() && par.is_repeated()) {
+    size_t s = par.nrepeats() * layout::entry_size;
+    for (auto i=0; i<par.nrepeats(); i++)
+      s = layout::align(s, 8) + wire_size(*par.group(i));
+    return s;
+  }
+  if (par.is_group())
+    return wire_size(*par.group());
+  if (par.is_scalar() && par.item_size() == 0)
+    return (par.is_repeated()) ? 4 : 0; // repeat count of void
+  return par.data_size();
+}
+
+size_t AlignedProto::wire_size(const Parameter& par) const {
+  return data_size(par);
+}
+
+size_t AlignedProto::wire_size(const Group& group) const {
+
+  std::vector<size_t> sizes;
+  size_t s = fixed_size(group, sizes) + table_size(group) * layout::entry_size;
+  for (auto i=0; i<group.nparams(); i++) {
+    auto& par = group.param(i);
+    if (!layout::is_fixed(par) && par.is_set())
+      s = layout::align(s, align_of(par)) + data_size(par);
+  }
+  return s;
+}
+
+size_t AlignedProto::wire_size(const Message& msg) const {
+  return layout::header_size + wire_size((const Group&)msg);
+}
+
+int AlignedProto::write_entry(size_t offset, size_t data_offset, size_t length) {
+  return seek(offset) | put((uint32_t)data_offset) | put((uint32_t)length);
+}
+
+int AlignedProto::to_wire(const Message& msg) {
+
+  int ret = seek(0);
+  ret |= put((uint16_t)msg.id());
+  ret |= put((uint16_t)0);
+  ret |= put((uint32_t)size());
+  m_block = layout::header_size;
+  ret |= to_wire((const Group&)msg);
+  buf()->reset(); // read pointer to start of buffer
+  return ret;
+}
+
+int AlignedProto::to_wire(const Group& group) {
+
+// Fixed fields are written to their slots, other parameters after the
+// table in parameter order. The buffer is zero filled, so the entries
+// of absent parameters need not be written.
+
+  int ret = 0;
+  auto base = m_block;
+  std::vector<size_t> sizes;
+  auto table = fixed_size(group, sizes);
+  size_t cursor = table + table_size(group) * layout::entry_size;
+  size_t k = 0, j = 0;
+
+  for (auto i=0; i<group.nparams(); i++) {
+    auto& par = group.param(i);
+
+    if (layout::is_fixed(par)) {
+      ret |= seek(base + layout::fixed_offset(sizes, k++));
+      ret |= par.data_to_wire(*this, 0);
+      continue;
+    }
+
+    auto entry = base + table + j++ * layout::entry_size;
+    if (!par.is_set())
+      continue;
+
+    cursor = layout::align(cursor, align_of(par));
+    auto offset = cursor;
+    size_t length;
+
+    if (par.is_group() && par.is_repeated()) {
+      length = par.nrepeats() * layout::entry_size;
+      cursor += length;
+      for (auto r=0; r<par.nrepeats(); r++) {
+        cursor = layout::align(cursor, 8);
+        auto n = wire_size(*par.group(r));
+        m_block = base + cursor;
+        ret |= par.data_to_wire(*this, r);
+        ret |= write_entry(base + offset + r * layout::entry_size, cursor, n);
+        cursor += n;
+      }
+    } else if (par.is_group()) {
+      length = wire_size(*par.group());
+      m_block = base + cursor;
+      ret |= par.data_to_wire(*this, 0);
+      cursor += length;
+    } else {
+      length = data_size(par);
+      ret |= seek(base + cursor);
+      if (par.is_scalar() && par.item_size() == 0)
+        ret |= (par.is_repeated()) ? put((uint32_t)par.nrepeats()) : 0;
+      else
+        for (auto r=0; r<par.nrepeats(); r++)
+          ret |= par.data_to_wire(*this, r);
+      cursor += length;
+    }
+    ret |= write_entry(entry, offset, length);
+  }
+  m_block = base;
+  return ret;
+}
+
+int AlignedProto::to_wire(const Parameter& par) {
+
+  int ret = 0;
+  for (auto r=0; r<par.nrepeats(); r++)
+    ret |= par.data_to_wire(*this, r);
+  return ret;
+}
+
+int AlignedProto::from_wire(Message& msg) const {
+
+  if (size() < layout::header_size)
+    return -1;
+  m_block = layout::header_size;
+  m_length = size() - layout::header_size;
+  return from_wire((Group&)msg);
+}
+
+int AlignedProto::from_wire(Group& group) const {
+
+  int ret = 0;
+  auto base = m_block;
+  auto length = m_length;
+  std::vector<size_t> sizes;
+  auto table = fixed_size(group, sizes);
+  size_t k = 0, j = 0;
+
+  if (table + table_size(group) * layout::entry_size > length)
+    return -1;
+
+  for (auto i=0; i<group.nparams(); i++) {
+    auto& par = group.param(i);
+
+    if (layout::is_fixed(par)) {
+      ret |= seek(base + layout::fixed_offset(sizes, k++));
+      ret |= par.data_from_wire(*this);
+      continue;
+    }
+
+    uint32_t offset, n;
+    ret |= seek(base + table + j++ * layout::entry_size);
+    ret |= get(offset) | get(n);
+    if (ret != 0 || (uint64_t)offset + n > length)
+      return -1;
+    if (offset > 0)
+      ret |= read_data(par, base, length, offset, n);
+  }
+  return ret;
+}
+
+int AlignedProto::read_data(Parameter& par, size_t base, size_t block_length,
+                            uint32_t offset, uint32_t length) const {
+  int ret = 0;
+
+  if (par.is_group() && par.is_repeated()) {
+    for (size_t r=0; r < length / layout::entry_size; r++) {
+      uint32_t o, n;
+      ret |= seek(base + offset + r * layout::entry_size);
+      ret |= get(o) | get(n);
+      if (ret != 0 || o == 0 || (uint64_t)o + n > block_length)
+        return -1;
+      m_block = base + o;
+      m_length = n;
+      ret |= par.data_from_wire(*this);
+    }
+  } else if (par.is_group()) {
+    m_block = base + offset;
+    m_length = length;
+    ret |= par.data_from_wire(*this);
+  } else if (par.is_scalar() && par.item_size() == 0) {
+    uint32_t n = 1;
+    if (par.is_repeated()) {
+      ret |= seek(base + offset);
+      ret |= (length == 4) ? get(n) : -1;
+    }
+    for (uint32_t r=0; ret == 0 && r < n; r++)
+      ret |= par.data_from_wire(*this);
+  } else if (par.is_scalar()) {
+    if (length % par.item_size() != 0 || (!par.is_repeated() && length != par.item_size()))
+      return -1;
+    ret |= seek(base + offset);
+    for (size_t r=0; ret == 0 && r < length / par.item_size(); r++)
+      ret |= par.data_from_wire(*this);
+  } else {
+    ret |= seek(base + offset);
+    m_length = length;
+    ret |= par.data_from_wire(*this);
+  }
+  return ret;
+}
+
+int AlignedProto::from_wire(blob_t& data) const {
+  static const uint8_t empty = 0;
+  auto p = (m_length) ? buf()->getp(m_length) : &empty;
+  if (!p)
+    return -1;
+  data.assign(p, m_length); // assign message buffer sub-area
+  buf()->advance(m_length);
+  return 0;
+}
+
+int AlignedProto::from_wire(string_t& data) const {
+  static const uint8_t empty = 0;
+  auto p = (m_length) ? buf()->getp(m_length) : &empty;
+  if (!p)
+    return -1;
+  data.assign((const char *)p, m_length); // assign message buffer sub-area
+  buf()->advance(m_length);
+  return 0;
+}
+
+int AlignedProto::from_wire(std::string& data) const {
+  auto p = (m_length) ? buf()->getp(m_length) : nullptr;
+  if (m_length && !p)
+    return -1;
+  data.assign((const char *)p, (m_length) ? m_length - 1 : 0); // without terminator
+  buf()->advance(m_length);
+  return 0;
+}
+
+void AlignedProto::dump(std::ostream& os, const Parameter& par) const {
+  os << "param " << std::dec << par.id() << ": " << data_size(par) << " bytes\n";
+}
+
+void AlignedProto::dump(std::ostream& os, const Group& group, int id) const {
+  for (auto i=0; i<group.nparams(); i++) {
+    auto& par = group.param(i);
+    if (!par.is_set())
+      continue;
+    os << ((id) ? "  " : "- ");
+    dump(os, par);
+  }
+}
+
+void AlignedProto::dump(std::ostream& os, const Message& msg) const {
+
+  os << "dump\n";
+  os << std::setfill('0');
+  os << "Message: 0x" << std::hex << std::setw(4) << id();
+  os << std::dec << ", length " << size() << '(' << msg.data_size() << ")\n";
+
+  buf()->hexdump(os);
+  dump(os, dynamic_cast<const Group&>(msg), 0);
+}
+
+} // namespace mig
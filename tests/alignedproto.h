@@ -0,0 +1,121 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _ALIGNEDPROTO_H_
+#define _ALIGNEDPROTO_H_
+
+//
+// Aligned fixed layout protocol implementation
+//
+// - see the aligned layout in migmsg.h, generated <Message>View classes
+//   read the encoded buffers without decoding
+//
+
+#include "migmsg.h"
+#include "msgbuf.h"
+
+namespace mig {
+
+class AlignedProto : public WireFormat {
+
+  public:
+    AlignedProto(Message& msg);
+    AlignedProto(storage_ptr_t& buf, size_t n);
+    ~AlignedProto() {}
+
+    size_t wire_size(const Group&) const override;
+    size_t wire_size(const Message&) const override;
+    size_t wire_size(const Parameter&) const override;
+
+    int to_wire(const Message&) override;
+    int to_wire(const Group&) override;
+    int to_wire(const Parameter&) override;
+
+    int from_wire(Message&) const override;
+    int from_wire(Group&) const override;
+
+    wire_format_ptr_t reencode(Message&) const override;
+
+    int to_wire(int8_t value) override { return put(value); }
+    int to_wire(int16_t value) override { return put(value); }
+    int to_wire(int32_t value) override { return put(value); }
+    int to_wire(int64_t value) override { return put(value); }
+    int to_wire(uint8_t value) override { return put(value); }
+    int to_wire(uint16_t value) override { return put(value); }
+    int to_wire(uint32_t value) override { return put(value); }
+    int to_wire(uint64_t value) override { return put(value); }
+
+    int from_wire(int8_t& data) const override { return get(data); }
+    int from_wire(int16_t& data) const override { return get(data); }
+    int from_wire(int32_t& data) const override { return get(data); }
+    int from_wire(int64_t& data) const override { return get(data); }
+    int from_wire(uint8_t& data) const override { return get(data); }
+    int from_wire(uint16_t& data) const override { return get(data); }
+    int from_wire(uint32_t& data) const override { return get(data); }
+    int from_wire(uint64_t& data) const override { return get(data); }
+    int from_wire(blob_t&) const override;
+    int from_wire(string_t&) const override;
+    int from_wire(std::string&) const override;
+
+    using WireFormat::to_wire;
+    using WireFormat::from_wire;
+
+    void dump(std::ostream&, const Message&) const override;
+    void dump(std::ostream&, const Group&, int) const override;
+    void dump(std::ostream&, const Parameter&) const override;
+
+  private:
+    template <class T>
+    int put(T value) {
+      uint8_t data[sizeof(T)];
+      layout::store(data, value);
+      return buf()->putp(data, sizeof(T));
+    }
+
+    template <class T>
+    int get(T& data) const {
+      auto p = buf()->getp(sizeof(T));
+      if (!p)
+        return -1;
+      data = layout::load<T>(p);
+      buf()->advance(sizeof(T));
+      return 0;
+    }
+
+    int seek(size_t offset) const;
+    static size_t fixed_size(const Group&, std::vector<size_t>&);
+    static int table_size(const Group&);
+    static size_t align_of(const Parameter&);
+    size_t data_size(const Parameter&) const;
+    int write_entry(size_t offset, size_t data_offset, size_t length);
+    int read_data(Parameter&, size_t base, size_t block_length, uint32_t offset, uint32_t length) const;
+
+    mutable size_t m_block = 0; //!< start of the group block being encoded/decoded
+    mutable size_t m_length = 0; //!< length of the block or data item being decoded
+};
+
+} // namespace mig
+
+#endif // ifndef _ALIGNEDPROTO_H_
@@ -36,14 +36,20 @@ struct TestGroup1 : ::mig::Group {
     ::mig::ScalarParameter<int32_t> param2{1, ::mig::OPTIONAL};
     ::mig::VarParameter<::mig::string_t> param3{9, ::mig::OPTIONAL};
 
-    TestGroup1() : ::mig::Group(m_params) {}
+    TestGroup1() : ::mig::Group(m_params, m_index, required_mask()) { bind(); }
     virtual ~TestGroup1() {}
+    static constexpr ::mig::presence_t required_mask() { return 0x0ULL; }
   private:
     const ::mig::parameter_container_t  m_params = {
         {0, param1},
         {1, param2},
         {9, param3}
     };
+    const ::mig::parameter_index_t m_index = {
+        &param1,
+        &param2,
+        &param3
+    };
 };
 
 // message TestMessage1002 = 0x1002 {
@@ -61,9 +67,10 @@ struct TestGroup1 : ::mig::Group {
 class TestMessage1002 : public ::mig::Message {
 
   public:
-    TestMessage1002() : ::mig::Message(0x1002, m_params) { }
+    TestMessage1002() : ::mig::Message(0x1002, m_params, m_index, required_mask()) { bind(); }
     virtual ~TestMessage1002() {}
     static ::mig::message_ptr_t create() { return std::make_unique<TestMessage1002>(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x27bULL; }
 
     ::mig::ScalarParameter<int8_t> param1{8, ::mig::OPTIONAL};
     ::mig::ScalarParameter<bool> param2{1, ::mig::REQUIRED};
@@ -92,6 +99,20 @@ class TestMessage1002 : public ::mig::Message {
       {10, param10},
       {11, param11}
   };
+    // presence bits in parameter id order
+    const ::mig::parameter_index_t m_index = {
+      &param8,
+      &param2,
+      &param3,
+      &param4,
+      &param5,
+      &param6,
+      &param7,
+      &param1,
+      &param9,
+      &param10,
+      &param11
+  };
 };
 
 const std::map<int, mig::MessageCreatorFunc> mig::Message::creators {
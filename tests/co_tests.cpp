@@ -0,0 +1,189 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+//
+// Coroutine reader and writer tests, built as C++20
+//
+// Messages come from the randomizers of the test schema, which is
+// included by msg_tests.cpp
+//
+
+#include "gtest/gtest.h"
+#include "migrand.h"
+#include "costream.h"
+#include <unistd.h>
+#include <sys/socket.h>
+
+using ::mig::co::task;
+
+//! messages of a seed, large blobs fill the socket buffers
+static ::mig::Random source(unsigned seed, size_t max_blob = 200000)
+{
+  ::mig::Random r(seed);
+  r.blob_sizes = { ::mig::size_dist::LogUniform, 0, max_blob };
+  return r;
+}
+
+static task<void> produce(::mig::co::Loop& loop, int fd, unsigned seed, int count)
+{
+  ::mig::co::Writer out(loop, fd);
+  auto r = source(seed);
+  for (auto i=0; i<count; i++) {
+    auto m = r.message(4100);
+    EXPECT_EQ(co_await out.send(*m), 0);
+  }
+  close(fd);
+}
+
+static task<void> consume(::mig::co::Loop& loop, int fd, ::mig::Random r, int& count)
+{
+  ::mig::co::Reader in(loop, fd, 1000);
+  while (auto msg = co_await in.next_message()) {
+    auto m = r.message(4100);
+    EXPECT_EQ(msg->equals(*m), true);
+    count++;
+  }
+  EXPECT_EQ(in.pending(), 0u);
+  close(fd);
+}
+
+TEST(CoroutineTests, ReadWrite)
+{
+  // both ends on one thread, the writer suspends on a full socket and
+  // the reader on partial frames
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  ::mig::co::Loop loop;
+  int count = 0;
+  loop.spawn(consume(loop, sv[1], source(1), count));
+  loop.spawn(produce(loop, sv[0], 1, 200));
+  EXPECT_EQ(loop.tasks(), 2u);
+  EXPECT_EQ(loop.run(), 0);
+  EXPECT_EQ(count, 200);
+  EXPECT_EQ(loop.tasks(), 0u);
+}
+
+static task<void> trickle(::mig::co::Loop& loop, int fd, std::vector<uint8_t> bytes)
+{
+  ::mig::co::Writer out(loop, fd);
+  for (auto& b : bytes) {
+    EXPECT_EQ(co_await out.send(&b, 1), 0);
+    co_await loop.writable(fd); // let the reader run
+  }
+  close(fd);
+}
+
+TEST(CoroutineTests, ByteByByte)
+{
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  auto r = source(2, 100);
+  std::vector<uint8_t> bytes;
+  for (auto i=0; i<10; i++) {
+    auto m = r.message(4100);
+    m->to_wire();
+    auto w = m->wire_format();
+    w->buf()->reset();
+    auto p = w->buf()->getp(w->size());
+    bytes.insert(bytes.end(), p, p + w->size());
+  }
+
+  ::mig::co::Loop loop;
+  int count = 0;
+  loop.spawn(consume(loop, sv[1], source(2, 100), count));
+  loop.spawn(trickle(loop, sv[0], bytes));
+  EXPECT_EQ(loop.run(), 0);
+  EXPECT_EQ(count, 10);
+}
+
+TEST(CoroutineTests, ManyConnections)
+{
+  ::mig::co::Loop loop;
+  const int conns = 50;
+  std::vector<int> counts(conns, 0);
+  for (auto k=0; k<conns; k++) {
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    loop.spawn(produce(loop, sv[0], k, 20));
+    loop.spawn(consume(loop, sv[1], source(k), counts[k]));
+  }
+  EXPECT_EQ(loop.run(), 0);
+  EXPECT_EQ(counts, std::vector<int>(conns, 20));
+}
+
+static task<void> stuck(::mig::co::Loop& loop, int fd, bool& done)
+{
+  ::mig::co::Reader in(loop, fd);
+  auto msg = co_await in.next_message();
+  done = true;
+}
+
+TEST(CoroutineTests, WaitError)
+{
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  bool first = false, second = false;
+  ::mig::co::Loop loop;
+  loop.spawn(stuck(loop, sv[1], first));
+  // a second reader of the descriptor cannot wait, it ends
+  loop.spawn(stuck(loop, sv[1], second));
+  EXPECT_EQ(second, true);
+  EXPECT_EQ(first, false);
+  EXPECT_EQ(loop.tasks(), 1u);
+  close(sv[0]);
+  EXPECT_EQ(loop.run(), 0);
+  EXPECT_EQ(first, true);
+  close(sv[1]);
+}
+
+TEST(CoroutineTests, Stop)
+{
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  bool done = false;
+  {
+    ::mig::co::Loop loop;
+    loop.spawn(stuck(loop, sv[1], done));
+    EXPECT_EQ(loop.tasks(), 1u);
+    // a half frame, then the peer goes away
+    uint8_t half[] = { 0x10, 0x04, 0x00, 0x10, 0x01 };
+    ASSERT_EQ(write(sv[0], half, sizeof(half)), (ssize_t)sizeof(half));
+    shutdown(sv[0], SHUT_WR);
+    EXPECT_EQ(loop.run(), 0);
+    EXPECT_EQ(done, true);
+
+    // destroyed while it waits
+    done = false;
+    int sp[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sp), 0);
+    loop.spawn(stuck(loop, sp[1], done));
+    EXPECT_EQ(loop.tasks(), 1u);
+    close(sp[0]);
+    close(sp[1]);
+  }
+  EXPECT_EQ(done, false);
+  close(sv[0]);
+  close(sv[1]);
+}
@@ -0,0 +1,443 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+// 
+// Columnar batches of messages of one type
+//
+// - see columnar.h
+//
+
+#include "columnar.h"
+#include <limits>
+
+namespace mig {
+
+static const size_t batch_header_size = 16;
+static const size_t column_entry_size = 8;
+
+static size_t bitmap_size(size_t count) { return (count + 63) / 64 * 8; }
+
+//! parameter has a column
+static bool is_column(const Parameter& par) {
+  return !par.is_repeated() && !par.is_group();
+}
+
+static ColumnKind column_kind(const Parameter& par) {
+  if (!par.is_scalar())
+    return ColumnKind::Var;
+  return (par.item_size() > 0) ? ColumnKind::Fixed : ColumnKind::Void;
+}
+
+//
+// Wire formats moving single parameter values between messages and
+// columns, only the value conversions are used
+//
+
+class ColumnFormat : public WireFormat {
+
+  public:
+    size_t wire_size(const Group&) const override { return 0; }
+    size_t wire_size(const Message&) const override { return 0; }
+    size_t wire_size(const Parameter&) const override { return 0; }
+
+    int to_wire(const Message&) override { return -1; }
+    int to_wire(const Group&) override { return -1; }
+    int to_wire(const Parameter&) override { return -1; }
+
+    int from_wire(Message&) const override { return -1; }
+    int from_wire(Group&) const override { return -1; }
+
+    int from_wire(blob_t&) const override { return -1; }
+    int from_wire(string_t&) const override { return -1; }
+    int from_wire(std::string&) const override { return -1; }
+
+    using WireFormat::to_wire;
+    using WireFormat::from_wire;
+
+    void dump(std::ostream&, const Message&) const override {}
+    void dump(std::ostream&, const Group&, int) const override {}
+    void dump(std::ostream&, const Parameter&) const override {}
+};
+
+//! Appends values to a column
+class ColumnSink : public ColumnFormat {
+
+  public:
+    explicit ColumnSink(std::vector<uint8_t>& out) : m_out(out) {}
+
+    int to_wire(int8_t value) override { return put(value); }
+    int to_wire(int16_t value) override { return put(value); }
+    int to_wire(int32_t value) override { return put(value); }
+    int to_wire(int64_t value) override { return put(value); }
+    int to_wire(uint8_t value) override { return put(value); }
+    int to_wire(uint16_t value) override { return put(value); }
+    int to_wire(uint32_t value) override { return put(value); }
+    int to_wire(uint64_t value) override { return put(value); }
+    int to_wire(const blob_t& value) override { return put(value.data(), value.size()); }
+    int to_wire(const string_t& value) override { return put((const uint8_t *)value.data(), value.size()); }
+    int to_wire(const std::string& value) override { return put((const uint8_t *)value.c_str(), value.size() + 1); }
+
+    using ColumnFormat::to_wire;
+
+  private:
+    template <class T>
+    int put(T value) {
+      uint8_t data[sizeof(T)];
+      layout::store(data, value);
+      return put(data, sizeof(T));
+    }
+
+    int put(const uint8_t *p, size_t n) {
+      if (n)
+        this->m_out.insert(this->m_out.end(), p, p + n);
+      return 0;
+    }
+
+    std::vector<uint8_t>& m_out;
+};
+
+//! Reads the values of one message of a batch
+class ColumnRow : public ColumnFormat {
+
+  public:
+    ColumnRow(const ColumnBatch& batch, size_t i) : m_batch(batch), m_row(i) { set_id(batch.id()); }
+
+    int from_wire(Message& msg) const override { return from_wire((Group&)msg); }
+    int from_wire(Group&) const override;
+
+    int from_wire(int8_t& data) const override { return get(data); }
+    int from_wire(int16_t& data) const override { return get(data); }
+    int from_wire(int32_t& data) const override { return get(data); }
+    int from_wire(int64_t& data) const override { return get(data); }
+    int from_wire(uint8_t& data) const override { return get(data); }
+    int from_wire(uint16_t& data) const override { return get(data); }
+    int from_wire(uint32_t& data) const override { return get(data); }
+    int from_wire(uint64_t& data) const override { return get(data); }
+    int from_wire(bool& data) const override {
+      uint8_t x;
+      auto ret = get(x);
+      data = (x != 0);
+      return ret;
+    }
+    int from_wire(blob_t& data) const override {
+      data.assign(this->m_value, this->m_length); // refer to the batch
+      return 0;
+    }
+    int from_wire(string_t& data) const override {
+      data.assign((const char *)this->m_value, this->m_length);
+      return 0;
+    }
+    int from_wire(std::string& data) const override { // without terminator
+      data.assign((const char *)this->m_value, (this->m_length) ? this->m_length - 1 : 0);
+      return 0;
+    }
+
+    using ColumnFormat::from_wire;
+
+  private:
+    template <class T>
+    int get(T& data) const {
+      if (this->m_length != sizeof(T))
+        return -1;
+      data = layout::load<T>(this->m_value);
+      return 0;
+    }
+
+    const ColumnBatch& m_batch;
+    size_t m_row;
+    mutable const uint8_t *m_value = nullptr;
+    mutable size_t m_length = 0;
+};
+
+int ColumnRow::from_wire(Group& group) const {
+  for (auto& c : m_batch.m_columns) {
+    auto it = group.params().find(c.id);
+    if (it == group.params().end())
+      return -1;
+    auto& par = it->second;
+    if (!is_column(par) || column_kind(par) != c.kind
+        || (c.kind == ColumnKind::Fixed && par.item_size() != c.item_size))
+      return -1;
+    if (!(c.presence[m_row / 64] & (1ULL << (m_row % 64))))
+      continue;
+
+    if (c.kind == ColumnKind::Fixed) {
+      m_value = c.values + m_row * c.item_size;
+      m_length = c.item_size;
+    } else if (c.kind == ColumnKind::Var) {
+      auto offsets = (const uint32_t *)c.values;
+      m_value = c.data + offsets[m_row];
+      m_length = offsets[m_row + 1] - offsets[m_row];
+    } else {
+      m_value = nullptr;
+      m_length = 0;
+    }
+    if (par.data_from_wire(*this) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+//
+// ColumnWriter
+//
+
+ColumnWriter::ColumnWriter(const Message& schema) : m_id(schema.id()) {
+  for (auto& p : schema.params()) {
+    auto& par = p.second;
+    if (!is_column(par))
+      continue;
+    column c;
+    c.id = p.first;
+    c.kind = column_kind(par);
+    c.item_size = (c.kind == ColumnKind::Fixed) ? par.item_size() : 0;
+    c.offsets.push_back(0);
+    m_columns.push_back(std::move(c));
+  }
+}
+
+size_t ColumnWriter::block_size(const column& c) const {
+  size_t s = bitmap_size(m_count);
+  if (c.kind == ColumnKind::Fixed)
+    s += layout::align(m_count * c.item_size, 8);
+  else if (c.kind == ColumnKind::Var)
+    s += layout::align((m_count + 1) * 4, 8) + layout::align(c.data.size(), 8);
+  return s;
+}
+
+size_t ColumnWriter::size() const {
+  size_t s = batch_header_size + m_columns.size() * column_entry_size;
+  for (auto& c : m_columns)
+    s += block_size(c);
+  return s;
+}
+
+int ColumnWriter::add(const Message& msg) {
+  if (msg.id() != m_id)
+    return -1;
+  for (auto& p : msg.params())
+    if (p.second.is_set() && !is_column(p.second))
+      return -1;
+
+  size_t word = m_count / 64;
+  for (auto& c : m_columns) {
+    auto& par = msg.params().at(c.id);
+    if (word == c.presence.size())
+      c.presence.push_back(0);
+    if (par.is_set())
+      c.presence[word] |= 1ULL << (m_count % 64);
+
+    if (c.kind == ColumnKind::Fixed) {
+      if (!par.is_set())
+        c.values.resize((m_count + 1) * c.item_size);
+      else {
+        ColumnSink sink(c.values);
+        if (par.data_to_wire(sink) != 0 || c.values.size() != (m_count + 1) * c.item_size) {
+          truncate();
+          return -1;
+        }
+      }
+    } else if (c.kind == ColumnKind::Var) {
+      ColumnSink sink(c.data);
+      if ((par.is_set() && par.data_to_wire(sink) != 0)
+          || c.data.size() > std::numeric_limits<uint32_t>::max()) {
+        truncate();
+        return -1;
+      }
+      c.offsets.push_back(c.data.size());
+    }
+  }
+
+  m_count++;
+  if (m_count > std::numeric_limits<uint32_t>::max() || size() > std::numeric_limits<uint32_t>::max()) {
+    m_count--;
+    truncate();
+    return -1;
+  }
+  return 0;
+}
+
+void ColumnWriter::truncate() {
+  for (auto& c : m_columns) {
+    c.presence.resize((m_count + 63) / 64);
+    if (m_count % 64)
+      c.presence.back() &= (1ULL << (m_count % 64)) - 1;
+    c.values.resize(m_count * c.item_size);
+    c.offsets.resize(m_count + 1);
+    c.data.resize(c.offsets.back());
+  }
+}
+
+void ColumnWriter::clear() {
+  m_count = 0;
+  truncate();
+}
+
+int ColumnWriter::encode(std::vector<uint8_t>& out) const {
+  size_t s = size();
+  if (s > std::numeric_limits<uint32_t>::max() || m_columns.size() > 0xffff)
+    return -1;
+  out.assign(s, 0);
+
+  auto p = out.data();
+  layout::store<uint16_t>(p, m_id);
+  layout::store<uint16_t>(p + 2, m_columns.size());
+  layout::store<uint32_t>(p + 4, s);
+  layout::store<uint32_t>(p + 8, m_count);
+
+  auto entry = p + batch_header_size;
+  size_t offset = batch_header_size + m_columns.size() * column_entry_size;
+  for (auto& c : m_columns) {
+    layout::store<uint16_t>(entry, c.id);
+    entry[2] = (uint8_t)c.kind;
+    entry[3] = c.item_size;
+    layout::store<uint32_t>(entry + 4, offset);
+    entry += column_entry_size;
+
+    auto q = p + offset;
+    for (auto w : c.presence) {
+      layout::store(q, w);
+      q += 8;
+    }
+    if (c.kind == ColumnKind::Fixed && !c.values.empty()) {
+      memcpy(q, c.values.data(), c.values.size()); // already little endian
+    } else if (c.kind == ColumnKind::Var) {
+      for (auto o : c.offsets) {
+        layout::store(q, o);
+        q += 4;
+      }
+      q = p + offset + bitmap_size(m_count) + layout::align((m_count + 1) * 4, 8);
+      if (!c.data.empty())
+        memcpy(q, c.data.data(), c.data.size());
+    }
+    offset += block_size(c);
+  }
+  return 0;
+}
+
+//
+// ColumnBatch
+//
+
+ColumnBatch::ColumnBatch(const uint8_t *p, size_t n) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return; // columns are read as native arrays
+#endif
+  if (!p || ((uintptr_t)p & 7) || n < batch_header_size)
+    return;
+  int ncolumns = layout::load<uint16_t>(p + 2);
+  m_size = layout::load<uint32_t>(p + 4);
+  m_count = layout::load<uint32_t>(p + 8);
+  if (m_size > n || m_size < batch_header_size + ncolumns * column_entry_size)
+    return;
+
+  m_data = p;
+  for (int i = 0; i < ncolumns; i++) {
+    if (read_column(p + batch_header_size + i * column_entry_size) != 0) {
+      m_data = nullptr;
+      m_columns.clear();
+      return;
+    }
+  }
+  m_id = layout::load<uint16_t>(p);
+}
+
+int ColumnBatch::read_column(const uint8_t *entry) {
+  block c;
+  c.id = layout::load<uint16_t>(entry);
+  c.kind = (ColumnKind)entry[2];
+  c.item_size = entry[3];
+  uint64_t offset = layout::load<uint32_t>(entry + 4);
+  uint64_t end = offset + bitmap_size(m_count);
+
+  if ((offset & 7) || offset < (uint64_t)(entry - m_data) || end > m_size
+      || (!m_columns.empty() && c.id <= m_columns.back().id))
+    return -1;
+  c.presence = (const uint64_t *)(m_data + offset);
+  c.values = m_data + end;
+  c.data = nullptr;
+
+  switch (c.kind) {
+    case ColumnKind::Fixed:
+      if (c.item_size == 0 || end + (uint64_t)m_count * c.item_size > m_size)
+        return -1;
+      break;
+    case ColumnKind::Var: {
+      uint64_t data = end + layout::align((m_count + 1) * 4, 8);
+      if (data > m_size)
+        return -1;
+      auto offsets = (const uint32_t *)c.values;
+      if (offsets[0] != 0)
+        return -1;
+      for (size_t i = 0; i < m_count; i++)
+        if (offsets[i + 1] < offsets[i])
+          return -1;
+      if (data + offsets[m_count] > m_size)
+        return -1;
+      c.data = m_data + data;
+      break;
+    }
+    case ColumnKind::Void:
+      if (c.item_size != 0)
+        return -1;
+      break;
+    default:
+      return -1;
+  }
+  m_columns.push_back(c);
+  return 0;
+}
+
+const ColumnBatch::block *ColumnBatch::find(int id) const {
+  for (auto& c : m_columns)
+    if (c.id == id)
+      return &c;
+  return nullptr;
+}
+
+span<uint64_t> ColumnBatch::presence(int id) const {
+  auto c = find(id);
+  return (c) ? span<uint64_t>(c->presence, bitmap_size(m_count) / 8) : span<uint64_t>();
+}
+
+bool ColumnBatch::is_present(int id, size_t i) const {
+  auto c = find(id);
+  return c && i < m_count && (c->presence[i / 64] & (1ULL << (i % 64)));
+}
+
+var_column ColumnBatch::var(int id) const {
+  auto c = find(id);
+  if (!c || c->kind != ColumnKind::Var)
+    return var_column();
+  return var_column((const uint32_t *)c->values, m_count, c->data);
+}
+
+int ColumnBatch::message(size_t i, Message& msg) const {
+  if (!is_valid() || i >= m_count || msg.id() != m_id)
+    return -1;
+  ColumnRow row(*this, i);
+  return msg.decode(row);
+}
+
+} // namespace mig
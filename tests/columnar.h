@@ -0,0 +1,209 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+#ifndef _COLUMNAR_H_
+#define _COLUMNAR_H_
+
+//
+// Columnar batches of messages of one type
+//
+// Batch:  | u16 id | u16 ncolumns | u32 size | u32 count | u32 0 | table | blocks |
+// Entry:  | u16 param id | u8 kind | u8 item size | u32 offset |
+// Block:  | presence bitmap | values |
+//
+// Each top level, not repeated parameter of the schema is a column with
+// an entry in id order. The offset of its block is relative to the start
+// of the batch. The bitmap has a bit for each message, in u64 words, bit
+// i % 64 of word i / 64. Fixed size values follow packed, zeros for absent
+// values. Variable length values follow as count + 1 u32 offsets and the
+// data, value i is data[offsets[i], offsets[i + 1]). A void column only
+// has the bitmap. Strings include their terminator like in the other wire
+// formats. Blocks are aligned to 8 and values are little endian.
+//
+// ColumnWriter collects messages and encodes the batch. ColumnBatch reads
+// one in place and gives the columns as arrays for loops over all the
+// messages, selected by the generated field ids:
+//
+//   ColumnBatch b(buf.data(), buf.size());
+//   auto p3 = b.column(TestMessage1002::field_param3());
+//   for (size_t i = 0; i < p3.size(); i++) sum += p3[i];
+//
+// Groups and repeated parameters have no columns. Messages that have them
+// set are not accepted into a batch.
+//
+
+#include "migmsg.h"
+#include <vector>
+
+namespace mig {
+
+//! Read only array in a batch
+template <class T>
+class span {
+
+  public:
+    span() {}
+    span(const T *data, size_t size) : m_data(data), m_size(size) {}
+
+    const T *data() const { return this->m_data; }
+    size_t size() const { return this->m_size; }
+    bool empty() const { return this->m_size == 0; }
+    const T& operator[](size_t i) const { return this->m_data[i]; }
+    const T *begin() const { return this->m_data; }
+    const T *end() const { return this->m_data + this->m_size; }
+
+  private:
+    const T *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+//! Variable length values of a column
+class var_column {
+
+  public:
+    var_column() {}
+    var_column(const uint32_t *offsets, size_t size, const uint8_t *data) :
+      m_offsets(offsets), m_size(size), m_data(data) {}
+
+    size_t size() const { return this->m_size; }
+    //! size() + 1 offsets into data()
+    span<uint32_t> offsets() const { return span<uint32_t>(this->m_offsets, (this->m_offsets) ? this->m_size + 1 : 0); }
+    const uint8_t *data() const { return this->m_data; }
+
+    const uint8_t *at(size_t i) const { return this->m_data + this->m_offsets[i]; }
+    size_t length(size_t i) const { return this->m_offsets[i + 1] - this->m_offsets[i]; }
+    //! values refer to the batch buffer
+    string_t string(size_t i) const { return string_t((const char *)at(i), length(i)); }
+    blob_t blob(size_t i) const { return blob_t(at(i), length(i)); }
+
+  private:
+    const uint32_t *m_offsets = nullptr;
+    size_t m_size = 0;
+    const uint8_t *m_data = nullptr;
+};
+
+//! Kind of a column
+enum class ColumnKind : uint8_t { Fixed = 1, Var = 2, Void = 3 };
+
+//! Collects messages of one type into a columnar batch
+class ColumnWriter {
+
+  public:
+    explicit ColumnWriter(const Message& schema);
+
+    int id() const { return this->m_id; }
+    //! messages in the batch
+    size_t count() const { return this->m_count; }
+    //! size of the encoded batch
+    size_t size() const;
+
+    //! append a message of the schema's type, -1 if it is of another type
+    //! or has a group or a repeated parameter set
+    int add(const Message& msg);
+    //! write the batch to out, -1 if it does not fit the size fields
+    int encode(std::vector<uint8_t>& out) const;
+    //! start a new batch
+    void clear();
+
+  private:
+    struct column {
+      int id;
+      ColumnKind kind;
+      size_t item_size;
+      std::vector<uint64_t> presence;
+      std::vector<uint8_t> values; //!< fixed values
+      std::vector<uint32_t> offsets; //!< of variable length values
+      std::vector<uint8_t> data;
+    };
+
+    size_t block_size(const column& c) const;
+    //! drop a partly added message
+    void truncate();
+
+    int m_id;
+    size_t m_count = 0;
+    std::vector<column> m_columns; //!< in id order
+};
+
+//! Columnar batch read in place
+class ColumnBatch {
+
+  public:
+    //! p must be aligned to 8
+    ColumnBatch(const uint8_t *p, size_t n);
+
+    bool is_valid() const { return this->m_data != nullptr; }
+    int id() const { return this->m_id; }
+    //! messages in the batch
+    size_t count() const { return this->m_count; }
+    //! encoded size of the batch
+    size_t size() const { return this->m_size; }
+
+    bool has_column(int id) const { return find(id) != nullptr; }
+    //! presence bitmap of a column, empty if there is none
+    span<uint64_t> presence(int id) const;
+    bool is_present(int id, size_t i) const;
+
+    //! values of a fixed size column, empty if there is none of the type
+    template <class T>
+    span<T> column(field_t<T> f) const {
+      auto c = find(f.id);
+      if (!c || c->kind != ColumnKind::Fixed || c->item_size != sizeof(T))
+        return span<T>();
+      return span<T>((const T *)c->values, this->m_count);
+    }
+    //! values of a variable length column
+    var_column var(int id) const;
+    template <class T>
+    var_column var(field_t<T> f) const { return var(f.id); }
+
+    //! set the parameters of msg from message i of the batch, variable
+    //! length values refer to the batch buffer
+    int message(size_t i, Message& msg) const;
+
+  private:
+    friend class ColumnRow;
+
+    struct block {
+      int id;
+      ColumnKind kind;
+      size_t item_size;
+      const uint64_t *presence;
+      const uint8_t *values; //!< fixed values or variable length offsets
+      const uint8_t *data; //!< of variable length values
+    };
+
+    const block *find(int id) const;
+    int read_column(const uint8_t *entry);
+
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    int m_id = -1;
+    size_t m_count = 0;
+    std::vector<block> m_columns; //!< in id order
+};
+
+} // namespace mig
+
+#endif // ifndef _COLUMNAR_H_
@@ -0,0 +1,92 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+//
+// Reading a column of a batch compared with decoding frames
+//
+// Usage: columnarbench [messages]
+//
+// Random messages are encoded both as SampleProto frames and as one
+// columnar batch. A parameter is summed over all of them from the
+// batch's column and by decoding each frame.
+//
+
+#include "msg_tests.msg.h"
+#include "columnar.h"
+#include "sampleproto.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+
+int main(int argc, char *argv[]) {
+
+  size_t n = (argc > 1) ? atol(argv[1]) : 200000;
+
+  using M = TestMessage1005;
+  ::mig::Random r(1);
+  ::mig::ColumnWriter writer(M::schema());
+  std::vector<std::vector<uint8_t>> frames;
+  size_t frame_bytes = 0;
+  for (size_t i=0; i<n; i++) {
+    auto m = r.message(0x1005);
+    if (writer.add(*m) != 0) {
+      std::cerr << "cannot add message " << i << '\n';
+      return 1;
+    }
+    m->to_wire();
+    auto w = m->wire_format();
+    w->buf()->reset();
+    auto p = w->buf()->getp(w->size());
+    frames.emplace_back(p, p + w->size());
+    frame_bytes += w->size();
+  }
+  std::vector<uint8_t> batch;
+  writer.encode(batch);
+
+  int64_t a = 0, b = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  ::mig::ColumnBatch columns(batch.data(), batch.size());
+  for (auto v : columns.column(M::field_param3()))
+    a += v;
+  auto t1 = std::chrono::steady_clock::now();
+  M m;
+  for (auto& f : frames) {
+    ::mig::SampleProto w(f.data(), f.size());
+    if (m.decode(w) == 0)
+      b += m.param3.data();
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  auto column = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+  auto decoded = std::chrono::duration<double, std::nano>(t2 - t1).count() / n;
+  std::cout << n << " messages, " << frame_bytes << " bytes in frames, "
+            << batch.size() << " bytes in the batch\n"
+            << "  column ns   decode ns  speedup\n"
+            << std::setw(11) << std::fixed << std::setprecision(2) << column
+            << std::setw(12) << decoded
+            << std::setw(8) << std::setprecision(1) << decoded / column << 'x'
+            << ((a != b) ? "  results differ" : "") << '\n';
+  return 0;
+}
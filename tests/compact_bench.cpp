@@ -0,0 +1,114 @@
+/*
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+
+*/
+
+//
+// Encoded size and throughput of SampleProto vs. CompactProto
+//
+// Usage: compactbench [iterations]
+//
+
+#include "msg_tests.msg.h"
+#include "compactproto.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+typedef ::mig::wire_format_ptr_t (*EncodeFunc)(::mig::Message&);
+typedef ::mig::wire_format_ptr_t (*DecodeFunc)(::mig::storage_ptr_t&, size_t);
+
+static ::mig::wire_format_ptr_t compact_encode(::mig::Message& msg) {
+  return std::make_unique<::mig::CompactProto>(msg);
+}
+
+static ::mig::wire_format_ptr_t compact_decode(::mig::storage_ptr_t& p, size_t n) {
+  return std::make_unique<::mig::CompactProto>(p, n);
+}
+
+static void bench(const char *name, ::mig::Message& msg, int n,
+                  EncodeFunc encode, DecodeFunc decode) {
+
+  auto w = encode(msg);
+  auto size = w->size();
+  w->buf()->reset();
+  std::vector<uint8_t> frame(w->buf()->getp(size), w->buf()->getp(size) + size);
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (auto i=0; i<n; i++)
+    w = encode(msg);
+  auto t1 = std::chrono::steady_clock::now();
+  for (auto i=0; i<n; i++) {
+    auto p = std::make_unique<uint8_t []>(size);
+    memcpy(p.get(), frame.data(), size);
+    auto d = decode(p, size);
+    auto m = ::mig::Message::factory(d);
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  auto enc = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+  auto dec = std::chrono::duration<double, std::nano>(t2 - t1).count() / n;
+  std::cout << std::setw(14) << name
+            << std::setw(8) << size << " B"
+            << std::setw(10) << std::fixed << std::setprecision(1) << enc << " ns"
+            << std::setw(10) << dec << " ns\n";
+}
+
+int main(int argc, char *argv[]) {
+
+  int n = (argc > 1) ? atoi(argv[1]) : 100000;
+
+  TestMessage1002 m2;
+  m2.param1.set();
+  m2.param2 = 1;
+  m2.param3 = 2;
+  m2.param4 = 3;
+  m2.param5 = TestEnum1::VALUE2;
+  m2.param6 = true;
+
+  TestMessage1003 m3;
+  ::mig::string_t s("sample string");
+  ::mig::blob_t b((const uint8_t *)"\x01\x02\x03\x04", 4);
+  m3.param1.assign(s);
+  m3.param2.assign(b);
+  m3.param3.data().param1.set();
+  m3.param3.data().param2 = 100;
+  m3.param5 = 5;
+
+  TestMessage1005 m5;
+  m5.param1 = -1;
+  m5.param2 = 1000;
+  m5.param3 = -100000;
+  m5.param4 = 10;
+  m5.param5 = 1000000;
+
+  std::cout << "message         format     size    encode    decode\n";
+  for (auto m : std::vector<::mig::Message*>{ &m2, &m3, &m5 }) {
+    std::cout << "0x" << std::hex << m->id() << std::dec << '\n';
+    bench("sample", *m, n, ::mig::WireFormat::factory, ::mig::WireFormat::factory);
+    bench("compact", *m, n, compact_encode, compact_decode);
+  }
+  return 0;
+}
@@ -0,0 +1,320 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Compact protocol implementation
+//
+// - see compactproto.h for the wire layout
+//
+
+#include "compactproto.h"
+#include <iostream>
+#include <iomanip>
+
+namespace mig {
+
+CompactProto::CompactProto(Message& msg) {
+
+  auto length = wire_size((const Group&)msg);
+  auto size = varint_size(msg.id()) + varint_size(length) + length;
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(size);
+
+  set_buf(buf);
+  set_size(size);
+  set_id(msg.id());
+
+  encode(msg, length);
+}
+
+CompactProto::CompactProto(storage_ptr_t& p, size_t n) {
+
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(p, n);
+  set_buf(buf);
+  set_size(n);
+
+  uint64_t id = 0, length = 0;
+  if (get_varint(id) != 0 || get_varint(length) != 0) {
+    set_id(-1);
+    return;
+  }
+  set_id((int)id);
+
+  m_header = this->buf()->offset();
+  if (m_header + length < n)
+    set_size(m_header + length);
+}
+
+wire_format_ptr_t CompactProto::reencode(Message& msg) const {
+  wire_format_ptr_t w = std::make_unique<CompactProto>(msg);
+  return w;
+}
+
+const uint8_t *CompactProto::get_data(uint64_t& n) const {
+
+  if (get_varint(n) != 0)
+    return nullptr;
+  static const uint8_t empty = 0;
+  if (n == 0)
+    return &empty;
+  const uint8_t *p = buf()->getp(n);
+  if (p)
+    buf()->advance(n);
+  return p;
+}
+
+size_t CompactProto::wire_size(const Parameter& par) const {
+  CompactProto counter;
+  counter.to_wire(par);
+  return counter.m_count;
+}
+
+size_t CompactProto::wire_size(const Group& group) const {
+  CompactProto counter;
+  counter.to_wire(group);
+  return counter.m_count;
+}
+
+size_t CompactProto::wire_size(const Message& msg) const {
+  auto s = wire_size((const Group&)msg);
+  return varint_size(msg.id()) + varint_size(s) + s;
+}
+
+int CompactProto::to_wire(const Message& msg) {
+  return encode(msg, wire_size((const Group&)msg));
+}
+
+int CompactProto::encode(const Message& msg, size_t length) {
+
+  auto ret = put_varint(msg.id());
+  ret |= put_varint(length);
+  m_header = buf()->offset();
+  ret |= to_wire((const Group&)msg);
+  buf()->reset(); // read pointer to start of buffer
+  return ret;
+}
+
+int CompactProto::to_wire(const Group& group) {
+
+  int ret = 0;
+  for (auto bits = group.presence(); bits; )
+    ret |= to_wire(group.param(pop_bit(bits)));
+  return ret | put_varint(0); // end of group
+}
+
+int CompactProto::to_wire(const Parameter& par) {
+
+  int ret = 0;
+  if (par.is_set())
+    for (auto i=0; i < par.nrepeats(); i++) {
+      ret |= put_varint(par.id() + 1);
+      ret |= par.data_to_wire(*this, i);
+    }
+  return ret;
+}
+
+int CompactProto::from_wire(Message& msg) const {
+
+  buf()->reset();
+  buf()->advance(m_header);
+  return from_wire((Group&)msg);
+}
+
+int CompactProto::from_wire(Group& group) const {
+
+  uint64_t key;
+  while (get_varint(key) == 0) {
+    if (key == 0)
+      return 0; // end of group
+    auto it = group.params().find((int)(key - 1));
+    if (it == group.params().end())
+      return -1; // unknown parameter, the rest cannot be parsed
+    if (it->second.data_from_wire(*this) != 0)
+      return -1;
+  }
+  return -1; // end mark missing
+}
+
+int CompactProto::to_wire(uint8_t value) { return put_varint(value); }
+int CompactProto::to_wire(uint16_t value) { return put_varint(value); }
+int CompactProto::to_wire(uint32_t value) { return put_varint(value); }
+int CompactProto::to_wire(uint64_t value) { return put_varint(value); }
+int CompactProto::to_wire(int8_t value) { return put_varint(zigzag(value)); }
+int CompactProto::to_wire(int16_t value) { return put_varint(zigzag(value)); }
+int CompactProto::to_wire(int32_t value) { return put_varint(zigzag(value)); }
+int CompactProto::to_wire(int64_t value) { return put_varint(zigzag(value)); }
+
+int CompactProto::to_wire(const blob_t& value) {
+  return put_data(value.data(), value.size());
+}
+
+int CompactProto::to_wire(const string_t& value) {
+  return put_data(value.data(), value.size());
+}
+
+int CompactProto::to_wire(const std::string& value) {
+  return put_data(value.data(), value.size());
+}
+
+int CompactProto::from_wire(uint8_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (uint8_t)x;
+  return ret;
+}
+
+int CompactProto::from_wire(uint16_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (uint16_t)x;
+  return ret;
+}
+
+int CompactProto::from_wire(uint32_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (uint32_t)x;
+  return ret;
+}
+
+int CompactProto::from_wire(uint64_t& data) const {
+  return get_varint(data);
+}
+
+int CompactProto::from_wire(int8_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (int8_t)unzigzag(x);
+  return ret;
+}
+
+int CompactProto::from_wire(int16_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (int16_t)unzigzag(x);
+  return ret;
+}
+
+int CompactProto::from_wire(int32_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (int32_t)unzigzag(x);
+  return ret;
+}
+
+int CompactProto::from_wire(int64_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = unzigzag(x);
+  return ret;
+}
+
+int CompactProto::from_wire(bool& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (x != 0);
+  return ret;
+}
+
+int CompactProto::from_wire(blob_t& data) const {
+  uint64_t n;
+  auto p = get_data(n);
+  if (!p)
+    return -1;
+  data.assign(p, n); // assign message buffer sub-area
+  return 0;
+}
+
+int CompactProto::from_wire(string_t& data) const {
+  uint64_t n;
+  auto p = get_data(n);
+  if (!p)
+    return -1;
+  data.assign((const char *)p, n); // assign message buffer sub-area
+  return 0;
+}
+
+int CompactProto::from_wire(std::string& data) const {
+  uint64_t n;
+  auto p = get_data(n);
+  if (!p)
+    return -1;
+  data.assign((const char *)p, n);
+  return 0;
+}
+
+void CompactProto::dump(std::ostream& os, const Parameter& par) const {
+
+  if (par.is_group()) {
+    os << '\n';
+    dump(os, *par.group(), par.id());
+  } else if (par.is_scalar()) {
+    uint64_t value = 0;
+    if (par.item_size() > 0)
+      get_varint(value);
+    os << std::dec << value << '\n';
+  } else { // variable length parameter
+    uint64_t size = 0;
+    auto p = get_data(size);
+    os << std::setfill('0');
+    for (size_t i=0; p && i < size; i++)
+      os << std::hex << std::setw(2) << int(p[i]) << ' ';
+    os << '\n';
+  }
+}
+
+void CompactProto::dump(std::ostream& os, const Group& group, int id) const {
+
+  uint64_t key;
+  while (get_varint(key) == 0 && key != 0) {
+
+    if (dynamic_cast<const Message*>(&group))
+      // direct parameter
+      os << "- param " << std::dec << key - 1 << ": ";
+    else
+      // group parameter
+      os << "  group " << std::dec << id << '/' << key - 1 << ": ";
+
+    auto it = group.params().find((int)(key - 1));
+    if (it == group.params().end()) {
+      os << "invalid id " << std::dec << key - 1 << '\n';
+      return;
+    }
+    dump(os, it->second);
+  }
+}
+
+void CompactProto::dump(std::ostream& os, const Message& msg) const {
+
+  os << "dump\n";
+  os << std::setfill('0');
+  os << "Message: 0x" << std::hex << std::setw(4) << id();
+  os << std::dec << ", length " << size() << '(' << msg.data_size() << ")\n";
+
+  buf()->reset();
+  buf()->advance(m_header);
+  dump(os, dynamic_cast<const Group&>(msg), 0);
+}
+
+} // namespace mig
@@ -0,0 +1,130 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _COMPACTPROTO_H_
+#define _COMPACTPROTO_H_
+
+//
+// Compact protocol implementation
+//
+// Message:   | varint id | varint length of the rest | parameters | 0 |
+// Parameter: | varint (id + 1) | data |
+// Group:     | parameters | 0 |
+//
+// Unsigned integers, enums and bools are LEB128 varints, signed integers
+// are zigzag coded before that. Variable length data is preceded by
+// its varint length. Repeated parameters repeat the parameter key.
+//
+
+#include "migmsg.h"
+#include "msgbuf.h"
+
+namespace mig {
+
+class CompactProto : public WireFormat {
+
+  public:
+    CompactProto(Message& msg);
+    CompactProto(storage_ptr_t& buf, size_t n);
+    ~CompactProto() {}
+
+    static int varint_size(uint64_t value) { return ::mig::varint_size(value); }
+    static uint64_t zigzag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+    static int64_t unzigzag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+    size_t wire_size(const Group&) const override;
+    size_t wire_size(const Message&) const override;
+    size_t wire_size(const Parameter&) const override;
+
+    int to_wire(const Message&) override;
+    int to_wire(const Group&) override;
+    int to_wire(const Parameter&) override;
+
+    int from_wire(Message&) const override;
+    int from_wire(Group&) const override;
+
+    wire_format_ptr_t reencode(Message&) const override;
+
+    int to_wire(int8_t) override;
+    int to_wire(int16_t) override;
+    int to_wire(int32_t) override;
+    int to_wire(int64_t) override;
+    int to_wire(uint8_t) override;
+    int to_wire(uint16_t) override;
+    int to_wire(uint32_t) override;
+    int to_wire(uint64_t) override;
+    int to_wire(const blob_t&) override;
+    int to_wire(const string_t&) override;
+    int to_wire(const std::string&) override;
+
+    int from_wire(int8_t&) const override;
+    int from_wire(int16_t&) const override;
+    int from_wire(int32_t&) const override;
+    int from_wire(int64_t&) const override;
+    int from_wire(uint8_t&) const override;
+    int from_wire(uint16_t&) const override;
+    int from_wire(uint32_t&) const override;
+    int from_wire(uint64_t&) const override;
+    int from_wire(bool&) const override;
+    int from_wire(blob_t&) const override;
+    int from_wire(string_t&) const override;
+    int from_wire(std::string&) const override;
+
+    using WireFormat::to_wire;
+    using WireFormat::from_wire;
+
+    void dump(std::ostream&, const Message&) const override;
+    void dump(std::ostream&, const Group&, int) const override;
+    void dump(std::ostream&, const Parameter&) const override;
+
+  private:
+    CompactProto() : m_counter(true) {} // size counter, adds up lengths without a buffer
+    int encode(const Message&, size_t length);
+
+    int put_varint(uint64_t value) {
+      if (m_counter) {
+        m_count += varint_size(value);
+        return 0;
+      }
+      return ::mig::put_varint(*buf(), value);
+    }
+    int put_data(const void *p, size_t n) {
+      if (m_counter) {
+        m_count += varint_size(n) + n;
+        return 0;
+      }
+      return put_varint(n) | buf()->putp((const uint8_t *)p, n);
+    }
+    int get_varint(uint64_t& value) const { return ::mig::get_varint(*buf(), value); }
+    const uint8_t *get_data(uint64_t&) const;
+
+    size_t m_header = 0; //!< length of message id and length fields
+    bool m_counter = false;
+    size_t m_count = 0; //!< bytes counted by a size counter
+};
+
+} // namespace mig
+
+#endif // ifndef _COMPACTPROTO_H_
@@ -0,0 +1,287 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Conflation of frames
+//
+// - see conflate.h
+//
+
+#include "conflate.h"
+#include "migqueue.h"
+#include "sampleproto.h"
+#include <chrono>
+#include <new>
+#include <thread>
+
+namespace mig {
+
+message_ptr_t decode_frame(const uint8_t *frame, size_t n) {
+  if (!frame || SampleProto::frame_size(frame, n) != n)
+    return nullptr;
+  auto p = std::make_unique<uint8_t []>(n);
+  memcpy(p.get(), frame, n);
+  wire_format_ptr_t w = std::make_unique<SampleProto>(p, n);
+  return Message::factory(w);
+}
+
+//! key of a frame from a key function
+static int frame_key(const key_func_t& f, const uint8_t *frame, size_t n, uint64_t& key) {
+  if (!f || SampleProto::frame_size(frame, n) != n)
+    return -1;
+  SampleProto w(frame, n);
+  return f(w, key);
+}
+
+//! id of a valid frame
+static int frame_id(const uint8_t *frame, size_t n) {
+  SampleProto w(frame, n);
+  return w.id();
+}
+
+//
+// LastValueCache
+//
+
+LastValueCache::LastValueCache(const cache_options& options, const key_func_t& key_func) :
+  m_options(options), m_key_func(key_func) {
+
+  auto slots = queue_capacity(m_options.slots);
+  m_mask = slots - 1;
+  m_stride = (m_options.max_frame + 7) / 8;
+  static_assert(std::is_trivially_destructible<entry>::value, "entries are freed without destructors");
+  void *p = nullptr;
+  if (posix_memalign(&p, alignof(entry), slots * sizeof(entry)) != 0)
+    throw std::bad_alloc();
+  auto e = (entry *)p;
+  for (size_t i=0; i<slots; i++)
+    new (&e[i]) entry;
+  m_entries.reset(e);
+  m_words.reset(new std::atomic<uint64_t>[slots * m_stride]);
+  for (size_t i=0; i<slots * m_stride; i++)
+    m_words[i].store(0, std::memory_order_relaxed);
+}
+
+size_t LastValueCache::slot(int id, uint64_t key) const {
+  auto h = (key ^ ((uint64_t)id << 32 | (uint32_t)id)) * 0x9e3779b97f4a7c15ULL;
+  return (h ^ (h >> 29)) & m_mask;
+}
+
+const LastValueCache::entry *LastValueCache::find(int id, uint64_t key) const {
+  auto i = slot(id, key);
+  for (size_t n=0; n<=m_mask; n++, i = (i + 1) & m_mask) {
+    auto& e = m_entries[i];
+    if (!e.used.load(std::memory_order_acquire))
+      return nullptr;
+    if (e.id.load(std::memory_order_relaxed) == id && e.key.load(std::memory_order_relaxed) == key)
+      return &e;
+  }
+  return nullptr;
+}
+
+int LastValueCache::update(const uint8_t *frame, size_t n, uint64_t key) {
+  if (!frame || n > m_options.max_frame || SampleProto::frame_size(frame, n) != n)
+    return -1;
+  auto id = frame_id(frame, n);
+
+  auto i = slot(id, key);
+  size_t probes = 0;
+  for (; probes<=m_mask; probes++, i = (i + 1) & m_mask) {
+    auto& e = m_entries[i];
+    if (!e.used.load(std::memory_order_relaxed))
+      break;
+    if (e.id.load(std::memory_order_relaxed) == id && e.key.load(std::memory_order_relaxed) == key)
+      break;
+  }
+  if (probes > m_mask)
+    return -1; // full
+
+  auto& e = m_entries[i];
+  auto seq = e.seq.load(std::memory_order_relaxed);
+  e.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  auto w = words(i);
+  for (size_t k=0; k<n; k+=8) {
+    uint64_t v = 0;
+    memcpy(&v, frame + k, std::min((size_t)8, n - k));
+    w[k / 8].store(v, std::memory_order_relaxed);
+  }
+  e.size.store(n, std::memory_order_relaxed);
+  e.seq.store(seq + 2, std::memory_order_release);
+
+  if (!e.used.load(std::memory_order_relaxed)) {
+    // published after its first frame
+    e.id.store(id, std::memory_order_relaxed);
+    e.key.store(key, std::memory_order_relaxed);
+    e.used.store(true, std::memory_order_release);
+    m_size.fetch_add(1, std::memory_order_relaxed);
+  }
+  return 0;
+}
+
+int LastValueCache::update(const uint8_t *frame, size_t n) {
+  uint64_t key;
+  if (frame_key(m_key_func, frame, n, key) != 0)
+    return -1;
+  return update(frame, n, key);
+}
+
+int LastValueCache::update(const Message& msg, uint64_t key) {
+  auto r = SampleProto::encode(msg, [&](size_t n) {
+    m_scratch.resize(n);
+    return m_scratch.data();
+  });
+  if (r != 0)
+    return -1;
+  return update(m_scratch.data(), m_scratch.size(), key);
+}
+
+size_t LastValueCache::copy(size_t i, uint8_t *p, size_t room) const {
+  auto& e = m_entries[i];
+  auto w = words(i);
+  for (;;) {
+    auto seq = e.seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      std::this_thread::yield(); // being written
+      continue;
+    }
+    size_t n = e.size.load(std::memory_order_relaxed);
+    for (size_t k=0; k<n && k<room; k+=8) {
+      auto v = w[k / 8].load(std::memory_order_relaxed);
+      memcpy(p + k, &v, std::min((size_t)8, n - k));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (e.seq.load(std::memory_order_relaxed) == seq)
+      return n;
+  }
+}
+
+int LastValueCache::read(int id, uint64_t key, std::vector<uint8_t>& frame) const {
+  auto e = find(id, key);
+  if (!e)
+    return -1;
+  frame.resize(m_options.max_frame);
+  frame.resize(copy(e - m_entries.get(), frame.data(), frame.size()));
+  return 0;
+}
+
+message_ptr_t LastValueCache::get(int id, uint64_t key) const {
+  auto e = find(id, key);
+  if (!e)
+    return nullptr;
+  auto p = std::make_unique<uint8_t []>(m_options.max_frame);
+  auto n = copy(e - m_entries.get(), p.get(), m_options.max_frame);
+  wire_format_ptr_t w = std::make_unique<SampleProto>(p, n);
+  return Message::factory(w);
+}
+
+uint64_t LastValueCache::version(int id, uint64_t key) const {
+  auto e = find(id, key);
+  return (e) ? e->seq.load(std::memory_order_acquire) / 2 : 0;
+}
+
+//
+// ConflatingQueue
+//
+
+int ConflatingQueue::push(const uint8_t *frame, size_t n, uint64_t key) {
+  if (!frame || SampleProto::frame_size(frame, n) != n)
+    return -1;
+  slot_key k{ frame_id(frame, n), key };
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.pushed++;
+    auto it = m_pending.find(k);
+    if (it != m_pending.end()) {
+      // replace in place, the key keeps its place in the queue
+      it->second.frame.assign(frame, frame + n);
+      it->second.updates++;
+      m_stats.conflated++;
+      return 0;
+    }
+    auto& e = m_pending[k];
+    e.id = k.id;
+    e.key = key;
+    if (!m_spare.empty()) {
+      e.frame = std::move(m_spare.back());
+      m_spare.pop_back();
+    }
+    e.frame.assign(frame, frame + n);
+    e.updates = 1;
+    m_order.push_back(k);
+  }
+  m_ready.notify_one();
+  return 0;
+}
+
+int ConflatingQueue::push(const uint8_t *frame, size_t n) {
+  uint64_t key;
+  if (frame_key(m_key_func, frame, n, key) != 0)
+    return -1;
+  return push(frame, n, key);
+}
+
+int ConflatingQueue::push(const Message& msg, uint64_t key) {
+  std::vector<uint8_t> frame;
+  auto r = SampleProto::encode(msg, [&](size_t n) {
+    frame.resize(n);
+    return frame.data();
+  });
+  if (r != 0)
+    return -1;
+  return push(frame.data(), frame.size(), key);
+}
+
+int ConflatingQueue::pop(entry& e, int timeout) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  auto ready = [this]() { return !m_order.empty(); };
+  if (timeout < 0)
+    m_ready.wait(lock, ready);
+  else if (!m_ready.wait_for(lock, std::chrono::milliseconds(timeout), ready))
+    return -1;
+
+  auto it = m_pending.find(m_order.front());
+  m_order.pop_front();
+  // the caller's old buffer is kept for the next new key
+  std::swap(e, it->second);
+  if (it->second.frame.capacity() > 0 && m_spare.size() < 64)
+    m_spare.push_back(std::move(it->second.frame));
+  m_pending.erase(it);
+  m_stats.popped++;
+  return 0;
+}
+
+size_t ConflatingQueue::size() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_order.size();
+}
+
+conflate_stats ConflatingQueue::stats() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+} // namespace mig
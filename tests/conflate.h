@@ -0,0 +1,204 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _CONFLATE_H_
+#define _CONFLATE_H_
+
+//
+// Conflation of SampleProto frames by message id and routing key
+//
+// A consumer of state updates that only needs the latest state of each
+// key should not have to work through every update. LastValueCache
+// keeps the latest frame per (id, key) for readers which look up a key
+// when they need it, ConflatingQueue delivers keys in the order they
+// changed, each with its latest frame.
+//
+// Both keep encoded frames. A message is decoded only when a consumer
+// asks for one.
+//
+// The key of a frame can be given by the caller or computed with a key
+// function, e.g. message_key() of a schema with [key] parameters.
+//
+
+#include "migmsg.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace mig {
+
+//! computes the key of a frame, returns -1 if it has none
+typedef std::function<int(const WireFormat&, uint64_t&)> key_func_t;
+
+//! a message decoded from a copy of a frame, nullptr if it does not decode
+message_ptr_t decode_frame(const uint8_t *frame, size_t n);
+
+struct cache_options {
+  size_t slots = 1024; //!< (id, key) pairs the cache can hold
+  size_t max_frame = 256; //!< larger frames are not cached
+};
+
+//! Latest frame per message id and key
+//
+// One thread updates the cache, any number of threads read it without
+// locks. Each entry is a seqlock: the writer makes its sequence odd
+// while it copies a frame in, a reader retries if the sequence was odd
+// or changed during its copy. Entries are in an open addressed table
+// and are never removed, so a reader finds an entry the way the writer
+// placed it.
+//
+class LastValueCache {
+
+  public:
+    explicit LastValueCache(const cache_options& options = cache_options(),
+                            const key_func_t& key_func = nullptr);
+    LastValueCache(const LastValueCache&) = delete;
+    LastValueCache& operator=(const LastValueCache&) = delete;
+
+    //
+    // Writer, one thread
+    //
+
+    //! make a frame the latest of its id and key. Returns -1 if it is not
+    //! a frame, is larger than max_frame or the cache is full.
+    int update(const uint8_t *frame, size_t n, uint64_t key);
+    //! key from the key function
+    int update(const uint8_t *frame, size_t n);
+    int update(const Message& msg, uint64_t key);
+
+    //
+    // Readers, any thread
+    //
+
+    //! copy of the latest frame of an id and key, -1 if there is none
+    int read(int id, uint64_t key, std::vector<uint8_t>& frame) const;
+    //! the latest message of an id and key, decoded now
+    message_ptr_t get(int id, uint64_t key) const;
+    //! number of updates of an id and key, 0 if it has none. A reader
+    //! can poll this to see if there is anything new.
+    uint64_t version(int id, uint64_t key) const;
+    //! number of (id, key) pairs
+    size_t size() const { return this->m_size.load(std::memory_order_relaxed); }
+
+  private:
+    struct alignas(64) entry {
+      std::atomic<uint64_t> seq{0}; //!< odd while the frame is written
+      std::atomic<bool> used{false};
+      std::atomic<int> id{0};
+      std::atomic<uint64_t> key{0};
+      std::atomic<uint32_t> size{0};
+    };
+    //! entries are allocated with posix_memalign(), operator new does not
+    //! honor the alignment before C++17
+    struct entry_free {
+      void operator()(entry *p) const { free(p); }
+    };
+
+    size_t slot(int id, uint64_t key) const;
+    //! entry of an id and key, nullptr if there is none
+    const entry *find(int id, uint64_t key) const;
+    std::atomic<uint64_t> *words(size_t i) const { return &m_words[i * m_stride]; }
+    //! seqlock copy of an entry's frame to p, returns its size
+    size_t copy(size_t i, uint8_t *p, size_t room) const;
+
+    cache_options m_options;
+    key_func_t m_key_func;
+    size_t m_mask;
+    size_t m_stride; //!< 64 bit words per entry
+    std::unique_ptr<entry [], entry_free> m_entries;
+    std::unique_ptr<std::atomic<uint64_t> []> m_words; //!< frames, written word by word
+    std::atomic<size_t> m_size{0};
+    std::vector<uint8_t> m_scratch; //!< writer's encoding buffer
+};
+
+struct conflate_stats {
+  uint64_t pushed = 0;
+  uint64_t conflated = 0; //!< frames that replaced a pending one
+  uint64_t popped = 0;
+};
+
+//! Queue of keys with their latest frames
+//
+// A frame of an (id, key) that is already queued replaces the queued
+// frame and keeps its place. So the queue never holds more than one
+// entry per key, however far the consumer is behind.
+//
+class ConflatingQueue {
+
+  public:
+    struct entry {
+      int id = 0;
+      uint64_t key = 0;
+      std::vector<uint8_t> frame;
+      uint64_t updates = 0; //!< frames conflated into this one, itself included
+
+      //! decode the frame
+      message_ptr_t message() const { return decode_frame(frame.data(), frame.size()); }
+    };
+
+    explicit ConflatingQueue(const key_func_t& key_func = nullptr) : m_key_func(key_func) {}
+    ConflatingQueue(const ConflatingQueue&) = delete;
+    ConflatingQueue& operator=(const ConflatingQueue&) = delete;
+
+    //! queue a frame, or replace the queued frame of its id and key
+    int push(const uint8_t *frame, size_t n, uint64_t key);
+    //! key from the key function
+    int push(const uint8_t *frame, size_t n);
+    int push(const Message& msg, uint64_t key);
+
+    //! the oldest queued key with its latest frame, waits up to timeout
+    //! ms (forever if < 0). Returns -1 if nothing was queued.
+    int pop(entry& e, int timeout = 0);
+
+    size_t size() const;
+    conflate_stats stats() const;
+
+  private:
+    struct slot_key {
+      int id;
+      uint64_t key;
+      bool operator==(const slot_key& o) const { return id == o.id && key == o.key; }
+    };
+    struct slot_hash {
+      size_t operator()(const slot_key& k) const { return k.key * 0x9e3779b97f4a7c15ULL ^ k.id; }
+    };
+
+    key_func_t m_key_func;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::unordered_map<slot_key, entry, slot_hash> m_pending;
+    std::deque<slot_key> m_order; //!< pending keys, oldest first
+    std::vector<std::vector<uint8_t>> m_spare; //!< frame buffers for reuse
+    conflate_stats m_stats;
+};
+
+} // namespace mig
+
+#endif // ifndef _CONFLATE_H_
@@ -0,0 +1,221 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Coroutine interface for reading and writing messages
+//
+// - see costream.h
+//
+
+#include "costream.h"
+#include "sampleproto.h"
+#include <cerrno>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+}
+
+static_assert(mig::co::Loop::read_event == EPOLLIN && mig::co::Loop::write_event == EPOLLOUT,
+              "event bits are epoll's");
+
+namespace mig {
+namespace co {
+
+static void set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags >= 0 && !(flags & O_NONBLOCK))
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+//
+// Loop
+//
+
+Loop::Loop() : m_fd(epoll_create1(EPOLL_CLOEXEC)) {}
+
+Loop::~Loop() {
+  m_tasks.clear(); // coroutine frames are destroyed where they wait
+  if (m_fd >= 0)
+    close(m_fd);
+}
+
+void Loop::spawn(task<void>&& t) {
+  m_tasks.push_back(std::move(t));
+  m_tasks.back().handle().resume();
+  reap();
+}
+
+void Loop::reap() {
+  m_tasks.remove_if([](const task<void>& t) { return t.done(); });
+}
+
+int Loop::update(int fd, const waiters& w) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = (w.in ? EPOLLIN : 0) | (w.out ? EPOLLOUT : 0);
+  ev.data.fd = fd;
+  // a closed descriptor left the epoll set, its number may be reused
+  if (epoll_ctl(m_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+    return 0;
+  return (errno == ENOENT) ? epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &ev) : -1;
+}
+
+int Loop::wait(int fd, uint32_t events, std::coroutine_handle<> h) {
+  auto& w = m_waiters[fd];
+  auto& slot = (events & EPOLLIN) ? w.in : w.out;
+  if (slot)
+    return -1; // one reader and one writer per descriptor
+  slot = h;
+  if (update(fd, w) != 0) {
+    slot = nullptr;
+    if (!w.in && !w.out)
+      m_waiters.erase(fd);
+    return -1;
+  }
+  m_waiting++;
+  return 0;
+}
+
+int Loop::run() {
+  m_stop = false;
+  struct epoll_event events[64];
+  while (!m_tasks.empty() && !m_stop) {
+    if (m_waiting == 0)
+      return -1; // nothing can resume them
+    int n = epoll_wait(m_fd, events, 64, -1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    for (auto i=0; i<n; i++) {
+      int fd = events[i].data.fd;
+      auto it = m_waiters.find(fd);
+      if (it == m_waiters.end())
+        continue;
+      // errors and hangups resume both, the coroutines see them on I/O
+      auto ev = events[i].events;
+      bool in = ev & (EPOLLIN | EPOLLERR | EPOLLHUP);
+      bool out = ev & (EPOLLOUT | EPOLLERR | EPOLLHUP);
+      auto w = it->second;
+      if (in && w.in)
+        it->second.in = nullptr;
+      if (out && w.out)
+        it->second.out = nullptr;
+      update(fd, it->second);
+      if (!it->second.in && !it->second.out)
+        m_waiters.erase(it); // the descriptor stays in the epoll set without events
+      if (in && w.in) {
+        m_waiting--;
+        w.in.resume();
+      }
+      if (out && w.out) {
+        m_waiting--;
+        w.out.resume();
+      }
+    }
+    reap();
+  }
+  return 0;
+}
+
+//
+// Reader
+//
+
+Reader::Reader(Loop& loop, int fd, size_t read_size) :
+  m_loop(loop), m_fd(fd), m_read_size(read_size), m_in(read_size) {
+  set_nonblocking(fd);
+}
+
+task<frame_ref> Reader::next_frame() {
+  for (;;) {
+    size_t n;
+    if (auto p = m_in.next(n))
+      co_return frame_ref{ p, n };
+    if (m_in.error())
+      co_return frame_ref{ nullptr, 0 };
+
+    auto p = m_in.space(m_read_size);
+    auto r = read(m_fd, p, m_in.room());
+    if (r > 0)
+      m_in.produced(r);
+    else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (co_await m_loop.readable(m_fd) != 0)
+        co_return frame_ref{ nullptr, 0 };
+    } else if (r == 0 || errno != EINTR)
+      co_return frame_ref{ nullptr, 0 }; // end of stream
+  }
+}
+
+task<message_ptr_t> Reader::next_message() {
+  for (;;) {
+    auto f = co_await next_frame();
+    if (!f.data)
+      co_return nullptr;
+    // the frame moves with the next read
+    auto p = std::make_unique<uint8_t []>(f.size);
+    memcpy(p.get(), f.data, f.size);
+    wire_format_ptr_t w = std::make_unique<SampleProto>(p, f.size);
+    if (auto msg = Message::factory(w))
+      co_return msg;
+    // not a message of this schema, skip it
+  }
+}
+
+//
+// Writer
+//
+
+Writer::Writer(Loop& loop, int fd) : m_loop(loop), m_fd(fd) {
+  set_nonblocking(fd);
+}
+
+task<int> Writer::send(const Message& msg) {
+  m_out.clear();
+  if (SampleProto::encode(msg, [&](size_t n) { m_out.resize(n); return m_out.data(); }) != 0)
+    co_return -1;
+  co_return co_await send(m_out.data(), m_out.size());
+}
+
+task<int> Writer::send(const uint8_t *p, size_t n) {
+  while (n > 0) {
+    auto r = write(m_fd, p, n);
+    if (r > 0) {
+      p += r;
+      n -= r;
+    } else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (co_await m_loop.writable(m_fd) != 0)
+        co_return -1;
+    } else if (r == 0 || errno != EINTR)
+      co_return -1;
+  }
+  co_return 0;
+}
+
+} // namespace co
+} // namespace mig
@@ -0,0 +1,243 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _COSTREAM_H_
+#define _COSTREAM_H_
+
+//
+// Coroutine interface for reading and writing messages (C++20)
+//
+//   co::task<void> echo(co::Loop& loop, int fd) {
+//     co::Reader in(loop, fd);
+//     co::Writer out(loop, fd);
+//     while (auto msg = co_await in.next_message())
+//       co_await out.send(*msg);
+//   }
+//
+//   co::Loop loop;
+//   loop.spawn(echo(loop, fd));
+//   loop.run();
+//
+// A reader suspends when a frame is not complete and resumes when the
+// descriptor is readable, bytes that arrived are kept and only frame
+// headers are looked at until a frame is complete. A writer suspends
+// while the descriptor is not writable. A loop runs the coroutines of
+// one thread, many connections are multiplexed on a loop per thread.
+//
+
+#if __cplusplus < 202002L
+#error "costream.h needs C++20"
+#endif
+
+#include "migmsg.h"
+#include "transport.h"
+#include <coroutine>
+#include <exception>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace mig {
+namespace co {
+
+template <class T> class task;
+
+namespace detail {
+
+template <class T>
+struct promise_base {
+  std::coroutine_handle<> continuation; //!< awaiting coroutine
+
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <class P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      auto c = h.promise().continuation;
+      return (c) ? c : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { std::terminate(); }
+};
+
+template <class T>
+struct promise : promise_base<T> {
+  T value{};
+  task<T> get_return_object();
+  void return_value(T v) { value = std::move(v); }
+  T result() { return std::move(value); }
+};
+
+template <>
+struct promise<void> : promise_base<void> {
+  task<void> get_return_object();
+  void return_void() {}
+  void result() {}
+};
+
+} // namespace detail
+
+//! Lazily started coroutine, runs when awaited or spawned on a loop
+template <class T = void>
+class task {
+
+  public:
+    typedef detail::promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_t;
+
+    explicit task(handle_t h) : m_handle(h) {}
+    task(task&& t) noexcept : m_handle(std::exchange(t.m_handle, nullptr)) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() { if (m_handle) m_handle.destroy(); }
+
+    bool done() const { return !m_handle || m_handle.done(); }
+    handle_t handle() const { return this->m_handle; }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+      m_handle.promise().continuation = c;
+      return m_handle;
+    }
+    T await_resume() { return m_handle.promise().result(); }
+
+  private:
+    handle_t m_handle;
+};
+
+template <class T>
+task<T> detail::promise<T>::get_return_object() {
+  return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> detail::promise<void>::get_return_object() {
+  return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+//! Runs coroutines that wait for descriptors with epoll
+class Loop {
+
+  public:
+    Loop();
+    ~Loop();
+    Loop(const Loop&) = delete;
+    Loop& operator=(const Loop&) = delete;
+
+    //! start a coroutine, the loop keeps it until it is done
+    void spawn(task<void>&& t);
+    //! run until all spawned coroutines are done or stop() is called,
+    //! -1 on error or if coroutines wait for nothing
+    int run();
+    void stop() { m_stop = true; }
+    size_t tasks() const { return this->m_tasks.size(); }
+
+    //! awaits to 0, or to -1 without suspending if the wait cannot be
+    //! set up, e.g. another coroutine waits for the same events of fd
+    struct wait_for {
+      Loop& loop;
+      int fd;
+      uint32_t events;
+      int result = 0;
+      bool await_ready() const noexcept { return false; }
+      bool await_suspend(std::coroutine_handle<> h) {
+        result = loop.wait(fd, events, h);
+        return result == 0;
+      }
+      int await_resume() const noexcept { return result; }
+    };
+
+    //! resume when fd is readable
+    wait_for readable(int fd) { return { *this, fd, read_event }; }
+    //! resume when fd is writable
+    wait_for writable(int fd) { return { *this, fd, write_event }; }
+
+    static const uint32_t read_event = 1;
+    static const uint32_t write_event = 4;
+
+  private:
+    struct waiters {
+      std::coroutine_handle<> in;
+      std::coroutine_handle<> out;
+    };
+
+    int wait(int fd, uint32_t events, std::coroutine_handle<> h);
+    int update(int fd, const waiters& w);
+    void reap();
+
+    int m_fd;
+    bool m_stop = false;
+    size_t m_waiting = 0;
+    std::list<task<void>> m_tasks;
+    std::unordered_map<int, waiters> m_waiters;
+};
+
+//! Reads frames from a descriptor, which is made non-blocking
+class Reader {
+
+  public:
+    Reader(Loop& loop, int fd, size_t read_size = 0x10000);
+
+    //! next frame, valid until the next call. Data is nullptr at the end
+    //! of the stream, if it does not hold frames or if the descriptor
+    //! cannot be waited for.
+    task<frame_ref> next_frame();
+    //! next decoded message, nullptr at the end of the stream
+    task<message_ptr_t> next_message();
+
+    //! bytes received of a frame that is not complete
+    size_t pending() const { return this->m_in.pending(); }
+
+  private:
+    Loop& m_loop;
+    int m_fd;
+    size_t m_read_size;
+    FrameSplitter m_in;
+};
+
+//! Writes frames to a descriptor, which is made non-blocking. A writer
+//! sends one frame at a time.
+class Writer {
+
+  public:
+    Writer(Loop& loop, int fd);
+
+    //! send a message, 0 when it is written or -1
+    task<int> send(const Message& msg);
+    //! send a frame or any bytes
+    task<int> send(const uint8_t *p, size_t n);
+
+  private:
+    Loop& m_loop;
+    int m_fd;
+    std::vector<uint8_t> m_out; //!< encoded message
+};
+
+} // namespace co
+} // namespace mig
+
+#endif // ifndef _COSTREAM_H_
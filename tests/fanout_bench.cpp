@@ -0,0 +1,108 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+//
+// Fan-out of one message to many subscribers
+//
+// Usage: fanoutbench [messages]
+//
+// Each message goes to 1, 10 and 1000 transports writing to /dev/null.
+// "copy" sends the message to every transport, which encodes it each
+// time. "shared" encodes it once with broadcast() and queues references
+// to the same frame.
+//
+
+#include "msg_tests.msg.h"
+#include "transport.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+}
+
+static void bench(::mig::Message& msg, int n, size_t subscribers, bool shared) {
+  ::mig::transport_options o;
+  o.batch = 64;
+  std::vector<std::unique_ptr<::mig::Transport>> transports;
+  std::vector<::mig::Transport*> targets;
+  for (size_t i=0; i<subscribers; i++) {
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd < 0) {
+      std::cerr << "cannot open /dev/null\n";
+      return;
+    }
+    transports.push_back(std::make_unique<::mig::Transport>(fd, o));
+    targets.push_back(transports.back().get());
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (auto i=0; i<n; i++) {
+    if (shared)
+      ::mig::broadcast(msg, targets);
+    else
+      for (auto t : targets)
+        t->send(msg);
+  }
+  for (auto t : targets)
+    t->flush();
+  auto t1 = std::chrono::steady_clock::now();
+
+  auto ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+  std::cout << std::setw(12) << subscribers
+            << std::setw(8) << ((shared) ? "shared" : "copy")
+            << std::setw(14) << std::fixed << std::setprecision(0) << ns / n
+            << std::setw(14) << std::setprecision(1) << ns / n / subscribers
+            << std::setw(12) << ((shared) ? 1 : subscribers) << '\n';
+}
+
+int main(int argc, char *argv[]) {
+
+  int n = (argc > 1) ? atoi(argv[1]) : 20000;
+
+  TestMessage1003 m3;
+  ::mig::string_t s("sample string");
+  ::mig::blob_t b((const uint8_t *)"\x01\x02\x03\x04", 4);
+  m3.param1.assign(s);
+  m3.param2.assign(b);
+  m3.param3.data().param1.set();
+  m3.param3.data().param2 = 100;
+  m3.param5 = 5;
+  m3.to_wire();
+
+  std::cout << "frame " << m3.wire_format()->size() << " B, " << n << " messages\n"
+            << " subscribers    mode        ns/msg       ns/send encodes/msg\n";
+  for (size_t subscribers : { 1, 10, 1000 }) {
+    // fewer messages for many subscribers, the rates are per message
+    auto k = (subscribers > 10) ? n / 100 : n;
+    bench(m3, k, subscribers, false);
+    bench(m3, k, subscribers, true);
+  }
+  return 0;
+}
@@ -0,0 +1,255 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Predicates evaluated on encoded frames
+//
+// - see filter.h
+//
+
+#include "filter.h"
+#include "sampleproto.h"
+
+namespace mig {
+
+static const size_t max_fields = 32;
+static const size_t max_program = 64;
+
+//
+// Predicate
+//
+
+Predicate::Predicate(Op op, int field, Kind kind, size_t size, uint64_t value) :
+  m_node(std::make_shared<node>(node{ op, field, kind, size, value, nullptr, nullptr })) {}
+
+Predicate::Predicate(Op op, const Predicate& a, const Predicate& b) :
+  m_node(std::make_shared<node>(node{ op, -1, Kind::Unsigned, 0, 0, a.m_node, b.m_node })) {}
+
+//
+// FrameFilter
+//
+
+FrameFilter::FrameFilter(const Message& schema, const Predicate& predicate) : m_id(schema.id()) {
+  add_layout(schema);
+  if (!predicate.m_node || compile(*predicate.m_node, schema) != 0 || m_program.size() > max_program)
+    m_valid = false;
+}
+
+int FrameFilter::add_layout(const Group& group) {
+  int index = m_layouts.size();
+  m_layouts.emplace_back();
+  if (!group.params().empty())
+    m_layouts[index].resize(group.params().rbegin()->first + 1);
+  for (auto& p : group.params()) {
+    auto& par = p.second;
+    param e;
+    if (par.is_group()) {
+      auto g = par.layout();
+      if (g) {
+        e.kind = param::Group;
+        e.layout = add_layout(*g);
+      }
+    } else if (par.is_scalar()) {
+      e.kind = param::Fixed;
+      e.size = par.item_size();
+    } else {
+      e.kind = param::Var;
+    }
+    m_layouts[index][p.first] = e;
+  }
+  return index;
+}
+
+int FrameFilter::slot(int id, size_t size, const Message& schema) {
+  if (schema.params().count(id) == 0)
+    return -1;
+  auto& par = schema.params().at(id);
+  if (!par.is_scalar() || par.is_repeated() || par.item_size() != size)
+    return -1;
+  for (size_t i=0; i<m_fields.size(); i++)
+    if (m_fields[i].id == id)
+      return i;
+  if (m_fields.size() >= max_fields)
+    return -1;
+  m_fields.push_back({ id, size });
+  m_max_id = std::max(m_max_id, id);
+  return m_fields.size() - 1;
+}
+
+int FrameFilter::compile(const Predicate::node& n, const Message& schema) {
+
+// Postfix: operands before their operator
+
+  switch (n.op) {
+    case Predicate::Op::And:
+    case Predicate::Op::Or:
+      if (!n.a || !n.b || compile(*n.a, schema) != 0 || compile(*n.b, schema) != 0)
+        return -1;
+      m_program.push_back({ n.op, -1, n.kind, 0 });
+      return 0;
+    case Predicate::Op::Not:
+      if (!n.a || compile(*n.a, schema) != 0)
+        return -1;
+      m_program.push_back({ n.op, -1, n.kind, 0 });
+      return 0;
+    default: {
+      auto s = slot(n.field, n.size, schema);
+      if (s < 0)
+        return -1;
+      m_program.push_back({ n.op, s, n.kind, n.value });
+      return 0;
+    }
+  }
+}
+
+static inline uint64_t get_be(const uint8_t *p, size_t n) {
+  uint64_t v = 0;
+  for (size_t i=0; i<n; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+const uint8_t *FrameFilter::skip(const param& par, const uint8_t *p, const uint8_t *end, bool wide) const {
+  size_t id_size = wide ? 2 : 1;
+  size_t len_size = wide ? 4 : 2;
+  switch (par.kind) {
+    case param::Fixed:
+      p += par.size;
+      break;
+    case param::Var:
+      if (p + len_size > end)
+        return nullptr;
+      p += len_size + get_be(p, len_size);
+      break;
+    case param::Group: {
+      auto& layout = m_layouts[par.layout];
+      for (;;) {
+        if (p + id_size > end)
+          return nullptr;
+        auto id = get_be(p, id_size);
+        p += id_size;
+        if (id == (wide ? 0xFFFFu : 0xFFu))
+          break;
+        if (id >= layout.size() || layout[id].kind == param::Unknown)
+          return nullptr;
+        p = skip(layout[id], p, end, wide);
+        if (!p)
+          return nullptr;
+      }
+      break;
+    }
+    default:
+      return nullptr;
+  }
+  return (p <= end) ? p : nullptr;
+}
+
+bool FrameFilter::match(const uint8_t *frame, size_t n) const {
+  if (!m_valid || !frame)
+    return false;
+  auto size = SampleProto::frame_size(frame, n);
+  if (size == 0 || size > n || get_be(frame, 2) != (uint64_t)m_id)
+    return false;
+
+  bool wide = (frame[2] == 0 && frame[3] == 0);
+  size_t id_size = wide ? 2 : 1;
+  auto p = frame + (wide ? 8 : 4);
+  auto end = frame + size;
+  auto& layout = m_layouts[0];
+  const uint8_t *found[max_fields] = {};
+  size_t nfound = 0;
+
+  if (p + id_size <= end && get_be(p, id_size) == (wide ? 0xFFFDu : 0xFDu))
+    return false; // delta
+
+  // walk the parameters up to the last field
+  while (nfound < m_fields.size()) {
+    if (p + id_size > end)
+      return false;
+    auto id = get_be(p, id_size);
+    p += id_size;
+    if (id == (wide ? 0xFFFFu : 0xFFu) || id > (uint64_t)m_max_id)
+      break;
+    if (id >= layout.size() || layout[id].kind == param::Unknown)
+      return false; // also a delta frame
+    for (size_t i=0; i<m_fields.size(); i++)
+      if (m_fields[i].id == (int)id && !found[i]) {
+        found[i] = p;
+        nfound++;
+      }
+    p = skip(layout[id], p, end, wide);
+    if (!p)
+      return false;
+  }
+
+  bool stack[max_program];
+  size_t top = 0;
+  for (auto& in : m_program) {
+    switch (in.op) {
+      case Predicate::Op::And:
+        top--;
+        stack[top - 1] = stack[top - 1] && stack[top];
+        continue;
+      case Predicate::Op::Or:
+        top--;
+        stack[top - 1] = stack[top - 1] || stack[top];
+        continue;
+      case Predicate::Op::Not:
+        stack[top - 1] = !stack[top - 1];
+        continue;
+      default:
+        break;
+    }
+    auto f = found[in.slot];
+    if (in.op == Predicate::Op::Present || !f) {
+      stack[top++] = (f != nullptr) && in.op == Predicate::Op::Present;
+      continue;
+    }
+    auto bytes = m_fields[in.slot].size;
+    auto v = get_be(f, bytes);
+    int c;
+    if (in.kind == Predicate::Kind::Signed) {
+      auto shift = 64 - 8 * bytes;
+      int64_t a = (int64_t)(v << shift) >> shift; // sign extended
+      int64_t b = (int64_t)in.value;
+      c = (a < b) ? -1 : (a > b);
+    } else {
+      c = (v < in.value) ? -1 : (v > in.value);
+    }
+    bool r;
+    switch (in.op) {
+      case Predicate::Op::Eq: r = (c == 0); break;
+      case Predicate::Op::Ne: r = (c != 0); break;
+      case Predicate::Op::Lt: r = (c < 0); break;
+      case Predicate::Op::Le: r = (c <= 0); break;
+      case Predicate::Op::Gt: r = (c > 0); break;
+      default: r = (c >= 0); break;
+    }
+    stack[top++] = r;
+  }
+  return top == 1 && stack[0];
+}
+
+} // namespace mig
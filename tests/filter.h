@@ -0,0 +1,189 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+//
+// Predicates evaluated on encoded SampleProto frames
+//
+// A predicate compares top level scalar and enum parameters, named by
+// the generated field ids, with constants:
+//
+//   using M = TestMessage1002;
+//   FrameFilter f(M::schema(), M::field_param3() > 100 && M::field_param5() == TestEnum1::VALUE2);
+//   if (f.match(frame, n)) ...
+//
+// The filter compiles the predicate into a postfix program and a table
+// of how to skip each parameter of the schema. match() walks the
+// parameter ids of a frame until it has seen the fields of the program,
+// reads their values in place and runs the program. No message is
+// built. SampleProto writes parameters in the order of their ids, so the
+// walk also stops at the first id beyond the last field.
+//
+// A comparison with an absent field is false. Frames of other messages,
+// delta frames and frames that cannot be walked do not match.
+//
+
+#include "migmsg.h"
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace mig {
+
+//! Expression over fields of a message
+class Predicate {
+
+  public:
+    enum class Op { Eq, Ne, Lt, Le, Gt, Ge, Present, And, Or, Not };
+    enum class Kind { Unsigned, Signed };
+
+    //! a comparison of a field with a value, or a field's presence
+    Predicate(Op op, int field, Kind kind, size_t size, uint64_t value);
+    //! a combination of predicates
+    Predicate(Op op, const Predicate& a, const Predicate& b = Predicate());
+
+    Predicate operator&&(const Predicate& b) const { return Predicate(Op::And, *this, b); }
+    Predicate operator||(const Predicate& b) const { return Predicate(Op::Or, *this, b); }
+    Predicate operator!() const { return Predicate(Op::Not, *this); }
+
+  private:
+    friend class FrameFilter;
+
+    Predicate() {}
+
+    struct node {
+      Op op;
+      int field;
+      Kind kind;
+      size_t size;
+      uint64_t value;
+      std::shared_ptr<const node> a, b;
+    };
+    std::shared_ptr<const node> m_node;
+};
+
+namespace detail {
+
+template <class T>
+struct field_value {
+  typedef typename std::conditional<std::is_enum<T>::value, enum_t, T>::type type;
+  static const Predicate::Kind kind = std::is_signed<type>::value ?
+    Predicate::Kind::Signed : Predicate::Kind::Unsigned;
+
+  static uint64_t bits(T v) {
+    return (kind == Predicate::Kind::Signed) ? (uint64_t)(int64_t)(type)v : (uint64_t)(type)v;
+  }
+  static Predicate compare(Predicate::Op op, field_t<T> f, T v) {
+    return Predicate(op, f.id, kind, sizeof(type), bits(v));
+  }
+};
+
+template <class T>
+struct identity { typedef T type; };
+
+} // namespace detail
+
+template <class T>
+Predicate operator==(field_t<T> f, typename detail::identity<T>::type v) {
+  return detail::field_value<T>::compare(Predicate::Op::Eq, f, v);
+}
+template <class T>
+Predicate operator!=(field_t<T> f, typename detail::identity<T>::type v) {
+  return detail::field_value<T>::compare(Predicate::Op::Ne, f, v);
+}
+template <class T>
+Predicate operator<(field_t<T> f, typename detail::identity<T>::type v) {
+  return detail::field_value<T>::compare(Predicate::Op::Lt, f, v);
+}
+template <class T>
+Predicate operator<=(field_t<T> f, typename detail::identity<T>::type v) {
+  return detail::field_value<T>::compare(Predicate::Op::Le, f, v);
+}
+template <class T>
+Predicate operator>(field_t<T> f, typename detail::identity<T>::type v) {
+  return detail::field_value<T>::compare(Predicate::Op::Gt, f, v);
+}
+template <class T>
+Predicate operator>=(field_t<T> f, typename detail::identity<T>::type v) {
+  return detail::field_value<T>::compare(Predicate::Op::Ge, f, v);
+}
+//! the field is in the message
+template <class T>
+Predicate present(field_t<T> f) {
+  typedef detail::field_value<T> fv;
+  return Predicate(Predicate::Op::Present, f.id, fv::kind, sizeof(typename fv::type), 0);
+}
+
+//! Predicate compiled for frames of one message
+class FrameFilter {
+
+  public:
+    FrameFilter(const Message& schema, const Predicate& predicate);
+
+    //! all fields are top level, not repeated scalars of the schema
+    bool is_valid() const { return this->m_valid; }
+    //! the frame is a message of the schema for which the predicate holds
+    bool match(const uint8_t *frame, size_t n) const;
+
+  private:
+    //! how a parameter is skipped
+    struct param {
+      enum Kind : uint8_t { Unknown, Fixed, Var, Group } kind = Unknown;
+      uint32_t size = 0; //!< of fixed data
+      int layout = -1; //!< of a group
+    };
+    typedef std::vector<param> layout_t; //!< by parameter id
+
+    struct instr {
+      Predicate::Op op;
+      int slot; //!< of a field
+      Predicate::Kind kind;
+      uint64_t value;
+    };
+
+    struct field {
+      int id;
+      size_t size;
+    };
+
+    int add_layout(const Group& group);
+    int compile(const Predicate::node& n, const Message& schema);
+    int slot(int id, size_t size, const Message& schema);
+    //! position after the parameter with data at p, nullptr if it cannot be skipped
+    const uint8_t *skip(const param& par, const uint8_t *p, const uint8_t *end, bool wide) const;
+
+    int m_id;
+    bool m_valid = true;
+    std::vector<layout_t> m_layouts; //!< the message's is the first
+    std::vector<field> m_fields; //!< slots of the fields
+    int m_max_id = 0; //!< of the fields
+    std::vector<instr> m_program;
+};
+
+} // namespace mig
+
+#endif // ifndef _FILTER_H_
@@ -0,0 +1,107 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+//
+// Filtering encoded frames compared with decoding them first
+//
+// Usage: filterbench [frames]
+//
+// Frames of random messages are filtered with a FrameFilter, and by
+// decoding each frame into a message and testing its parameters.
+//
+
+#include "msg_tests.msg.h"
+#include "filter.h"
+#include "sampleproto.h"
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+
+typedef std::function<bool(const ::mig::Message&)> check_t;
+
+static std::vector<std::vector<uint8_t>> frames(int id, size_t n) {
+  ::mig::Random r(1);
+  std::vector<std::vector<uint8_t>> v;
+  for (size_t i=0; i<n; i++) {
+    auto m = r.message(id);
+    m->to_wire();
+    auto w = m->wire_format();
+    w->buf()->reset();
+    auto p = w->buf()->getp(w->size());
+    v.emplace_back(p, p + w->size());
+  }
+  return v;
+}
+
+static void bench(const char *name, const std::vector<std::vector<uint8_t>>& v,
+                  const ::mig::FrameFilter& filter, const check_t& check) {
+  size_t a = 0, b = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (auto& f : v)
+    a += filter.match(f.data(), f.size());
+  auto t1 = std::chrono::steady_clock::now();
+  for (auto& f : v) {
+    ::mig::SampleProto w(f.data(), f.size());
+    auto m = ::mig::Message::instance(w.id());
+    b += (m && m->decode(w) == 0 && check(*m));
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  auto in_place = std::chrono::duration<double, std::nano>(t1 - t0).count() / v.size();
+  auto decoded = std::chrono::duration<double, std::nano>(t2 - t1).count() / v.size();
+  std::cout << std::setw(28) << name
+            << std::setw(10) << std::fixed << std::setprecision(1) << 100.0 * a / v.size()
+            << std::setw(12) << in_place
+            << std::setw(12) << decoded
+            << std::setw(9) << decoded / in_place << 'x'
+            << ((a != b) ? "  results differ" : "") << '\n';
+}
+
+int main(int argc, char *argv[]) {
+
+  size_t n = (argc > 1) ? atol(argv[1]) : 200000;
+
+  std::cout << n << " frames per filter\n"
+            << "                      filter  matched%   frame ns   decode ns  speedup\n";
+
+  using M2 = TestMessage1002;
+  bench("param2 > 100 && param5 == 1", frames(0x1002, n),
+        ::mig::FrameFilter(M2::schema(), M2::field_param2() > 100 && M2::field_param5() == TestEnum1::VALUE2),
+        [](const ::mig::Message& m) {
+          auto& s = static_cast<const M2&>(m);
+          return s.param2.data() > 100 && s.param5.is_set() && s.param5.data() == TestEnum1::VALUE2;
+        });
+
+  using M6 = TestMessage1006;
+  bench("param1 < 0 || param8 > 0", frames(0x1006, n),
+        ::mig::FrameFilter(M6::schema(), M6::field_param1() < 0 || M6::field_param8() > 0),
+        [](const ::mig::Message& m) {
+          auto& s = static_cast<const M6&>(m);
+          return (s.param1.is_set() && s.param1.data() < 0) || (s.param8.is_set() && s.param8.data() > 0);
+        });
+  return 0;
+}
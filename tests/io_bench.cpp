@@ -0,0 +1,138 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+//
+// Receive and decode throughput of the io engine per core
+//
+// Usage: iobench [connections] [messages per connection]
+//
+// Writer threads send frames over socket pairs, the engine runs in the
+// main thread. Messages per second of engine CPU time is the per core
+// figure.
+//
+
+#include "msg_tests.msg.h"
+#include "ioengine.h"
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+
+extern "C" {
+#include <sys/socket.h>
+#include <unistd.h>
+}
+
+static double thread_cpu() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(::mig::IoEngine::Backend backend, const char *name,
+                  const std::vector<uint8_t>& frame, int conns, int count) {
+  ::mig::IoEngine e;
+  if (e.open(backend) != 0) {
+    std::cout << std::setw(8) << name << "  not available\n";
+    return;
+  }
+  std::vector<int> writers;
+  for (auto k=0; k<conns; k++) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0 || e.add(sv[1]) < 0) {
+      std::cerr << "cannot connect\n";
+      return;
+    }
+    writers.push_back(sv[0]);
+  }
+  uint64_t sum = 0;
+  e.on(0x1003, [&](::mig::Message& m, int) { sum += static_cast<TestMessage1003&>(m).param5.data(); });
+
+  // a write carries a batch of frames
+  const int batch = 16;
+  std::vector<uint8_t> bytes;
+  for (auto i=0; i<batch; i++)
+    bytes.insert(bytes.end(), frame.begin(), frame.end());
+
+  const int nthreads = 2;
+  std::vector<std::thread> threads;
+  auto t0 = std::chrono::steady_clock::now();
+  for (auto t=0; t<nthreads; t++)
+    threads.emplace_back([&, t]() {
+      for (auto i=0; i<count; i+=batch)
+        for (auto k=t; k<conns; k+=nthreads)
+          if (write(writers[k], bytes.data(), bytes.size()) != (ssize_t)bytes.size())
+            return;
+    });
+
+  uint64_t total = (uint64_t)conns * ((count + batch - 1) / batch) * batch;
+  auto c0 = thread_cpu();
+  while (e.stats().messages < total)
+    if (e.run_once(1000) <= 0 && e.stats().messages < total)
+      break;
+  auto c1 = thread_cpu();
+  auto t1 = std::chrono::steady_clock::now();
+  for (auto& t : threads)
+    t.join();
+  for (auto fd : writers)
+    close(fd);
+
+  auto& s = e.stats();
+  auto wall = std::chrono::duration<double>(t1 - t0).count();
+  std::cout << std::setw(8) << name
+            << std::setw(12) << std::fixed << std::setprecision(0) << s.messages / wall
+            << std::setw(12) << s.messages / (c1 - c0)
+            << std::setw(10) << std::setprecision(3) << (double)s.calls / s.messages
+            << std::setw(10) << (double)s.reads / s.messages
+            << ((s.messages < total) ? "  incomplete" : "") << '\n';
+}
+
+int main(int argc, char *argv[]) {
+
+  int conns = (argc > 1) ? atoi(argv[1]) : 1000;
+  int count = (argc > 2) ? atoi(argv[2]) : 1000;
+
+  TestMessage1003 m3;
+  ::mig::string_t s("sample string");
+  ::mig::blob_t b((const uint8_t *)"\x01\x02\x03\x04", 4);
+  m3.param1.assign(s);
+  m3.param2.assign(b);
+  m3.param3.data().param1.set();
+  m3.param3.data().param2 = 100;
+  m3.param5 = 5;
+  m3.to_wire();
+  auto w = m3.wire_format();
+  w->buf()->reset();
+  std::vector<uint8_t> frame(w->buf()->getp(w->size()), w->buf()->getp(w->size()) + w->size());
+
+  std::cout << "frame " << frame.size() << " B, " << conns << " connections, "
+            << count << " messages each\n"
+            << " backend      msgs/s  msgs/cpu-s  calls/msg  reads/msg\n";
+  bench(::mig::IoEngine::Backend::Uring, "io_uring", frame, conns, count);
+  bench(::mig::IoEngine::Backend::Epoll, "epoll", frame, conns, count);
+  return 0;
+}
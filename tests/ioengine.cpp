@@ -0,0 +1,529 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Asynchronous receive and decode engine
+//
+// - see ioengine.h
+//
+
+#include "ioengine.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+namespace mig {
+
+//! Reads connections and passes the data to the engine
+class IoBackend {
+
+  public:
+    IoBackend(IoEngine& engine) : m_engine(engine) {}
+    virtual ~IoBackend() {}
+
+    virtual int open() = 0;
+    virtual int add(int conn) = 0;
+    virtual int remove(int conn) = 0;
+    //! wait for and handle reads, -1 on error
+    virtual int poll(int timeout) = 0;
+
+  protected:
+    IoEngine& m_engine;
+};
+
+//
+// io_uring
+//
+
+static inline int uring_setup(unsigned entries, struct io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags,
+                              const void *arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz);
+}
+
+class UringBackend : public IoBackend {
+
+  public:
+    UringBackend(IoEngine& engine) : IoBackend(engine) {}
+    ~UringBackend();
+
+    int open() override;
+    int add(int conn) override { return recv(conn); }
+    int remove(int conn) override;
+    int poll(int timeout) override;
+
+  private:
+    // user_data: | op 8 | connection 32 |
+    enum Op : uint64_t { Recv = 1, Provide = 2, Cancel = 3 };
+    static uint64_t tag(Op op, int conn) { return (op << 32) | (uint32_t)conn; }
+
+    struct io_uring_sqe *sqe();
+    int submit(unsigned wait, int timeout);
+    int recv(int conn);
+    void provide(unsigned bid, unsigned n);
+    void complete(const struct io_uring_cqe& cqe);
+
+    int m_fd = -1;
+    unsigned m_entries = 0;
+    unsigned m_queued = 0; //!< prepared submissions
+    void *m_sq = MAP_FAILED, *m_cq = MAP_FAILED, *m_sqes = MAP_FAILED;
+    size_t m_sq_size = 0, m_cq_size = 0, m_sqes_size = 0;
+    std::atomic<unsigned> *m_sq_head = nullptr, *m_sq_tail = nullptr;
+    std::atomic<unsigned> *m_cq_head = nullptr, *m_cq_tail = nullptr;
+    unsigned m_sq_mask = 0, m_cq_mask = 0;
+    unsigned *m_sq_array = nullptr;
+    struct io_uring_sqe *m_sqe = nullptr;
+    struct io_uring_cqe *m_cqe = nullptr;
+
+    std::vector<uint8_t> m_pool; //!< provided receive buffers
+    std::vector<int> m_starved; //!< connections that found no buffer
+};
+
+UringBackend::~UringBackend() {
+  if (m_sqes != MAP_FAILED)
+    munmap(m_sqes, m_sqes_size);
+  if (m_cq != MAP_FAILED && m_cq != m_sq)
+    munmap(m_cq, m_cq_size);
+  if (m_sq != MAP_FAILED)
+    munmap(m_sq, m_sq_size);
+  if (m_fd >= 0)
+    close(m_fd);
+}
+
+int UringBackend::open() {
+  auto& o = m_engine.options();
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  // every connection can have a completion pending
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = std::max(4096u, o.queue_depth * 2);
+  m_fd = uring_setup(o.queue_depth, &p);
+  if (m_fd < 0)
+    return -1;
+  // waiting with a timeout and no dropped completions
+  auto needed = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+  if ((p.features & needed) != needed)
+    return -1;
+
+  m_entries = p.sq_entries;
+  m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+  m_sq = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              m_fd, IORING_OFF_SQ_RING);
+  if (m_sq == MAP_FAILED)
+    return -1;
+  m_cq = (p.features & IORING_FEAT_SINGLE_MMAP) ? m_sq :
+    mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+         m_fd, IORING_OFF_CQ_RING);
+  if (m_cq == MAP_FAILED)
+    return -1;
+  m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  m_sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                m_fd, IORING_OFF_SQES);
+  if (m_sqes == MAP_FAILED)
+    return -1;
+
+  auto sq = static_cast<uint8_t *>(m_sq);
+  auto cq = static_cast<uint8_t *>(m_cq);
+  m_sq_head = reinterpret_cast<std::atomic<unsigned> *>(sq + p.sq_off.head);
+  m_sq_tail = reinterpret_cast<std::atomic<unsigned> *>(sq + p.sq_off.tail);
+  m_sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+  m_sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+  m_cq_head = reinterpret_cast<std::atomic<unsigned> *>(cq + p.cq_off.head);
+  m_cq_tail = reinterpret_cast<std::atomic<unsigned> *>(cq + p.cq_off.tail);
+  m_cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+  m_cqe = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+  m_sqe = static_cast<struct io_uring_sqe *>(m_sqes);
+
+  m_pool.resize(o.buffers * o.buffer_size);
+  provide(0, o.buffers);
+  return submit(0, 0);
+}
+
+struct io_uring_sqe *UringBackend::sqe() {
+  auto tail = m_sq_tail->load(std::memory_order_relaxed);
+  if (tail - m_sq_head->load(std::memory_order_acquire) >= m_entries) {
+    submit(0, 0); // full, hand them to the kernel
+    if (tail - m_sq_head->load(std::memory_order_acquire) >= m_entries)
+      return nullptr;
+  }
+  auto i = tail & m_sq_mask;
+  auto e = &m_sqe[i];
+  memset(e, 0, sizeof(*e));
+  m_sq_array[i] = i;
+  m_sq_tail->store(tail + 1, std::memory_order_release);
+  m_queued++;
+  return e;
+}
+
+int UringBackend::submit(unsigned wait, int timeout) {
+  struct __kernel_timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = (timeout >= 0) ? (uint64_t)(uintptr_t)&ts : 0;
+  unsigned flags = (wait) ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0;
+
+  for (;;) {
+    m_engine.m_stats.calls++;
+    int r = uring_enter(m_fd, m_queued, wait, flags, (wait) ? &arg : nullptr, sizeof(arg));
+    if (r >= 0) {
+      m_queued -= std::min((unsigned)r, m_queued);
+      return 0;
+    }
+    if (errno == ETIME || (errno == EINTR && wait))
+      return 0;
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      return -1;
+  }
+}
+
+void UringBackend::provide(unsigned bid, unsigned n) {
+  auto size = m_engine.options().buffer_size;
+  auto e = sqe();
+  if (!e)
+    return;
+  e->opcode = IORING_OP_PROVIDE_BUFFERS;
+  e->fd = n;
+  e->addr = (uint64_t)(uintptr_t)(m_pool.data() + bid * size);
+  e->len = size;
+  e->off = bid;
+  e->buf_group = 0;
+  e->user_data = tag(Provide, 0);
+}
+
+int UringBackend::recv(int conn) {
+  auto e = sqe();
+  if (!e)
+    return -1;
+  e->opcode = IORING_OP_RECV;
+  e->fd = m_engine.m_conns[conn].fd;
+  e->len = m_engine.options().buffer_size;
+  e->flags = IOSQE_BUFFER_SELECT;
+  e->buf_group = 0;
+  e->user_data = tag(Recv, conn);
+  return 0;
+}
+
+int UringBackend::remove(int conn) {
+  auto e = sqe();
+  if (!e)
+    return -1;
+  e->opcode = IORING_OP_ASYNC_CANCEL;
+  e->addr = tag(Recv, conn);
+  e->user_data = tag(Cancel, conn);
+  return 0;
+}
+
+void UringBackend::complete(const struct io_uring_cqe& cqe) {
+  auto op = cqe.user_data >> 32;
+  int conn = (int)(uint32_t)cqe.user_data;
+  if (op != Recv)
+    return;
+
+  auto& e = m_engine;
+  auto& c = e.m_conns[conn];
+  e.m_stats.reads++;
+  if (cqe.res == -ENOBUFS && !c.closing) {
+    m_starved.push_back(conn); // again when buffers are back
+    return;
+  }
+  if (cqe.res <= 0 || c.closing) {
+    if (cqe.flags & IORING_CQE_F_BUFFER)
+      provide(cqe.flags >> IORING_CQE_BUFFER_SHIFT, 1);
+    e.closed(conn);
+    return;
+  }
+
+  unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+  auto p = m_pool.data() + bid * e.options().buffer_size;
+  int r = e.received(conn, p, cqe.res);
+  provide(bid, 1);
+  if (r == 0)
+    recv(conn);
+  else
+    e.closed(conn);
+}
+
+int UringBackend::poll(int timeout) {
+  if (submit(1, timeout) != 0)
+    return -1;
+  for (;;) {
+    auto head = m_cq_head->load(std::memory_order_relaxed);
+    auto tail = m_cq_tail->load(std::memory_order_acquire);
+    if (head == tail)
+      break;
+    for (; head != tail; head++)
+      complete(m_cqe[head & m_cq_mask]);
+    m_cq_head->store(head, std::memory_order_release);
+  }
+  // returned buffers are provided before the starved receives
+  auto starved = std::move(m_starved);
+  m_starved.clear();
+  for (auto conn : starved)
+    if (m_engine.m_conns[conn].closing)
+      m_engine.closed(conn);
+    else
+      recv(conn);
+  return 0;
+}
+
+//
+// epoll
+//
+
+class EpollBackend : public IoBackend {
+
+  public:
+    EpollBackend(IoEngine& engine) : IoBackend(engine) {}
+    ~EpollBackend() { if (m_fd >= 0) close(m_fd); }
+
+    int open() override;
+    int add(int conn) override;
+    int remove(int conn) override;
+    int poll(int timeout) override;
+
+  private:
+    int m_fd = -1;
+    std::vector<uint8_t> m_buf; //!< connections are read one at a time
+    std::vector<struct epoll_event> m_events;
+};
+
+int EpollBackend::open() {
+  m_fd = epoll_create1(EPOLL_CLOEXEC);
+  m_buf.resize(m_engine.options().buffer_size);
+  m_events.resize(256);
+  return (m_fd >= 0) ? 0 : -1;
+}
+
+int EpollBackend::add(int conn) {
+  int fd = m_engine.m_conns[conn].fd;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = conn;
+  return epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int EpollBackend::remove(int conn) {
+  epoll_ctl(m_fd, EPOLL_CTL_DEL, m_engine.m_conns[conn].fd, nullptr);
+  m_engine.closed(conn);
+  return 0;
+}
+
+int EpollBackend::poll(int timeout) {
+  auto& e = m_engine;
+  e.m_stats.calls++;
+  int n = epoll_wait(m_fd, m_events.data(), m_events.size(), timeout);
+  if (n < 0)
+    return (errno == EINTR) ? 0 : -1;
+  for (auto i=0; i<n; i++) {
+    int conn = m_events[i].data.u32;
+    int fd = e.m_conns[conn].fd;
+    e.m_stats.calls++;
+    auto r = read(fd, m_buf.data(), m_buf.size());
+    if (r < 0 && (errno == EAGAIN || errno == EINTR))
+      continue;
+    e.m_stats.reads++;
+    if (r <= 0 || e.received(conn, m_buf.data(), r) != 0) {
+      epoll_ctl(m_fd, EPOLL_CTL_DEL, fd, nullptr);
+      e.closed(conn);
+    }
+  }
+  return 0;
+}
+
+//
+// IoEngine
+//
+
+//! frame the decoder is built on before it is attached to received ones
+static const uint8_t empty_frame[] = { 0, 0, 0, 5, SampleProto::end_mark };
+
+IoEngine::IoEngine(const io_options& options) :
+  m_options(options), m_decoder(empty_frame, sizeof(empty_frame)) {}
+
+IoEngine::~IoEngine() {
+  m_backend = nullptr; // no more completions refer to connections
+  for (auto& c : m_conns)
+    if (c.fd >= 0)
+      close(c.fd);
+}
+
+int IoEngine::open(Backend type) {
+  if (type != Backend::Epoll) {
+    m_backend = std::make_unique<UringBackend>(*this);
+    m_type = Backend::Uring;
+    if (m_backend->open() == 0)
+      return 0;
+    if (type == Backend::Uring) {
+      m_backend = nullptr;
+      return -1;
+    }
+  }
+  m_backend = std::make_unique<EpollBackend>(*this);
+  m_type = Backend::Epoll;
+  if (m_backend->open() == 0)
+    return 0;
+  m_backend = nullptr;
+  return -1;
+}
+
+int IoEngine::add(int fd) {
+  if (!m_backend || fd < 0)
+    return -1;
+  int conn;
+  if (!m_free.empty()) {
+    conn = m_free.back();
+    m_free.pop_back();
+  } else {
+    conn = m_conns.size();
+    m_conns.emplace_back();
+  }
+  auto& c = m_conns[conn];
+  c.fd = fd;
+  c.closing = false;
+  c.carry.clear();
+  if (m_backend->add(conn) != 0) {
+    c.fd = -1;
+    m_free.push_back(conn);
+    return -1;
+  }
+  m_count++;
+  return conn;
+}
+
+int IoEngine::remove(int conn) {
+  if (!m_backend || conn < 0 || (size_t)conn >= m_conns.size() ||
+      m_conns[conn].fd < 0 || m_conns[conn].closing)
+    return -1;
+  m_conns[conn].closing = true;
+  return m_backend->remove(conn);
+}
+
+void IoEngine::on(int id, const handler_t& func) {
+  auto& h = m_handlers[id];
+  h.func = func;
+  if (!h.msg)
+    h.msg = Message::instance(id);
+}
+
+int IoEngine::run_once(int timeout) {
+  if (!m_backend)
+    return -1;
+  m_handled = 0;
+  if (m_backend->poll(timeout) != 0)
+    return -1;
+  return m_handled;
+}
+
+void IoEngine::closed(int conn) {
+  auto& c = m_conns[conn];
+  if (c.fd < 0)
+    return;
+  close(c.fd);
+  c.fd = -1;
+  c.carry.clear();
+  m_free.push_back(conn);
+  m_count--;
+  if (m_on_close)
+    m_on_close(conn);
+}
+
+int IoEngine::received(int conn, const uint8_t *p, size_t n) {
+
+// A frame started by an earlier read is completed in the carry buffer,
+// the frames after it are decoded where they are
+
+  m_stats.bytes += n;
+  auto& carry = m_conns[conn].carry;
+  while (carry.pending() > 0 && n > 0) {
+    auto k = std::min(carry.missing(), n);
+    if (k == 0)
+      return -1; // not a frame
+    carry.feed(p, k);
+    m_stats.copied += k;
+    p += k;
+    n -= k;
+    size_t size;
+    while (auto f = carry.next(size))
+      dispatch(conn, f, size);
+    if (carry.error())
+      return -1;
+  }
+  if (carry.pending() == 0)
+    carry.clear();
+
+  while (n > 0) {
+    auto size = SampleProto::frame_size(p, n);
+    if (size == 0 && n >= 8)
+      return -1;
+    if (size == 0 || size > n) {
+      carry.feed(p, n);
+      m_stats.copied += n;
+      break;
+    }
+    dispatch(conn, p, size);
+    p += size;
+    n -= size;
+  }
+  return 0;
+}
+
+int IoEngine::dispatch(int conn, const uint8_t *p, size_t n) {
+  auto it = m_handlers.find((p[0] << 8) | p[1]);
+  if (it == m_handlers.end() || !it->second.msg) {
+    m_stats.skipped++;
+    return -1;
+  }
+  auto& h = it->second;
+  m_decoder.attach(p, n);
+  if (h.msg->decode(m_decoder) != 0) {
+    m_stats.skipped++;
+    return -1;
+  }
+  m_stats.messages++;
+  m_handled++;
+  h.func(*h.msg, conn);
+  return 0;
+}
+
+} // namespace mig
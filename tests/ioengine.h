@@ -0,0 +1,145 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _IOENGINE_H_
+#define _IOENGINE_H_
+
+//
+// Asynchronous receive and decode engine
+//
+// The engine reads SampleProto frames from many stream connections and
+// calls a handler for each message by id. With io_uring a receive is
+// kept submitted on every connection and the kernel picks a buffer from
+// a pool of provided buffers when data arrives, a single system call
+// submits and reaps any number of them. The epoll backend reads ready
+// connections into a pool buffer.
+//
+// Frames are decoded in place in the receive buffer into one message
+// object per id, which is reused: a handler gets a message that is
+// valid until it returns. Only the parts of frames that cross buffer
+// boundaries are copied. Ids without a handler are not decoded.
+//
+
+#include "migmsg.h"
+#include "sampleproto.h"
+#include "transport.h"
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace mig {
+
+class IoBackend;
+
+struct io_options {
+  unsigned queue_depth = 256; //!< io_uring submission queue entries
+  size_t buffers = 256; //!< receive buffers in the pool
+  size_t buffer_size = 0x4000;
+};
+
+struct io_stats {
+  uint64_t messages = 0; //!< handled
+  uint64_t skipped = 0; //!< frames without a handler or not decodable
+  uint64_t bytes = 0;
+  uint64_t reads = 0; //!< completed reads
+  uint64_t calls = 0; //!< system calls to wait and submit
+  uint64_t copied = 0; //!< bytes of frames that crossed buffers
+};
+
+//! Receive and decode engine for stream connections
+class IoEngine {
+
+  public:
+    enum class Backend { Auto, Uring, Epoll };
+
+    typedef std::function<void(Message&, int)> handler_t; //!< message, connection
+    typedef std::function<void(int)> close_handler_t; //!< connection
+
+    IoEngine(const io_options& options = io_options());
+    ~IoEngine();
+    IoEngine(const IoEngine&) = delete;
+    IoEngine& operator=(const IoEngine&) = delete;
+
+    //! set up a backend, Auto prefers io_uring
+    int open(Backend backend = Backend::Auto);
+    Backend backend() const { return this->m_type; }
+
+    //! start reading a connection, the engine owns fd.
+    //! returns the connection number or -1
+    int add(int fd);
+    //! stop reading a connection, it is closed when pending reads finish
+    int remove(int conn);
+    size_t connections() const { return this->m_count; }
+
+    //! handler of messages of an id
+    void on(int id, const handler_t& handler);
+    //! handler of connections closed by the peer, on error or by remove()
+    void on_close(const close_handler_t& handler) { m_on_close = handler; }
+
+    //! wait up to timeout ms (forever if < 0) and handle what was read,
+    //! returns the number of messages handled or -1
+    int run_once(int timeout = -1);
+
+    const io_stats& stats() const { return this->m_stats; }
+    const io_options& options() const { return this->m_options; }
+
+  private:
+    friend class UringBackend;
+    friend class EpollBackend;
+
+    struct connection {
+      int fd = -1;
+      bool closing = false;
+      FrameSplitter carry{0}; //!< start of a frame from a previous read
+    };
+
+    struct handler {
+      handler_t func;
+      message_ptr_t msg; //!< decoded into for every frame
+    };
+
+    //! data read from a connection
+    int received(int conn, const uint8_t *p, size_t n);
+    int dispatch(int conn, const uint8_t *p, size_t n);
+    //! connection ended
+    void closed(int conn);
+
+    io_options m_options;
+    Backend m_type = Backend::Auto;
+    std::unique_ptr<IoBackend> m_backend;
+    std::vector<connection> m_conns;
+    std::vector<int> m_free; //!< unused connection numbers
+    size_t m_count = 0;
+    std::unordered_map<int, handler> m_handlers;
+    close_handler_t m_on_close;
+    SampleProto m_decoder; //!< reattached to each frame
+    io_stats m_stats;
+    int m_handled = 0;
+};
+
+} // namespace mig
+
+#endif // ifndef _IOENGINE_H_
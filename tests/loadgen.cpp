@@ -0,0 +1,200 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+//
+// Synthetic load generator
+//
+// Usage: mig-loadgen [options]
+//
+//   -n <count>    number of messages (default 1000000)
+//   -s <seed>     generator seed (default 1)
+//   -i <id>       message id to generate, may be repeated (default all)
+//   -l <log>      append to a message log
+//   -u <path>     send to a Unix stream socket
+//   -o <path>     write to a pipe or file, - for stdout
+//   -p <prob>     probability of optional parameters (default 0.5)
+//   -r <min:max>  repeat counts
+//   -t <min:max>  string lengths
+//   -b <min:max>  blob lengths, log-uniform
+//
+// Without an output the messages are only generated and encoded. The
+// schema header has to be generated with mig -r (make mig-loadgen
+// SCHEMA=...). The same seed and options give the same stream.
+//
+
+#ifndef MIG_SCHEMA
+#define MIG_SCHEMA "msg_tests.msg.h"
+#endif
+
+#include MIG_SCHEMA
+#include "msglog.h"
+#include "sampleproto.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+static bool parse_range(const char *s, ::mig::size_dist& d) {
+  char *end;
+  d.min = strtoul(s, &end, 0);
+  d.max = (*end == ':') ? strtoul(end + 1, &end, 0) : d.min;
+  return *end == '\0' && d.min <= d.max;
+}
+
+static int connect_socket(const char *path) {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int write_frame(int fd, const ::mig::WireFormat& w) {
+  w.buf()->reset();
+  auto p = w.buf()->getp(w.size());
+  for (size_t done = 0; done < w.size(); ) {
+    auto n = write(fd, p + done, w.size() - done);
+    if (n <= 0)
+      return -1;
+    done += n;
+  }
+  return 0;
+}
+
+static void usage() {
+  std::cerr << "usage: mig-loadgen [-n count] [-s seed] [-i id]... [-l log | -u socket | -o path]\n"
+            << "                   [-p prob] [-r min:max] [-t min:max] [-b min:max]\n";
+}
+
+int main(int argc, char *argv[]) {
+
+  long count = 1000000;
+  ::mig::Random r;
+  std::vector<int> ids;
+  const char *log_path = nullptr, *socket_path = nullptr, *path = nullptr;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:s:i:l:u:o:p:r:t:b:")) != -1) {
+    bool ok = true;
+    switch (c) {
+      case 'n': count = atol(optarg); break;
+      case 's': r.seed(strtoull(optarg, nullptr, 0)); break;
+      case 'i': ids.push_back(strtol(optarg, nullptr, 0)); break;
+      case 'l': log_path = optarg; break;
+      case 'u': socket_path = optarg; break;
+      case 'o': path = optarg; break;
+      case 'p': r.optional = atof(optarg); break;
+      case 'r': ok = parse_range(optarg, r.repeats); break;
+      case 't': ok = parse_range(optarg, r.string_sizes); break;
+      case 'b': ok = parse_range(optarg, r.blob_sizes); break;
+      default: ok = false; break;
+    }
+    if (!ok) {
+      usage();
+      return 2;
+    }
+  }
+  if (optind != argc || count < 0 || (!!log_path + !!socket_path + !!path) > 1) {
+    usage();
+    return 2;
+  }
+
+  if (ids.empty())
+    for (auto& it : ::mig::Random::randomizers)
+      ids.push_back(it.first);
+  for (auto id : ids)
+    if (::mig::Random::randomizers.count(id) == 0) {
+      std::cerr << "unknown message id 0x" << std::hex << id << '\n';
+      return 2;
+    }
+  if (ids.empty()) {
+    std::cerr << "no message randomizers, generate the messages with -r\n";
+    return 2;
+  }
+
+  ::mig::LogWriter log(0x100000);
+  int fd = -1;
+  if (log_path && log.open(log_path) != 0) {
+    std::cerr << log_path << ": cannot open log\n";
+    return 1;
+  }
+  if (socket_path && (fd = connect_socket(socket_path)) < 0) {
+    std::cerr << socket_path << ": cannot connect\n";
+    return 1;
+  }
+  if (path && (fd = (strcmp(path, "-") == 0) ? dup(1) : open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+    std::cerr << path << ": cannot open\n";
+    return 1;
+  }
+
+  size_t bytes = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (long i=0; i<count; i++) {
+    auto m = r.message(ids[r.below(ids.size())]);
+    int ret = 0;
+    if (log_path)
+      ret = log.append(*m);
+    else {
+      m->to_wire();
+      if (fd >= 0)
+        ret = write_frame(fd, *m->wire_format());
+    }
+    if (ret != 0) {
+      std::cerr << "write failed after " << i << " messages\n";
+      return 1;
+    }
+    bytes += m->wire_format()->size();
+  }
+  if (log_path && log.close() != 0) {
+    std::cerr << log_path << ": write failed\n";
+    return 1;
+  }
+  if (fd >= 0)
+    close(fd);
+  auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  auto& os = (path && strcmp(path, "-") == 0) ? std::cerr : std::cout;
+  os << std::fixed << std::setprecision(0);
+  os << count << " messages, " << bytes << " bytes in "
+     << std::setprecision(3) << secs << " s\n" << std::setprecision(0);
+  if (secs > 0)
+    os << count / secs << " msg/s, " << bytes / secs << " B/s\n";
+  return 0;
+}
@@ -25,6 +25,10 @@
 
 #include "gtest/gtest.h"
 #include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
 
 extern "C" {
 #include "mig.c"
@@ -177,6 +181,41 @@ TEST_F(HashTableTests, IdTableTest)
 }
 
 
+//
+// SCHEMA ERRORS
+//
+
+// run mig on a schema with n parameters in a message or group, returns its exit status
+static int run_mig(const char *kind, int n, const std::string& out)
+{
+  auto in = "/tmp/mig_tests_" + std::to_string(getpid()) + ".msg";
+  std::ofstream f(in);
+  f << "type uint8 = uint8_t;\n" << kind << " Many" << ((kind[0] == 'm') ? " = 1" : "") << " {\n";
+  for (int i=0; i<n; i++)
+    f << "  uint8 p" << i << " = " << i+1 << ";\n";
+  f << "}\n";
+  f.close();
+  auto status = std::system(("../mig -o " + out + " " + in + " 2>/dev/null").c_str());
+  unlink(in.c_str());
+  return (WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+}
+
+TEST(SchemaTests, TooManyParameters)
+{
+  auto out = "/tmp/mig_tests_" + std::to_string(getpid()) + ".h";
+  for (auto kind : { "message", "group" }) {
+    unlink(out.c_str());
+    EXPECT_EQ(run_mig(kind, MIG_MAX_PARAMETERS, out), 0) << kind;
+    EXPECT_EQ(access(out.c_str(), F_OK), 0) << kind;
+
+    unlink(out.c_str());
+    EXPECT_NE(run_mig(kind, MIG_MAX_PARAMETERS + 2, out), 0) << kind;
+    EXPECT_NE(access(out.c_str(), F_OK), 0) << kind; // nothing generated
+  }
+  unlink(out.c_str());
+}
+
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,69 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+//
+// Message log tool
+//
+// Usage: miglog <log>       list the records of a log
+//        miglog -r <log>    rebuild the index after a crash
+//
+
+#include "msglog.h"
+#include <cstring>
+#include <iostream>
+
+// records are listed, not decoded
+const std::map<int, mig::MessageCreatorFunc> mig::Message::creators;
+
+int main(int argc, char *argv[]) {
+
+  if (argc == 3 && strcmp(argv[1], "-r") == 0) {
+    auto n = ::mig::rebuild_index(argv[2]);
+    if (n < 0) {
+      std::cerr << argv[2] << ": not a message log\n";
+      return 1;
+    }
+    std::cout << n << " records\n";
+    return 0;
+  }
+
+  if (argc != 2) {
+    std::cerr << "usage: miglog [-r] <log>\n";
+    return 2;
+  }
+
+  ::mig::LogReader log;
+  if (log.open(argv[1]) != 0) {
+    std::cerr << argv[1] << ": cannot open log or index\n";
+    return 1;
+  }
+  std::cout << "seq timestamp id offset size\n";
+  for (size_t i=0; i<log.size(); i++) {
+    auto& e = log.entry(i);
+    std::cout << e.seq << ' ' << e.timestamp << " 0x" << std::hex << e.id << std::dec
+              << ' ' << e.offset << ' ' << e.size << '\n';
+  }
+  return 0;
+}
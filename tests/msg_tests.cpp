@@ -25,9 +25,28 @@
 
 #include "gtest/gtest.h"
 #include <cstdlib>
+#include <thread>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 // Generated message definitions
 #include "msg_tests.msg.h"
+#include "sampleproto.h"
+#include "compactproto.h"
+#include "pbproto.h"
+#include "alignedproto.h"
+#include "msglog.h"
+#include "shmring.h"
+#include "transport.h"
+#include "ioengine.h"
+#include "pipeline.h"
+#include "migqueue.h"
+#include "conflate.h"
+#include "filter.h"
+#include "columnar.h"
 
 // 
 // Generated code tests
@@ -217,3 +236,2718 @@ TEST_F(MessageTests, Message1003_blob)
   a2[2] = 4;
   EXPECT_EQ(m3.param2.data().equals(b2), false);
 }
+
+TEST_F(MessageTests, PresenceBits)
+{
+  // presence bits are assigned in parameter id order
+  EXPECT_EQ(TestMessage1002::required_mask(), 0x7u);
+  EXPECT_EQ(m2.required(), TestMessage1002::required_mask());
+  EXPECT_EQ(m2.presence(), 0u);
+  EXPECT_EQ(m2.param1.bit(), 0);
+  EXPECT_EQ(m2.param4.bit(), 3);
+  EXPECT_EQ(m2.param6.bit(), 5);
+  EXPECT_EQ(&m2.param(4), &m2.param5);
+
+  m2.param5 = TestEnum1::VALUE2; // optional
+  EXPECT_EQ(m2.presence(), 0x10u);
+  EXPECT_EQ(m2.is_valid(), false);
+  m2.param1.set();
+  m2.param2 = 1;
+  m2.param3 = 2;
+  EXPECT_EQ(m2.presence(), 0x17u);
+  EXPECT_EQ(m2.is_valid(), true);
+
+  // parameters with ids out of source order
+  EXPECT_EQ(m3.param1.bit(), 0); // id 2
+  EXPECT_EQ(m3.param4.bit(), 1); // id 3
+  EXPECT_EQ(m3.param2.bit(), 2); // id 4
+  EXPECT_EQ(m3.param5.bit(), 3); // id 5
+  EXPECT_EQ(m3.param3.bit(), 4); // id 6
+  EXPECT_EQ(TestMessage1003::required_mask(), 0x1du);
+}
+
+TEST_F(MessageTests, NestedGroupValidity)
+{
+  // nested group validity is reflected in the group parameter's presence bit
+  EXPECT_EQ(m3.param3.is_set(), false);
+  EXPECT_EQ(m3.presence() & (1u << m3.param3.bit()), 0u);
+
+  m3.param3.data().param2 = 42;
+  EXPECT_EQ(m3.param3.is_set(), false);
+  EXPECT_EQ(m3.param3.is_valid(), false);
+  m3.param3.data().param1.set();
+  EXPECT_EQ(m3.param3.data().is_valid(), true);
+  EXPECT_EQ(m3.param3.is_set(), true);
+  EXPECT_NE(m3.presence() & (1u << m3.param3.bit()), 0u);
+
+  EXPECT_EQ(m3.is_valid(), false);
+  uint8_t a[] = { 1, 2, 3 };
+  ::mig::blob_t b(a, 3);
+  m3.param2.assign(b);
+  ::mig::string_t s("abc");
+  m3.param1.assign(s);
+  m3.param5 = 5;
+  EXPECT_EQ(m3.is_valid(), true);
+}
+
+static std::vector<uint8_t> wire_bytes(const ::mig::WireFormat& w)
+{
+  auto buf = w.buf();
+  buf->reset();
+  auto p = buf->getp(buf->size());
+  return std::vector<uint8_t>(p, p + buf->size());
+}
+
+static std::vector<uint8_t> wire_bytes(const ::mig::Message& msg)
+{
+  return wire_bytes(*msg.wire_format());
+}
+
+TEST_F(MessageTests, CachedEncoding)
+{
+  m2.param1.set();
+  m2.param2 = 1;
+  m2.param3 = 2;
+  m2.param5 = TestEnum1::VALUE1;
+  EXPECT_EQ(m2.is_modified(), true);
+
+  m2.to_wire();
+  EXPECT_EQ(m2.is_modified(), false);
+  auto w = m2.wire_format();
+  auto bytes = wire_bytes(m2);
+
+  // unmodified message reuses the previous encoding
+  m2.to_wire();
+  EXPECT_EQ(m2.wire_format(), w);
+  EXPECT_EQ(wire_bytes(m2), bytes);
+
+  // fixed size parameter change is patched in place
+  m2.param3 = -2;
+  m2.param5 = TestEnum1::VALUE2;
+  EXPECT_EQ(m2.modified(), 0x14u);
+  m2.to_wire();
+  EXPECT_EQ(m2.wire_format(), w);
+  EXPECT_NE(wire_bytes(m2), bytes);
+
+  TestMessage1002 ref;
+  ref.param1.set();
+  ref.param2 = 1;
+  ref.param3 = -2;
+  ref.param5 = TestEnum1::VALUE2;
+  ref.to_wire();
+  EXPECT_EQ(wire_bytes(m2), wire_bytes(ref));
+
+  // new parameter changes the layout
+  m2.param4 = 77;
+  m2.to_wire();
+  EXPECT_NE(m2.wire_format(), w);
+  ref.param4 = 77;
+  ref.to_wire();
+  EXPECT_EQ(wire_bytes(m2), wire_bytes(ref));
+}
+
+TEST_F(MessageTests, CachedEncodingNestedGroup)
+{
+  uint8_t a[] = { 1, 2, 3 };
+  ::mig::blob_t b(a, 3);
+  ::mig::string_t s("abc");
+  m3.param1.assign(s);
+  m3.param2.assign(b);
+  m3.param3.data().param1.set();
+  m3.param3.data().param2 = 1;
+  m3.param5 = 5;
+  m3.to_wire();
+  auto w = m3.wire_format();
+
+  // nested fixed size parameter is patched in place
+  m3.param3.data().param2 = 0x01020304;
+  EXPECT_EQ(m3.is_modified(), true);
+  m3.to_wire();
+  EXPECT_EQ(m3.wire_format(), w);
+  EXPECT_EQ(m3.param3.data().is_modified(), false);
+
+  TestMessage1003 ref;
+  ref.param1.assign(s);
+  ref.param2.assign(b);
+  ref.param3.data().param1.set();
+  ref.param3.data().param2 = 0x01020304;
+  ref.param5 = 5;
+  ref.to_wire();
+  EXPECT_EQ(wire_bytes(m3), wire_bytes(ref));
+
+  // variable length parameter is re-serialized
+  ::mig::string_t s2("abcdef");
+  m3.param1.assign(s2);
+  m3.to_wire();
+  EXPECT_NE(m3.wire_format(), w);
+}
+
+static ::mig::wire_format_ptr_t wire_copy(const ::mig::WireFormat& w)
+{
+  auto bytes = wire_bytes(w);
+  auto p = std::make_unique<uint8_t []>(bytes.size());
+  memcpy(p.get(), bytes.data(), bytes.size());
+  return ::mig::WireFormat::factory(p, bytes.size());
+}
+
+static ::mig::wire_format_ptr_t wire_copy(const ::mig::Message& msg)
+{
+  return wire_copy(*msg.wire_format());
+}
+
+TEST_F(MessageTests, FrameUpdate)
+{
+  m2.param1.set();
+  m2.param2 = 1;
+  m2.param3 = 2;
+  m2.param4 = 3;
+  m2.param5 = TestEnum1::VALUE1;
+  m2.to_wire();
+
+  auto w = wire_copy(m2);
+  EXPECT_EQ(TestMessage1002::update_param3(*w, -1234), 0);
+  EXPECT_EQ(TestMessage1002::update_param4(*w, 0x12345678), 0);
+  EXPECT_EQ(TestMessage1002::update_param5(*w, TestEnum1::VALUE2), 0);
+  EXPECT_EQ(TestMessage1002::update_param3(*w, -4321), 0); // cached offset
+  EXPECT_EQ(TestMessage1002::update_param6(*w, true), -1); // not in frame
+  EXPECT_EQ(TestMessage1003::update_param5(*w, 1), -1); // other message
+
+  auto m = ::mig::Message::factory(w);
+  ASSERT_NE(m.get(), nullptr);
+  auto& m4 = static_cast<TestMessage1002&>(*m);
+  EXPECT_EQ(m4.param2.data(), 1);
+  EXPECT_EQ(m4.param3.data(), -4321);
+  EXPECT_EQ(m4.param4.data(), 0x12345678u);
+  EXPECT_EQ(m4.param5.data(), TestEnum1::VALUE2);
+  EXPECT_EQ(m4.param6.is_set(), false);
+}
+
+TEST_F(MessageTests, FrameUpdateAfterVarParameters)
+{
+  uint8_t a[] = { 1, 2, 3 };
+  ::mig::blob_t b(a, 3);
+  ::mig::string_t s("abc");
+  m3.param1.assign(s);
+  m3.param2.assign(b);
+  m3.param3.data().param1.set();
+  m3.param3.data().param2 = 1;
+  m3.param5 = 5;
+  m3.to_wire();
+
+  auto w = wire_copy(m3);
+  EXPECT_EQ(TestMessage1003::update_param5(*w, 99), 0);
+
+  auto m = ::mig::Message::factory(w);
+  ASSERT_NE(m.get(), nullptr);
+  auto& m4 = static_cast<TestMessage1003&>(*m);
+  EXPECT_EQ(m4.param5.data(), 99);
+  EXPECT_EQ(m4.param3.data().param2.data(), 1u);
+}
+
+TEST(FrameUpdateTests, AfterGroupArray)
+{
+  using M = TestMessage1006;
+  M m;
+  m.param5 = TestEnum1::VALUE1;
+  ::mig::string_t s("abc");
+  auto g = new TestGroup2;
+  g->param1 = 1;
+  g->param2.assign(s);
+  m.param7.append(g);
+  g = new TestGroup2;
+  g->param1 = 2;
+  m.param7.append(g);
+  m.param8 = 5;
+  m.to_wire();
+
+  // skipped with the schema, whose group array is empty
+  auto w = wire_copy(m);
+  EXPECT_GE(w->locate(M::schema(), 8), 0);
+  EXPECT_EQ(M::update_param8(*w, -7), 0);
+  int64_t v = 0;
+  EXPECT_EQ(w->peek(M::schema(), 8, v), 0);
+  EXPECT_EQ(v, -7);
+
+  auto d = ::mig::Message::factory(w);
+  ASSERT_NE(d.get(), nullptr);
+  auto& m4 = static_cast<M&>(*d);
+  EXPECT_EQ(m4.param8.data(), -7);
+  EXPECT_EQ(m4.param7.nrepeats(), 2);
+}
+
+TEST_F(MessageTests, PassThroughEncoding)
+{
+  m2.param1.set();
+  m2.param2 = 1;
+  m2.param3 = 2;
+  m2.param6 = true;
+  m2.to_wire();
+  auto bytes = wire_bytes(m2);
+
+  auto w = wire_copy(m2);
+  auto frame = w.get();
+  auto m = ::mig::Message::factory(w);
+  ASSERT_NE(m.get(), nullptr);
+  EXPECT_EQ(m->is_modified(), false);
+
+  // untouched message is forwarded as the original frame
+  m->to_wire();
+  EXPECT_EQ(m->wire_format(), frame);
+  EXPECT_EQ(wire_bytes(*m), bytes);
+
+  // fixed size change is patched into the original frame
+  auto& m4 = static_cast<TestMessage1002&>(*m);
+  m4.param3 = 1000;
+  m->to_wire();
+  EXPECT_EQ(m->wire_format(), frame);
+  m2.param3 = 1000;
+  m2.to_wire();
+  EXPECT_EQ(wire_bytes(*m), wire_bytes(m2));
+}
+
+TEST_F(MessageTests, SplicedEncoding)
+{
+  uint8_t a[] = { 1, 2, 3 };
+  ::mig::blob_t b(a, 3);
+  ::mig::string_t s("abc");
+  m3.param1.assign(s);
+  m3.param2.assign(b);
+  m3.param3.data().param1.set();
+  m3.param3.data().param2 = 1;
+  m3.param5 = 5;
+  m3.to_wire();
+
+  auto w = wire_copy(m3);
+  auto frame = w.get();
+  auto m = ::mig::Message::factory(w);
+  ASSERT_NE(m.get(), nullptr);
+  auto& m4 = static_cast<TestMessage1003&>(*m);
+
+  // layout changes, unmodified parameters are copied from the source frame
+  ::mig::string_t s2("longer string");
+  m4.param1.assign(s2);
+  m4.param3.data().param2 = 7;
+  m4.param4.set();
+  m->to_wire();
+  EXPECT_NE(m->wire_format(), frame);
+  EXPECT_EQ(m4.param2.data().equals(b), true); // still refers to source frame
+
+  TestMessage1003 ref;
+  ::mig::string_t s3("longer string");
+  ref.param1.assign(s3);
+  ref.param2.assign(b);
+  ref.param3.data().param1.set();
+  ref.param3.data().param2 = 7;
+  ref.param4.set();
+  ref.param5 = 5;
+  ref.to_wire();
+  EXPECT_EQ(wire_bytes(*m), wire_bytes(ref));
+
+  // spliced encoding can be patched again
+  auto spliced = m->wire_format();
+  m4.param3.data().param2 = 8;
+  m4.param5 = 6;
+  m->to_wire();
+  EXPECT_EQ(m->wire_format(), spliced);
+  ref.param3.data().param2 = 8;
+  ref.param5 = 6;
+  ref.to_wire();
+  EXPECT_EQ(wire_bytes(*m), wire_bytes(ref));
+}
+
+static void fill(TestMessage1004& m)
+{
+  ::mig::blob_t b((const uint8_t *)"\x01\x02\x03", 3);
+  m.param1 = 1;
+  m.param3 = TestEnum1::VALUE2;
+  m.param4.assign(b);
+  m.param6.assign("std");
+  m.param7.data().param1.set();
+  m.param7.data().param2 = 7;
+  m.param8.append(1);
+  m.param8.append(2);
+  auto g = new TestGroup2;
+  g->param1 = 3;
+  m.param10.append(g);
+}
+
+TEST_F(MessageTests, TruncatedValues)
+{
+  // fixed size values cut short by the end of the buffer
+  std::vector<std::vector<uint8_t>> frames = {
+    { 0x10, 0x02, 0, 5, 0x01 },                  // uint8
+    { 0x10, 0x02, 0, 6, 0x02, 0x12 },            // int16
+    { 0x10, 0x02, 0, 7, 0x03, 0x12, 0x34 },      // uint32
+    { 0x10, 0x04, 0, 6, 0x01, 0x12 },            // uint16
+    { 0x10, 0x04, 0, 9, 0x7f, 0x7f, 0, 1, 0xff },
+  };
+  for (auto& bytes : frames) {
+    auto p = std::make_unique<uint8_t []>(bytes.size());
+    memcpy(p.get(), bytes.data(), bytes.size());
+    ::mig::wire_format_ptr_t w = std::make_unique<::mig::SampleProto>(p, bytes.size());
+    auto m = ::mig::Message::instance(w->id());
+    ASSERT_NE(m.get(), nullptr);
+    EXPECT_NE(m->decode(w), 0);
+  }
+}
+
+TEST(GroupArrayTests, ModifiedElement)
+{
+  TestMessage1004 m, ref;
+  fill(m);
+  m.to_wire();
+  EXPECT_EQ(m.is_modified(), false);
+
+  // changing an appended group re-encodes the message
+  m.param10[0].param1 = 4;
+  EXPECT_EQ(m.is_modified(), true);
+  m.to_wire();
+  fill(ref);
+  ref.param10[0].param1 = 4;
+  ref.to_wire();
+  EXPECT_EQ(wire_bytes(m), wire_bytes(ref));
+
+  // also in a decoded message
+  auto w = wire_copy(m);
+  auto d = ::mig::Message::factory(w);
+  ASSERT_NE(d.get(), nullptr);
+  auto& msg = static_cast<TestMessage1004&>(*d);
+  EXPECT_EQ(msg.is_modified(), false);
+  ::mig::string_t s("changed");
+  msg.param10[0].param2.assign(s);
+  msg.to_wire();
+  auto c = wire_copy(msg);
+  auto e = ::mig::Message::factory(c);
+  ASSERT_NE(e.get(), nullptr);
+  EXPECT_EQ(static_cast<TestMessage1004&>(*e).param10.data(0).param2.is_set(), true);
+  EXPECT_EQ(e->equals(msg), true);
+}
+
+TEST(DeltaTests, ApplyDelta)
+{
+  TestMessage1004 base, target;
+  fill(base);
+  fill(target);
+
+  target.param1 = 2;                          // changed
+  target.param2.set();                        // added
+  target.param3.clear();                      // cleared
+  ::mig::string_t s("delta");
+  target.param5.assign(s);                    // added, var length
+  target.param6.assign("changed");            // changed, var length
+  target.param7.data().param2 = 8;            // nested change
+  target.param8.append(3);                    // repeats replaced
+  target.param9.append();
+  target.param9.append();
+  target.param10.clear();                     // repeated group cleared
+
+  auto delta = ::mig::WireFormat::factory(base, target);
+  ASSERT_NE(delta.get(), nullptr);
+  EXPECT_EQ(delta->is_delta(), true);
+
+  // delta frames are not messages of their own
+  auto d = wire_copy(*delta);
+  EXPECT_EQ(::mig::Message::factory(d).get(), nullptr);
+
+  // apply onto a decoded baseline, then release the delta frame
+  base.to_wire();
+  auto w = wire_copy(base);
+  auto m = ::mig::Message::factory(w);
+  ASSERT_NE(m.get(), nullptr);
+  EXPECT_EQ(m->apply(*d), 0);
+  d.reset();
+  delta.reset();
+  EXPECT_EQ(m->equals(target), true);
+  EXPECT_EQ(m->is_modified(), true);
+
+  // unchanged parameters are spliced from the baseline frame
+  m->to_wire();
+  target.to_wire();
+  EXPECT_EQ(wire_bytes(*m), wire_bytes(target));
+}
+
+TEST(DeltaTests, EmptyDelta)
+{
+  TestMessage1004 base, target;
+  fill(base);
+  fill(target);
+
+  auto delta = ::mig::WireFormat::factory(base, target);
+  ASSERT_NE(delta.get(), nullptr);
+  EXPECT_EQ(delta->size(), 6u); // header, delta mark and end mark only
+
+  TestMessage1002 other;
+  EXPECT_EQ(::mig::WireFormat::factory(base, other).get(), nullptr);
+  EXPECT_EQ(base.apply(*delta), 0);
+  EXPECT_EQ(base.equals(target), true);
+  EXPECT_EQ(other.apply(*delta), -1);
+}
+
+//
+// Wide frames and streaming
+//
+static std::vector<uint8_t> pattern(size_t n)
+{
+  std::vector<uint8_t> v(n);
+  for (size_t i=0; i<n; i++)
+    v[i] = (uint8_t)(i * 7 + (i >> 8));
+  return v;
+}
+
+TEST(LargeTests, LargeBlob)
+{
+  auto data = pattern(200000);
+  TestMessage1004 m;
+  fill(m);
+  ::mig::blob_t b(data.data(), data.size());
+  m.param4.assign(b);
+
+  m.to_wire();
+  auto w = static_cast<::mig::SampleProto *>(m.wire_format());
+  EXPECT_EQ(w->is_wide(), true);
+  auto bytes = wire_bytes(m);
+  EXPECT_EQ(bytes.size(), w->wire_size(m));
+  EXPECT_EQ(bytes[2], 0);
+  EXPECT_EQ(bytes[3], 0);
+
+  auto c = wire_copy(m);
+  auto d = ::mig::Message::factory(c);
+  ASSERT_NE(d.get(), nullptr);
+  EXPECT_EQ(d->equals(m), true);
+
+  // small messages keep the narrow frame
+  TestMessage1004 small;
+  fill(small);
+  small.to_wire();
+  EXPECT_EQ(static_cast<::mig::SampleProto *>(small.wire_format())->is_wide(), false);
+}
+
+TEST(LargeTests, Reencode)
+{
+  TestMessage1004 m;
+  fill(m);
+  m.to_wire();
+  auto w = wire_copy(m);
+  auto d = ::mig::Message::factory(w);
+  ASSERT_NE(d.get(), nullptr);
+
+  // the frame outgrows u16 sizes
+  auto data = pattern(70000);
+  ::mig::blob_t b(data.data(), data.size());
+  auto& msg = static_cast<TestMessage1004&>(*d);
+  msg.param4.assign(b);
+  msg.to_wire();
+  EXPECT_EQ(static_cast<::mig::SampleProto *>(msg.wire_format())->is_wide(), true);
+  m.param4.assign(b);
+  m.to_wire();
+  EXPECT_EQ(wire_bytes(msg), wire_bytes(m));
+
+  // a wide frame is spliced as a wide frame
+  msg.param1 = 9;
+  msg.param6.assign("spliced");
+  msg.to_wire();
+  auto c = wire_copy(msg);
+  auto e = ::mig::Message::factory(c);
+  ASSERT_NE(e.get(), nullptr);
+  EXPECT_EQ(e->equals(msg), true);
+}
+
+TEST(LargeTests, WideIds)
+{
+  TestMessage1007 m;
+  m.param1 = 5;
+  m.param3.data().param1 = 7;
+  m.to_wire();
+  EXPECT_EQ(static_cast<::mig::SampleProto *>(m.wire_format())->is_wide(), true);
+
+  auto w = wire_copy(m);
+  EXPECT_EQ(w->update(m, 1, (uint8_t)6), 0);
+  auto d = ::mig::Message::factory(w);
+  ASSERT_NE(d.get(), nullptr);
+  auto& msg = static_cast<TestMessage1007&>(*d);
+  EXPECT_EQ(msg.param1, 6);
+  EXPECT_EQ(msg.param3.is_set(), true);
+  EXPECT_EQ(msg.param3.data().param1, 7);
+
+  // delta frames use the wide marks
+  TestMessage1007 target;
+  target.param1 = 6;
+  ::mig::string_t s("wide");
+  target.param3.data().param1 = 7;
+  target.param3.data().param2.assign(s);
+  auto delta = ::mig::WireFormat::factory(msg, target);
+  ASSERT_NE(delta.get(), nullptr);
+  auto dc = wire_copy(*delta);
+  EXPECT_EQ(dc->is_delta(), true);
+  EXPECT_EQ(msg.apply(*dc), 0);
+  EXPECT_EQ(msg.equals(target), true);
+}
+
+TEST(LargeTests, Stream)
+{
+  auto data = pattern(300000);
+  TestMessage1004 m;
+  fill(m);
+  ::mig::blob_t b(data.data(), data.size());
+  m.param4.assign(b);
+  TestMessage1007 small;
+  small.param1 = 3;
+
+  std::vector<uint8_t> out;
+  size_t pieces = 0, largest = 0;
+  auto sink = [&](const uint8_t *p, size_t n) {
+    out.insert(out.end(), p, p + n);
+    pieces++;
+    largest = std::max(largest, n);
+    return 0;
+  };
+  EXPECT_EQ(::mig::SampleProto::write(m, sink, 1024), 0);
+  EXPECT_EQ(largest, data.size()); // blob is passed through as is
+  EXPECT_EQ(::mig::SampleProto::write(small, sink, 1024), 0);
+
+  m.to_wire();
+  small.to_wire();
+  auto expect = wire_bytes(m);
+  auto tail = wire_bytes(small);
+  expect.insert(expect.end(), tail.begin(), tail.end());
+  EXPECT_EQ(out, expect);
+
+  // frames are read one after the other from the same source
+  size_t pos = 0;
+  auto source = [&](uint8_t *p, size_t n) -> ssize_t {
+    n = std::min(n, std::min((size_t)5000, out.size() - pos));
+    memcpy(p, &out[pos], n);
+    pos += n;
+    return n;
+  };
+  auto d = ::mig::SampleProto::read(source, 256);
+  ASSERT_NE(d.get(), nullptr);
+  EXPECT_EQ(d->wire_format(), nullptr);
+  EXPECT_EQ(d->equals(m), true);
+  auto e = ::mig::SampleProto::read(source, 256);
+  ASSERT_NE(e.get(), nullptr);
+  EXPECT_EQ(e->equals(small), true);
+  EXPECT_EQ(pos, out.size());
+  EXPECT_EQ(::mig::SampleProto::read(source, 256).get(), nullptr);
+
+  // decoded message is encoded again on request
+  d->to_wire();
+  EXPECT_EQ(wire_bytes(*d), wire_bytes(m));
+
+  // a blob length beyond the frame is not allocated
+  auto offset = wire_copy(m)->locate(TestMessage1004::schema(), 4);
+  ASSERT_GE(offset, 0);
+  out = wire_bytes(m);
+  out[offset] = 0x7f;
+  pos = 0;
+  EXPECT_EQ(::mig::SampleProto::read(source, 256).get(), nullptr);
+
+  // sink errors are reported
+  auto fail = [](const uint8_t *, size_t) { return -1; };
+  EXPECT_EQ(::mig::SampleProto::write(m, fail, 1024), -1);
+}
+
+//
+// Mapped file regions
+//
+class RegionTests : public ::testing::Test
+{
+  protected:
+    void SetUp() override {
+      char name[] = "/tmp/mig_region_XXXXXX";
+      fd = mkstemp(name);
+      ASSERT_GE(fd, 0);
+      unlink(name);
+      data = pattern(100000);
+      ASSERT_EQ(write(fd, data.data(), data.size()), (ssize_t)data.size());
+      ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    }
+
+    void TearDown() override {
+      close(fd);
+      close(sv[0]);
+      close(sv[1]);
+    }
+
+    //! read n bytes from the other end of the socket pair
+    std::thread receive(std::vector<uint8_t>& v) {
+      return std::thread([this, &v]() {
+        size_t pos = 0;
+        ssize_t r;
+        while (pos < v.size() && (r = read(sv[1], &v[pos], v.size() - pos)) > 0)
+          pos += r;
+        v.resize(pos);
+      });
+    }
+
+    int fd = -1;
+    int sv[2];
+    std::vector<uint8_t> data;
+};
+
+TEST_F(RegionTests, Map)
+{
+  auto r = ::mig::file_region::map(fd, 5000, 20000); // not page aligned
+  ASSERT_NE(r.get(), nullptr);
+  EXPECT_EQ(r->size(), 20000u);
+  EXPECT_EQ(memcmp(r->data(), &data[5000], 20000), 0);
+  EXPECT_EQ(::mig::file_region::map(-1, 0, 10).get(), nullptr);
+
+  // blobs share the mapping, which lives as long as any of them
+  ::mig::blob_t b(r);
+  r.reset();
+  ::mig::blob_t c(b);
+  EXPECT_EQ(c.data(), b.data());
+  c.own();
+  EXPECT_EQ(c.data(), b.data());
+  EXPECT_NE(c.region().get(), nullptr);
+
+  TestMessage1004 m;
+  m.param4.assign(b);
+  EXPECT_EQ(memcmp(m.param4.data().data(), &data[5000], 20000), 0);
+}
+
+TEST_F(RegionTests, Send)
+{
+  TestMessage1004 m;
+  fill(m);
+  ::mig::blob_t b(::mig::file_region::map(fd, 1000, 90000));
+  m.param4.assign(b);
+  ::mig::string_t s("after the blob");
+  m.param5.assign(s);
+  close(fd); // region keeps the file open
+  fd = open("/dev/null", O_RDONLY);
+
+  m.to_wire();
+  auto expect = wire_bytes(m);
+
+  std::vector<uint8_t> got(expect.size());
+  auto t = receive(got);
+  EXPECT_EQ(::mig::SampleProto::send(m, sv[0]), 0);
+  t.join();
+  EXPECT_EQ(got, expect);
+}
+
+TEST_F(RegionTests, SendToPipe)
+{
+  // the frame is decoded from the receiving end as it is written
+  TestMessage1004 m;
+  fill(m);
+  ::mig::blob_t b(::mig::file_region::map(fd, 0, data.size()));
+  m.param4.assign(b);
+
+  int p[2];
+  ASSERT_EQ(pipe(p), 0);
+  ::mig::message_ptr_t d;
+  std::thread t([&]() {
+    auto source = [&](uint8_t *buf, size_t n) { return read(p[0], buf, n); };
+    d = ::mig::SampleProto::read(source);
+  });
+  EXPECT_EQ(::mig::SampleProto::send(m, p[1]), 0);
+  t.join();
+  close(p[0]);
+  close(p[1]);
+  ASSERT_NE(d.get(), nullptr);
+  EXPECT_EQ(d->equals(m), true);
+}
+
+//
+// Message log
+//
+class LogTests : public ::testing::Test
+{
+  protected:
+    void SetUp() override {
+      char name[] = "/tmp/mig_log_XXXXXX";
+      int fd = mkstemp(name);
+      ASSERT_GE(fd, 0);
+      close(fd);
+      unlink(name);
+      path = name;
+    }
+
+    void TearDown() override {
+      unlink(path.c_str());
+      unlink(::mig::index_path(path.c_str()).c_str());
+    }
+
+    //! write n messages with timestamps 1000, 2000, ...
+    void write_log(::mig::LogWriter& w, int first, int n) {
+      for (auto i=first; i<first+n; i++) {
+        TestMessage1004 m;
+        fill(m);
+        m.param1 = i;
+        ASSERT_EQ(w.append(m, (i + 1) * 1000), 0);
+      }
+    }
+
+    std::string path;
+};
+
+TEST_F(LogTests, WriteRead)
+{
+  ::mig::LogWriter w(512);
+  ASSERT_EQ(w.open(path.c_str()), 0);
+  write_log(w, 0, 100);
+
+  ::mig::LogReader partial; // whole batches only
+  ASSERT_EQ(partial.open(path.c_str()), 0);
+  EXPECT_GT(partial.size(), 0u);
+  EXPECT_LT(partial.size(), 100u);
+  EXPECT_EQ(w.close(), 0);
+
+  ::mig::message_ptr_t kept;
+  {
+    ::mig::LogReader log;
+    ASSERT_EQ(log.open(path.c_str()), 0);
+    ASSERT_EQ(log.size(), 100u);
+    for (size_t i=0; i<log.size(); i++) {
+      auto& e = log.entry(i);
+      EXPECT_EQ(e.seq, i);
+      EXPECT_EQ(e.id, 4100);
+      EXPECT_EQ(e.timestamp, (int64_t)(i + 1) * 1000);
+    }
+    EXPECT_EQ(log.find(42), 42u);
+    EXPECT_EQ(log.find(100), log.size());
+    EXPECT_EQ(log.lower_bound(50001), 50u);
+
+    // decoded in place
+    kept = log.message(42);
+    ASSERT_NE(kept.get(), nullptr);
+    auto& m = static_cast<TestMessage1004&>(*kept);
+    EXPECT_EQ(m.param1, 42);
+    auto blob = m.param4.data().data();
+    EXPECT_GT(blob, log.frame(42));
+    EXPECT_LT(blob, log.frame(42) + log.entry(42).size);
+  }
+
+  // the mapping outlives the reader, the frame is read only
+  auto& m = static_cast<TestMessage1004&>(*kept);
+  TestMessage1004 ref;
+  fill(ref);
+  ref.param1 = 43;
+  m.param1 = 43;
+  m.to_wire();
+  ref.to_wire();
+  EXPECT_EQ(wire_bytes(m), wire_bytes(ref));
+}
+
+TEST_F(LogTests, Append)
+{
+  ::mig::LogWriter w;
+  ASSERT_EQ(w.open(path.c_str()), 0);
+  write_log(w, 0, 10);
+  w.close();
+  ASSERT_EQ(w.open(path.c_str()), 0);
+  EXPECT_EQ(w.next_seq(), 10u);
+
+  // timestamps do not decrease, also across reopening
+  TestMessage1004 old;
+  fill(old);
+  EXPECT_EQ(w.append(old, 9999), -1);
+  EXPECT_EQ(w.next_seq(), 10u);
+  write_log(w, 10, 10);
+  EXPECT_EQ(w.append(old, 20000), 0); // same as the last one
+  EXPECT_EQ(w.append(old, 19999), -1);
+  w.close();
+
+  ::mig::LogReader log;
+  ASSERT_EQ(log.open(path.c_str()), 0);
+  ASSERT_EQ(log.size(), 21u);
+  EXPECT_EQ(log.lower_bound(20000), 19u);
+  EXPECT_EQ(log.lower_bound(20001), 21u);
+  auto m = log.message(15);
+  ASSERT_NE(m.get(), nullptr);
+  EXPECT_EQ(static_cast<TestMessage1004&>(*m).param1, 15);
+  EXPECT_EQ(log.entry(15).seq, 15u);
+}
+
+TEST_F(LogTests, Recovery)
+{
+  ::mig::LogWriter w;
+  ASSERT_EQ(w.open(path.c_str()), 0);
+  write_log(w, 0, 10);
+  w.close();
+
+  // crash: last index entries lost, last record partly written
+  auto ipath = ::mig::index_path(path.c_str());
+  struct stat st;
+  ASSERT_EQ(stat(ipath.c_str(), &st), 0);
+  ASSERT_EQ(truncate(ipath.c_str(), st.st_size - 3 * sizeof(::mig::log_entry)), 0);
+  ASSERT_EQ(stat(path.c_str(), &st), 0);
+  auto complete = st.st_size;
+  int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+  ASSERT_GE(fd, 0);
+  uint8_t torn[] = { 1, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0x10, 0x04, 0x01 };
+  ASSERT_EQ(write(fd, torn, sizeof(torn)), (ssize_t)sizeof(torn));
+  close(fd);
+
+  ASSERT_EQ(w.open(path.c_str()), 0); // rebuilds the index
+  EXPECT_EQ(w.next_seq(), 10u);
+  ASSERT_EQ(stat(path.c_str(), &st), 0);
+  EXPECT_EQ(st.st_size, complete);
+  write_log(w, 10, 1);
+  w.close();
+
+  ::mig::LogReader log;
+  ASSERT_EQ(log.open(path.c_str()), 0);
+  ASSERT_EQ(log.size(), 11u);
+  EXPECT_EQ(log.entry(9).timestamp, 10000);
+  EXPECT_EQ(log.entry(10).seq, 10u);
+  EXPECT_EQ(::mig::rebuild_index(path.c_str()), 11);
+  EXPECT_EQ(::mig::rebuild_index("/nonexistent"), -1);
+}
+
+//
+// Generated randomizers
+//
+TEST(RandomTests, Reproducible)
+{
+  ::mig::Random a(42), b(42), c(43);
+  int differ = 0;
+  for (auto i=0; i<10; i++)
+    for (auto& it : ::mig::Random::randomizers) {
+      auto m1 = a.message(it.first);
+      auto m2 = b.message(it.first);
+      auto m3 = c.message(it.first);
+      ASSERT_NE(m1.get(), nullptr);
+      EXPECT_EQ(m1->id(), it.first);
+      EXPECT_EQ(m1->is_valid(), true);
+      EXPECT_EQ(m1->equals(*m2), true);
+      differ += !m1->equals(*m3);
+    }
+  EXPECT_GT(differ, 0);
+  EXPECT_EQ(a.message(1).get(), nullptr);
+}
+
+TEST(RandomTests, Distributions)
+{
+  ::mig::Random r(7);
+  r.optional = 1.0;
+  r.repeats = { ::mig::size_dist::Fixed, 3, 3 };
+  r.string_sizes = { ::mig::size_dist::Fixed, 5, 5 };
+  r.blob_sizes = { ::mig::size_dist::LogUniform, 10, 100 };
+
+  for (auto i=0; i<100; i++) {
+    TestMessage1004 m;
+    m.randomize(r);
+    EXPECT_EQ(m.presence(), (1ULL << m.nparams()) - 1);
+    EXPECT_EQ(m.param8.nrepeats(), 3);
+    EXPECT_EQ(m.param9.nrepeats(), 3);
+    EXPECT_EQ(m.param10.nrepeats(), 3);
+    EXPECT_EQ(m.param5.data().size(), 6u); // with NUL
+    EXPECT_EQ(m.param6.data().size(), 5u);
+    auto n = m.param4.data().size();
+    EXPECT_GE(n, 10u);
+    EXPECT_LE(n, 100u);
+    EXPECT_TRUE(m.param3 == TestEnum1::VALUE1 || m.param3 == TestEnum1::VALUE2);
+  }
+
+  r.optional = 0.0;
+  TestMessage1004 m;
+  m.randomize(r);
+  EXPECT_EQ(m.presence(), 0u);
+}
+
+TEST(RandomTests, RoundTrip)
+{
+  ::mig::Random r(1);
+  for (auto i=0; i<200; i++)
+    for (auto& it : ::mig::Random::randomizers) {
+      auto m = r.message(it.first);
+      m->to_wire();
+      auto w = wire_copy(*m);
+      auto d = ::mig::Message::factory(w);
+      ASSERT_NE(d.get(), nullptr);
+      EXPECT_EQ(d->equals(*m), true);
+    }
+}
+
+//
+// Shared memory ring
+//
+class RingTests : public ::testing::Test
+{
+  protected:
+    void SetUp() override {
+      name = "/mig_ring_" + std::to_string(getpid());
+    }
+
+    //! run f in a child process that has the ring open
+    pid_t spawn(const std::function<int(::mig::ShmRing&)>& f) {
+      auto pid = fork();
+      if (pid == 0) {
+        ::mig::ShmRing r;
+        _exit((r.open(name.c_str()) == 0) ? f(r) : 1);
+      }
+      return pid;
+    }
+
+    int join(pid_t pid) {
+      int status = 0;
+      return (waitpid(pid, &status, 0) == pid && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+    }
+
+    std::string name;
+};
+
+TEST_F(RingTests, ReadWrite)
+{
+  ::mig::ShmRing r;
+  ASSERT_EQ(r.create(name.c_str(), 1000), 0);
+  EXPECT_EQ(r.capacity(), 4096u);
+  EXPECT_EQ(r.create(name.c_str(), 1000), 0); // recreated after close
+
+  ::mig::ShmRing other;
+  EXPECT_EQ(other.create(name.c_str(), 1000), -1); // exists
+  EXPECT_EQ(other.open("/mig_ring_none"), -1);
+
+  size_t n;
+  EXPECT_EQ(r.read(n, 0), nullptr);
+  EXPECT_EQ(r.read(n, 10), nullptr);
+
+  TestMessage1004 m;
+  fill(m);
+  EXPECT_EQ(r.write(m), 0);
+  uint8_t big[4096] = {};
+  EXPECT_EQ(r.write(big, r.max_frame() + 1), -1);
+
+  // fill up the ring without a consumer
+  int count = 1;
+  while (r.write(m) == 0)
+    count++;
+  EXPECT_GT(count, 2);
+  EXPECT_LE(r.used(), r.capacity());
+
+  for (auto i=0; i<count; i++) {
+    auto d = r.receive(0);
+    ASSERT_NE(d.get(), nullptr);
+    EXPECT_EQ(d->equals(m), true);
+  }
+  EXPECT_EQ(r.receive(0).get(), nullptr);
+  EXPECT_EQ(r.used(), 0u);
+}
+
+TEST_F(RingTests, StalledCommit)
+{
+  ::mig::ShmRing r;
+  ASSERT_EQ(r.create(name.c_str(), 4096), 0);
+
+  // the first claim is not published, the second one waits for it
+  ::mig::ShmRing::slot s1, s2;
+  ASSERT_EQ(r.reserve(4, s1), 0);
+  ASSERT_EQ(r.reserve(4, s2), 0);
+  memcpy(s1.data, "abcd", 4);
+  memcpy(s2.data, "efgh", 4);
+  EXPECT_EQ(r.commit(s2, 10), -1);
+  size_t n;
+  EXPECT_EQ(r.read(n, 0), nullptr);
+
+  EXPECT_EQ(r.commit(s1, 0), 0);
+  EXPECT_EQ(r.commit(s2, 0), 0);
+  auto p = r.read(n, 0);
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(memcmp(p, "abcd", n), 0);
+  p = r.read(n, 0);
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(memcmp(p, "efgh", n), 0);
+}
+
+TEST_F(RingTests, TwoProcesses)
+{
+  ::mig::ShmRing r;
+  ASSERT_EQ(r.create(name.c_str(), 8192), 0);
+
+  // the producer encodes into the ring, the ring wraps and runs full,
+  // the consumer sleeps when it runs empty
+  const int count = 2000;
+  auto pid = spawn([&](::mig::ShmRing& w) {
+    ::mig::Random rnd(11);
+    rnd.blob_sizes = { ::mig::size_dist::LogUniform, 0, 1000 };
+    for (auto i=0; i<count; i++) {
+      auto m = rnd.message(4100);
+      while (w.write(*m) != 0)
+        sched_yield();
+      if (i % 500 == 0)
+        usleep(10000);
+    }
+    return 0;
+  });
+  ASSERT_GT(pid, 0);
+
+  ::mig::Random rnd(11);
+  rnd.blob_sizes = { ::mig::size_dist::LogUniform, 0, 1000 };
+  for (auto i=0; i<count; i++) {
+    auto m = rnd.message(4100);
+    auto d = r.receive(5000);
+    ASSERT_NE(d.get(), nullptr);
+    EXPECT_EQ(d->equals(*m), true);
+  }
+  EXPECT_EQ(join(pid), 0);
+  EXPECT_EQ(r.receive(0).get(), nullptr);
+}
+
+TEST_F(RingTests, MultipleProducers)
+{
+  ::mig::ShmRing r;
+  ASSERT_EQ(r.create(name.c_str(), 4096), 0);
+
+  const int producers = 3;
+  const uint32_t count = 3000;
+  std::vector<pid_t> pids;
+  for (auto k=0; k<producers; k++)
+    pids.push_back(spawn([&](::mig::ShmRing& w) {
+      for (uint32_t i=0; i<count; i++) {
+        TestMessage1002 m;
+        m.param2 = k;
+        m.param3 = -1;
+        m.param4 = i;
+        while (w.write(m) != 0)
+          sched_yield();
+      }
+      return 0;
+    }));
+
+  // records of one producer arrive in order
+  std::vector<uint32_t> next(producers, 0);
+  for (uint32_t i=0; i<producers * count; i++) {
+    auto d = r.receive(5000);
+    ASSERT_NE(d.get(), nullptr);
+    ASSERT_EQ(d->id(), 4098);
+    auto& m = static_cast<TestMessage1002&>(*d);
+    auto k = m.param2.data();
+    ASSERT_LT(k, producers);
+    EXPECT_EQ(m.param4.data(), next[k]);
+    next[k]++;
+  }
+  for (auto pid : pids)
+    EXPECT_EQ(join(pid), 0);
+}
+
+//
+// Batched transport
+//
+TEST(TransportTests, Splitter)
+{
+  TestMessage1004 m;
+  fill(m);
+  m.to_wire();
+  auto bytes = wire_bytes(m);
+
+  ::mig::FrameSplitter s(16);
+  size_t n;
+  int frames = 0;
+  for (auto k=0; k<3; k++)
+    for (size_t i=0; i<bytes.size(); i++) {
+      s.feed(&bytes[i], 1);
+      auto p = s.next(n);
+      EXPECT_EQ(p != nullptr, i == bytes.size() - 1); // only when complete
+      if (p) {
+        EXPECT_EQ(std::vector<uint8_t>(p, p + n), bytes);
+        frames++;
+      }
+    }
+  EXPECT_EQ(frames, 3);
+  EXPECT_EQ(s.next(n), nullptr);
+  EXPECT_EQ(s.pending(), 0u);
+  EXPECT_EQ(s.error(), false);
+
+  uint8_t bad[8] = { 0x10, 0x04, 0, 2 };
+  s.feed(bad, 4);
+  EXPECT_EQ(s.next(n), nullptr);
+  EXPECT_EQ(s.error(), false);
+  s.feed(bad + 4, 4);
+  EXPECT_EQ(s.next(n), nullptr);
+  EXPECT_EQ(s.error(), true);
+}
+
+TEST(TransportTests, StreamBatch)
+{
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  ::mig::transport_options o;
+  o.batch = 4;
+  o.flush_latency = std::chrono::seconds(10);
+  ::mig::Transport a(sv[0], o), b(sv[1]);
+  EXPECT_EQ(a.is_stream(), true);
+
+  TestMessage1004 m;
+  fill(m);
+  std::vector<::mig::message_ptr_t> msgs;
+  for (auto i=0; i<3; i++)
+    ASSERT_EQ(a.send(m), 0);
+  EXPECT_EQ(a.queued(), 3u);
+  EXPECT_GT(a.next_flush(), 0);
+  EXPECT_EQ(b.receive(msgs, 0), 0);
+
+  ASSERT_EQ(a.send(m), 0);
+  EXPECT_EQ(a.queued(), 0u);
+  EXPECT_EQ(a.stats().send_calls, 1u);
+  EXPECT_EQ(b.receive(msgs, 1000), 4);
+  for (auto& d : msgs)
+    EXPECT_EQ(d->equals(m), true);
+
+  // not a frame
+  EXPECT_EQ(a.send((const uint8_t *)"\x10\x04\x00\x10", 4), -1);
+}
+
+TEST(TransportTests, Latency)
+{
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  ::mig::transport_options o;
+  o.flush_latency = std::chrono::milliseconds(1);
+  ::mig::Transport a(sv[0], o), b(sv[1]);
+
+  TestMessage1002 m;
+  m.param2 = 1;
+  m.param3 = 2;
+  EXPECT_EQ(a.next_flush(), -1);
+  ASSERT_EQ(a.send(m), 0);
+  EXPECT_EQ(a.queued(), 1u);
+  usleep(2000);
+  EXPECT_EQ(a.next_flush(), 0);
+  EXPECT_EQ(a.poll(), 0);
+  EXPECT_EQ(a.queued(), 0u);
+
+  std::vector<::mig::frame_ref> frames;
+  EXPECT_EQ(b.receive(frames, 1000), 1);
+}
+
+TEST(TransportTests, Broadcast)
+{
+  // stream and datagram subscribers
+  const int n = 4;
+  int sv[n][2];
+  std::vector<std::unique_ptr<::mig::Transport>> senders, receivers;
+  std::vector<::mig::Transport*> subscribers;
+  ::mig::transport_options o;
+  o.batch = 3;
+  o.flush_latency = std::chrono::seconds(10);
+  for (auto i=0; i<n; i++) {
+    ASSERT_EQ(socketpair(AF_UNIX, (i < 3) ? SOCK_STREAM : SOCK_SEQPACKET, 0, sv[i]), 0);
+    senders.push_back(std::make_unique<::mig::Transport>(sv[i][0], o));
+    receivers.push_back(std::make_unique<::mig::Transport>(sv[i][1]));
+    subscribers.push_back(senders.back().get());
+  }
+
+  TestMessage1004 m;
+  fill(m);
+  auto f = ::mig::SharedFrame::encode(m);
+  ASSERT_EQ((bool)f, true);
+  m.to_wire();
+  EXPECT_EQ(std::vector<uint8_t>(f.data(), f.data() + f.size()), wire_bytes(m));
+  TestMessage1002 c;
+  c.param2 = 1;
+  c.param3 = 2;
+
+  // a copied frame between two shared ones
+  ASSERT_EQ(::mig::broadcast(f, subscribers), 0);
+  EXPECT_EQ(f.use_count(), n + 1); // referenced by the queues
+  for (auto s : subscribers)
+    ASSERT_EQ(s->send(c), 0);
+  ASSERT_EQ(::mig::broadcast(f, subscribers), 0); // flushes
+  EXPECT_EQ(f.use_count(), 1);
+  ASSERT_EQ(::mig::broadcast(m, subscribers), 0);
+
+  for (auto i=0; i<n; i++) {
+    EXPECT_EQ(senders[i]->stats().send_calls, 1u);
+    EXPECT_EQ(senders[i]->queued(), 1u);
+    senders[i]->flush();
+    std::vector<::mig::message_ptr_t> msgs;
+    while (msgs.size() < 4) {
+      std::vector<::mig::message_ptr_t> more;
+      ASSERT_GT(receivers[i]->receive(more, 1000), 0);
+      for (auto& d : more)
+        msgs.push_back(std::move(d));
+    }
+    EXPECT_EQ(msgs[0]->equals(m), true);
+    EXPECT_EQ(msgs[1]->equals(c), true);
+    EXPECT_EQ(msgs[2]->equals(m), true);
+    EXPECT_EQ(msgs[3]->equals(m), true);
+  }
+
+  EXPECT_EQ(::mig::broadcast(::mig::SharedFrame(), subscribers), -1);
+}
+
+TEST(TransportTests, Datagrams)
+{
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv), 0);
+  ::mig::transport_options o;
+  o.batch = 8;
+  ::mig::Transport a(sv[0], o), b(sv[1], o);
+  EXPECT_EQ(a.is_stream(), false);
+
+  ::mig::Random r(3);
+  std::vector<::mig::message_ptr_t> sent, msgs;
+  for (auto i=0; i<8; i++) {
+    sent.push_back(r.message(4100));
+    ASSERT_EQ(a.send(*sent.back()), 0);
+  }
+  EXPECT_EQ(a.stats().send_calls, 1u);
+  ASSERT_EQ(b.receive(msgs, 1000), 8);
+  EXPECT_EQ(b.stats().receive_calls, 1u);
+  for (auto i=0; i<8; i++)
+    EXPECT_EQ(msgs[i]->equals(*sent[i]), true);
+}
+
+TEST(TransportTests, Loopback)
+{
+  int l = ::mig::listen_inet("127.0.0.1", 0);
+  ASSERT_GE(l, 0);
+  auto port = ::mig::local_port(l);
+  ASSERT_GT(port, 0);
+  int c = ::mig::connect_inet("127.0.0.1", port);
+  ASSERT_GE(c, 0);
+  int s = accept(l, nullptr, nullptr);
+  ASSERT_GE(s, 0);
+  close(l);
+
+  // frames larger than the read size, split at any byte
+  ::mig::transport_options o;
+  o.read_size = 1000;
+  ::mig::Transport b(s, o);
+  const int count = 500;
+  std::thread t([&]() {
+    ::mig::Transport a(c);
+    ::mig::Random r(5);
+    r.blob_sizes = { ::mig::size_dist::LogUniform, 0, 20000 };
+    for (auto i=0; i<count; i++)
+      a.send(*r.message(4100));
+  });
+
+  ::mig::Random r(5);
+  r.blob_sizes = { ::mig::size_dist::LogUniform, 0, 20000 };
+  std::vector<::mig::message_ptr_t> msgs;
+  int n = 0;
+  while (n < count && b.receive(msgs, 5000) > 0)
+    for (auto& d : msgs) {
+      EXPECT_EQ(d->equals(*r.message(4100)), true);
+      n++;
+    }
+  t.join();
+  EXPECT_EQ(n, count);
+  EXPECT_EQ(b.receive(msgs, 1000), -1); // closed
+}
+
+//
+// Receive and decode engine
+//
+static const ::mig::IoEngine::Backend io_backends[] = {
+  ::mig::IoEngine::Backend::Uring, ::mig::IoEngine::Backend::Epoll
+};
+
+//! write frames to fd in chunks of random size
+static void write_chunks(int fd, const std::vector<uint8_t>& bytes, unsigned seed)
+{
+  ::mig::Random r(seed);
+  for (size_t i=0; i<bytes.size(); ) {
+    auto n = std::min((size_t)r.below(700) + 1, bytes.size() - i);
+    ASSERT_EQ(write(fd, &bytes[i], n), (ssize_t)n);
+    i += n;
+  }
+}
+
+//! run the engine until done, false on error or after 10 s
+static bool run_until(::mig::IoEngine& e, const std::function<bool()>& done)
+{
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!done())
+    if (e.run_once(100) < 0 || std::chrono::steady_clock::now() > deadline)
+      return false;
+  return true;
+}
+
+TEST(IoEngineTests, Dispatch)
+{
+  for (auto backend : io_backends) {
+    ::mig::IoEngine e;
+    ASSERT_EQ(e.open(backend), 0);
+    EXPECT_EQ(e.backend(), backend);
+
+    const int conns = 3, count = 50;
+    int sv[conns][2];
+    std::vector<std::vector<::mig::message_ptr_t>> sent(conns);
+    std::vector<std::vector<uint8_t>> bytes(conns);
+    std::vector<int> received(conns, 0), closed;
+    std::map<int, int> index; // connection to socket pair
+    ::mig::Random r(9);
+    r.blob_sizes = { ::mig::size_dist::LogUniform, 0, 5000 };
+    for (auto k=0; k<conns; k++) {
+      ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv[k]), 0);
+      for (auto i=0; i<count; i++) {
+        sent[k].push_back(r.message(4100));
+        sent[k].back()->to_wire();
+        auto b = wire_bytes(*sent[k].back());
+        bytes[k].insert(bytes[k].end(), b.begin(), b.end());
+        if (i == 10) { // no handler
+          TestMessage1002 m;
+          m.param2 = 1;
+          m.param3 = 2;
+          m.to_wire();
+          b = wire_bytes(m);
+          bytes[k].insert(bytes[k].end(), b.begin(), b.end());
+        }
+      }
+      auto conn = e.add(sv[k][1]);
+      ASSERT_GE(conn, 0);
+      index[conn] = k;
+    }
+    EXPECT_EQ(e.connections(), (size_t)conns);
+
+    e.on(4100, [&](::mig::Message& m, int conn) {
+      auto k = index[conn];
+      ASSERT_LT(received[k], count);
+      EXPECT_EQ(m.equals(*sent[k][received[k]]), true);
+      received[k]++;
+    });
+    e.on_close([&](int conn) { closed.push_back(conn); });
+
+    std::thread t([&]() {
+      for (auto k=0; k<conns; k++)
+        write_chunks(sv[k][0], bytes[k], k);
+    });
+    EXPECT_EQ(run_until(e, [&]() { return e.stats().messages == conns * count; }), true);
+    t.join();
+    EXPECT_EQ(received, std::vector<int>(conns, count));
+    EXPECT_EQ(e.stats().skipped, (uint64_t)conns);
+
+    for (auto k=0; k<conns; k++)
+      close(sv[k][0]);
+    EXPECT_EQ(run_until(e, [&]() { return closed.size() == conns; }), true);
+    EXPECT_EQ(closed.size(), (size_t)conns);
+    EXPECT_EQ(e.connections(), 0u);
+  }
+}
+
+TEST(IoEngineTests, ManyConnections)
+{
+  for (auto backend : io_backends) {
+    // fewer buffers than connections, frames larger than buffers
+    ::mig::io_options o;
+    o.buffers = 4;
+    o.buffer_size = 256;
+    ::mig::IoEngine e(o);
+    ASSERT_EQ(e.open(backend), 0);
+
+    TestMessage1004 m;
+    fill(m);
+    std::vector<uint8_t> data(1000, 7);
+    ::mig::blob_t b(data.data(), data.size());
+    m.param4.assign(b);
+    m.to_wire();
+    auto frame = wire_bytes(m);
+
+    const int conns = 200, count = 5;
+    std::vector<int> writers;
+    for (auto k=0; k<conns; k++) {
+      int sv[2];
+      ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+      ASSERT_GE(e.add(sv[1]), 0);
+      writers.push_back(sv[0]);
+    }
+    int received = 0;
+    e.on(4100, [&](::mig::Message& d, int) {
+      EXPECT_EQ(d.equals(m), true);
+      received++;
+    });
+    for (auto i=0; i<count; i++)
+      for (auto fd : writers)
+        ASSERT_EQ(write(fd, frame.data(), frame.size()), (ssize_t)frame.size());
+    EXPECT_EQ(run_until(e, [&]() { return received == conns * count; }), true);
+    EXPECT_EQ(received, conns * count);
+    EXPECT_GT(e.stats().copied, 0u);
+
+    // removed connections are closed
+    int closed = 0;
+    e.on_close([&](int) { closed++; });
+    for (auto conn=0; conn<conns; conn++)
+      EXPECT_EQ(e.remove(conn), 0);
+    EXPECT_EQ(e.remove(0), -1);
+    EXPECT_EQ(run_until(e, [&]() { return closed == conns; }), true);
+    EXPECT_EQ(closed, conns);
+    EXPECT_EQ(e.connections(), 0u);
+    for (auto fd : writers)
+      close(fd);
+  }
+}
+
+//
+// Decode pipeline
+//
+TEST(PipelineTests, Unordered)
+{
+  const int count = 5000;
+  std::vector<::mig::message_ptr_t> sent, received(count);
+  ::mig::Random r(21);
+  {
+    ::mig::pipeline_options o;
+    o.workers = 4;
+    o.batch = 16;
+    ::mig::DecodePipeline p([&](::mig::message_ptr_t m, uint64_t key) {
+      received[key] = std::move(m); // every key once
+    }, o);
+    EXPECT_EQ(p.workers(), 4u);
+
+    for (auto i=0; i<count; i++) {
+      sent.push_back(r.message(4100));
+      sent.back()->to_wire();
+      auto bytes = wire_bytes(*sent.back());
+      auto f = std::make_unique<uint8_t []>(bytes.size());
+      memcpy(f.get(), bytes.data(), bytes.size());
+      ASSERT_EQ(p.submit(f, bytes.size(), i), 0);
+    }
+    uint8_t bad[] = { 0x10, 0x04, 0x00, 0x10 };
+    EXPECT_EQ(p.submit(::mig::frame_ref{ bad, sizeof(bad) }), -1);
+    // a known id and a valid size, but the parameters do not decode
+    uint8_t truncated[] = { 0x10, 0x04, 0x00, 0x07, 0x7f, 0x7e, 0xff };
+    EXPECT_EQ(p.submit(::mig::frame_ref{ truncated, sizeof(truncated) }), 0);
+    p.drain();
+    auto s = p.stats();
+    EXPECT_EQ(s.submitted, (uint64_t)count + 1);
+    EXPECT_EQ(s.delivered, (uint64_t)count);
+    EXPECT_EQ(s.failed, 1u);
+    EXPECT_EQ(s.batches, (uint64_t)(count + 1 + 15) / 16);
+  }
+  for (auto i=0; i<count; i++) {
+    ASSERT_NE(received[i].get(), nullptr);
+    EXPECT_EQ(received[i]->equals(*sent[i]), true);
+  }
+}
+
+TEST(PipelineTests, OrderedByKey)
+{
+  // frames stay in the caller's buffer, param4 numbers them per key
+  const int keys = 7, count = 20000;
+  std::vector<uint8_t> frames;
+  std::vector<::mig::frame_ref> refs;
+  std::vector<size_t> offsets;
+  for (auto i=0; i<count; i++) {
+    TestMessage1002 m;
+    m.param2 = i % keys;
+    m.param3 = 0;
+    m.param4 = i / keys;
+    m.to_wire();
+    auto b = wire_bytes(m);
+    offsets.push_back(frames.size());
+    frames.insert(frames.end(), b.begin(), b.end());
+  }
+  for (auto i=0; i<count; i++) {
+    auto end = (i + 1 < count) ? offsets[i + 1] : frames.size();
+    refs.push_back({ frames.data() + offsets[i], end - offsets[i] });
+  }
+
+  ::mig::pipeline_options o;
+  o.workers = 4;
+  o.batch = 8;
+  o.order = ::mig::pipeline_options::Order::Key;
+  o.lanes = 3;
+  std::vector<std::vector<uint32_t>> seen(keys);
+  std::atomic<int> failures{0};
+  {
+    ::mig::DecodePipeline p([&](::mig::message_ptr_t d, uint64_t key) {
+      auto& m = static_cast<TestMessage1002&>(*d);
+      if (m.param2.data() != key)
+        failures++;
+      seen[key].push_back(m.param4.data()); // one thread at a time per key
+    }, o);
+    for (auto i=0; i<count; i++)
+      ASSERT_EQ(p.submit(refs[i], i % keys), 0);
+  } // drained by the destructor
+
+  EXPECT_EQ(failures, 0);
+  for (auto k=0; k<keys; k++) {
+    std::vector<uint32_t> expected;
+    for (auto i=k; i<count; i+=keys)
+      expected.push_back(i / keys);
+    EXPECT_EQ(seen[k], expected);
+  }
+}
+
+//
+// Queue and message pool tests
+//
+TEST(QueueTests, Spsc)
+{
+  ::mig::SpscQueue<int> q(5);
+  EXPECT_EQ(q.capacity(), 8u);
+  int v = 0;
+  EXPECT_EQ(q.pop(v), false);
+  for (auto i=0; i<8; i++)
+    EXPECT_EQ(q.push(std::move(i)), true);
+  int extra = 8;
+  EXPECT_EQ(q.push(std::move(extra)), false);
+  EXPECT_EQ(q.size(), 8u);
+
+  // batches wrap around the end of the buffer
+  int out[8];
+  EXPECT_EQ(q.pop(out, 5), 5u);
+  EXPECT_EQ(out[4], 4);
+  int in[] = { 8, 9, 10, 11, 12, 13, 14 };
+  EXPECT_EQ(q.push(in, 7), 5u);
+  EXPECT_EQ(q.pop(out, 8), 8u);
+  for (auto i=0; i<8; i++)
+    EXPECT_EQ(out[i], i + 5);
+  EXPECT_EQ(q.pop(out, 8), 0u);
+}
+
+TEST(QueueTests, SpscThreads)
+{
+  const size_t count = 200000;
+  ::mig::SpscQueue<size_t> q(64);
+  std::thread producer([&]() {
+    size_t batch[16];
+    for (size_t i=0; i<count; ) {
+      size_t n = 0;
+      while (n < 16 && i + n < count) {
+        batch[n] = i + n;
+        n++;
+      }
+      i += q.push(batch, n);
+    }
+  });
+  size_t expected = 0, errors = 0, batch[32];
+  while (expected < count) {
+    auto n = q.pop(batch, 32);
+    for (size_t i=0; i<n; i++)
+      if (batch[i] != expected++)
+        errors++;
+  }
+  producer.join();
+  EXPECT_EQ(errors, 0u);
+}
+
+TEST(QueueTests, MpmcThreads)
+{
+  const int producers = 3, consumers = 3;
+  const uint64_t count = 50000;
+  ::mig::MpmcQueue<uint64_t> q(128);
+  std::atomic<uint64_t> sum{0}, popped{0};
+  std::atomic<int> errors{0};
+  std::vector<std::thread> threads;
+  for (auto p=0; p<producers; p++)
+    threads.emplace_back([&, p]() {
+      for (uint64_t i=0; i<count; ) {
+        uint64_t batch[4];
+        size_t n = 0;
+        for (; n<4 && i + n < count; n++)
+          batch[n] = (uint64_t)p << 32 | (i + n);
+        i += q.push(batch, n);
+      }
+    });
+  for (auto c=0; c<consumers; c++)
+    threads.emplace_back([&]() {
+      // values of one producer come out in order for a single consumer
+      std::vector<int64_t> last(producers, -1);
+      uint64_t batch[8];
+      while (popped < producers * count) {
+        auto n = q.pop(batch, 8);
+        for (size_t i=0; i<n; i++) {
+          auto p = batch[i] >> 32;
+          int64_t v = batch[i] & 0xFFFFFFFF;
+          if (v <= last[p])
+            errors++;
+          last[p] = v;
+          sum += v;
+        }
+        popped += n;
+      }
+    });
+  for (auto& t : threads)
+    t.join();
+  EXPECT_EQ(errors, 0);
+  EXPECT_EQ(popped, producers * count);
+  EXPECT_EQ(sum, producers * count * (count - 1) / 2);
+  EXPECT_EQ(q.size(), 0u);
+}
+
+TEST(QueueTests, MessagePool)
+{
+  auto frame = [](uint32_t n) {
+    TestMessage1002 m;
+    m.param2 = n % 7;
+    m.param3 = 0;
+    m.param4 = n;
+    if (n == 1)
+      m.param5 = TestEnum1::VALUE2;
+    m.to_wire();
+    auto bytes = wire_bytes(m);
+    auto p = std::make_unique<uint8_t []>(bytes.size());
+    memcpy(p.get(), bytes.data(), bytes.size());
+    return ::mig::wire_format_ptr_t(std::make_unique<::mig::SampleProto>(p, bytes.size()));
+  };
+
+  ::mig::MessagePool pool(64);
+  EXPECT_EQ(pool.get(0x7777), nullptr);
+  auto w = frame(1);
+  auto m = pool.decode(w);
+  ASSERT_NE(m.get(), nullptr);
+  auto raw = m.get();
+  pool.put(std::move(m));
+  w = frame(2);
+  m = pool.decode(w);
+  EXPECT_EQ(m.get(), raw); // same message again
+  EXPECT_EQ(static_cast<TestMessage1002&>(*m).param4.data(), 2u);
+  EXPECT_EQ(static_cast<TestMessage1002&>(*m).param5.is_set(), false); // cleared
+  EXPECT_EQ(pool.created(), 1u);
+  EXPECT_EQ(pool.reused(), 1u);
+  pool.put(std::move(m));
+  m = pool.get(0x1002);
+  EXPECT_EQ(m.get(), raw);
+  EXPECT_EQ(m->presence(), 0u); // no parameters of the last frame
+  EXPECT_EQ(m->wire_format(), nullptr);
+  pool.put(std::move(m));
+
+  // a message re-encoded after decoding keeps its source frame, the
+  // pool releases that too
+  {
+    char name[] = "/tmp/mig_pool_XXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_GE(fd, 0);
+    unlink(name);
+    auto f = frame(2);
+    f->buf()->reset();
+    ASSERT_EQ(write(fd, f->buf()->getp(f->size()), f->size()), (ssize_t)f->size());
+    auto r = ::mig::file_region::map(fd, 0, f->size());
+    close(fd);
+    ASSERT_NE(r.get(), nullptr);
+    w = std::make_unique<::mig::SampleProto>(r, 0, r->size());
+    m = pool.decode(w);
+    ASSERT_NE(m.get(), nullptr);
+    static_cast<TestMessage1002&>(*m).param5 = TestEnum1::VALUE2;
+    m->to_wire(); // not patched in place, the frame is the source now
+    EXPECT_EQ(r.use_count(), 2);
+    pool.put(std::move(m));
+    m = pool.get(0x1002);
+    EXPECT_EQ(r.use_count(), 1);
+  }
+
+  // returns beyond the queue overflow to the owner, which keeps max_free
+  ::mig::MessagePool small(2, 3);
+  std::vector<::mig::message_ptr_t> taken;
+  for (uint32_t i=0; i<5; i++) {
+    w = frame(i);
+    taken.push_back(small.decode(w));
+  }
+  std::thread returner([&]() {
+    for (auto& d : taken)
+      small.put(std::move(d));
+  });
+  returner.join();
+  for (auto& d : taken) {
+    d = small.get(0x1002);
+    EXPECT_EQ(d->presence(), 0u);
+  }
+  EXPECT_EQ(small.reused(), 3u);
+  EXPECT_EQ(small.created(), 7u);
+
+  // decoded here, consumed and returned on another thread
+  const uint32_t count = 20000;
+  ::mig::SpscQueue<::mig::message_ptr_t> q(32);
+  std::atomic<int> errors{0};
+  std::thread consumer([&]() {
+    for (uint32_t i=0; i<count; ) {
+      ::mig::message_ptr_t d;
+      if (!q.pop(d))
+        continue;
+      if (static_cast<TestMessage1002&>(*d).param4.data() != i++)
+        errors++;
+      pool.put(std::move(d));
+    }
+  });
+  for (uint32_t i=0; i<count; ) {
+    w = frame(i);
+    auto d = pool.decode(w);
+    while (d && !q.push(std::move(d)))
+      std::this_thread::yield();
+    i++;
+  }
+  consumer.join();
+  EXPECT_EQ(errors, 0);
+  EXPECT_EQ(pool.created() + pool.reused(), count + 5);
+  EXPECT_LT(pool.created(), 100u); // bounded by messages in flight
+}
+
+//
+// Typed dispatch tests
+//
+static ::mig::wire_format_ptr_t sample_copy(const std::vector<uint8_t>& bytes)
+{
+  auto p = std::make_unique<uint8_t []>(bytes.size());
+  memcpy(p.get(), bytes.data(), bytes.size());
+  return std::make_unique<::mig::SampleProto>(p, bytes.size());
+}
+
+TEST(DispatchTests, Messages)
+{
+  EXPECT_EQ(message_index(0x1001), 0);
+  EXPECT_EQ(message_index(0x1007), 6);
+  EXPECT_EQ(message_index(0x2000), -1);
+
+  int ones = 0, twos = 0;
+  uint32_t last = 0;
+  auto d = make_dispatcher(::mig::overload(
+    [&](TestMessage1001&) { ones++; },
+    [&](TestMessage1002& m) { twos++; last = m.param4.data(); }));
+  EXPECT_EQ(d.handles(0x1001), true);
+  EXPECT_EQ(d.handles(0x1003), false);
+  EXPECT_EQ(d.handles(0x2000), false);
+
+  TestMessage1001 m1;
+  TestMessage1002 m2;
+  TestMessage1003 m3;
+  m2.param4 = 42;
+  EXPECT_EQ(d.dispatch(m1), 0);
+  EXPECT_EQ(d.dispatch(m2), 0);
+  EXPECT_EQ(d.dispatch(m3), 1);
+  EXPECT_EQ(ones, 1);
+  EXPECT_EQ(twos, 1);
+  EXPECT_EQ(last, 42u);
+
+  // a generic handler takes the rest
+  std::vector<int> ids;
+  auto all = make_dispatcher([&](auto& m) { ids.push_back(m.id()); });
+  EXPECT_EQ(all.dispatch(m3), 0);
+  EXPECT_EQ(all.dispatch(m1), 0);
+  EXPECT_EQ(ids, std::vector<int>({ 0x1003, 0x1001 }));
+}
+
+TEST(DispatchTests, Frames)
+{
+  ::mig::Random r(45);
+  std::vector<::mig::message_ptr_t> sent;
+  int got = 0;
+  auto d = make_dispatcher([&](TestMessage1004& m) {
+    EXPECT_EQ(m.equals(*sent[got]), true);
+    got++;
+  });
+
+  for (auto i=0; i<20; i++) {
+    sent.push_back(r.message(0x1004));
+    sent.back()->to_wire();
+    auto w = sample_copy(wire_bytes(*sent.back()));
+    ASSERT_EQ(d.dispatch(w), 0);
+    EXPECT_EQ(w, nullptr); // kept by the decoded message
+  }
+  EXPECT_EQ(got, 20);
+
+  // frame is not taken over
+  auto bytes = wire_bytes(*sent[0]);
+  got = 0;
+  auto w = sample_copy(bytes);
+  EXPECT_EQ(d.dispatch(*w), 0);
+  EXPECT_EQ(got, 1);
+
+  // unhandled frames are skipped before decoding
+  TestMessage1002 m;
+  m.param2 = 1;
+  m.param3 = 2;
+  m.to_wire();
+  w = sample_copy(wire_bytes(m));
+  EXPECT_EQ(d.dispatch(w), 1);
+  EXPECT_NE(w, nullptr);
+  EXPECT_EQ(d.dispatch(*w), 1);
+  EXPECT_EQ(got, 1);
+}
+
+//
+// Routing key tests
+//
+TEST(KeyTests, MessageAndFrame)
+{
+  ::mig::Random r(47);
+  for (auto i=0; i<200; i++) {
+    auto m = r.message(0x1008);
+    m->to_wire();
+    auto w = sample_copy(wire_bytes(*m));
+    uint64_t from_msg = 0, from_frame = 1;
+    ASSERT_EQ(message_key(*m, from_msg), 0);
+    ASSERT_EQ(message_key(*w, from_frame), 0);
+    EXPECT_EQ(from_msg, from_frame);
+    EXPECT_EQ(from_msg, static_cast<TestMessage1008&>(*m).key());
+  }
+
+  TestMessage1002 k;
+  uint64_t h;
+  EXPECT_EQ(message_key(k, h), -1); // no key
+}
+
+TEST(KeyTests, Parameters)
+{
+  TestMessage1008 m;
+  m.param1 = 1;
+  m.param3 = TestEnum1::VALUE1;
+  auto h = m.key();
+  ::mig::blob_t b((const uint8_t *)"xyz", 3);
+  m.param4.assign(b);
+  EXPECT_EQ(m.key(), h); // not a key parameter
+  m.param1 = 2;
+  EXPECT_NE(m.key(), h);
+  m.param1 = 1;
+  ::mig::string_t empty("");
+  m.param2.assign(empty);
+  EXPECT_NE(m.key(), h); // present, if empty
+  m.param2.clear();
+  EXPECT_EQ(m.key(), h);
+
+  // frame of another message
+  TestMessage1002 o;
+  o.param2 = 1;
+  o.param3 = 2;
+  o.to_wire();
+  uint64_t k;
+  EXPECT_EQ(TestMessage1008::key(*o.wire_format(), k), -1);
+}
+
+TEST(KeyTests, UnreadableFrame)
+{
+  using M = TestMessage1006;
+  M m;
+  ::mig::string_t s("abc");
+  m.param1 = 1;
+  m.param2.assign(s);
+  m.param8 = 8;
+  m.to_wire();
+  auto b = wire_bytes(m);
+
+  // absent in a frame that can be read
+  auto w = sample_copy(b);
+  EXPECT_EQ(w->locate(M::schema(), 5), ::mig::WireFormat::not_found);
+  ::mig::KeyHash h;
+  EXPECT_EQ(h.add<::mig::enum_t>(*w, M::schema(), 5, true), 0);
+
+  // string length beyond the frame, the rest cannot be read
+  auto offset = w->locate(M::schema(), 2);
+  ASSERT_GE(offset, 0);
+  b[offset] = 0x70;
+  w = sample_copy(b);
+  EXPECT_GE(w->locate(M::schema(), 1), 0);
+  EXPECT_EQ(w->locate(M::schema(), 5), ::mig::WireFormat::unreadable);
+  EXPECT_EQ(w->locate(M::schema(), 8), ::mig::WireFormat::unreadable);
+  int64_t v;
+  EXPECT_EQ(w->peek(M::schema(), 8, v), -1);
+  EXPECT_EQ(h.add<::mig::enum_t>(*w, M::schema(), 5, true), -1);
+}
+
+TEST(KeyTests, Partitions)
+{
+  // accounts spread evenly over partitions
+  const int accounts = 4000, partitions = 4;
+  int count[partitions] = {};
+  TestMessage1008 m;
+  m.param3 = TestEnum1::VALUE2;
+  for (auto i=0; i<accounts; i++) {
+    m.param1 = i;
+    m.to_wire();
+    auto w = sample_copy(wire_bytes(m));
+    uint64_t h;
+    ASSERT_EQ(TestMessage1008::key(*w, h), 0);
+    count[h % partitions]++;
+  }
+  for (auto i=0; i<partitions; i++)
+    EXPECT_GT(count[i], accounts / partitions * 9 / 10);
+}
+
+//
+// Conflation tests
+//
+static std::vector<uint8_t> state_frame(int32_t key, int64_t value)
+{
+  TestMessage1005 m;
+  m.param1 = 1;
+  m.param2 = key;
+  m.param3 = value;
+  m.param4 = 4;
+  m.param5 = value * 3; // checked by readers
+  m.to_wire();
+  return wire_bytes(m);
+}
+
+TEST(ConflateTests, Cache)
+{
+  ::mig::cache_options o;
+  o.slots = 8;
+  o.max_frame = 64;
+  ::mig::LastValueCache c(o, [](const ::mig::WireFormat& w, uint64_t& k) {
+    return message_key(w, k);
+  });
+
+  for (auto v=0; v<5; v++)
+    for (auto k=0; k<3; k++) {
+      auto f = state_frame(k, v * 10 + k);
+      ASSERT_EQ(c.update(f.data(), f.size(), k), 0);
+    }
+  EXPECT_EQ(c.size(), 3u);
+  EXPECT_EQ(c.version(0x1005, 1), 5u);
+  EXPECT_EQ(c.version(0x1005, 3), 0u);
+  auto m = c.get(0x1005, 2);
+  ASSERT_NE(m.get(), nullptr);
+  EXPECT_EQ(static_cast<TestMessage1005&>(*m).param3.data(), 42);
+  std::vector<uint8_t> f;
+  ASSERT_EQ(c.read(0x1005, 0, f), 0);
+  EXPECT_EQ(f, state_frame(0, 40));
+  EXPECT_EQ(c.read(0x1005, 7, f), -1);
+  EXPECT_EQ(c.get(0x1002, 0), nullptr);
+
+  // keys of the frames
+  TestMessage1008 a;
+  a.param1 = 100;
+  a.param3 = TestEnum1::VALUE1;
+  a.to_wire();
+  auto fa = wire_bytes(a);
+  ASSERT_EQ(c.update(fa.data(), fa.size()), 0);
+  auto d = c.get(0x1008, a.key());
+  ASSERT_NE(d.get(), nullptr);
+  EXPECT_EQ(d->equals(a), true);
+  EXPECT_EQ(c.update(f.data(), f.size()), -1); // no key
+  std::vector<uint8_t> data(100);
+  ::mig::blob_t b(data.data(), data.size());
+  a.param4.assign(b);
+  EXPECT_EQ(c.update(a, 0), -1); // larger than max_frame
+
+  // full
+  for (auto k=3; k<7; k++)
+    ASSERT_EQ(c.update(state_frame(k, 0).data(), f.size(), k), 0);
+  EXPECT_EQ(c.size(), 8u);
+  EXPECT_EQ(c.update(state_frame(9, 0).data(), f.size(), 9), -1);
+  EXPECT_EQ(c.update(state_frame(6, 1).data(), f.size(), 6), 0);
+}
+
+TEST(ConflateTests, CacheReaders)
+{
+  const int keys = 4, updates = 20000;
+  ::mig::LastValueCache c;
+  std::atomic<bool> done{false};
+  std::atomic<int> errors{0};
+  std::vector<std::thread> readers;
+  for (auto r=0; r<2; r++)
+    readers.emplace_back([&]() {
+      std::vector<int64_t> last(keys, -1);
+      while (!done) {
+        for (auto k=0; k<keys; k++) {
+          auto m = c.get(0x1005, k);
+          if (!m)
+            continue;
+          auto& s = static_cast<TestMessage1005&>(*m);
+          // never torn, never older than what was seen
+          if (s.param5.data() != (uint64_t)s.param3.data() * 3 || s.param3.data() < last[k])
+            errors++;
+          last[k] = s.param3.data();
+        }
+      }
+    });
+  for (auto v=0; v<updates; v++) {
+    auto f = state_frame(v % keys, v);
+    c.update(f.data(), f.size(), v % keys);
+  }
+  done = true;
+  for (auto& t : readers)
+    t.join();
+  EXPECT_EQ(errors, 0);
+  EXPECT_EQ(c.version(0x1005, 0), (uint64_t)updates / keys);
+}
+
+TEST(ConflateTests, Queue)
+{
+  ::mig::ConflatingQueue q;
+  for (auto v=0; v<10; v++)
+    for (auto k : { 5, 3, 8 }) {
+      auto f = state_frame(k, v);
+      ASSERT_EQ(q.push(f.data(), f.size(), k), 0);
+    }
+  TestMessage1002 other;
+  other.param2 = 1;
+  other.param3 = 2;
+  ASSERT_EQ(q.push(other, 3), 0); // another id, same key
+  EXPECT_EQ(q.size(), 4u);
+  auto s = q.stats();
+  EXPECT_EQ(s.pushed, 31u);
+  EXPECT_EQ(s.conflated, 27u);
+
+  // in the order the keys were first queued, with their latest frames
+  ::mig::ConflatingQueue::entry e;
+  for (auto k : { 5, 3, 8 }) {
+    ASSERT_EQ(q.pop(e), 0);
+    EXPECT_EQ(e.id, 0x1005);
+    EXPECT_EQ(e.key, (uint64_t)k);
+    EXPECT_EQ(e.updates, 10u);
+    auto m = e.message();
+    ASSERT_NE(m.get(), nullptr);
+    EXPECT_EQ(static_cast<TestMessage1005&>(*m).param3.data(), 9);
+  }
+  ASSERT_EQ(q.pop(e), 0);
+  EXPECT_EQ(e.id, 0x1002);
+  EXPECT_EQ(q.pop(e, 1), -1);
+  EXPECT_EQ(q.push((const uint8_t *)"\x10\x04\x00\x10", 4, 0), -1);
+}
+
+TEST(ConflateTests, SlowConsumer)
+{
+  const int keys = 10, updates = 20000;
+  ::mig::ConflatingQueue q;
+  std::vector<int64_t> latest(keys, -1);
+  std::thread consumer([&]() {
+    ::mig::ConflatingQueue::entry e;
+    int finished = 0;
+    while (finished < keys && q.pop(e, 5000) == 0) {
+      auto m = e.message();
+      auto v = static_cast<TestMessage1005&>(*m).param3.data();
+      latest[e.key] = v;
+      if (v >= updates - keys)
+        finished++;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+  for (auto v=0; v<updates; v++) {
+    auto f = state_frame(v % keys, v);
+    q.push(f.data(), f.size(), v % keys);
+  }
+  consumer.join();
+  for (auto k=0; k<keys; k++)
+    EXPECT_EQ(latest[k], updates - keys + k);
+  auto s = q.stats();
+  EXPECT_LT(s.popped, (uint64_t)updates / 10); // most updates were conflated
+  EXPECT_EQ(s.popped + s.conflated, (uint64_t)updates);
+}
+
+//
+// Frame filter tests
+//
+TEST(FilterTests, Scalars)
+{
+  using M = TestMessage1002;
+  ::mig::FrameFilter gt(M::schema(), M::field_param2() > 100 && M::field_param5() == TestEnum1::VALUE2);
+  ::mig::FrameFilter neg(M::schema(), M::field_param3() < -10 || !::mig::present(M::field_param4()));
+  ::mig::FrameFilter ne(M::schema(), !(M::field_param6() != true));
+  ASSERT_EQ(gt.is_valid(), true);
+  ASSERT_EQ(neg.is_valid(), true);
+
+  ::mig::Random r(49);
+  int matched = 0;
+  for (auto i=0; i<500; i++) {
+    auto m = r.message(0x1002);
+    m->to_wire();
+    auto f = wire_bytes(*m);
+    auto& s = static_cast<M&>(*m);
+    bool expected = s.param2.data() > 100 && s.param5.is_set() && s.param5.data() == TestEnum1::VALUE2;
+    EXPECT_EQ(gt.match(f.data(), f.size()), expected);
+    matched += expected;
+    expected = s.param3.data() < -10 || !s.param4.is_set();
+    EXPECT_EQ(neg.match(f.data(), f.size()), expected);
+    expected = !(s.param6.is_set() && s.param6.data() != true); // absent is not != either
+    EXPECT_EQ(ne.match(f.data(), f.size()), expected);
+  }
+  EXPECT_GT(matched, 0);
+
+  // other messages and broken frames
+  TestMessage1005 o;
+  o.param1 = 1;
+  o.param2 = 2;
+  o.param3 = 3;
+  o.param4 = 4;
+  o.param5 = 5;
+  o.to_wire();
+  auto f = wire_bytes(o);
+  EXPECT_EQ(gt.match(f.data(), f.size()), false);
+  EXPECT_EQ(gt.match(f.data(), 3), false);
+
+  // not a field of the schema or of another type
+  EXPECT_EQ(::mig::FrameFilter(M::schema(), ::mig::field_t<uint32_t>{1} == 1u).is_valid(), false);
+  EXPECT_EQ(::mig::FrameFilter(M::schema(), ::mig::field_t<uint8_t>{5} == 1).is_valid(), false);
+}
+
+TEST(FilterTests, SkipParameters)
+{
+  // fields after strings, groups and repeated parameters
+  using M = TestMessage1006;
+  ::mig::FrameFilter f(M::schema(), M::field_param8() >= 0 && ::mig::present(M::field_param5()));
+  ASSERT_EQ(f.is_valid(), true);
+  ::mig::Random r(50);
+  for (auto i=0; i<300; i++) {
+    auto m = r.message(0x1006);
+    m->to_wire();
+    auto b = wire_bytes(*m);
+    auto& s = static_cast<M&>(*m);
+    bool expected = s.param8.is_set() && s.param8.data() >= 0 && s.param5.is_set();
+    EXPECT_EQ(f.match(b.data(), b.size()), expected);
+  }
+
+  // wide frame
+  using W = TestMessage1007;
+  ::mig::FrameFilter w(W::schema(), W::field_param1() == 7);
+  W m;
+  m.param1 = 7;
+  m.param3.data().param1 = 1;
+  m.to_wire();
+  auto b = wire_bytes(m);
+  EXPECT_EQ(b[2] == 0 && b[3] == 0, true);
+  EXPECT_EQ(w.match(b.data(), b.size()), true);
+  m.param1 = 8;
+  m.to_wire();
+  b = wire_bytes(m);
+  EXPECT_EQ(w.match(b.data(), b.size()), false);
+}
+
+TEST(ColumnarTests, Columns)
+{
+  using M = TestMessage1002;
+  ::mig::ColumnWriter w(M::schema());
+  ::mig::Random r(60);
+  std::vector<::mig::message_ptr_t> msgs;
+  for (auto i=0; i<100; i++) {
+    msgs.push_back(r.message(0x1002));
+    ASSERT_EQ(w.add(*msgs.back()), 0);
+  }
+  EXPECT_EQ(w.count(), 100u);
+  std::vector<uint8_t> buf;
+  ASSERT_EQ(w.encode(buf), 0);
+  EXPECT_EQ(buf.size(), w.size());
+
+  ::mig::ColumnBatch b(buf.data(), buf.size());
+  ASSERT_EQ(b.is_valid(), true);
+  EXPECT_EQ(b.id(), 0x1002);
+  EXPECT_EQ(b.count(), 100u);
+  EXPECT_EQ(b.presence(0).size(), 2u);
+
+  auto p3 = b.column(M::field_param3());
+  auto p4 = b.column(M::field_param4());
+  auto p5 = b.column(M::field_param5());
+  auto p6 = b.column(M::field_param6());
+  ASSERT_EQ(p3.size(), 100u);
+  ASSERT_EQ(p5.size(), 100u);
+  int64_t sum = 0, expected = 0;
+  for (auto v : p3)
+    sum += v;
+  for (size_t i=0; i<msgs.size(); i++) {
+    auto& m = static_cast<M&>(*msgs[i]);
+    expected += m.param3.data();
+    EXPECT_EQ(b.is_present(0, i), m.param1.is_set());
+    EXPECT_EQ(b.is_present(3, i), m.param4.is_set());
+    EXPECT_EQ(p4[i], (m.param4.is_set()) ? m.param4.data() : 0u);
+    if (m.param5.is_set()) {
+      EXPECT_EQ(p5[i], m.param5.data());
+    }
+    if (m.param6.is_set()) {
+      EXPECT_EQ(p6[i], m.param6.data());
+    }
+
+    M d;
+    ASSERT_EQ(b.message(i, d), 0);
+    EXPECT_EQ(d.equals(m), true);
+  }
+  EXPECT_EQ(sum, expected);
+
+  // wrong type or size of a column
+  EXPECT_EQ(b.column(::mig::field_t<uint64_t>{2}).empty(), true);
+  EXPECT_EQ(b.var(2).size(), 0u);
+
+  w.clear();
+  EXPECT_EQ(w.count(), 0u);
+  ASSERT_EQ(w.encode(buf), 0);
+  ::mig::ColumnBatch e(buf.data(), buf.size());
+  ASSERT_EQ(e.is_valid(), true);
+  EXPECT_EQ(e.count(), 0u);
+  EXPECT_EQ(e.column(M::field_param3()).size(), 0u);
+}
+
+TEST(ColumnarTests, VarColumns)
+{
+  using M = TestMessage1008;
+  ::mig::ColumnWriter w(M::schema());
+  for (auto i=0; i<70; i++) {
+    M m;
+    m.param1 = i;
+    ::mig::string_t s(std::string(i % 7, 'a' + i % 26));
+    if (i % 3)
+      m.param2.assign(s);
+    m.param3 = (i & 1) ? TestEnum1::VALUE2 : TestEnum1::VALUE1;
+    ASSERT_EQ(w.add(m), 0);
+  }
+  std::vector<uint8_t> buf;
+  ASSERT_EQ(w.encode(buf), 0);
+
+  ::mig::ColumnBatch b(buf.data(), buf.size());
+  ASSERT_EQ(b.is_valid(), true);
+  auto p1 = b.column(M::field_param1());
+  auto p2 = b.var(M::field_param2());
+  auto p3 = b.column(M::field_param3());
+  auto p4 = b.var(M::field_param4());
+  ASSERT_EQ(p2.size(), 70u);
+  ASSERT_EQ(p2.offsets().size(), 71u);
+  EXPECT_EQ(p4.offsets()[70], 0u);
+  for (size_t i=0; i<70; i++) {
+    EXPECT_EQ(p1[i], i);
+    EXPECT_EQ(p3[i], (i & 1) ? TestEnum1::VALUE2 : TestEnum1::VALUE1);
+    EXPECT_EQ(b.is_present(2, i), (i % 3) != 0);
+    ::mig::string_t s(std::string(i % 7, 'a' + i % 26));
+    if (i % 3) {
+      EXPECT_EQ(p2.string(i).equals(s), true);
+    } else {
+      EXPECT_EQ(p2.length(i), 0u);
+    }
+    M d;
+    ASSERT_EQ(b.message(i, d), 0);
+    EXPECT_EQ(d.param1.data(), i);
+    EXPECT_EQ(d.param2.is_set(), (i % 3) != 0);
+    EXPECT_EQ(d.param4.is_set(), false);
+  }
+}
+
+TEST(ColumnarTests, Rejects)
+{
+  // groups and other types are not accepted
+  ::mig::ColumnWriter w(TestMessage1003::schema());
+  TestMessage1003 g;
+  g.param3.data().param1.set();
+  g.param3.data().param2 = 1;
+  EXPECT_EQ(w.add(g), -1);
+  TestMessage1002 o;
+  EXPECT_EQ(w.add(o), -1);
+  EXPECT_EQ(w.count(), 0u);
+
+  ::mig::ColumnWriter v(TestMessage1008::schema());
+  TestMessage1008 m;
+  m.param1 = 1;
+  ::mig::blob_t x((const uint8_t *)"xyz", 3);
+  m.param4.assign(x);
+  ASSERT_EQ(v.add(m), 0);
+  std::vector<uint8_t> buf;
+  ASSERT_EQ(v.encode(buf), 0);
+
+  // message of another type
+  TestMessage1002 d;
+  EXPECT_EQ(::mig::ColumnBatch(buf.data(), buf.size()).message(0, d), -1);
+  TestMessage1008 e;
+  EXPECT_EQ(::mig::ColumnBatch(buf.data(), buf.size()).message(1, e), -1);
+
+  // truncated and corrupted batches
+  EXPECT_EQ(::mig::ColumnBatch(buf.data(), buf.size() - 1).is_valid(), false);
+  EXPECT_EQ(::mig::ColumnBatch(buf.data(), 8).is_valid(), false);
+  auto c = buf;
+  c[16 + 4]++; // misaligned block
+  EXPECT_EQ(::mig::ColumnBatch(c.data(), c.size()).is_valid(), false);
+  c = buf;
+  auto offset = ::mig::layout::load<uint32_t>(&c[16 + 3 * 8 + 4]); // param4
+  ::mig::layout::store<uint32_t>(&c[offset + 8 + 4], 100); // beyond the data
+  EXPECT_EQ(::mig::ColumnBatch(c.data(), c.size()).is_valid(), false);
+  c = buf;
+  c[16 + 2] = 7; // unknown kind
+  EXPECT_EQ(::mig::ColumnBatch(c.data(), c.size()).is_valid(), false);
+}
+
+//
+// Compact wire format tests
+//
+static ::mig::message_ptr_t compact_copy(const ::mig::WireFormat& w)
+{
+  auto bytes = wire_bytes(w);
+  auto p = std::make_unique<uint8_t []>(bytes.size());
+  memcpy(p.get(), bytes.data(), bytes.size());
+  ::mig::wire_format_ptr_t c = std::make_unique<::mig::CompactProto>(p, bytes.size());
+  return ::mig::Message::factory(c);
+}
+
+TEST(CompactTests, Varint)
+{
+  using ::mig::CompactProto;
+  EXPECT_EQ(CompactProto::varint_size(0), 1);
+  EXPECT_EQ(CompactProto::varint_size(127), 1);
+  EXPECT_EQ(CompactProto::varint_size(128), 2);
+  EXPECT_EQ(CompactProto::varint_size(16383), 2);
+  EXPECT_EQ(CompactProto::varint_size(16384), 3);
+  EXPECT_EQ(CompactProto::varint_size(UINT64_MAX), 10);
+
+  EXPECT_EQ(CompactProto::zigzag(0), 0u);
+  EXPECT_EQ(CompactProto::zigzag(-1), 1u);
+  EXPECT_EQ(CompactProto::zigzag(1), 2u);
+  EXPECT_EQ(CompactProto::zigzag(-2), 3u);
+  EXPECT_EQ(CompactProto::unzigzag(CompactProto::zigzag(INT64_MIN)), INT64_MIN);
+  EXPECT_EQ(CompactProto::unzigzag(CompactProto::zigzag(INT64_MAX)), INT64_MAX);
+}
+
+TEST(CompactTests, Encoding)
+{
+  TestMessage1002 m;
+  m.param1.set();
+  m.param2 = 1;
+  m.param3 = -2;
+  m.param4 = 300;
+
+  ::mig::CompactProto w(m);
+  std::vector<uint8_t> expected = {
+    0x82, 0x20,       // id 0x1002
+    0x09,             // length
+    0x01,             // param1, void
+    0x02, 0x01,       // param2 = 1
+    0x03, 0x03,       // param3 = -2, zigzag
+    0x04, 0xac, 0x02, // param4 = 300
+    0x00 };           // end mark
+  EXPECT_EQ(w.size(), expected.size());
+  EXPECT_EQ(wire_bytes(w), expected);
+}
+
+TEST(CompactTests, RoundTripIntegers)
+{
+  TestMessage1005 m;
+  m.param1 = INT8_MIN;
+  m.param2 = INT32_MAX;
+  m.param3 = INT64_MIN;
+  m.param4 = UINT16_MAX;
+  m.param5 = UINT64_MAX;
+
+  ::mig::CompactProto w(m);
+  auto d = compact_copy(w);
+  ASSERT_NE(d.get(), nullptr);
+  EXPECT_EQ(d->equals(m), true);
+  EXPECT_EQ(d->is_valid(), true);
+
+  // fixed width encoding round trips as well
+  m.to_wire();
+  auto sw = wire_copy(m);
+  auto s = ::mig::Message::factory(sw);
+  ASSERT_NE(s.get(), nullptr);
+  EXPECT_EQ(s->equals(m), true);
+}
+
+TEST(CompactTests, RoundTripAllKinds)
+{
+  TestMessage1004 m;
+  fill(m);
+  ::mig::string_t str("compact");
+  m.param2.set();
+  m.param5.assign(str);
+  m.param9.append();
+
+  ::mig::CompactProto w(m);
+  auto d = compact_copy(w);
+  ASSERT_NE(d.get(), nullptr);
+  EXPECT_EQ(d->equals(m), true);
+
+  // modified message is re-encoded in the compact format
+  auto& d4 = static_cast<TestMessage1004&>(*d);
+  d4.param1 = 1000;
+  m.param1 = 1000;
+  d->to_wire();
+  EXPECT_NE(dynamic_cast<::mig::CompactProto*>(d->wire_format()), nullptr);
+  EXPECT_EQ(wire_bytes(*d), wire_bytes(::mig::CompactProto(m)));
+}
+
+TEST(CompactTests, Truncated)
+{
+  TestMessage1003 m;
+  ::mig::blob_t b((const uint8_t *)"\x01\x02\x03", 3);
+  ::mig::string_t s("abc");
+  m.param1.assign(s);
+  m.param2.assign(b);
+  m.param3.data().param2 = 1;
+  m.param5 = 5;
+
+  ::mig::CompactProto w(m);
+  auto bytes = wire_bytes(w);
+  for (size_t n = 3; n < bytes.size(); n++) {
+    auto p = std::make_unique<uint8_t []>(n);
+    memcpy(p.get(), bytes.data(), n);
+    ::mig::CompactProto c(p, n);
+    TestMessage1003 t;
+    EXPECT_EQ(c.from_wire(t), -1);
+  }
+}
+
+TEST(CompactTests, SmallerThanSampleProto)
+{
+  TestMessage1002 m2;
+  m2.param1.set();
+  m2.param2 = 1;
+  m2.param3 = 2;
+  m2.param4 = 3;
+  m2.param5 = TestEnum1::VALUE2;
+  m2.param6 = true;
+
+  TestMessage1004 m4;
+  fill(m4);
+
+  TestMessage1005 m5;
+  m5.param1 = -1;
+  m5.param2 = 10;
+  m5.param3 = -100;
+  m5.param4 = 1000;
+  m5.param5 = 10000;
+
+  for (::mig::Message* m : std::vector<::mig::Message*>{ &m2, &m4, &m5 }) {
+    m->to_wire();
+    EXPECT_LT(::mig::CompactProto(*m).size(), m->wire_format()->size());
+  }
+}
+
+//
+// Protocol buffers wire format tests
+//
+static ::mig::message_ptr_t pb_decode(const std::vector<uint8_t>& bytes, int id)
+{
+  auto p = std::make_unique<uint8_t []>(bytes.size());
+  memcpy(p.get(), bytes.data(), bytes.size());
+  ::mig::wire_format_ptr_t w = std::make_unique<::mig::PbProto>(p, bytes.size(), id);
+  return ::mig::Message::factory(w);
+}
+
+class PbTests : public ::testing::Test
+{
+  public:
+    void SetUp() override {
+      m.param1 = 150;
+      m.param2.assign(str);
+      m.param3.data().param1 = 1;
+      m.param4.append(3);
+      m.param4.append(270);
+      m.param4.append(86942);
+      m.param5 = TestEnum1::VALUE2;
+      m.param6 = true;
+      auto g1 = new TestGroup2;
+      g1->param1 = -1;
+      m.param7.append(g1);
+      auto g2 = new TestGroup2;
+      g2->param1 = 2;
+      g2->param2.assign(str2);
+      m.param7.append(g2);
+      m.param8 = -2;
+      m.param9.set();
+    }
+
+    TestMessage1006 m;
+    ::mig::string_t str{"testing"};
+    ::mig::string_t str2{"x"};
+
+    // as encoded by protoc generated code
+    const std::vector<uint8_t> pb = {
+      0x08, 0x96, 0x01,                                      // 1: 150
+      0x12, 0x07, 't', 'e', 's', 't', 'i', 'n', 'g',         // 2: "testing"
+      0x1a, 0x02, 0x08, 0x01,                                // 3: { 1: 1 }
+      0x22, 0x06, 0x03, 0x8e, 0x02, 0x9e, 0xa7, 0x05,        // 4: [3, 270, 86942]
+      0x28, 0x01,                                            // 5: VALUE2
+      0x30, 0x01,                                            // 6: true
+      0x3a, 0x0b, 0x08, 0xff, 0xff, 0xff, 0xff, 0xff,        // 7: { 1: -1 }
+                  0xff, 0xff, 0xff, 0xff, 0x01,
+      0x3a, 0x05, 0x08, 0x02, 0x12, 0x01, 'x',               // 7: { 1: 2, 2: "x" }
+      0x40, 0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,  // 8: -2
+            0xff, 0x01,
+      0x4a, 0x00,                                            // 9: {}
+    };
+};
+
+TEST_F(PbTests, Encode)
+{
+  ::mig::PbProto w(m);
+  EXPECT_EQ(w.size(), pb.size());
+  EXPECT_EQ(wire_bytes(w), pb);
+}
+
+TEST_F(PbTests, Decode)
+{
+  auto d = pb_decode(pb, 0x1006);
+  ASSERT_NE(d.get(), nullptr);
+  EXPECT_EQ(d->equals(m), true);
+}
+
+TEST_F(PbTests, DecodeUnpackedAndUnordered)
+{
+  // unpacked repeats, fields out of order, last value wins
+  std::vector<uint8_t> bytes = {
+    0x20, 0x03,
+    0x08, 0x01,
+    0x4a, 0x00,
+    0x40, 0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01,
+    0x20, 0x8e, 0x02,
+    0x08, 0x96, 0x01,
+    0x12, 0x07, 't', 'e', 's', 't', 'i', 'n', 'g',
+    0x22, 0x03, 0x9e, 0xa7, 0x05,
+    0x1a, 0x02, 0x08, 0x01,
+    0x28, 0x01,
+    0x30, 0x01,
+    0x3a, 0x0b, 0x08, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01,
+    0x3a, 0x05, 0x08, 0x02, 0x12, 0x01, 'x',
+  };
+  auto d = pb_decode(bytes, 0x1006);
+  ASSERT_NE(d.get(), nullptr);
+  EXPECT_EQ(d->equals(m), true);
+}
+
+TEST_F(PbTests, SkipUnknownFields)
+{
+  std::vector<uint8_t> bytes = {
+    0x78, 0x05,                                            // 15: varint
+    0x82, 0x01, 0x02, 0xaa, 0xbb,                          // 16: len
+    0x89, 0x01, 1, 2, 3, 4, 5, 6, 7, 8,                    // 17: i64
+    0x95, 0x01, 1, 2, 3, 4,                                // 18: i32
+  };
+  bytes.insert(bytes.begin() + 7, pb.begin(), pb.end());
+  auto d = pb_decode(bytes, 0x1006);
+  ASSERT_NE(d.get(), nullptr);
+  EXPECT_EQ(d->equals(m), true);
+}
+
+TEST_F(PbTests, Malformed)
+{
+  std::vector<std::vector<uint8_t>> invalid = {
+    { 0x08, 0x96 },                     // truncated varint
+    { 0x12, 0x07, 't', 'e' },           // truncated string
+    { 0x1a, 0x02, 0x08 },               // truncated submessage
+    { 0x1a, 0x01, 0x08, 0x01 },         // submessage field overruns
+    { 0x22, 0x06, 0x03, 0x8e, 0x02 },   // truncated packed repeats
+    { 0x0a, 0x01, 0x01 },               // wire type mismatch
+    { 0x1b },                           // deprecated group
+    { 0x00, 0x01 },                     // field number 0
+  };
+  for (auto& bytes : invalid) {
+    auto p = std::make_unique<uint8_t []>(bytes.size());
+    memcpy(p.get(), bytes.data(), bytes.size());
+    ::mig::PbProto w(p, bytes.size(), 0x1006);
+    TestMessage1006 t;
+    EXPECT_EQ(w.from_wire(t), -1);
+  }
+}
+
+TEST_F(PbTests, Reencode)
+{
+  auto d = pb_decode(pb, 0x1006);
+  ASSERT_NE(d.get(), nullptr);
+  auto& d6 = static_cast<TestMessage1006&>(*d);
+  d6.param1 = 1;
+  m.param1 = 1;
+  d->to_wire();
+  EXPECT_EQ(wire_bytes(*d), wire_bytes(::mig::PbProto(m)));
+
+  // parameter id 0 has no field number
+  TestMessage1002 m2;
+  m2.param1.set();
+  EXPECT_EQ(::mig::PbProto(m2).to_wire(m2), -1);
+}
+
+//
+// Aligned layout tests
+//
+
+// larger fields first: param3, param5, param2, param4, param1
+static_assert(TestMessage1005View::fixed_offset(2) == 0, "int64_t");
+static_assert(TestMessage1005View::fixed_offset(4) == 8, "uint64_t");
+static_assert(TestMessage1005View::fixed_offset(1) == 16, "int32_t");
+static_assert(TestMessage1005View::fixed_offset(3) == 20, "uint16_t");
+static_assert(TestMessage1005View::fixed_offset(0) == 22, "int8_t");
+static_assert(TestMessage1005View::fixed_offset(5) == 24, "block size");
+
+TEST(AlignedTests, FixedBlock)
+{
+  TestMessage1005 m;
+  m.param1 = -1;
+  m.param2 = 0x01020304;
+  m.param3 = INT64_MIN;
+  m.param4 = 0xabcd;
+  m.param5 = UINT64_MAX - 1;
+
+  ::mig::AlignedProto w(m);
+  EXPECT_EQ(w.size(), 8u + 24u);
+  auto bytes = wire_bytes(w);
+  EXPECT_EQ(bytes[0], 0x05); // id 0x1005, little endian
+  EXPECT_EQ(bytes[1], 0x10);
+  EXPECT_EQ(bytes[4], 32);   // size
+  EXPECT_EQ(bytes[8 + 16], 0x04); // int32_t at 16
+  EXPECT_EQ(bytes[8 + 20], 0xcd); // uint16_t at 20
+
+  TestMessage1005View v(bytes.data(), bytes.size());
+  ASSERT_EQ(v.is_valid(), true);
+  EXPECT_EQ(v.param1(), -1);
+  EXPECT_EQ(v.param2(), 0x01020304);
+  EXPECT_EQ(v.param3(), INT64_MIN);
+  EXPECT_EQ(v.param4(), 0xabcd);
+  EXPECT_EQ(v.param5(), UINT64_MAX - 1);
+
+  // other message types and truncated frames are rejected
+  EXPECT_EQ(TestMessage1005View(bytes.data(), bytes.size() - 1).is_valid(), false);
+  EXPECT_EQ(TestMessage1004View(bytes.data(), bytes.size()).is_valid(), false);
+  EXPECT_EQ(v.param1(), -1);
+}
+
+TEST(AlignedTests, Table)
+{
+  TestMessage1004 m;
+  fill(m);
+  m.param2.set();
+  ::mig::string_t s("aligned");
+  m.param5.assign(s);
+  m.param9.append();
+  m.param9.append();
+  auto g = new TestGroup2;
+  g->param1 = -7;
+  ::mig::string_t s2("second");
+  g->param2.assign(s2);
+  m.param10.append(g);
+
+  ::mig::AlignedProto w(m);
+  auto bytes = wire_bytes(w);
+  EXPECT_EQ(bytes.size(), w.size());
+
+  TestMessage1004View v(bytes.data(), bytes.size());
+  ASSERT_EQ(v.is_valid(), true);
+  EXPECT_EQ(v.has_param1(), true);
+  EXPECT_EQ(v.param1(), 1);
+  EXPECT_EQ(v.has_param2(), true);
+  EXPECT_EQ(v.param3(), TestEnum1::VALUE2);
+  EXPECT_EQ(v.param4().size(), 3u);
+  EXPECT_EQ(v.param4().data()[2], 3);
+  EXPECT_STREQ(v.param5().data(), "aligned"); // terminated in place
+  EXPECT_EQ(v.param6(), "std");
+  EXPECT_EQ(v.has_param7(), true);
+  EXPECT_EQ(v.param7().has_param1(), true);
+  EXPECT_EQ(v.param7().param2(), 7u);
+  ASSERT_EQ(v.param8().size(), 2u);
+  EXPECT_EQ(v.param8()[0], 1u);
+  EXPECT_EQ(v.param8()[1], 2u);
+  EXPECT_EQ(v.param9(), 2u);
+  ASSERT_EQ(v.param10().size(), 2u);
+  EXPECT_EQ(v.param10()[0].param1(), 3);
+  EXPECT_EQ(v.param10()[0].has_param2(), false);
+  EXPECT_EQ(v.param10()[1].param1(), -7);
+  EXPECT_STREQ(v.param10()[1].param2().data(), "second");
+
+  // fixed size data is naturally aligned relative to the frame
+  EXPECT_EQ((v.param7().data() - bytes.data()) % 8, 0);
+  EXPECT_EQ((v.param10()[1].data() - bytes.data()) % 8, 0);
+
+  // absent parameters
+  TestMessage1004 e;
+  ::mig::AlignedProto we(e);
+  auto eb = wire_bytes(we);
+  TestMessage1004View ev(eb.data(), eb.size());
+  ASSERT_EQ(ev.is_valid(), true);
+  EXPECT_EQ(ev.has_param1(), false);
+  EXPECT_EQ(ev.has_param5(), false);
+  EXPECT_EQ(ev.param8().size(), 0u);
+  EXPECT_EQ(ev.param10().size(), 0u);
+}
+
+TEST(AlignedTests, RoundTrip)
+{
+  TestMessage1004 m;
+  fill(m);
+  m.param2.set();
+  m.param9.append();
+
+  ::mig::AlignedProto w(m);
+  auto bytes = wire_bytes(w);
+  auto p = std::make_unique<uint8_t []>(bytes.size());
+  memcpy(p.get(), bytes.data(), bytes.size());
+  ::mig::wire_format_ptr_t a = std::make_unique<::mig::AlignedProto>(p, bytes.size());
+  auto d = ::mig::Message::factory(a);
+  ASSERT_NE(d.get(), nullptr);
+  EXPECT_EQ(d->equals(m), true);
+
+  // corrupted table entry
+  bytes[8 + 4] = 0xff;
+  TestMessage1004View v(bytes.data(), bytes.size());
+  EXPECT_EQ(v.has_param1(), false);
+  p = std::make_unique<uint8_t []>(bytes.size());
+  memcpy(p.get(), bytes.data(), bytes.size());
+  ::mig::AlignedProto c(p, bytes.size());
+  TestMessage1004 t;
+  EXPECT_EQ(c.from_wire(t), -1);
+}
@@ -7,12 +7,12 @@
 //  --------------------
 //
 //  Source:  msg_tests.msg
-//  Sun Jan 20 21:22:40 2019
+//  Mon Oct 19 02:45:48 2026
 
 #ifndef _MSG_TESTS_MSG_H_
 #define _MSG_TESTS_MSG_H_
 
-#include "migmsg.h"
+#include "migrand.h"
 
 enum class TestEnum1 : ::mig::enum_t {
   VALUE1 = 0,
@@ -23,18 +23,45 @@ enum class TestEnum1 : ::mig::enum_t {
 class TestMessage1001 : public ::mig::Message {
 
   public:
-    TestMessage1001() : ::mig::Message(0x1001, m_params) {}
+    TestMessage1001() : ::mig::Message(0x1001, m_params, m_index, required_mask()) { bind(); }
     static ::mig::message_ptr_t create() { return std::make_unique<TestMessage1001>(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x0ULL; }
+
+    //! blank instance describing the message layout
+    static const TestMessage1001& schema() { static const TestMessage1001 m; return m; }
+
+    //! fill parameters with random content
+    void randomize(::mig::Random& r) {
+      (void)r;
+    }
 
   private:
     const ::mig::parameter_container_t m_params = {
     };
+    const ::mig::parameter_index_t m_index = {
+    };
+};
+
+//! Read only view of TestMessage1001 in the aligned layout
+class TestMessage1001View : public ::mig::LayoutView {
+
+  public:
+    TestMessage1001View(const uint8_t *p, size_t n) : ::mig::LayoutView(p, n, 0x1001, fixed_offset(0), 0) {}
+    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({ }, k); }
+
 };
 
 struct TestGroup1 : ::mig::Group {
 
   public:
-    TestGroup1() : ::mig::Group(m_params) {}
+    TestGroup1() : ::mig::Group(m_params, m_index, required_mask()) { bind(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x3ULL; }
+
+    //! fill parameters with random content
+    void randomize(::mig::Random& r) {
+      r.fill(param1);
+      r.fill(param2);
+    }
 
     ::mig::ScalarParameter<::mig::void_t> param1{0};
     ::mig::ScalarParameter<uint32_t> param2{9};
@@ -44,14 +71,54 @@ struct TestGroup1 : ::mig::Group {
       {0, param1},
       {9, param2},
     };
+    const ::mig::parameter_index_t m_index = {
+      &param1,
+      &param2,
+    };
+};
+
+//! Read only view of TestGroup1 in the aligned layout
+class TestGroup1View : public ::mig::LayoutView {
+
+  public:
+    TestGroup1View(const uint8_t *p, size_t n) : ::mig::LayoutView(p, n, fixed_offset(1), 1) {}
+    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({ sizeof(uint32_t), }, k); }
+
+    bool has_param1() const { return has(0); }
+    uint32_t param2() const { return fixed<uint32_t>(fixed_offset(0)); }
 };
 
 
 class TestMessage1002 : public ::mig::Message {
 
   public:
-    TestMessage1002() : ::mig::Message(0x1002, m_params) {}
+    TestMessage1002() : ::mig::Message(0x1002, m_params, m_index, required_mask()) { bind(); }
     static ::mig::message_ptr_t create() { return std::make_unique<TestMessage1002>(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x7ULL; }
+
+    //! blank instance describing the message layout
+    static const TestMessage1002& schema() { static const TestMessage1002 m; return m; }
+    static constexpr ::mig::field_t<::mig::void_t> field_param1() { return {0}; }
+    static int update_param2(::mig::WireFormat& w, uint8_t value) { return w.update(schema(), 1, value); }
+    static constexpr ::mig::field_t<uint8_t> field_param2() { return {1}; }
+    static int update_param3(::mig::WireFormat& w, int16_t value) { return w.update(schema(), 2, value); }
+    static constexpr ::mig::field_t<int16_t> field_param3() { return {2}; }
+    static int update_param4(::mig::WireFormat& w, uint32_t value) { return w.update(schema(), 3, value); }
+    static constexpr ::mig::field_t<uint32_t> field_param4() { return {3}; }
+    static int update_param5(::mig::WireFormat& w, TestEnum1 value) { return w.update(schema(), 12, (::mig::enum_t)value); }
+    static constexpr ::mig::field_t<TestEnum1> field_param5() { return {12}; }
+    static int update_param6(::mig::WireFormat& w, bool value) { return w.update(schema(), 13, value); }
+    static constexpr ::mig::field_t<bool> field_param6() { return {13}; }
+
+    //! fill parameters with random content
+    void randomize(::mig::Random& r) {
+      r.fill(param1);
+      r.fill(param2);
+      r.fill(param3);
+      if (r.chance(r.optional)) r.fill(param4); else param4.clear();
+      if (r.chance(r.optional)) r.fill(param5, { TestEnum1::VALUE1, TestEnum1::VALUE2 }); else param5.clear();
+      if (r.chance(r.optional)) r.fill(param6); else param6.clear();
+    }
 
     ::mig::ScalarParameter<::mig::void_t> param1{0};
     ::mig::ScalarParameter<uint8_t> param2{1};
@@ -69,13 +136,57 @@ class TestMessage1002 : public ::mig::Message {
       {12, param5},
       {13, param6},
     };
+    const ::mig::parameter_index_t m_index = {
+      &param1,
+      &param2,
+      &param3,
+      &param4,
+      &param5,
+      &param6,
+    };
+};
+
+//! Read only view of TestMessage1002 in the aligned layout
+class TestMessage1002View : public ::mig::LayoutView {
+
+  public:
+    TestMessage1002View(const uint8_t *p, size_t n) : ::mig::LayoutView(p, n, 0x1002, fixed_offset(2), 4) {}
+    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({ sizeof(uint8_t), sizeof(int16_t), }, k); }
+
+    bool has_param1() const { return has(0); }
+    uint8_t param2() const { return fixed<uint8_t>(fixed_offset(0)); }
+    int16_t param3() const { return fixed<int16_t>(fixed_offset(1)); }
+    bool has_param4() const { return has(1); }
+    uint32_t param4() const { return value<uint32_t>(1); }
+    bool has_param5() const { return has(2); }
+    TestEnum1 param5() const { return static_cast<TestEnum1>(value<::mig::enum_t>(2)); }
+    bool has_param6() const { return has(3); }
+    bool param6() const { return value<bool>(3); }
 };
 
 class TestMessage1003 : public ::mig::Message {
 
   public:
-    TestMessage1003() : ::mig::Message(0x1003, m_params) {}
+    TestMessage1003() : ::mig::Message(0x1003, m_params, m_index, required_mask()) { bind(); }
     static ::mig::message_ptr_t create() { return std::make_unique<TestMessage1003>(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x1dULL; }
+
+    //! blank instance describing the message layout
+    static const TestMessage1003& schema() { static const TestMessage1003 m; return m; }
+    static constexpr ::mig::field_t<::mig::blob_t> field_param2() { return {4}; }
+    static constexpr ::mig::field_t<::mig::string_t> field_param1() { return {2}; }
+    static constexpr ::mig::field_t<::mig::void_t> field_param4() { return {3}; }
+    static int update_param5(::mig::WireFormat& w, uint8_t value) { return w.update(schema(), 5, value); }
+    static constexpr ::mig::field_t<uint8_t> field_param5() { return {5}; }
+
+    //! fill parameters with random content
+    void randomize(::mig::Random& r) {
+      r.fill(param2);
+      r.fill(param1);
+      r.fill(param3);
+      if (r.chance(r.optional)) r.fill(param4); else param4.clear();
+      r.fill(param5);
+    }
 
     ::mig::VarParameter<::mig::blob_t> param2{4};
     ::mig::VarParameter<::mig::string_t> param1{2};
@@ -91,6 +202,453 @@ class TestMessage1003 : public ::mig::Message {
       {3, param4},
       {5, param5},
     };
+    const ::mig::parameter_index_t m_index = {
+      &param1,
+      &param4,
+      &param2,
+      &param5,
+      &param3,
+    };
+};
+
+//! Read only view of TestMessage1003 in the aligned layout
+class TestMessage1003View : public ::mig::LayoutView {
+
+  public:
+    TestMessage1003View(const uint8_t *p, size_t n) : ::mig::LayoutView(p, n, 0x1003, fixed_offset(1), 4) {}
+    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({ sizeof(uint8_t), }, k); }
+
+    bool has_param1() const { return has(0); }
+    ::mig::string_t param1() const { return var<::mig::string_t>(0); }
+    bool has_param4() const { return has(1); }
+    bool has_param2() const { return has(2); }
+    ::mig::blob_t param2() const { return var<::mig::blob_t>(2); }
+    uint8_t param5() const { return fixed<uint8_t>(fixed_offset(0)); }
+    bool has_param3() const { return has(3); }
+    TestGroup1View param3() const { return group<TestGroup1View>(3); }
+};
+
+struct TestGroup2 : ::mig::Group {
+
+  public:
+    TestGroup2() : ::mig::Group(m_params, m_index, required_mask()) { bind(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x1ULL; }
+
+    //! fill parameters with random content
+    void randomize(::mig::Random& r) {
+      r.fill(param1);
+      if (r.chance(r.optional)) r.fill(param2); else param2.clear();
+    }
+
+    ::mig::ScalarParameter<int16_t> param1{1};
+    ::mig::VarParameter<::mig::string_t> param2{2, ::mig::OPTIONAL};
+
+  private:
+    const ::mig::parameter_container_t m_params = {
+      {1, param1},
+      {2, param2},
+    };
+    const ::mig::parameter_index_t m_index = {
+      &param1,
+      &param2,
+    };
+};
+
+//! Read only view of TestGroup2 in the aligned layout
+class TestGroup2View : public ::mig::LayoutView {
+
+  public:
+    TestGroup2View(const uint8_t *p, size_t n) : ::mig::LayoutView(p, n, fixed_offset(1), 1) {}
+    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({ sizeof(int16_t), }, k); }
+
+    int16_t param1() const { return fixed<int16_t>(fixed_offset(0)); }
+    bool has_param2() const { return has(0); }
+    ::mig::string_t param2() const { return var<::mig::string_t>(0); }
+};
+
+
+class TestMessage1004 : public ::mig::Message {
+
+  public:
+    TestMessage1004() : ::mig::Message(0x1004, m_params, m_index, required_mask()) { bind(); }
+    static ::mig::message_ptr_t create() { return std::make_unique<TestMessage1004>(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x0ULL; }
+
+    //! blank instance describing the message layout
+    static const TestMessage1004& schema() { static const TestMessage1004 m; return m; }
+    static int update_param1(::mig::WireFormat& w, uint16_t value) { return w.update(schema(), 1, value); }
+    static constexpr ::mig::field_t<uint16_t> field_param1() { return {1}; }
+    static constexpr ::mig::field_t<::mig::void_t> field_param2() { return {2}; }
+    static int update_param3(::mig::WireFormat& w, TestEnum1 value) { return w.update(schema(), 3, (::mig::enum_t)value); }
+    static constexpr ::mig::field_t<TestEnum1> field_param3() { return {3}; }
+    static constexpr ::mig::field_t<::mig::blob_t> field_param4() { return {4}; }
+    static constexpr ::mig::field_t<::mig::string_t> field_param5() { return {5}; }
+    static constexpr ::mig::field_t<std::string> field_param6() { return {6}; }
+
+    //! fill parameters with random content
+    void randomize(::mig::Random& r) {
+      if (r.chance(r.optional)) r.fill(param1); else param1.clear();
+      if (r.chance(r.optional)) r.fill(param2); else param2.clear();
+      if (r.chance(r.optional)) r.fill(param3, { TestEnum1::VALUE1, TestEnum1::VALUE2 }); else param3.clear();
+      if (r.chance(r.optional)) r.fill(param4); else param4.clear();
+      if (r.chance(r.optional)) r.fill(param5); else param5.clear();
+      if (r.chance(r.optional)) r.fill(param6); else param6.clear();
+      if (r.chance(r.optional)) r.fill(param7); else param7.clear();
+      if (r.chance(r.optional)) r.fill(param8); else param8.clear();
+      if (r.chance(r.optional)) r.fill(param9); else param9.clear();
+      if (r.chance(r.optional)) r.fill(param10); else param10.clear();
+    }
+
+    ::mig::ScalarParameter<uint16_t> param1{1, ::mig::OPTIONAL};
+    ::mig::ScalarParameter<::mig::void_t> param2{2, ::mig::OPTIONAL};
+    ::mig::EnumParameter<TestEnum1> param3{3, ::mig::OPTIONAL};
+    ::mig::VarParameter<::mig::blob_t> param4{4, ::mig::OPTIONAL};
+    ::mig::VarParameter<::mig::string_t> param5{5, ::mig::OPTIONAL};
+    ::mig::VarParameter<std::string> param6{6, ::mig::OPTIONAL};
+    ::mig::GroupParameter<TestGroup1> param7{7, ::mig::OPTIONAL};
+    ::mig::ScalarArray<uint32_t> param8{8, ::mig::OPTIONAL};
+    ::mig::ScalarArray<::mig::void_t> param9{9, ::mig::OPTIONAL};
+    ::mig::GroupArray<TestGroup2> param10{10, ::mig::OPTIONAL};
+
+  private:
+    const ::mig::parameter_container_t m_params = {
+      {1, param1},
+      {2, param2},
+      {3, param3},
+      {4, param4},
+      {5, param5},
+      {6, param6},
+      {7, param7},
+      {8, param8},
+      {9, param9},
+      {10, param10},
+    };
+    const ::mig::parameter_index_t m_index = {
+      &param1,
+      &param2,
+      &param3,
+      &param4,
+      &param5,
+      &param6,
+      &param7,
+      &param8,
+      &param9,
+      &param10,
+    };
+};
+
+//! Read only view of TestMessage1004 in the aligned layout
+class TestMessage1004View : public ::mig::LayoutView {
+
+  public:
+    TestMessage1004View(const uint8_t *p, size_t n) : ::mig::LayoutView(p, n, 0x1004, fixed_offset(0), 10) {}
+    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({ }, k); }
+
+    bool has_param1() const { return has(0); }
+    uint16_t param1() const { return value<uint16_t>(0); }
+    bool has_param2() const { return has(1); }
+    bool has_param3() const { return has(2); }
+    TestEnum1 param3() const { return static_cast<TestEnum1>(value<::mig::enum_t>(2)); }
+    bool has_param4() const { return has(3); }
+    ::mig::blob_t param4() const { return var<::mig::blob_t>(3); }
+    bool has_param5() const { return has(4); }
+    ::mig::string_t param5() const { return var<::mig::string_t>(4); }
+    bool has_param6() const { return has(5); }
+    std::string param6() const { return var<std::string>(5); }
+    bool has_param7() const { return has(6); }
+    TestGroup1View param7() const { return group<TestGroup1View>(6); }
+    ::mig::array_view<uint32_t> param8() const { return array<uint32_t>(7); }
+    size_t param9() const { return count(8); }
+    ::mig::group_array_view<TestGroup2View> param10() const { return groups<TestGroup2View>(9); }
+};
+
+class TestMessage1005 : public ::mig::Message {
+
+  public:
+    TestMessage1005() : ::mig::Message(0x1005, m_params, m_index, required_mask()) { bind(); }
+    static ::mig::message_ptr_t create() { return std::make_unique<TestMessage1005>(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x1fULL; }
+
+    //! blank instance describing the message layout
+    static const TestMessage1005& schema() { static const TestMessage1005 m; return m; }
+    static int update_param1(::mig::WireFormat& w, int8_t value) { return w.update(schema(), 1, value); }
+    static constexpr ::mig::field_t<int8_t> field_param1() { return {1}; }
+    static int update_param2(::mig::WireFormat& w, int32_t value) { return w.update(schema(), 2, value); }
+    static constexpr ::mig::field_t<int32_t> field_param2() { return {2}; }
+    static int update_param3(::mig::WireFormat& w, int64_t value) { return w.update(schema(), 3, value); }
+    static constexpr ::mig::field_t<int64_t> field_param3() { return {3}; }
+    static int update_param4(::mig::WireFormat& w, uint16_t value) { return w.update(schema(), 4, value); }
+    static constexpr ::mig::field_t<uint16_t> field_param4() { return {4}; }
+    static int update_param5(::mig::WireFormat& w, uint64_t value) { return w.update(schema(), 5, value); }
+    static constexpr ::mig::field_t<uint64_t> field_param5() { return {5}; }
+
+    //! fill parameters with random content
+    void randomize(::mig::Random& r) {
+      r.fill(param1);
+      r.fill(param2);
+      r.fill(param3);
+      r.fill(param4);
+      r.fill(param5);
+    }
+
+    ::mig::ScalarParameter<int8_t> param1{1};
+    ::mig::ScalarParameter<int32_t> param2{2};
+    ::mig::ScalarParameter<int64_t> param3{3};
+    ::mig::ScalarParameter<uint16_t> param4{4};
+    ::mig::ScalarParameter<uint64_t> param5{5};
+
+  private:
+    const ::mig::parameter_container_t m_params = {
+      {1, param1},
+      {2, param2},
+      {3, param3},
+      {4, param4},
+      {5, param5},
+    };
+    const ::mig::parameter_index_t m_index = {
+      &param1,
+      &param2,
+      &param3,
+      &param4,
+      &param5,
+    };
+};
+
+//! Read only view of TestMessage1005 in the aligned layout
+class TestMessage1005View : public ::mig::LayoutView {
+
+  public:
+    TestMessage1005View(const uint8_t *p, size_t n) : ::mig::LayoutView(p, n, 0x1005, fixed_offset(5), 0) {}
+    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({ sizeof(int8_t), sizeof(int32_t), sizeof(int64_t), sizeof(uint16_t), sizeof(uint64_t), }, k); }
+
+    int8_t param1() const { return fixed<int8_t>(fixed_offset(0)); }
+    int32_t param2() const { return fixed<int32_t>(fixed_offset(1)); }
+    int64_t param3() const { return fixed<int64_t>(fixed_offset(2)); }
+    uint16_t param4() const { return fixed<uint16_t>(fixed_offset(3)); }
+    uint64_t param5() const { return fixed<uint64_t>(fixed_offset(4)); }
+};
+
+class TestMessage1006 : public ::mig::Message {
+
+  public:
+    TestMessage1006() : ::mig::Message(0x1006, m_params, m_index, required_mask()) { bind(); }
+    static ::mig::message_ptr_t create() { return std::make_unique<TestMessage1006>(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x0ULL; }
+
+    //! blank instance describing the message layout
+    static const TestMessage1006& schema() { static const TestMessage1006 m; return m; }
+    static int update_param1(::mig::WireFormat& w, int32_t value) { return w.update(schema(), 1, value); }
+    static constexpr ::mig::field_t<int32_t> field_param1() { return {1}; }
+    static constexpr ::mig::field_t<::mig::string_t> field_param2() { return {2}; }
+    static int update_param5(::mig::WireFormat& w, TestEnum1 value) { return w.update(schema(), 5, (::mig::enum_t)value); }
+    static constexpr ::mig::field_t<TestEnum1> field_param5() { return {5}; }
+    static int update_param6(::mig::WireFormat& w, bool value) { return w.update(schema(), 6, value); }
+    static constexpr ::mig::field_t<bool> field_param6() { return {6}; }
+    static int update_param8(::mig::WireFormat& w, int64_t value) { return w.update(schema(), 8, value); }
+    static constexpr ::mig::field_t<int64_t> field_param8() { return {8}; }
+    static constexpr ::mig::field_t<::mig::void_t> field_param9() { return {9}; }
+
+    //! fill parameters with random content
+    void randomize(::mig::Random& r) {
+      if (r.chance(r.optional)) r.fill(param1); else param1.clear();
+      if (r.chance(r.optional)) r.fill(param2); else param2.clear();
+      if (r.chance(r.optional)) r.fill(param3); else param3.clear();
+      if (r.chance(r.optional)) r.fill(param4); else param4.clear();
+      if (r.chance(r.optional)) r.fill(param5, { TestEnum1::VALUE1, TestEnum1::VALUE2 }); else param5.clear();
+      if (r.chance(r.optional)) r.fill(param6); else param6.clear();
+      if (r.chance(r.optional)) r.fill(param7); else param7.clear();
+      if (r.chance(r.optional)) r.fill(param8); else param8.clear();
+      if (r.chance(r.optional)) r.fill(param9); else param9.clear();
+    }
+
+    ::mig::ScalarParameter<int32_t> param1{1, ::mig::OPTIONAL};
+    ::mig::VarParameter<::mig::string_t> param2{2, ::mig::OPTIONAL};
+    ::mig::GroupParameter<TestGroup2> param3{3, ::mig::OPTIONAL};
+    ::mig::ScalarArray<uint32_t> param4{4, ::mig::OPTIONAL};
+    ::mig::EnumParameter<TestEnum1> param5{5, ::mig::OPTIONAL};
+    ::mig::ScalarParameter<bool> param6{6, ::mig::OPTIONAL};
+    ::mig::GroupArray<TestGroup2> param7{7, ::mig::OPTIONAL};
+    ::mig::ScalarParameter<int64_t> param8{8, ::mig::OPTIONAL};
+    ::mig::ScalarParameter<::mig::void_t> param9{9, ::mig::OPTIONAL};
+
+  private:
+    const ::mig::parameter_container_t m_params = {
+      {1, param1},
+      {2, param2},
+      {3, param3},
+      {4, param4},
+      {5, param5},
+      {6, param6},
+      {7, param7},
+      {8, param8},
+      {9, param9},
+    };
+    const ::mig::parameter_index_t m_index = {
+      &param1,
+      &param2,
+      &param3,
+      &param4,
+      &param5,
+      &param6,
+      &param7,
+      &param8,
+      &param9,
+    };
+};
+
+//! Read only view of TestMessage1006 in the aligned layout
+class TestMessage1006View : public ::mig::LayoutView {
+
+  public:
+    TestMessage1006View(const uint8_t *p, size_t n) : ::mig::LayoutView(p, n, 0x1006, fixed_offset(0), 9) {}
+    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({ }, k); }
+
+    bool has_param1() const { return has(0); }
+    int32_t param1() const { return value<int32_t>(0); }
+    bool has_param2() const { return has(1); }
+    ::mig::string_t param2() const { return var<::mig::string_t>(1); }
+    bool has_param3() const { return has(2); }
+    TestGroup2View param3() const { return group<TestGroup2View>(2); }
+    ::mig::array_view<uint32_t> param4() const { return array<uint32_t>(3); }
+    bool has_param5() const { return has(4); }
+    TestEnum1 param5() const { return static_cast<TestEnum1>(value<::mig::enum_t>(4)); }
+    bool has_param6() const { return has(5); }
+    bool param6() const { return value<bool>(5); }
+    ::mig::group_array_view<TestGroup2View> param7() const { return groups<TestGroup2View>(6); }
+    bool has_param8() const { return has(7); }
+    int64_t param8() const { return value<int64_t>(7); }
+    bool has_param9() const { return has(8); }
+};
+
+class TestMessage1007 : public ::mig::Message {
+
+  public:
+    TestMessage1007() : ::mig::Message(0x1007, m_params, m_index, required_mask()) { bind(); }
+    static ::mig::message_ptr_t create() { return std::make_unique<TestMessage1007>(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x1ULL; }
+
+    //! blank instance describing the message layout
+    static const TestMessage1007& schema() { static const TestMessage1007 m; return m; }
+    static int update_param1(::mig::WireFormat& w, uint8_t value) { return w.update(schema(), 1, value); }
+    static constexpr ::mig::field_t<uint8_t> field_param1() { return {1}; }
+    static constexpr ::mig::field_t<::mig::blob_t> field_param2() { return {2}; }
+
+    //! fill parameters with random content
+    void randomize(::mig::Random& r) {
+      r.fill(param1);
+      if (r.chance(r.optional)) r.fill(param2); else param2.clear();
+      if (r.chance(r.optional)) r.fill(param3); else param3.clear();
+    }
+
+    ::mig::ScalarParameter<uint8_t> param1{1};
+    ::mig::VarParameter<::mig::blob_t> param2{2, ::mig::OPTIONAL};
+    ::mig::GroupParameter<TestGroup2> param3{300, ::mig::OPTIONAL};
+
+  private:
+    const ::mig::parameter_container_t m_params = {
+      {1, param1},
+      {2, param2},
+      {300, param3},
+    };
+    const ::mig::parameter_index_t m_index = {
+      &param1,
+      &param2,
+      &param3,
+    };
+};
+
+//! Read only view of TestMessage1007 in the aligned layout
+class TestMessage1007View : public ::mig::LayoutView {
+
+  public:
+    TestMessage1007View(const uint8_t *p, size_t n) : ::mig::LayoutView(p, n, 0x1007, fixed_offset(1), 2) {}
+    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({ sizeof(uint8_t), }, k); }
+
+    uint8_t param1() const { return fixed<uint8_t>(fixed_offset(0)); }
+    bool has_param2() const { return has(0); }
+    ::mig::blob_t param2() const { return var<::mig::blob_t>(0); }
+    bool has_param3() const { return has(1); }
+    TestGroup2View param3() const { return group<TestGroup2View>(1); }
+};
+
+class TestMessage1008 : public ::mig::Message {
+
+  public:
+    TestMessage1008() : ::mig::Message(0x1008, m_params, m_index, required_mask()) { bind(); }
+    static ::mig::message_ptr_t create() { return std::make_unique<TestMessage1008>(); }
+    static constexpr ::mig::presence_t required_mask() { return 0x5ULL; }
+
+    //! blank instance describing the message layout
+    static const TestMessage1008& schema() { static const TestMessage1008 m; return m; }
+    static int update_param1(::mig::WireFormat& w, uint32_t value) { return w.update(schema(), 1, value); }
+    static constexpr ::mig::field_t<uint32_t> field_param1() { return {1}; }
+    static constexpr ::mig::field_t<::mig::string_t> field_param2() { return {2}; }
+    static int update_param3(::mig::WireFormat& w, TestEnum1 value) { return w.update(schema(), 3, (::mig::enum_t)value); }
+    static constexpr ::mig::field_t<TestEnum1> field_param3() { return {3}; }
+    static constexpr ::mig::field_t<::mig::blob_t> field_param4() { return {4}; }
+
+    //! hash of the routing key
+    uint64_t key() const {
+      ::mig::KeyHash h;
+      h.add(param1);
+      h.add(param2);
+      h.add(param3);
+      return h.value();
+    }
+    //! hash of the routing key of an encoded frame, without decoding it
+    static int key(const ::mig::WireFormat& w, uint64_t& hash) {
+      ::mig::KeyHash h;
+      if (h.add<uint32_t>(w, schema(), 1, false) != 0)
+        return -1;
+      if (h.add<::mig::string_t>(w, schema(), 2, true) != 0)
+        return -1;
+      if (h.add<::mig::enum_t>(w, schema(), 3, false) != 0)
+        return -1;
+      hash = h.value();
+      return 0;
+    }
+
+    //! fill parameters with random content
+    void randomize(::mig::Random& r) {
+      r.fill(param1);
+      if (r.chance(r.optional)) r.fill(param2); else param2.clear();
+      r.fill(param3, { TestEnum1::VALUE1, TestEnum1::VALUE2 });
+      if (r.chance(r.optional)) r.fill(param4); else param4.clear();
+    }
+
+    ::mig::ScalarParameter<uint32_t> param1{1};
+    ::mig::VarParameter<::mig::string_t> param2{2, ::mig::OPTIONAL};
+    ::mig::EnumParameter<TestEnum1> param3{3};
+    ::mig::VarParameter<::mig::blob_t> param4{4, ::mig::OPTIONAL};
+
+  private:
+    const ::mig::parameter_container_t m_params = {
+      {1, param1},
+      {2, param2},
+      {3, param3},
+      {4, param4},
+    };
+    const ::mig::parameter_index_t m_index = {
+      &param1,
+      &param2,
+      &param3,
+      &param4,
+    };
+};
+
+//! Read only view of TestMessage1008 in the aligned layout
+class TestMessage1008View : public ::mig::LayoutView {
+
+  public:
+    TestMessage1008View(const uint8_t *p, size_t n) : ::mig::LayoutView(p, n, 0x1008, fixed_offset(2), 2) {}
+    static constexpr size_t fixed_offset(int k) { return ::mig::layout::fixed_offset({ sizeof(uint32_t), sizeof(::mig::enum_t), }, k); }
+
+    uint32_t param1() const { return fixed<uint32_t>(fixed_offset(0)); }
+    bool has_param2() const { return has(0); }
+    ::mig::string_t param2() const { return var<::mig::string_t>(0); }
+    TestEnum1 param3() const { return static_cast<TestEnum1>(fixed<::mig::enum_t>(fixed_offset(1))); }
+    bool has_param4() const { return has(1); }
+    ::mig::blob_t param4() const { return var<::mig::blob_t>(1); }
 };
 
 
@@ -98,6 +656,70 @@ const std::map<int, mig::MessageCreatorFunc> mig::Message::creators {
   { 0x1001, TestMessage1001::create },
   { 0x1002, TestMessage1002::create },
   { 0x1003, TestMessage1003::create },
+  { 0x1004, TestMessage1004::create },
+  { 0x1005, TestMessage1005::create },
+  { 0x1006, TestMessage1006::create },
+  { 0x1007, TestMessage1007::create },
+  { 0x1008, TestMessage1008::create },
+  };
+
+//! position of a message id in MessageDispatcher, -1 if not in the schema
+inline int message_index(int id) {
+  switch (id) {
+  case 0x1001: return 0;
+  case 0x1002: return 1;
+  case 0x1003: return 2;
+  case 0x1004: return 3;
+  case 0x1005: return 4;
+  case 0x1006: return 5;
+  case 0x1007: return 6;
+  case 0x1008: return 7;
+  default: return -1;
+  }
+}
+
+//! dispatcher of the messages in msg_tests.msg to typed handlers
+template <class Handler>
+using MessageDispatcher = ::mig::Dispatcher<message_index, Handler,
+  TestMessage1001,
+  TestMessage1002,
+  TestMessage1003,
+  TestMessage1004,
+  TestMessage1005,
+  TestMessage1006,
+  TestMessage1007,
+  TestMessage1008>;
+
+template <class Handler>
+MessageDispatcher<Handler> make_dispatcher(Handler handler) {
+  return MessageDispatcher<Handler>(std::move(handler));
+}
+
+//! hash of the routing key of a message, -1 if it has no key
+inline int message_key(const ::mig::Message& msg, uint64_t& hash) {
+  switch (msg.id()) {
+  case 0x1008: hash = static_cast<const TestMessage1008&>(msg).key(); return 0;
+  default: return -1;
+  }
+}
+
+//! hash of the routing key of an encoded frame, -1 if it has no key
+inline int message_key(const ::mig::WireFormat& w, uint64_t& hash) {
+  switch (w.id()) {
+  case 0x1008: return TestMessage1008::key(w, hash);
+  default: return -1;
+  }
+}
+
+const std::map<int, mig::RandomizerFunc> mig::Random::randomizers {
+  { 0x1001, [](mig::Message& m, mig::Random& r) { static_cast<TestMessage1001&>(m).randomize(r); } },
+  { 0x1002, [](mig::Message& m, mig::Random& r) { static_cast<TestMessage1002&>(m).randomize(r); } },
+  { 0x1003, [](mig::Message& m, mig::Random& r) { static_cast<TestMessage1003&>(m).randomize(r); } },
+  { 0x1004, [](mig::Message& m, mig::Random& r) { static_cast<TestMessage1004&>(m).randomize(r); } },
+  { 0x1005, [](mig::Message& m, mig::Random& r) { static_cast<TestMessage1005&>(m).randomize(r); } },
+  { 0x1006, [](mig::Message& m, mig::Random& r) { static_cast<TestMessage1006&>(m).randomize(r); } },
+  { 0x1007, [](mig::Message& m, mig::Random& r) { static_cast<TestMessage1007&>(m).randomize(r); } },
+  { 0x1008, [](mig::Message& m, mig::Random& r) { static_cast<TestMessage1008&>(m).randomize(r); } },
   };
 
 #endif // ifndef _MSG_TESTS_MSG_H_
@@ -0,0 +1,538 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _MSGBUF_H_
+#define _MSGBUF_H_
+
+//
+// Plain heap buffer for the sample wire formats
+//
+
+#include "migmsg.h"
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <vector>
+#include <cerrno>
+#include <climits>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+namespace mig {
+
+class msgbuf : public MsgBuf {
+  
+  public:
+    msgbuf(size_t n) { alloc_buf(n); }
+    msgbuf(storage_ptr_t& p, size_t n) { set_buf(p, n); }
+    //! buffer over n bytes of memory owned by someone else
+    msgbuf(const uint8_t *p, size_t n, bool readonly) {
+      m_ptr = (uint8_t *)p;
+      m_size = n;
+      m_readonly = readonly;
+    }
+    //! point a buffer at other memory, read only
+    void view(const uint8_t *p, size_t n) {
+      m_data = nullptr;
+      m_region = nullptr;
+      m_ptr = (uint8_t *)p;
+      m_size = n;
+      m_readonly = true;
+      m_next = 0;
+    }
+    //! read only buffer of n bytes at offset of a mapped file region
+    msgbuf(const region_ptr_t& r, size_t offset, size_t n) : m_region(r) {
+      m_ptr = (uint8_t *)r->data() + offset;
+      m_size = n;
+      m_readonly = true;
+    }
+    ~msgbuf() {}
+    
+    int alloc_buf(size_t n) override {
+      m_data = std::make_unique<uint8_t []>(n);
+      m_ptr = m_data.get();
+      m_region = nullptr;
+      m_readonly = false;
+      m_size = n;
+      m_next = 0;
+      return 0;
+    }
+    int set_buf(storage_ptr_t& p, size_t n) override 
+      { m_data = std::move(p); m_ptr = m_data.get(); m_region = nullptr;
+        m_readonly = false; m_size = n; m_next=0; return 0; }
+    
+    int putc(uint8_t c) override {
+      if (m_ptr && !m_readonly && m_next < m_size ) {
+        m_ptr[m_next] = c;
+        m_next++;
+        return 0;
+      }
+      return -1;
+    }
+    
+    int putp(const uint8_t *p, size_t n) override { 
+      if (!m_ptr || m_readonly || m_next + n > m_size)
+        return -1; // does not fit
+      memcpy(&m_ptr[m_next], p, n);
+      m_next += n;
+      return 0;
+    }
+
+    uint8_t getc() override {
+      if (m_ptr && m_next < m_size ) {
+        uint8_t c = m_ptr[m_next];
+        m_next++;
+        return c;
+      }
+      return 0xff;
+    }
+    
+    uint8_t *getp(size_t n) const override {
+        if (m_ptr && m_next + n <= m_size)
+          return &m_ptr[m_next];
+        return nullptr;
+    }
+
+    int advance(int n) override { 
+        if (m_next + n <= m_size) 
+          m_next += n;
+        else
+          m_next = m_size;
+        return m_next;
+    }
+
+    int reverse(int n) override { 
+        if (m_next - n > 0)
+          m_next -= n;
+        else
+          m_next = 0; 
+        return m_next;
+    }
+
+    void reset() override { m_next = 0; }
+  
+    size_t size() const override { return m_size; }
+
+    size_t offset() const override { return m_next; }
+
+    void hexdump(std::ostream& os) const override {
+      os << std::setfill('0');
+      for (auto i=0; i < m_size; i++)
+        os << std::hex << std::setw(2) << int(m_ptr[i]) << ' ';
+      os << '\n';
+    }
+
+  private:
+    
+    storage_ptr_t m_data = nullptr;
+    region_ptr_t m_region = nullptr; //!< keeps a mapped buffer alive
+    uint8_t *m_ptr = nullptr;
+    bool m_readonly = false;
+    size_t m_size = 0;
+    int m_next = 0;
+};
+
+
+//! Buffer which only counts the bytes put into it
+class countbuf : public MsgBuf {
+
+  public:
+    int alloc_buf(size_t) override { return -1; }
+    int set_buf(storage_ptr_t&, size_t) override { return -1; }
+    int putc(uint8_t) override { m_count++; return 0; }
+    int putp(const uint8_t *, size_t n) override { m_count += n; return 0; }
+    uint8_t getc() override { return 0; }
+    uint8_t *getp(size_t) const override { return nullptr; }
+    void reset() override { m_count = 0; }
+    int advance(int n) override { m_count += n; return m_count; }
+    int reverse(int n) override { m_count -= n; return m_count; }
+    size_t size() const override { return m_count; }
+    size_t offset() const override { return m_count; }
+    void hexdump(std::ostream&) const override {}
+
+  private:
+    size_t m_count = 0;
+};
+
+//! consumes n bytes, returns 0 on success
+typedef std::function<int(const uint8_t *, size_t)> sink_t;
+//! reads at most n bytes, returns the number of bytes read, 0 at the end
+typedef std::function<ssize_t(uint8_t *, size_t)> source_t;
+
+//! Write only buffer which passes the data to a sink chunk by chunk
+class streambuf : public MsgBuf {
+
+  public:
+    streambuf(const sink_t& sink, size_t chunk) : m_sink(sink) { alloc_buf(chunk); }
+
+    int alloc_buf(size_t n) override {
+      m_data = std::make_unique<uint8_t []>(n);
+      m_size = n;
+      m_used = 0;
+      return 0;
+    }
+    int set_buf(storage_ptr_t&, size_t) override { return -1; }
+
+    int putc(uint8_t c) override {
+      if (m_used == m_size && flush() != 0)
+        return -1;
+      m_data[m_used++] = c;
+      m_count++;
+      return 0;
+    }
+
+    int putp(const uint8_t *p, size_t n) override {
+      if (m_used + n > m_size && flush() != 0)
+        return -1;
+      m_count += n;
+      if (n >= m_size)
+        return emit(p, n); // large data bypasses the chunk
+      memcpy(&m_data[m_used], p, n);
+      m_used += n;
+      return 0;
+    }
+
+    //! pass buffered data to the sink, returns non-zero after any sink error
+    int flush() {
+      if (m_used > 0)
+        emit(m_data.get(), m_used);
+      m_used = 0;
+      return m_error;
+    }
+
+    uint8_t getc() override { return 0xff; }
+    uint8_t *getp(size_t) const override { return nullptr; }
+    void reset() override {} // written data cannot be revisited
+    int advance(int) override { return -1; }
+    int reverse(int) override { return -1; }
+    size_t size() const override { return m_size; }
+    size_t offset() const override { return m_count; }
+
+    void hexdump(std::ostream& os) const override {
+      os << std::setfill('0');
+      for (size_t i=0; i < m_used; i++)
+        os << std::hex << std::setw(2) << int(m_data[i]) << ' ';
+      os << '\n';
+    }
+
+  private:
+    int emit(const uint8_t *p, size_t n) {
+      if (m_error == 0 && m_sink(p, n) != 0)
+        m_error = -1;
+      return m_error;
+    }
+
+    sink_t m_sink;
+    storage_ptr_t m_data = nullptr;
+    size_t m_size = 0; //!< chunk size
+    size_t m_used = 0; //!< bytes waiting in the chunk
+    size_t m_count = 0; //!< bytes put in total
+    int m_error = 0;
+};
+
+//! Read only buffer which pulls the data from a source
+//
+// getp() makes at most a chunk of data available, getn() copies larger
+// areas directly from the source. The source is not read past the limit.
+//
+class sourcebuf : public MsgBuf {
+
+  public:
+    sourcebuf(const source_t& source, size_t chunk) : m_source(source) { alloc_buf(chunk); }
+
+    int alloc_buf(size_t n) override {
+      m_data = std::make_unique<uint8_t []>(n);
+      m_size = n;
+      m_next = m_end = 0;
+      return 0;
+    }
+    int set_buf(storage_ptr_t&, size_t) override { return -1; }
+
+    //! total number of bytes which may be read from the source
+    void set_limit(size_t n) { m_limit = n; }
+
+    int putc(uint8_t) override { return -1; }
+    int putp(const uint8_t *, size_t) override { return -1; }
+
+    uint8_t getc() override {
+      if (!fill(1))
+        return 0xff;
+      m_count++;
+      return m_data[m_next++];
+    }
+
+    uint8_t *getp(size_t n) const override {
+      return fill(n) ? &m_data[m_next] : nullptr;
+    }
+
+    int getn(uint8_t *p, size_t n) override {
+      size_t k = std::min(n, m_end - m_next);
+      memcpy(p, &m_data[m_next], k);
+      m_next += k;
+      m_count += k;
+      for (ssize_t r; k < n; k += r, m_count += r) {
+        if (m_read + n - k > m_limit || (r = m_source(p + k, n - k)) <= 0)
+          return -1;
+        m_read += r;
+      }
+      return 0;
+    }
+
+    int advance(int n) override {
+      while (n > 0 && fill(1)) {
+        size_t k = std::min((size_t)n, m_end - m_next);
+        m_next += k;
+        m_count += k;
+        n -= k;
+      }
+      return m_count;
+    }
+
+    int reverse(int) override { return -1; }
+    void reset() override {} // consumed data cannot be revisited
+    size_t size() const override { return m_size; }
+    size_t offset() const override { return m_count; }
+
+    void hexdump(std::ostream& os) const override {
+      os << std::setfill('0');
+      for (size_t i=m_next; i < m_end; i++)
+        os << std::hex << std::setw(2) << int(m_data[i]) << ' ';
+      os << '\n';
+    }
+
+  private:
+    //! make n bytes available at m_next
+    bool fill(size_t n) const {
+      if (m_end - m_next >= n)
+        return true;
+      if (n > m_size)
+        return false;
+      memmove(m_data.get(), &m_data[m_next], m_end - m_next);
+      m_end -= m_next;
+      m_next = 0;
+      while (m_end < n) {
+        size_t want = std::min(m_size - m_end, m_limit - m_read);
+        ssize_t r = (want > 0) ? m_source(&m_data[m_end], want) : 0;
+        if (r <= 0)
+          return false;
+        m_end += r;
+        m_read += r;
+      }
+      return true;
+    }
+
+    source_t m_source;
+    storage_ptr_t m_data = nullptr;
+    size_t m_size = 0; //!< chunk size
+    mutable size_t m_next = 0; //!< read position in the chunk
+    mutable size_t m_end = 0; //!< end of data in the chunk
+    mutable size_t m_read = 0; //!< bytes read from the source
+    size_t m_limit = 0;
+    size_t m_count = 0; //!< bytes consumed
+};
+
+//! Write only gather buffer for sending a frame to a descriptor
+//
+// Small data is copied into the buffer, data of at least threshold bytes
+// is referred to where it is. Mapped file regions are sent with
+// sendfile(), the rest with writev(). Referred data must stay valid
+// until send() returns.
+//
+class iovbuf : public MsgBuf {
+
+  public:
+    iovbuf(size_t threshold = 256) : m_threshold(threshold) {}
+
+    int alloc_buf(size_t n) override { m_copy.reserve(n); return 0; }
+    int set_buf(storage_ptr_t&, size_t) override { return -1; }
+
+    int putc(uint8_t c) override { return putp(&c, 1); }
+
+    int putp(const uint8_t *p, size_t n) override {
+      if (n >= m_threshold) {
+        m_segments.push_back({ p, 0, n, nullptr });
+      } else {
+        if (m_segments.empty() || m_segments.back().data || m_segments.back().region)
+          m_segments.push_back({ nullptr, m_copy.size(), 0, nullptr });
+        m_copy.insert(m_copy.end(), p, p + n);
+        m_segments.back().length += n;
+      }
+      m_count += n;
+      return 0;
+    }
+
+    int putr(const file_region& r) override {
+      m_segments.push_back({ r.data(), 0, r.size(), &r });
+      m_count += r.size();
+      return 0;
+    }
+
+    //! write the whole frame to a descriptor, returns 0 on success
+    int send(int fd) const {
+      std::vector<struct iovec> iov;
+      for (size_t i=0; i < m_segments.size(); ) {
+        if (m_segments[i].region) {
+          if (send_region(fd, *m_segments[i].region) == 0) {
+            i++;
+            continue;
+          }
+          if (errno != EINVAL && errno != ENOSYS)
+            return -1;
+          // no sendfile() to this descriptor, write from the mapping
+        }
+        iov.clear(); // gather up to the next file region
+        do {
+          auto& s = m_segments[i++];
+          auto p = (s.data) ? s.data : &m_copy[s.offset];
+          iov.push_back({ (void *)p, s.length });
+        } while (i < m_segments.size() && !m_segments[i].region && iov.size() < IOV_MAX);
+        if (writev_all(fd, iov) != 0)
+          return -1;
+      }
+      return 0;
+    }
+
+    uint8_t getc() override { return 0xff; }
+    uint8_t *getp(size_t) const override { return nullptr; }
+    void reset() override {}
+    int advance(int) override { return -1; }
+    int reverse(int) override { return -1; }
+    size_t size() const override { return m_count; }
+    size_t offset() const override { return m_count; }
+    void hexdump(std::ostream&) const override {}
+
+  private:
+    struct segment {
+      const uint8_t *data; //!< referred data, nullptr if copied
+      size_t offset; //!< offset of copied data
+      size_t length;
+      const file_region *region;
+    };
+
+    static int send_region(int fd, const file_region& r) {
+      off_t offset = (off_t)r.offset();
+      size_t left = r.size();
+      while (left > 0) {
+        auto n = sendfile(fd, r.fd(), &offset, left);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0) {
+          if (left != r.size())
+            errno = EIO; // partly sent, cannot fall back
+          return -1;
+        }
+        left -= n;
+      }
+      return 0;
+    }
+
+    static int writev_all(int fd, std::vector<struct iovec>& iov) {
+      size_t first = 0;
+      while (first < iov.size()) {
+        auto n = writev(fd, &iov[first], iov.size() - first);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0)
+          return -1;
+        size_t k = n;
+        while (first < iov.size() && k >= iov[first].iov_len)
+          k -= iov[first++].iov_len;
+        if (first < iov.size()) { // partial write
+          iov[first].iov_base = (uint8_t *)iov[first].iov_base + k;
+          iov[first].iov_len -= k;
+        }
+      }
+      return 0;
+    }
+
+    size_t m_threshold;
+    std::vector<segment> m_segments;
+    std::vector<uint8_t> m_copy;
+    size_t m_count = 0;
+};
+
+//
+// LEB128 varints
+//
+
+inline int varint_size(uint64_t value) {
+  int n = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    n++;
+  }
+  return n;
+}
+
+inline int put_varint(MsgBuf& buf, uint64_t value) {
+  if (value < 0x80)
+    return buf.putc((uint8_t)value);
+  uint8_t data[10];
+  int n = 0;
+  while (value >= 0x80) {
+    data[n++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  data[n++] = (uint8_t)value;
+  return buf.putp(data, n);
+}
+
+inline int get_varint(MsgBuf& buf, uint64_t& value) {
+
+// Tags, lengths and small values take one or two bytes, which are
+// decoded without looping. Longer varints take the generic path.
+
+  const uint8_t *p = buf.getp(1);
+  if (!p)
+    return -1;
+
+  if (p[0] < 0x80) {
+    value = p[0];
+    buf.advance(1);
+    return 0;
+  }
+  size_t avail = buf.size() - buf.offset();
+  if (avail > 1 && p[1] < 0x80) {
+    value = (p[0] & 0x7f) | ((uint64_t)p[1] << 7);
+    buf.advance(2);
+    return 0;
+  }
+
+  value = 0;
+  for (size_t i=0; i < avail && i < 10; i++) {
+    value |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+    if (p[i] < 0x80) {
+      buf.advance(i + 1);
+      return 0;
+    }
+  }
+  return -1; // truncated or too long
+}
+
+} // namespace mig
+
+#endif // ifndef _MSGBUF_H_
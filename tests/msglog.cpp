@@ -0,0 +1,302 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Append only message log
+//
+// - see msglog.h for the file layout
+//
+
+#include "msglog.h"
+#include "sampleproto.h"
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace mig {
+
+static const char log_magic[8] = { 'M', 'I', 'G', 'L', 'O', 'G', '0', '1' };
+static const char index_magic[8] = { 'M', 'I', 'G', 'I', 'D', 'X', '0', '1' };
+
+static off_t file_size(int fd) {
+  struct stat st;
+  return (fstat(fd, &st) == 0) ? st.st_size : -1;
+}
+
+static int write_all(int fd, const void *p, size_t n) {
+  auto q = (const uint8_t *)p;
+  while (n > 0) {
+    auto r = write(fd, q, n);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return -1;
+    q += r;
+    n -= r;
+  }
+  return 0;
+}
+
+static bool has_magic(int fd, const char *magic) {
+  char buf[8];
+  return pread(fd, buf, 8, 0) == 8 && memcmp(buf, magic, 8) == 0;
+}
+
+//! number of index entries and the last of them, -1 if not an index
+static long last_entry(int fd, log_entry& e) {
+  auto size = file_size(fd);
+  if (size < 8 || (size - 8) % sizeof(log_entry) != 0 || !has_magic(fd, index_magic))
+    return -1;
+  long n = (size - 8) / sizeof(log_entry);
+  if (n > 0 && pread(fd, &e, sizeof(e), size - sizeof(e)) != sizeof(e))
+    return -1;
+  return n;
+}
+
+static int64_t now() {
+  auto t = std::chrono::system_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+}
+
+int LogWriter::open(const char *path) {
+
+  close();
+  auto ipath = index_path(path);
+  auto fail = [this]() { close(); return -1; };
+
+  m_log = ::open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (m_log < 0)
+    return -1;
+  if (file_size(m_log) == 0 && write_all(m_log, log_magic, 8) != 0)
+    return fail();
+  if (!has_magic(m_log, log_magic))
+    return fail();
+
+  m_index = ::open(ipath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (m_index < 0)
+    return fail();
+  if (file_size(m_index) == 0 && write_all(m_index, index_magic, 8) != 0)
+    return fail();
+
+  // the index has to end where the log ends, otherwise the previous
+  // writer did not finish and the index is rebuilt
+  log_entry last;
+  auto n = last_entry(m_index, last);
+  uint64_t end = file_size(m_log);
+  if (n < 0 || (n == 0 && end != 8) || (n > 0 && last.offset + last.size != end)) {
+    ::close(m_index);
+    m_index = -1;
+    if (rebuild_index(path) < 0)
+      return fail();
+    m_index = ::open(ipath.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (m_index < 0 || (n = last_entry(m_index, last)) < 0)
+      return fail();
+    end = file_size(m_log);
+  }
+
+  m_seq = (n > 0) ? last.seq + 1 : 0;
+  m_timestamp = (n > 0) ? last.timestamp : 0;
+  m_end = end;
+  return 0;
+}
+
+int LogWriter::append(Message& msg, int64_t timestamp) {
+  msg.to_wire();
+  auto w = msg.wire_format();
+  if (!w)
+    return -1;
+  w->buf()->reset();
+  auto p = w->buf()->getp(w->size());
+  return append(p, w->size(), timestamp);
+}
+
+int LogWriter::append(const uint8_t *frame, size_t n, int64_t timestamp) {
+
+  if (m_log < 0 || !frame || SampleProto::frame_size(frame, n) != n)
+    return -1;
+  if (timestamp == 0)
+    timestamp = std::max(now(), m_timestamp); // the clock may be set back
+  else if (timestamp < m_timestamp)
+    return -1; // lower_bound() relies on the order
+
+  log_entry e = {};
+  e.offset = m_end + record_header;
+  e.seq = m_seq++;
+  e.timestamp = timestamp;
+  e.size = n;
+  e.id = (frame[0] << 8) | frame[1];
+
+  auto header = (const uint8_t *)&e.seq; // seq and timestamp
+  m_records.insert(m_records.end(), header, header + record_header);
+  m_records.insert(m_records.end(), frame, frame + n);
+  m_entries.push_back(e);
+  m_end += record_header + n;
+  m_timestamp = timestamp;
+
+  if (m_records.size() >= m_batch)
+    return flush();
+  return 0;
+}
+
+int LogWriter::flush() {
+
+// Records go first, an index entry never refers past the end of the log
+
+  if (m_log < 0)
+    return -1;
+  int ret = 0;
+  if (!m_records.empty())
+    ret = write_all(m_log, m_records.data(), m_records.size());
+  if (ret == 0 && !m_entries.empty())
+    ret = write_all(m_index, m_entries.data(), m_entries.size() * sizeof(log_entry));
+  m_records.clear();
+  m_entries.clear();
+  return ret;
+}
+
+int LogWriter::close() {
+  int ret = 0;
+  if (m_log >= 0 && m_index >= 0)
+    ret = flush();
+  if (m_log >= 0)
+    ::close(m_log);
+  if (m_index >= 0)
+    ::close(m_index);
+  m_log = m_index = -1;
+  m_records.clear();
+  m_entries.clear();
+  return ret;
+}
+
+int LogReader::open(const char *path) {
+
+  m_log = file_region::map(path);
+  m_index = file_region::map(index_path(path).c_str());
+  m_entries = nullptr;
+  m_count = 0;
+  if (!m_log || m_log->size() < 8 || memcmp(m_log->data(), log_magic, 8) != 0)
+    return -1;
+  if (!m_index || m_index->size() < 8 || memcmp(m_index->data(), index_magic, 8) != 0)
+    return -1;
+
+  m_entries = (const log_entry *)(m_index->data() + 8); // mapping is page aligned
+  m_count = (m_index->size() - 8) / sizeof(log_entry);
+
+  // records appended after the log was mapped are not visible
+  while (m_count > 0 && m_entries[m_count-1].offset + m_entries[m_count-1].size > m_log->size())
+    m_count--;
+  return 0;
+}
+
+message_ptr_t LogReader::message(size_t i) const {
+  if (i >= m_count)
+    return nullptr;
+  auto& e = m_entries[i];
+  wire_format_ptr_t w = std::make_unique<SampleProto>(m_log, e.offset, e.size);
+  return Message::factory(w);
+}
+
+size_t LogReader::find(uint64_t seq) const {
+  auto end = m_entries + m_count;
+  auto it = std::lower_bound(m_entries, end, seq,
+      [](const log_entry& e, uint64_t s) { return e.seq < s; });
+  return (it != end && it->seq == seq) ? it - m_entries : m_count;
+}
+
+size_t LogReader::lower_bound(int64_t timestamp) const {
+  auto it = std::lower_bound(m_entries, m_entries + m_count, timestamp,
+      [](const log_entry& e, int64_t t) { return e.timestamp < t; });
+  return it - m_entries;
+}
+
+long rebuild_index(const char *path) {
+
+// Records are scanned from the start of the log, the log is truncated
+// after the last complete record and the index is replaced atomically
+
+  int fd = ::open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  auto size = file_size(fd);
+  if (size < 8 || !has_magic(fd, log_magic)) {
+    ::close(fd);
+    return -1;
+  }
+
+  std::vector<log_entry> entries;
+  size_t pos = 8;
+  if (size > 8) {
+    auto log = file_region::map(fd, 0, size);
+    if (!log) {
+      ::close(fd);
+      return -1;
+    }
+    auto data = log->data();
+    while (pos + LogWriter::record_header < (size_t)size) {
+      auto p = data + pos + LogWriter::record_header;
+      auto left = size - pos - LogWriter::record_header;
+      auto n = SampleProto::frame_size(p, left);
+      if (n == 0 || n > left)
+        break; // partly written record
+      log_entry e = {};
+      memcpy(&e.seq, data + pos, LogWriter::record_header);
+      e.offset = pos + LogWriter::record_header;
+      e.size = n;
+      e.id = (p[0] << 8) | p[1];
+      entries.push_back(e);
+      pos += LogWriter::record_header + n;
+    }
+  }
+
+  int ret = (pos < (size_t)size) ? ftruncate(fd, pos) : 0;
+  ::close(fd);
+  if (ret != 0)
+    return -1;
+
+  auto ipath = index_path(path);
+  auto tmp = ipath + ".tmp";
+  fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -1;
+  ret = write_all(fd, index_magic, 8);
+  if (ret == 0 && !entries.empty())
+    ret = write_all(fd, entries.data(), entries.size() * sizeof(log_entry));
+  if (ret == 0)
+    ret = fsync(fd);
+  ::close(fd);
+  if (ret != 0 || rename(tmp.c_str(), ipath.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return -1;
+  }
+  return entries.size();
+}
+
+} // namespace mig
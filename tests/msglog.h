@@ -0,0 +1,134 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _MSGLOG_H_
+#define _MSGLOG_H_
+
+//
+// Append only message log
+//
+// Log:    | "MIGLOG01" | record | record | ...
+// Record: | u64 seq | i64 timestamp | SampleProto frame |
+//
+// Sidecar index (<log>.idx), one entry per record:
+//
+// Index:  | "MIGIDX01" | log_entry | log_entry | ...
+//
+// Record headers and index entries are in host byte order, so the index
+// can be used in place from a mapping. Timestamps are nanoseconds since
+// the epoch and do not decrease along the log, so the index can be
+// searched by time. The writer appends records before their index
+// entries, the index can always be rebuilt from the log.
+//
+
+#include "migmsg.h"
+#include <string>
+#include <vector>
+
+namespace mig {
+
+struct log_entry {
+  uint64_t offset; //!< log offset of the frame
+  uint64_t seq;
+  int64_t timestamp;
+  uint32_t size; //!< frame size
+  uint16_t id; //!< message id
+  uint16_t reserved;
+};
+
+static_assert(sizeof(log_entry) == 32, "index entry layout");
+
+//! Batching log writer
+class LogWriter {
+
+  public:
+    LogWriter(size_t batch = 0x10000) : m_batch(batch) {}
+    ~LogWriter() { close(); }
+
+    //! create a log or open it for appending, a stale index is rebuilt
+    int open(const char *path);
+    //! write pending records and index entries
+    int flush();
+    int close();
+
+    //! append an encoded message, timestamp 0 means the current time
+    //! returns -1 if timestamp is older than the last appended one
+    int append(Message& msg, int64_t timestamp = 0);
+    //! append a SampleProto frame as is
+    int append(const uint8_t *frame, size_t n, int64_t timestamp = 0);
+
+    uint64_t next_seq() const { return this->m_seq; }
+
+    static const size_t record_header = 16;
+
+  private:
+    size_t m_batch; //!< flush when this many bytes are pending
+    int m_log = -1;
+    int m_index = -1;
+    uint64_t m_seq = 0;
+    int64_t m_timestamp = 0; //!< of the last record
+    uint64_t m_end = 0; //!< log size including pending records
+    std::vector<uint8_t> m_records; //!< pending records
+    std::vector<log_entry> m_entries; //!< pending index entries
+};
+
+//! Log reader on mappings of the log and its index
+//
+// Messages are decoded in place, their data refers to the mapped log,
+// which stays mapped as long as any of the messages exist. The reader
+// sees the log as it was when opened.
+//
+class LogReader {
+
+  public:
+    int open(const char *path);
+
+    size_t size() const { return this->m_count; }
+    const log_entry& entry(size_t i) const { return this->m_entries[i]; }
+    const uint8_t *frame(size_t i) const { return m_log->data() + m_entries[i].offset; }
+    message_ptr_t message(size_t i) const;
+
+    //! index of the entry with sequence number seq, size() if not found
+    size_t find(uint64_t seq) const;
+    //! index of the first entry at or after timestamp
+    size_t lower_bound(int64_t timestamp) const;
+
+  private:
+    region_ptr_t m_log = nullptr;
+    region_ptr_t m_index = nullptr;
+    const log_entry *m_entries = nullptr;
+    size_t m_count = 0;
+};
+
+//! rebuild the index of a log, a partly written last record is dropped
+//! returns the number of records or -1
+long rebuild_index(const char *path);
+
+//! name of the index file of a log
+inline std::string index_path(const char *path) { return std::string(path) + ".idx"; }
+
+} // namespace mig
+
+#endif // ifndef _MSGLOG_H_
@@ -0,0 +1,445 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Protocol buffers compatible wire format
+//
+// - see pbproto.h for the type mapping
+//
+
+#include "pbproto.h"
+#include <iostream>
+#include <iomanip>
+
+namespace mig {
+
+PbProto::PbProto(Message& msg) {
+
+  auto size = wire_size(msg);
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(size);
+
+  set_buf(buf);
+  set_size(size);
+  set_id(msg.id());
+
+  encode(msg); // group sizes were collected by wire_size()
+}
+
+PbProto::PbProto(storage_ptr_t& p, size_t n, int id) {
+
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(p, n);
+  set_buf(buf);
+  set_size(n);
+  set_id(id); // protobuf carries no message type, it is known from the context
+}
+
+wire_format_ptr_t PbProto::reencode(Message& msg) const {
+  wire_format_ptr_t w = std::make_unique<PbProto>(msg);
+  return w;
+}
+
+const uint8_t *PbProto::get_data(uint64_t& n) const {
+
+  if (get_varint(n) != 0)
+    return nullptr;
+  static const uint8_t empty = 0;
+  if (n == 0)
+    return &empty;
+  const uint8_t *p = buf()->getp(n);
+  if (p)
+    buf()->advance(n);
+  return p;
+}
+
+size_t PbProto::wire_size(const Parameter& par) const {
+  m_sizes.clear();
+  return field_size(par);
+}
+
+size_t PbProto::wire_size(const Group& group) const {
+  m_sizes.clear();
+  return group_size(group);
+}
+
+size_t PbProto::wire_size(const Message& msg) const {
+  return wire_size((const Group&)msg);
+}
+
+size_t PbProto::group_size(const Group& group) const {
+  size_t n = 0;
+  for (auto bits = group.presence(); bits; )
+    n += field_size(group.param(pop_bit(bits)));
+  return n;
+}
+
+// Nested group sizes are computed bottom-up once and stored in m_sizes
+// in the order to_wire() writes the length prefixes
+size_t PbProto::field_size(const Parameter& par) const {
+
+  if (!par.is_set() || par.id() <= 0)
+    return 0;
+
+  if (par.is_group()) {
+    size_t n = 0;
+    for (auto i=0; i < par.nrepeats(); i++) {
+      auto slot = m_sizes.size();
+      m_sizes.push_back(0);
+      auto s = group_size(*par.group(i));
+      m_sizes[slot] = s;
+      n += varint_size(((uint64_t)par.id() << 3) | LEN) + varint_size(s) + s;
+    }
+    return n;
+  }
+
+  PbProto counter;
+  msgbuf_ptr_t buf = std::make_unique<countbuf>();
+  counter.set_buf(buf);
+  counter.to_wire(par);
+  return counter.buf()->offset();
+}
+
+size_t PbProto::packed_size(const Parameter& par) const {
+  PbProto counter;
+  msgbuf_ptr_t buf = std::make_unique<countbuf>();
+  counter.set_buf(buf);
+  for (auto i=0; i < par.nrepeats(); i++)
+    par.data_to_wire(counter, i);
+  return counter.buf()->offset();
+}
+
+int PbProto::to_wire(const Message& msg) {
+
+  wire_size(msg);
+  return encode(msg);
+}
+
+int PbProto::encode(const Message& msg) {
+
+  m_next = 0;
+  auto ret = to_wire((const Group&)msg);
+  buf()->reset(); // read pointer to start of buffer
+  return ret;
+}
+
+int PbProto::to_wire(const Group& group) {
+
+  int ret = 0;
+  for (auto bits = group.presence(); bits; )
+    ret |= to_wire(group.param(pop_bit(bits)));
+  return ret;
+}
+
+int PbProto::to_wire(const Parameter& par) {
+
+  if (!par.is_set())
+    return 0;
+  if (par.id() <= 0)
+    return -1; // not a valid field number
+
+  int ret = 0;
+  if (par.is_group()) {
+    for (auto i=0; i < par.nrepeats(); i++) {
+      if (m_next >= m_sizes.size())
+        return -1; // group sizes are collected by wire_size()
+      ret |= put_tag(par.id(), LEN);
+      ret |= put_varint(m_sizes[m_next++]);
+      ret |= to_wire(*par.group(i));
+    }
+  } else if (par.is_scalar() && par.item_size() == 0) { // void
+    for (auto i=0; i < par.nrepeats(); i++) {
+      ret |= put_tag(par.id(), LEN);
+      ret |= put_varint(0);
+    }
+  } else if (par.is_scalar() && par.is_repeated()) {
+    ret |= put_tag(par.id(), LEN);
+    ret |= put_varint(packed_size(par));
+    for (auto i=0; i < par.nrepeats(); i++)
+      ret |= par.data_to_wire(*this, i);
+  } else if (par.is_scalar()) {
+    ret |= put_tag(par.id(), VARINT);
+    ret |= par.data_to_wire(*this, 0);
+  } else { // variable length data writes its own length
+    ret |= put_tag(par.id(), LEN);
+    ret |= par.data_to_wire(*this, 0);
+  }
+  return ret;
+}
+
+int PbProto::from_wire(Message& msg) const {
+
+  buf()->reset();
+  m_end = size();
+  return from_wire((Group&)msg);
+}
+
+int PbProto::from_wire(Group& group) const {
+
+  auto end = m_end;
+  uint64_t key;
+  while (buf()->offset() < end) {
+    if (get_varint(key) != 0)
+      return -1;
+    auto id = (int)(key >> 3);
+    auto type = (WireType)(key & 0x7);
+    if (id == 0)
+      return -1; // not a valid field number
+    auto it = group.params().find(id);
+    if (it == group.params().end()) {
+      if (skip(type) != 0)
+        return -1;
+    } else if (field_from_wire(it->second, type) != 0)
+      return -1;
+  }
+  return (buf()->offset() == end) ? 0 : -1;
+}
+
+int PbProto::field_from_wire(Parameter& par, WireType type) const {
+
+  if (par.is_group()) {
+    uint64_t n;
+    if (type != LEN || get_varint(n) != 0 || buf()->offset() + n > m_end)
+      return -1;
+    auto outer = m_end;
+    m_end = buf()->offset() + n; // submessage bounds
+    auto ret = par.data_from_wire(*this);
+    m_end = outer;
+    return ret;
+  }
+
+  if (par.is_scalar() && par.item_size() == 0) { // void, contents ignored
+    uint64_t n;
+    if (type != LEN || get_data(n) == nullptr)
+      return -1;
+    return par.data_from_wire(*this);
+  }
+
+  if (par.is_scalar() && type == VARINT)
+    return par.data_from_wire(*this);
+
+  if (par.is_scalar() && type == LEN && par.is_repeated()) { // packed
+    uint64_t n;
+    if (get_varint(n) != 0 || buf()->offset() + n > m_end)
+      return -1;
+    auto end = buf()->offset() + n;
+    while (buf()->offset() < end)
+      if (par.data_from_wire(*this) != 0)
+        return -1;
+    return (buf()->offset() == end) ? 0 : -1;
+  }
+
+  if (!par.is_scalar() && type == LEN)
+    return par.data_from_wire(*this); // reads its own length
+
+  return -1; // wire type does not match parameter type
+}
+
+int PbProto::skip(WireType type) const {
+
+  uint64_t n;
+  switch (type) {
+    case VARINT:
+      return get_varint(n);
+    case LEN:
+      return (get_data(n) != nullptr) ? 0 : -1;
+    case I64:
+    case I32:
+      n = (type == I64) ? 8 : 4;
+      if (buf()->offset() + n > m_end)
+        return -1;
+      buf()->advance(n);
+      return 0;
+    default:
+      return -1; // deprecated groups are not supported
+  }
+}
+
+int PbProto::to_wire(uint8_t value) { return put_varint(value); }
+int PbProto::to_wire(uint16_t value) { return put_varint(value); }
+int PbProto::to_wire(uint32_t value) { return put_varint(value); }
+int PbProto::to_wire(uint64_t value) { return put_varint(value); }
+int PbProto::to_wire(int8_t value) { return put_varint((uint64_t)(int64_t)value); }
+int PbProto::to_wire(int16_t value) { return put_varint((uint64_t)(int64_t)value); }
+int PbProto::to_wire(int32_t value) { return put_varint((uint64_t)(int64_t)value); }
+int PbProto::to_wire(int64_t value) { return put_varint((uint64_t)value); }
+
+int PbProto::to_wire(const blob_t& value) {
+  return put_varint(value.size()) | buf()->putp(value.data(), value.size());
+}
+
+int PbProto::to_wire(const string_t& value) { // without the terminator
+  return put_varint(value.length()) | buf()->putp((const uint8_t *)value.data(), value.length());
+}
+
+int PbProto::to_wire(const std::string& value) {
+  return put_varint(value.size()) | buf()->putp((const uint8_t *)value.data(), value.size());
+}
+
+int PbProto::from_wire(uint8_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (uint8_t)x;
+  return ret;
+}
+
+int PbProto::from_wire(uint16_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (uint16_t)x;
+  return ret;
+}
+
+int PbProto::from_wire(uint32_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (uint32_t)x;
+  return ret;
+}
+
+int PbProto::from_wire(uint64_t& data) const {
+  return get_varint(data);
+}
+
+int PbProto::from_wire(int8_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (int8_t)x;
+  return ret;
+}
+
+int PbProto::from_wire(int16_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (int16_t)x;
+  return ret;
+}
+
+int PbProto::from_wire(int32_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (int32_t)x;
+  return ret;
+}
+
+int PbProto::from_wire(int64_t& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (int64_t)x;
+  return ret;
+}
+
+int PbProto::from_wire(bool& data) const {
+  uint64_t x;
+  auto ret = get_varint(x);
+  data = (x != 0);
+  return ret;
+}
+
+int PbProto::from_wire(blob_t& data) const {
+  uint64_t n;
+  auto p = get_data(n);
+  if (!p)
+    return -1;
+  data.assign(p, n); // assign message buffer sub-area
+  return 0;
+}
+
+int PbProto::from_wire(string_t& data) const {
+  uint64_t n;
+  auto p = get_data(n);
+  if (!p)
+    return -1;
+  data.copy((const char *)p, n); // the wire value has no terminator
+  return 0;
+}
+
+int PbProto::from_wire(std::string& data) const {
+  uint64_t n;
+  auto p = get_data(n);
+  if (!p)
+    return -1;
+  data.assign((const char *)p, n);
+  return 0;
+}
+
+void PbProto::dump(std::ostream& os, const Parameter& par) const {
+
+  if (par.is_group()) {
+    os << '\n';
+    dump(os, *par.group(), par.id());
+  }
+}
+
+void PbProto::dump(std::ostream& os, const Group& group, int id) const {
+
+  auto end = m_end;
+  uint64_t key;
+  while (buf()->offset() < end && get_varint(key) == 0) {
+
+    auto field = (int)(key >> 3);
+    auto type = (WireType)(key & 0x7);
+    if (dynamic_cast<const Message*>(&group))
+      // direct parameter
+      os << "- field " << std::dec << field << ": ";
+    else
+      // group parameter
+      os << "  group " << std::dec << id << '/' << field << ": ";
+
+    auto it = group.params().find(field);
+    uint64_t n;
+    if (it != group.params().end() && it->second.is_group() && type == LEN
+        && get_varint(n) == 0) {
+      auto outer = m_end;
+      m_end = buf()->offset() + n;
+      dump(os, it->second);
+      m_end = outer;
+      continue;
+    }
+
+    auto start = buf()->getp(1);
+    auto offset = buf()->offset();
+    if (skip(type) != 0) {
+      os << "invalid wire type " << int(type) << '\n';
+      return;
+    }
+    os << std::setfill('0');
+    for (auto i=offset; i < buf()->offset(); i++)
+      os << std::hex << std::setw(2) << int(start[i - offset]) << ' ';
+    os << '\n';
+  }
+}
+
+void PbProto::dump(std::ostream& os, const Message& msg) const {
+
+  os << "dump\n";
+  os << std::setfill('0');
+  os << "Message: 0x" << std::hex << std::setw(4) << id();
+  os << std::dec << ", length " << size() << '(' << msg.data_size() << ")\n";
+
+  buf()->reset();
+  m_end = size();
+  dump(os, dynamic_cast<const Group&>(msg), 0);
+}
+
+} // namespace mig
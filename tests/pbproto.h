@@ -0,0 +1,128 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _PBPROTO_H_
+#define _PBPROTO_H_
+
+//
+// Protocol buffers compatible wire format
+//
+// Message:   | fields |, the message id is not part of the encoding
+// Field:     | varint (parameter id << 3 | wire type) | data |
+//
+// Parameter id is the protobuf field number, so id 0 cannot be encoded.
+//
+// integers, bools, enums: VARINT, signed values are sign extended (int32/int64)
+// void:                   LEN, empty submessage (google.protobuf.Empty)
+// blob, string:           LEN
+// group:                  LEN, submessage
+// repeated integers:      LEN, packed. Unpacked repeats are accepted on input
+//
+// Unknown fields are skipped on input.
+//
+
+#include "migmsg.h"
+#include "msgbuf.h"
+
+#include <vector>
+
+namespace mig {
+
+class PbProto : public WireFormat {
+
+  public:
+    PbProto(Message& msg);
+    PbProto(storage_ptr_t& buf, size_t n, int id);
+    ~PbProto() {}
+
+    enum WireType { VARINT = 0, I64 = 1, LEN = 2, I32 = 5 };
+
+    size_t wire_size(const Group&) const override;
+    size_t wire_size(const Message&) const override;
+    size_t wire_size(const Parameter&) const override;
+
+    int to_wire(const Message&) override;
+    int to_wire(const Group&) override;
+    int to_wire(const Parameter&) override;
+
+    int from_wire(Message&) const override;
+    int from_wire(Group&) const override;
+
+    wire_format_ptr_t reencode(Message&) const override;
+
+    int to_wire(int8_t) override;
+    int to_wire(int16_t) override;
+    int to_wire(int32_t) override;
+    int to_wire(int64_t) override;
+    int to_wire(uint8_t) override;
+    int to_wire(uint16_t) override;
+    int to_wire(uint32_t) override;
+    int to_wire(uint64_t) override;
+    int to_wire(const blob_t&) override;
+    int to_wire(const string_t&) override;
+    int to_wire(const std::string&) override;
+
+    int from_wire(int8_t&) const override;
+    int from_wire(int16_t&) const override;
+    int from_wire(int32_t&) const override;
+    int from_wire(int64_t&) const override;
+    int from_wire(uint8_t&) const override;
+    int from_wire(uint16_t&) const override;
+    int from_wire(uint32_t&) const override;
+    int from_wire(uint64_t&) const override;
+    int from_wire(bool&) const override;
+    int from_wire(blob_t&) const override;
+    int from_wire(string_t&) const override;
+    int from_wire(std::string&) const override;
+
+    using WireFormat::to_wire;
+    using WireFormat::from_wire;
+
+    void dump(std::ostream&, const Message&) const override;
+    void dump(std::ostream&, const Group&, int) const override;
+    void dump(std::ostream&, const Parameter&) const override;
+
+  private:
+    PbProto() {} // size counter
+
+    int put_varint(uint64_t value) { return ::mig::put_varint(*buf(), value); }
+    int get_varint(uint64_t& value) const { return ::mig::get_varint(*buf(), value); }
+    int put_tag(int id, WireType type) { return put_varint(((uint64_t)id << 3) | type); }
+    const uint8_t *get_data(uint64_t&) const;
+    size_t packed_size(const Parameter&) const;
+    size_t group_size(const Group&) const;
+    size_t field_size(const Parameter&) const;
+    int encode(const Message&);
+    int field_from_wire(Parameter&, WireType) const;
+    int skip(WireType) const;
+
+    mutable size_t m_end = 0; //!< end offset of the (sub)message being decoded
+    mutable std::vector<size_t> m_sizes; //!< nested group sizes in encoding order, see wire_size()
+    size_t m_next = 0; //!< next entry of m_sizes to encode
+};
+
+} // namespace mig
+
+#endif // ifndef _PBPROTO_H_
@@ -0,0 +1,229 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Multithreaded decode pipeline
+//
+// - see pipeline.h
+//
+
+#include "pipeline.h"
+#include "sampleproto.h"
+
+namespace mig {
+
+DecodePipeline::DecodePipeline(const consumer_t& consumer, const pipeline_options& options) :
+  m_consumer(consumer), m_options(options) {
+
+  auto n = m_options.workers;
+  if (n == 0)
+    n = std::max(1u, std::thread::hardware_concurrency());
+  if (m_options.batch == 0)
+    m_options.batch = 1;
+  unsigned lanes = 1; // unordered frames share one batch
+  if (m_options.order == pipeline_options::Order::Key)
+    lanes = (m_options.lanes) ? m_options.lanes : 4 * n;
+
+  for (unsigned i=0; i<lanes; i++) {
+    m_lanes.push_back(std::make_unique<lane>());
+    m_lanes.back()->index = i;
+  }
+  for (unsigned i=0; i<n; i++)
+    m_workers.push_back(std::make_unique<worker>());
+  for (unsigned i=0; i<n; i++)
+    m_workers[i]->thread = std::thread(&DecodePipeline::run, this, i);
+}
+
+DecodePipeline::~DecodePipeline() {
+  drain();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_work.notify_all();
+  for (auto& w : m_workers)
+    w->thread.join();
+}
+
+int DecodePipeline::submit(storage_ptr_t& frame, size_t n, uint64_t key) {
+  auto p = frame.get();
+  return submit(item{ p, n, key, std::move(frame), nullptr });
+}
+
+int DecodePipeline::submit(const frame_ref& frame, uint64_t key) {
+  return submit(item{ frame.data, frame.size, key, nullptr, nullptr });
+}
+
+int DecodePipeline::submit(item&& it) {
+  if (!it.data || SampleProto::frame_size(it.data, it.size) != it.size)
+    return -1;
+  auto& l = *m_lanes[it.key % m_lanes.size()];
+  if (!l.pending) {
+    l.pending = std::make_unique<batch>();
+    l.pending->items.reserve(m_options.batch);
+  }
+  l.pending->items.push_back(std::move(it));
+  m_submitted++;
+  if (l.pending->items.size() >= m_options.batch)
+    dispatch(l);
+  return 0;
+}
+
+void DecodePipeline::dispatch(lane& l) {
+  auto b = std::move(l.pending);
+  b->lane = l.index;
+  b->seq = l.next_seq++;
+  m_batches++;
+
+  auto& w = *m_workers[m_next_worker++ % m_workers.size()];
+  {
+    std::lock_guard<std::mutex> lock(w.mutex);
+    w.tasks.push_back(std::move(b));
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queued++;
+  }
+  m_work.notify_one();
+}
+
+void DecodePipeline::flush() {
+  for (auto& l : m_lanes)
+    if (l->pending)
+      dispatch(*l);
+}
+
+void DecodePipeline::drain() {
+  flush();
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_idle.wait(lock, [this]() { return m_delivered + m_failed == m_submitted; });
+}
+
+pipeline_stats DecodePipeline::stats() const {
+  pipeline_stats s;
+  s.submitted = m_submitted;
+  s.delivered = m_delivered;
+  s.failed = m_failed;
+  s.batches = m_batches;
+  for (auto& w : m_workers)
+    s.stolen += w->stolen;
+  return s;
+}
+
+DecodePipeline::batch_ptr_t DecodePipeline::take(unsigned self) {
+
+// Own batches are taken newest first, which are likely still in cache,
+// stolen ones oldest first
+
+  batch_ptr_t b;
+  auto n = m_workers.size();
+  {
+    auto& w = *m_workers[self];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (!w.tasks.empty()) {
+      b = std::move(w.tasks.back());
+      w.tasks.pop_back();
+    }
+  }
+  for (size_t i=1; !b && i<n; i++) {
+    auto& v = *m_workers[(self + i) % n];
+    std::lock_guard<std::mutex> lock(v.mutex);
+    if (!v.tasks.empty()) {
+      b = std::move(v.tasks.front());
+      v.tasks.pop_front();
+      m_workers[self]->stolen++;
+    }
+  }
+  if (b) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queued--;
+  }
+  return b;
+}
+
+void DecodePipeline::run(unsigned self) {
+  for (;;) {
+    auto b = take(self);
+    if (!b) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_work.wait(lock, [this]() { return m_queued > 0 || m_stop; });
+      if (m_stop && m_queued == 0)
+        return;
+      continue;
+    }
+
+    for (auto& it : b->items) {
+      wire_format_ptr_t w;
+      if (it.owned)
+        w = std::make_unique<SampleProto>(it.owned, it.size);
+      else
+        w = std::make_unique<SampleProto>(it.data, it.size);
+      it.msg = Message::factory(w);
+    }
+    deliver(std::move(b));
+  }
+}
+
+void DecodePipeline::deliver(batch_ptr_t b) {
+  if (m_options.order == pipeline_options::Order::None) {
+    deliver_items(*b);
+    return;
+  }
+
+  // whoever finds the next batch of the lane delivers it and the ones
+  // that are waiting behind it
+  auto& l = *m_lanes[b->lane];
+  std::unique_lock<std::mutex> lock(l.mutex);
+  l.done.emplace(b->seq, std::move(b));
+  if (l.delivering)
+    return;
+  l.delivering = true;
+  while (!l.done.empty() && l.done.begin()->first == l.deliver_seq) {
+    auto next = std::move(l.done.begin()->second);
+    l.done.erase(l.done.begin());
+    lock.unlock();
+    deliver_items(*next);
+    lock.lock();
+    l.deliver_seq++;
+  }
+  l.delivering = false;
+}
+
+void DecodePipeline::deliver_items(batch& b) {
+  uint64_t failed = 0;
+  for (auto& it : b.items)
+    if (it.msg)
+      m_consumer(std::move(it.msg), it.key);
+    else
+      failed++;
+  m_failed += failed;
+  m_delivered += b.items.size() - failed;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+  }
+  m_idle.notify_all();
+}
+
+} // namespace mig
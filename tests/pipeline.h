@@ -0,0 +1,168 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+//
+// Multithreaded decode pipeline
+//
+// Frames are collected into batches, which are decoded by a pool of
+// workers. Each worker takes batches from the back of its own deque and
+// steals from the front of the others when it runs out. Decoded messages
+// are passed to the consumer on the worker threads.
+//
+// With Order::Key, frames are spread over lanes by key. A lane's batches
+// are delivered in the order they were submitted, one batch at a time,
+// so messages of a key (e.g. a connection) reach the consumer in order
+// and never concurrently. Decoding stays parallel.
+//
+// Message::creators is immutable after static initialization and every
+// decode has its own wire format and message, so workers share nothing
+// else of the runtime.
+//
+
+#include "migmsg.h"
+#include "transport.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mig {
+
+struct pipeline_options {
+  enum class Order { None, Key };
+
+  unsigned workers = 0; //!< 0 is one per hardware thread
+  size_t batch = 64; //!< frames per batch
+  Order order = Order::None;
+  unsigned lanes = 0; //!< ordered lanes, 0 is four per worker
+};
+
+struct pipeline_stats {
+  uint64_t submitted = 0;
+  uint64_t delivered = 0;
+  uint64_t failed = 0; //!< frames that did not decode
+  uint64_t batches = 0;
+  uint64_t stolen = 0; //!< batches decoded by another worker
+};
+
+//! Decodes frames on a pool of threads
+class DecodePipeline {
+
+  public:
+    //! consumer of decoded messages and their keys, called on workers
+    typedef std::function<void(message_ptr_t, uint64_t)> consumer_t;
+
+    DecodePipeline(const consumer_t& consumer,
+                   const pipeline_options& options = pipeline_options());
+    //! delivers what was submitted and stops the workers
+    ~DecodePipeline();
+    DecodePipeline(const DecodePipeline&) = delete;
+    DecodePipeline& operator=(const DecodePipeline&) = delete;
+
+    //
+    // Producer, one thread
+    //
+
+    //! submit a frame, the pipeline takes the storage
+    int submit(storage_ptr_t& frame, size_t n, uint64_t key = 0);
+    //! submit a frame which stays valid and unchanged until the message
+    //! delivered from it is destroyed
+    int submit(const frame_ref& frame, uint64_t key = 0);
+    //! hand partly filled batches to the workers
+    void flush();
+    //! flush and wait until everything submitted is delivered
+    void drain();
+
+    unsigned workers() const { return this->m_workers.size(); }
+    pipeline_stats stats() const;
+
+  private:
+    struct item {
+      const uint8_t *data;
+      size_t size;
+      uint64_t key;
+      storage_ptr_t owned;
+      message_ptr_t msg;
+    };
+
+    struct batch {
+      std::vector<item> items;
+      unsigned lane;
+      uint64_t seq; //!< in its lane
+    };
+    typedef std::unique_ptr<batch> batch_ptr_t;
+
+    struct alignas(64) worker {
+      std::mutex mutex;
+      std::deque<batch_ptr_t> tasks;
+      std::thread thread;
+      std::atomic<uint64_t> stolen{0};
+    };
+
+    struct alignas(64) lane {
+      unsigned index;
+      batch_ptr_t pending; //!< being filled by the producer
+      uint64_t next_seq = 0;
+      std::mutex mutex;
+      uint64_t deliver_seq = 0;
+      bool delivering = false;
+      std::map<uint64_t, batch_ptr_t> done; //!< decoded, waiting for their turn
+    };
+
+    int submit(item&& it);
+    void dispatch(lane& l);
+    batch_ptr_t take(unsigned self);
+    void run(unsigned self);
+    void deliver(batch_ptr_t b);
+    void deliver_items(batch& b);
+
+    consumer_t m_consumer;
+    pipeline_options m_options;
+    std::vector<std::unique_ptr<worker>> m_workers;
+    std::vector<std::unique_ptr<lane>> m_lanes;
+    unsigned m_next_worker = 0;
+    unsigned m_next_lane = 0;
+    uint64_t m_submitted = 0;
+    uint64_t m_batches = 0;
+
+    std::mutex m_mutex; //!< idle workers and drain() wait here
+    std::condition_variable m_work;
+    std::condition_variable m_idle;
+    size_t m_queued = 0; //!< batches in deques
+    bool m_stop = false;
+    std::atomic<uint64_t> m_delivered{0};
+    std::atomic<uint64_t> m_failed{0};
+};
+
+} // namespace mig
+
+#endif // ifndef _PIPELINE_H_
@@ -0,0 +1,107 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+//
+// Decode pipeline scaling from 1 to N workers
+//
+// Usage: pipelinebench [frames] [max workers]
+//
+// Frames of random messages of the test schema are decoded in place
+// from one buffer, unordered and ordered by key.
+//
+
+#include "msg_tests.msg.h"
+#include "pipeline.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+
+static double run(const std::vector<::mig::frame_ref>& frames, unsigned workers,
+                  ::mig::pipeline_options::Order order, uint64_t& stolen) {
+  ::mig::pipeline_options o;
+  o.workers = workers;
+  o.order = order;
+  std::atomic<uint64_t> ids{0};
+  auto t0 = std::chrono::steady_clock::now();
+  {
+    ::mig::DecodePipeline p([&](::mig::message_ptr_t m, uint64_t) {
+      ids.fetch_add(m->id(), std::memory_order_relaxed);
+    }, o);
+    for (size_t i=0; i<frames.size(); i++)
+      p.submit(frames[i], i % 64);
+    p.drain();
+    stolen = p.stats().stolen;
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  return frames.size() / std::chrono::duration<double>(t1 - t0).count();
+}
+
+int main(int argc, char *argv[]) {
+
+  size_t n = (argc > 1) ? atol(argv[1]) : 500000;
+  unsigned max = (argc > 2) ? atoi(argv[2]) : std::max(4u, std::thread::hardware_concurrency());
+
+  ::mig::Random r(1);
+  std::vector<int> ids;
+  for (auto& it : ::mig::Random::randomizers)
+    ids.push_back(it.first);
+  std::vector<uint8_t> bytes;
+  std::vector<size_t> offsets;
+  for (size_t i=0; i<n; i++) {
+    auto m = r.message(ids[r.below(ids.size())]);
+    m->to_wire();
+    auto w = m->wire_format();
+    w->buf()->reset();
+    auto p = w->buf()->getp(w->size());
+    offsets.push_back(bytes.size());
+    bytes.insert(bytes.end(), p, p + w->size());
+  }
+  offsets.push_back(bytes.size());
+  std::vector<::mig::frame_ref> frames;
+  for (size_t i=0; i<n; i++)
+    frames.push_back({ bytes.data() + offsets[i], offsets[i + 1] - offsets[i] });
+
+  std::cout << n << " frames, " << bytes.size() / n << " B average, "
+            << std::thread::hardware_concurrency() << " hardware threads\n"
+            << "workers   unordered  speedup     by key  speedup   stolen\n";
+  double base[2] = { 0, 0 };
+  for (unsigned w=1; w<=max; w*=2) {
+    uint64_t stolen;
+    auto u = run(frames, w, ::mig::pipeline_options::Order::None, stolen);
+    auto k = run(frames, w, ::mig::pipeline_options::Order::Key, stolen);
+    if (w == 1) {
+      base[0] = u;
+      base[1] = k;
+    }
+    std::cout << std::setw(7) << w
+              << std::setw(12) << std::fixed << std::setprecision(0) << u
+              << std::setw(9) << std::setprecision(2) << u / base[0]
+              << std::setw(11) << std::setprecision(0) << k
+              << std::setw(9) << std::setprecision(2) << k / base[1]
+              << std::setw(9) << stolen << '\n';
+  }
+  return 0;
+}
@@ -0,0 +1,274 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+//
+// Replay captured message streams
+//
+// Usage: mig-replay [options] <capture>
+//
+//   -u <path>   replay to a Unix stream socket
+//   -o <path>   replay to a pipe or file, - for stdout
+//   -t          keep the original pacing of a message log
+//   -x <factor> speed up the original pacing
+//   -n <count>  decode the capture count times in process (default mode)
+//
+// A capture is a message log (see msglog.h) or a file of concatenated
+// SampleProto frames. Raw frames carry no timestamps, they are always
+// replayed flat out. Messages are decoded with the creators of the
+// schema header the tool is built with (make mig-replay SCHEMA=...).
+//
+
+#ifndef MIG_SCHEMA
+#define MIG_SCHEMA "msg_tests.msg.h"
+#endif
+
+#include MIG_SCHEMA
+#include "msglog.h"
+#include "sampleproto.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+struct frame {
+  const uint8_t *data;
+  size_t size;
+  int id;
+  int64_t timestamp; //!< 0 if not known
+};
+
+typedef std::map<int, std::vector<uint64_t>> latencies_t; // ns by message id
+
+static int64_t elapsed_ns(std::chrono::steady_clock::time_point t0,
+                          std::chrono::steady_clock::time_point t1) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+}
+
+//! split a capture into frames, the mapping has to outlive them
+static int load(const char *path, ::mig::region_ptr_t& map, std::vector<frame>& frames) {
+
+  map = ::mig::file_region::map(path);
+  if (!map)
+    return -1;
+
+  ::mig::LogReader log;
+  if (log.open(path) == 0) {
+    for (size_t i=0; i<log.size(); i++) {
+      auto& e = log.entry(i);
+      if (e.offset + e.size <= map->size())
+        frames.push_back({ map->data() + e.offset, e.size, e.id, e.timestamp });
+    }
+    return 0;
+  }
+
+  auto p = map->data();
+  size_t left = map->size();
+  while (left > 0) {
+    auto n = ::mig::SampleProto::frame_size(p, left);
+    if (n == 0 || n > left) {
+      std::cerr << path << ": truncated frame at offset " << (p - map->data()) << '\n';
+      break;
+    }
+    frames.push_back({ p, n, (p[0] << 8) | p[1], 0 });
+    p += n;
+    left -= n;
+  }
+  return 0;
+}
+
+static int open_output(const char *socket_path, const char *path) {
+
+  if (path)
+    return (strcmp(path, "-") == 0) ? dup(1) : open(path, O_WRONLY | O_CLOEXEC);
+
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int write_frame(int fd, const frame& f) {
+  size_t done = 0;
+  while (done < f.size) {
+    auto n = write(fd, f.data + done, f.size - done);
+    if (n <= 0)
+      return -1;
+    done += n;
+  }
+  return 0;
+}
+
+static int replay(int fd, const std::vector<frame>& frames, bool paced, double speed,
+                  latencies_t& latencies) {
+
+// With pacing, each frame is sent when its offset from the first
+// timestamp has passed, a late sender catches up without sleeping
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto& f : frames) {
+    if (paced && f.timestamp) {
+      auto due = (f.timestamp - frames.front().timestamp) / speed;
+      std::this_thread::sleep_until(start + std::chrono::nanoseconds((int64_t)due));
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    if (write_frame(fd, f) != 0)
+      return -1;
+    latencies[f.id].push_back(elapsed_ns(t0, std::chrono::steady_clock::now()));
+  }
+  return 0;
+}
+
+static int decode(const std::vector<frame>& frames, int iterations, latencies_t& latencies) {
+
+// Frames are copied to their own storage outside of the measurement,
+// the factories own the storage like with frames read from a socket
+
+  int failed = 0;
+  for (auto i=0; i<iterations; i++)
+    for (auto& f : frames) {
+      auto p = std::make_unique<uint8_t []>(f.size);
+      memcpy(p.get(), f.data, f.size);
+      auto t0 = std::chrono::steady_clock::now();
+      auto w = ::mig::WireFormat::factory(p, f.size);
+      auto m = ::mig::Message::factory(w);
+      auto t1 = std::chrono::steady_clock::now();
+      if (!m)
+        failed++;
+      latencies[f.id].push_back(elapsed_ns(t0, t1));
+    }
+  return failed;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+  auto i = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+static void report(std::ostream& os, latencies_t& latencies, size_t messages,
+                   size_t bytes, int64_t ns) {
+
+  auto secs = ns / 1e9;
+  os << std::fixed << std::setprecision(0);
+  os << messages << " messages, " << bytes << " bytes in "
+     << std::setprecision(3) << secs << " s\n" << std::setprecision(0);
+  if (secs > 0)
+    os << messages / secs << " msg/s, " << bytes / secs << " B/s\n";
+
+  os << "id          count      p50      p90      p99    p99.9      max (ns)\n";
+  for (auto& l : latencies) {
+    auto& v = l.second;
+    std::sort(v.begin(), v.end());
+    os << "0x" << std::hex << std::setw(4) << std::setfill('0') << l.first
+       << std::dec << std::setfill(' ') << std::setw(12) << v.size();
+    for (auto p : { 50.0, 90.0, 99.0, 99.9 })
+      os << std::setw(9) << percentile(v, p);
+    os << std::setw(9) << v.back() << '\n';
+  }
+}
+
+static void usage() {
+  std::cerr << "usage: mig-replay [-u socket | -o path] [-t] [-x factor] [-n count] <capture>\n";
+}
+
+int main(int argc, char *argv[]) {
+
+  const char *socket_path = nullptr, *path = nullptr;
+  bool paced = false;
+  double speed = 1.0;
+  int iterations = 1;
+
+  int c;
+  while ((c = getopt(argc, argv, "u:o:tx:n:")) != -1) {
+    switch (c) {
+      case 'u': socket_path = optarg; break;
+      case 'o': path = optarg; break;
+      case 't': paced = true; break;
+      case 'x': speed = atof(optarg); break;
+      case 'n': iterations = atoi(optarg); break;
+      default: usage(); return 2;
+    }
+  }
+  if (optind != argc - 1 || speed <= 0 || iterations < 1 || (socket_path && path)) {
+    usage();
+    return 2;
+  }
+
+  ::mig::region_ptr_t map;
+  std::vector<frame> frames;
+  if (load(argv[optind], map, frames) != 0) {
+    std::cerr << argv[optind] << ": cannot read capture\n";
+    return 1;
+  }
+  size_t bytes = 0;
+  for (auto& f : frames)
+    bytes += f.size;
+
+  latencies_t latencies;
+  auto t0 = std::chrono::steady_clock::now();
+
+  if (socket_path || path) {
+    int fd = open_output(socket_path, path);
+    if (fd < 0) {
+      std::cerr << (socket_path ? socket_path : path) << ": cannot open\n";
+      return 1;
+    }
+    auto ret = replay(fd, frames, paced, speed, latencies);
+    close(fd);
+    if (ret != 0) {
+      std::cerr << "write failed\n";
+      return 1;
+    }
+  } else {
+    auto failed = decode(frames, iterations, latencies);
+    if (failed)
+      std::cerr << failed << " frames not decoded\n";
+    bytes *= iterations;
+  }
+
+  auto ns = elapsed_ns(t0, std::chrono::steady_clock::now());
+  auto messages = frames.size() * ((socket_path || path) ? 1 : iterations);
+  report((path && strcmp(path, "-") == 0) ? std::cerr : std::cout, latencies,
+         messages, bytes, ns);
+  return 0;
+}
@@ -29,146 +29,94 @@
 // - see README.md for further information 
 //
 
-#include "migmsg.h"
+#include "sampleproto.h"
 #include <iostream>
 #include <iomanip>
 
+#ifdef DEBUG
+#define TRACE(x) std::cout << x
+#else
+#define TRACE(x)
+#endif
+
 namespace mig {
 
-class msgbuf : public MsgBuf {
+SampleProto::SampleProto(Message& msg) {
   
-  public:
-    msgbuf(size_t n) { alloc_buf(n); }
-    msgbuf(storage_ptr_t& p, size_t n) { set_buf(p, n); }
-    ~msgbuf() {}
-    
-    int alloc_buf(size_t n) override {
-      m_data = std::make_unique<uint8_t []>(n);
-      m_size = n;
-      m_next = 0;
-      return 0;
-    }
-    int set_buf(storage_ptr_t& p, size_t n) override 
-      { m_data = std::move(p); m_size = n; m_next=0; return 0; }
-    
-    int putc(uint8_t c) override {
-      if (m_data.get() && m_next < m_size ) {
-        m_data.get()[m_next] = c;
-        m_next++;
-        return 0;
-      }
-      return -1;
-    }
-    
-    int putp(const uint8_t *p, size_t n) override { 
-      while (m_next < m_size && n-- && m_data.get()) { 
-        // TODO this is bytewise assignment - OPTIMIZE!!!
-        m_data.get()[m_next] = *p;
-        m_next++;
-        p++;
-      }
-      return (n)? -1 : 0; // everything copied?
-    }
+  auto size = frame(msg);
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(size);
 
-    uint8_t getc() override {
-      if (m_data.get() && m_next < m_size ) {
-        uint8_t c = m_data.get()[m_next];
-        m_next++;
-        return c;
-      }
-      return 0xff;
-    }
-    
-    uint8_t *getp(size_t n) const override {
-        if (m_next + n - 1 < m_size)
-          return &m_data.get()[m_next];
-        return nullptr;
-    }
+  set_buf(buf);
+  
+  to_wire(msg);
+}
 
-    int advance(int n) override { 
-        if (m_next + n - 1 <  m_size) 
-          m_next += n;
-        else
-          m_next = m_size;
-        return m_next;
-    }
+SampleProto::SampleProto(const Message& baseline, const Message& msg) {
 
-    int reverse(int n) override { 
-        if (m_next - n > 0)
-          m_next -= n;
-        else
-          m_next = 0; 
-        return m_next;
-    }
+// Delta: | header | 0xFD | changed parameters | 0xFF
 
-    void reset() override { m_next = 0; }
-  
-    size_t size() const override { return m_size; }
+  auto size = header_size() + id_size() + delta_size(baseline, msg);
+  if (size > 0xFFFF || max_id(msg) >= delta_mark) {
+    m_wide = true;
+    size = header_size() + id_size() + delta_size(baseline, msg);
+  }
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(size);
 
-    void hexdump(std::ostream& os) const override {
-      os << std::setfill('0');
-      for (auto i=0; i < m_size; i++)
-        os << std::hex << std::setw(2) << int(m_data.get()[i]) << ' ';
-      os << '\n';
-    }
+  set_buf(buf);
+  set_size(size);
+  set_id(msg.id());
+  m_delta = true;
+  m_spans = false; // buffer is not the encoding of msg
 
-  private:
-    
-    storage_ptr_t m_data = nullptr;
-    size_t m_size = 0;
-    int m_next = 0;
-};
+  to_wire((uint16_t)msg.id());
+  if (m_wide) {
+    to_wire((uint16_t)0);
+    to_wire((uint32_t)size);
+  } else
+    to_wire((uint16_t)size);
+  put_id(mark(delta_mark));
+  delta_to_wire(baseline, msg);
+  this->buf()->reset();
+}
 
+SampleProto::SampleProto(storage_ptr_t& p, size_t n) {
 
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(p, n);
+  set_buf(buf);
+  header(n);
+}
 
-class SampleProto : public WireFormat {
+SampleProto::SampleProto(const region_ptr_t& r, size_t offset, size_t n) {
 
-  public:
-    SampleProto(Message& msg);
-    SampleProto(storage_ptr_t& buf, size_t n);
-    ~SampleProto() {}    
+// Decoded data refers to the mapping, the buffer keeps it mapped
 
-    static const int par_wire_overhead = 1;
-    static const int msg_wire_overhead = 5;
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(r, offset, n);
+  set_buf(buf);
+  header(n);
+}
 
-    size_t wire_size(const Group&) const override;
-    size_t wire_size(const Message&) const override;
-    size_t wire_size(const Parameter&) const override;
- 
-    int to_wire(const Message&) override;
-    int to_wire(const Group&) override;
-    int to_wire(const Parameter&) override;
- 
-    int from_wire(Message&) const override;
-    int from_wire(Group&) const override;
-    int from_wire(blob_t&) const override;
-    int from_wire(string_t&) const override;
-    int from_wire(std::string&) const override;
+SampleProto::SampleProto(const uint8_t *p, size_t n) {
 
-    using WireFormat::to_wire;
-    using WireFormat::from_wire;
+// Decoded data refers to p, which has to stay valid and unchanged
 
-    void dump(std::ostream&, const Message&) const override;
-    void dump(std::ostream&, const Group&, int) const override;
-    void dump(std::ostream&, const Parameter&) const override;
-};
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(p, n, true);
+  set_buf(buf);
+  header(n);
+}
 
+void SampleProto::attach(const uint8_t *p, size_t n) {
 
-SampleProto::SampleProto(Message& msg) {
-  
-  auto size = wire_size(msg);
-  msgbuf_ptr_t buf = std::make_unique<msgbuf>(size);
+// Frames built by the public constructors are in a msgbuf
 
-  set_buf(buf);
-  set_size(size);
-  
-  to_wire(msg);
+  static_cast<msgbuf *>(buf())->view(p, n);
+  m_wide = false;
+  m_offsets.clear();
+  m_walk_end = -1;
+  header(n);
 }
 
-SampleProto::SampleProto(storage_ptr_t& p, size_t n) {
+void SampleProto::header(size_t n) {
 
-  msgbuf_ptr_t buf = std::make_unique<msgbuf>(p, n);
-  set_buf(buf);
   set_size(n);
   
   uint16_t id;
@@ -177,8 +125,125 @@ SampleProto::SampleProto(storage_ptr_t& p, size_t n) {
 
   uint16_t msg_size;
   from_wire(msg_size);
-  if (msg_size < n)
-    set_size(msg_size);
+  size_t size = msg_size;
+  if (size == 0 && this->buf()->getp(4)) { // wide header
+    uint32_t wide_size;
+    from_wire(wide_size);
+    size = wide_size;
+    m_wide = true;
+  }
+  if (size < n)
+    set_size(size);
+
+  auto c = this->buf()->getp(id_size());
+  m_delta = (c && c[id_size()-1] == delta_mark && (!m_wide || c[0] == 0xFF));
+}
+
+SampleProto::SampleProto(Message& msg, const SampleProto& prev) {
+
+// Unmodified parameters are copied from the previous encoding
+
+  m_wide = prev.m_wide;
+  auto size = header_size() + splice_size(msg);
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(size);
+
+  set_buf(buf);
+  set_size(size);
+
+  to_wire((uint16_t)msg.id());
+  if (m_wide) {
+    to_wire((uint16_t)0);
+    to_wire((uint32_t)size);
+  } else
+    to_wire((uint16_t)size);
+  splice(msg, *prev.buf());
+  prev.buf()->reset();
+  this->buf()->reset();
+}
+
+int SampleProto::write(const Message& msg, const sink_t& sink, size_t chunk) {
+
+// The frame is produced in chunks, data larger than a chunk is passed
+// to the sink directly from the message
+
+  SampleProto w;
+  msgbuf_ptr_t buf = std::make_unique<streambuf>(sink, chunk);
+  w.set_buf(buf);
+  w.m_spans = false;
+  w.frame(msg);
+  w.to_wire(msg);
+  return static_cast<streambuf *>(w.buf())->flush();
+}
+
+int SampleProto::send(const Message& msg, int fd) {
+
+// Only the framing and small parameters are copied, the frame is
+// gathered from the message when it is written
+
+  SampleProto w;
+  msgbuf_ptr_t buf = std::make_unique<iovbuf>();
+  w.set_buf(buf);
+  w.m_spans = false;
+  w.frame(msg);
+  if (w.to_wire(msg) != 0)
+    return -1;
+  return static_cast<iovbuf *>(w.buf())->send(fd);
+}
+
+int SampleProto::encode(const Message& msg, const std::function<uint8_t *(size_t)>& alloc) {
+
+  SampleProto w;
+  w.m_spans = false;
+  auto size = w.frame(msg);
+  auto p = alloc(size);
+  if (!p)
+    return -1;
+  msgbuf_ptr_t buf = std::make_unique<msgbuf>(p, size, false);
+  w.set_buf(buf);
+  return w.to_wire(msg);
+}
+
+message_ptr_t SampleProto::read(const source_t& source, size_t chunk) {
+
+// Only the header is read before the message is created, the rest of
+// the frame is decoded as it arrives. The source is not read past the
+// end of the frame.
+
+  auto src = std::make_unique<sourcebuf>(source, chunk);
+  auto in = src.get();
+  auto w = std::unique_ptr<SampleProto>(new SampleProto());
+  msgbuf_ptr_t buf = std::move(src);
+  w->set_buf(buf);
+  w->m_stream = true;
+  w->m_spans = false;
+
+  in->set_limit(4);
+  if (!in->getp(4))
+    return nullptr;
+  uint16_t id, msg_size;
+  w->from_wire(id);
+  w->from_wire(msg_size);
+  size_t size = msg_size;
+  if (size == 0) {
+    in->set_limit(8);
+    if (!in->getp(4))
+      return nullptr;
+    uint32_t wide_size;
+    w->from_wire(wide_size);
+    size = wide_size;
+    w->m_wide = true;
+  }
+  if (size < (size_t)w->header_size())
+    return nullptr;
+  in->set_limit(size);
+  w->set_id(id);
+  w->set_size(size);
+
+  auto c = in->getp(w->id_size());
+  w->m_delta = (c && c[w->id_size()-1] == delta_mark && (!w->m_wide || c[0] == 0xFF));
+
+  wire_format_ptr_t wf = std::move(w);
+  return Message::factory(wf);
 }
 
 wire_format_ptr_t WireFormat::factory(Message& msg) {
@@ -191,17 +256,93 @@ wire_format_ptr_t WireFormat::factory(storage_ptr_t& p, size_t n) {
   return w;
 }
 
+wire_format_ptr_t WireFormat::factory(const Message& baseline, Message& msg) {
+  if (baseline.id() != msg.id())
+    return nullptr;
+  wire_format_ptr_t w = std::make_unique<SampleProto>(baseline, msg);
+  return w;
+}
+
+size_t SampleProto::frame_size(const uint8_t *p, size_t n) {
+  if (n < 4)
+    return 0;
+  size_t size = (p[2] << 8) | p[3];
+  if (size == 0) { // wide header
+    if (n < 8)
+      return 0;
+    size = ((size_t)p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+    return (size > 8) ? size : 0;
+  }
+  return (size > 4) ? size : 0;
+}
+
+int SampleProto::max_id(const Group& group) {
+  int id = group.params().empty() ? 0 : group.params().rbegin()->first;
+  for (auto& p : group.params()) {
+    auto& par = p.second;
+    for (auto i=0; par.is_group() && i<par.nrepeats(); i++)
+      if (par.group(i))
+        id = std::max(id, max_id(*par.group(i)));
+  }
+  return id;
+}
+
+size_t SampleProto::frame(const Message& msg) {
+
+// Narrow frame if the message fits, wide otherwise
+
+  m_wide = false;
+  auto size = wire_size(msg);
+  if (size > 0xFFFF || max_id(msg) >= delta_mark) {
+    m_wide = true;
+    size = wire_size(msg);
+  }
+  set_size(size);
+  return size;
+}
+
+int SampleProto::put_id(int id) {
+  return m_wide ? to_wire((uint16_t)id) : to_wire((uint8_t)id);
+}
+
+int SampleProto::get_id() const {
+  if (!m_wide)
+    return buf()->getc();
+  if (!buf()->getp(2))
+    return mark(end_mark);
+  uint16_t id;
+  from_wire(id);
+  return id;
+}
+
+int SampleProto::put_len(size_t n) {
+  return m_wide ? to_wire((uint32_t)n) : to_wire((uint16_t)n);
+}
+
+size_t SampleProto::get_len() const {
+  if (!buf()->getp(len_size()))
+    return 0;
+  if (m_wide) {
+    uint32_t n;
+    from_wire(n);
+    return n;
+  }
+  uint16_t n;
+  from_wire(n);
+  return n;
+}
+
 size_t SampleProto::wire_size(const Message& msg) const {
-  auto s = msg_wire_overhead;
-  for (auto& it : msg.params())
-    s += wire_size(it.second);
+  size_t s = header_size() + id_size(); // header and end mark
+  for (auto bits = msg.presence(); bits; ) // set parameters only
+    s += wire_size(msg.param(pop_bit(bits)));
   return s;
 }
 
 size_t SampleProto::wire_size(const Group& group) const {
-  auto s = 1; // end mark
-  for (auto& it : group.params())
-    s += wire_size(it.second);
+  size_t s = id_size(); // end mark
+  for (auto bits = group.presence(); bits; )
+    s += wire_size(group.param(pop_bit(bits)));
   return s;
 }
 
@@ -214,40 +355,46 @@ size_t SampleProto::wire_size(const Parameter& par) const {
 
   if (par.is_group()) {
     for (auto i=0; i<par.nrepeats(); i++)
-      s +=  par_wire_overhead + wire_size(*par.group(i));
-    std::cout << "par " << par.id() << " wire size " << s << '\n';
+      s += id_size() + wire_size(*par.group(i));
+    TRACE("par " << par.id() << " wire size " << s << '\n');
   } else if (par.is_set()) {
     auto n = par.nrepeats();
-    s = n * par_wire_overhead; // parameter id
+    s = n * id_size(); // parameter id
     if  (!par.is_scalar())
-      s += n * 2; // data length field before data
+      s += n * len_size(); // data length field before data
     s += par.data_size(); // data length
-    std::cout << "par " << par.id() << " wire size " << s << '\n';
+    TRACE("par " << par.id() << " wire size " << s << '\n');
   } else {
-    std::cout << "par " << par.id() << " wire size 0\n";
+    TRACE("par " << par.id() << " wire size 0\n");
   }
   return s;
 }
 
 int SampleProto::to_wire(const Message& msg) {
 
-  std::cout << "msg: " << std::hex << msg.id() << '\n';
+  TRACE("msg: " << std::hex << msg.id() << '\n');
  
 // Message: | header | parameters | 0xFF
 // Header:  | Msg id | Msg size |
+// Wide:    | Msg id | 0 | Msg size u32 |
 
   to_wire((uint16_t)msg.id());
-  to_wire((uint16_t)size()); // wire format size 
-
-  for  (auto& it : msg.params()) {
-    to_wire(it.second); // serialize each parameter
-    std::cout << "end " << it.second.id() << '\n';
+  if (m_wide) {
+    to_wire((uint16_t)0);
+    to_wire((uint32_t)size());
+  } else
+    to_wire((uint16_t)size()); // wire format size 
+
+  for (auto bits = msg.presence(); bits; ) {
+    auto& par = msg.param(pop_bit(bits));
+    to_wire(par); // serialize each set parameter
+    TRACE("end " << par.id() << '\n');
   }
  
-  std::cout << "msg: " << std::hex << msg.id() << '\n';
-  to_wire((uint8_t)0xFF); // end of message 
+  TRACE("msg: " << std::hex << msg.id() << '\n');
+  put_id(mark(end_mark)); // end of message 
 
-  std::cout << "msg: " << std::hex << msg.id() << '\n';
+  TRACE("msg: " << std::hex << msg.id() << '\n');
   buf()->reset(); // read pointer to start of buffer
 
   return 0;
@@ -259,14 +406,21 @@ int SampleProto::to_wire(const Parameter& par) {
 // fixed size parameter:    | par id | data
 // variable size parameter: | par id | size | data
 
-  std::cout << "par: " << par.id() << '\n';
+  TRACE("par: " << par.id() << '\n');
+  auto offset = buf()->offset();
   if (par.is_set())
     for (auto i=0; i < par.nrepeats(); i++ ) {
-      to_wire((uint8_t)par.id());
+      put_id(par.id());
       if  (!par.is_scalar() && !par.is_group())
-        to_wire((uint16_t)par.data_size());
+        put_len(par.data_size());
       par.data_to_wire(*this,i);
     }
+  if (!m_spans)
+    ;
+  else if (par.is_set())
+    par.set_wire_span(offset, buf()->offset() - offset);
+  else
+    par.set_wire_span(-1, 0);
   return 0;
 }
 
@@ -275,48 +429,313 @@ int SampleProto::to_wire(const Group& group) {
 // group parameter: | par id | group | 0xFF
 // group          : | par 1 | par 2 | ...
 
-  std::cout << "group" << '\n';
+  TRACE("group" << '\n');
 
-  for (auto& it : group.params())
-    to_wire(it.second); // serialize each parameter
+  for (auto bits = group.presence(); bits; )
+    to_wire(group.param(pop_bit(bits))); // serialize each set parameter
  
-  to_wire((uint8_t)0xFF); // end of message 
+  put_id(mark(end_mark)); // end of group
+  return 0;
+}
+
+int SampleProto::patch(const Message& msg) {
+  auto ret = patch((const Group&)msg);
+  buf()->reset();
+  return ret;
+}
+
+int SampleProto::patch(const Group& group) {
+
+// Only fixed size parameters which were present in the previous encoding
+// can be overwritten, anything else changes the layout of the message
+
+  for (auto bits = group.modified(); bits; ) {
+    auto& par = group.param(pop_bit(bits));
+    if (par.wire_offset() < 0 || par.is_repeated())
+      return -1;
+    if (par.is_group()) {
+      if (patch(*par.group()) != 0)
+        return -1;
+    } else if (par.is_scalar()) {
+      buf()->reset();
+      buf()->advance(par.wire_offset() + id_size());
+      if (par.data_to_wire(*this, 0) != 0)
+        return -1; // read only buffer
+    } else
+      return -1; // variable length data
+  }
+  return 0;
+}
+
+wire_format_ptr_t SampleProto::reencode(Message& msg) const {
+  if (!m_wide && (header_size() + splice_size(msg) > 0xFFFF || max_id(msg) >= delta_mark))
+    return std::make_unique<SampleProto>(msg); // outgrows the narrow frame
+  wire_format_ptr_t w = std::make_unique<SampleProto>(msg, *this);
+  return w;
+}
+
+size_t SampleProto::splice_size(const Group& group) const {
+  size_t s = id_size(); // end mark
+  for (auto bits = group.presence(); bits; ) {
+    auto bit = pop_bit(bits);
+    auto& par = group.param(bit);
+    if (par.wire_offset() < 0)
+      s += wire_size(par);
+    else if (!(group.modified() & (presence_t(1) << bit)))
+      s += par.wire_length(); // copied as is
+    else if (par.is_group() && !par.is_repeated())
+      s += id_size() + splice_size(*par.group());
+    else
+      s += wire_size(par);
+  }
+  return s;
+}
+
+int SampleProto::splice(const Group& group, MsgBuf& src) {
+
+// Parameters found in the source buffer and not modified since are copied
+// byte by byte, modified single groups are spliced recursively
+
+  for (auto bits = group.presence(); bits; ) {
+    auto bit = pop_bit(bits);
+    auto& par = group.param(bit);
+    int offset = buf()->offset();
+
+    if (par.wire_offset() < 0) {
+      to_wire(par);
+    } else if (!(group.modified() & (presence_t(1) << bit))) {
+      src.reset();
+      src.advance(par.wire_offset());
+      auto p = src.getp(par.wire_length());
+      if (!p)
+        return -1;
+      buf()->putp(p, par.wire_length());
+      if (par.is_group() && !par.is_repeated())
+        rebase(*par.group(), offset - par.wire_offset());
+      par.set_wire_span(offset, par.wire_length());
+    } else if (par.is_group() && !par.is_repeated()) {
+      put_id(par.id());
+      if (splice(*par.group(), src) != 0)
+        return -1;
+      par.set_wire_span(offset, buf()->offset() - offset);
+    } else {
+      to_wire(par);
+    }
+  }
+  put_id(mark(end_mark)); // end of group or message
+  return 0;
+}
+
+void SampleProto::rebase(const Group& group, int delta) {
+  for (auto bits = group.presence(); bits; ) {
+    auto& par = group.param(pop_bit(bits));
+    if (par.wire_offset() < 0)
+      continue;
+    par.set_wire_span(par.wire_offset() + delta, par.wire_length());
+    if (par.is_group() && !par.is_repeated())
+      rebase(*par.group(), delta);
+  }
+}
+
+SampleProto::Delta SampleProto::delta_op(const Parameter& base, const Parameter& par) const {
+  if (par.is_group() && !par.is_repeated())
+    return (delta_size(*base.group(), *par.group()) > (size_t)id_size()) ? Delta::Nested : Delta::Same;
+  if (!par.is_set())
+    return (base.is_set()) ? Delta::Clear : Delta::Same;
+  return (par.equals(base)) ? Delta::Same : Delta::Full;
+}
+
+size_t SampleProto::delta_size(const Group& base, const Group& group) const {
+  size_t s = id_size(); // end mark
+  for (auto i=0; i<group.nparams(); i++) {
+    auto& par = group.param(i);
+    switch (delta_op(base.param(i), par)) {
+      case Delta::Clear:
+        s += 2 * id_size();
+        break;
+      case Delta::Full:
+        s += wire_size(par);
+        break;
+      case Delta::Nested:
+        s += id_size() + delta_size(*base.param(i).group(), *par.group());
+        break;
+      default:
+        break;
+    }
+  }
+  return s;
+}
+
+int SampleProto::delta_to_wire(const Group& base, const Group& group) {
+
+// Changed parameters are serialized as a whole, repeated parameters
+// replace the baseline's repeats. Single groups are compared recursively.
+
+  for (auto i=0; i<group.nparams(); i++) {
+    auto& par = group.param(i);
+    switch (delta_op(base.param(i), par)) {
+      case Delta::Clear:
+        put_id(mark(clear_mark));
+        put_id(par.id());
+        break;
+      case Delta::Full:
+        to_wire(par);
+        break;
+      case Delta::Nested:
+        put_id(par.id());
+        delta_to_wire(*base.param(i).group(), *par.group());
+        break;
+      default:
+        break;
+    }
+  }
+  put_id(mark(end_mark));
+  return 0;
+}
+
+int SampleProto::locate(const Message& msg, int id) const {
+
+// The first lookup scans the parameter ids of the whole message and
+// records where the data of each top level parameter starts. Parameters
+// are in id order, so one that is not found before the scan fails is
+// not in the message.
+
+  if (id < 0 || msg.params().count(id) == 0)
+    return not_found;
+
+  if (m_offsets.empty()) {
+    m_offsets.assign(msg.params().rbegin()->first + 1, -1);
+    m_walk_end = -1;
+    buf()->reset();
+    buf()->advance(header_size());
+
+    int c;
+    while ( (c = get_id()) != mark(end_mark)) {
+      if (msg.params().count(c) == 0) {
+        m_walk_end = c; // unknown parameter, rest of the message cannot be parsed
+        break;
+      }
+      if (m_offsets[c] < 0)
+        m_offsets[c] = buf()->offset();
+      if (skip(msg.params().at(c)) != 0) {
+        m_walk_end = c + 1;
+        break;
+      }
+    }
+    buf()->reset();
+  }
+
+  if (m_offsets[id] >= 0)
+    return m_offsets[id];
+  return (m_walk_end >= 0 && id >= m_walk_end) ? unreadable : not_found;
+}
+
+int SampleProto::skip(const Parameter& par) const {
+
+  if (par.is_group()) {
+    const Group *group = par.layout(); // also for a blank group array
+    if (!group)
+      return -1;
+    int c;
+    while ( (c = get_id()) != mark(end_mark)) {
+      if (group->params().count(c) == 0 || skip(group->params().at(c)) != 0)
+        return -1;
+    }
+  } else if (par.is_scalar()) {
+    if (!buf()->getp(par.item_size()))
+      return -1;
+    buf()->advance(par.item_size());
+  } else {
+    if (!buf()->getp(len_size()))
+      return -1;
+    auto n = get_len();
+    if (!buf()->getp(n))
+      return -1; // beyond the frame
+    buf()->advance(n);
+  }
   return 0;
 }
 
 int SampleProto::from_wire(Message& msg) const {
 
-  buf()->reset();
-  buf()->advance(4);
+  if (!m_stream) { // a stream is read past the header already
+    buf()->reset();
+    buf()->advance(header_size());
+  }
+  if (m_delta)
+    buf()->advance(id_size());
   return from_wire((Group&)msg);
 }
 
 int SampleProto::from_wire(Group& group) const {
 
-  std::cout << "group\n"; 
+  TRACE("group\n");
   int ret = 0;
-  uint8_t c;
-
-  while ( (c = buf()->getc()) != 0xff) {
+  int c;
+  presence_t seen = 0;
+
+  while ( (c = get_id()) != mark(end_mark)) {
+
+    if (m_delta && c == mark(clear_mark)) { // delta: cleared parameter
+      c = get_id();
+      if (group.params().count(int(c)) > 0)
+        group.params().at(c).clear();
+      else
+        ret -= 1;
+      continue;
+    }
 
-    std::cout << "trying parameter " << std::dec << int(c) << "\n"; 
+    TRACE("trying parameter " << std::dec << int(c) << "\n");
     if (group.params().count(int(c)) > 0) { // valid param id
-      std::cout << "parsing parameter " << std::dec << int(c) << "\n"; 
+      TRACE("parsing parameter " << std::dec << int(c) << "\n");
       Parameter& par = group.params().at(c);
-      ret -= par.data_from_wire(*this);
+      int offset = buf()->offset() - id_size();
+
+      if (m_delta) { // delta: repeats replace the previous ones
+        if (par.is_repeated() && !(seen & (presence_t(1) << par.bit())))
+          par.clear();
+        seen |= presence_t(1) << par.bit();
+        ret -= (par.data_from_wire(*this) != 0);
+        par.own_data(); // delta buffer is released after applying
+        continue;
+      }
+
+      ret -= (par.data_from_wire(*this) != 0); // count failures like unknown ids
+      if (m_stream) {
+        par.own_data(); // stream buffer is reused
+        continue;
+      }
+
+      // record where the parameter is found, repeats must be contiguous
+      int length = buf()->offset() - offset;
+      if (par.wire_offset() < 0 && par.wire_length() == 0)
+        par.set_wire_span(offset, length);
+      else if (par.wire_offset() >= 0
+               && par.wire_offset() + par.wire_length() == offset)
+        par.set_wire_span(par.wire_offset(), par.wire_length() + length);
+      else
+        par.set_wire_span(-1, -1);
 
     } else 
 
       ret -= 1; // non-valid param id
   }
 
-  std::cout << "group done" << "\n"; 
+  TRACE("group done" << "\n");
   return ret;
 }
 
 int SampleProto::from_wire(blob_t& data) const {
-  uint16_t n;
-  from_wire(n);
+  auto n = get_len();
+  if (m_stream) { // read directly into the blob's own storage
+    if (!fits(n))
+      return -1; // length from the wire is not allocated unchecked
+    storage_ptr_t p = std::make_unique<uint8_t []>(n);
+    if (buf()->getn(p.get(), n) != 0)
+      return -1;
+    data.assign(p, n);
+    return 0;
+  }
   uint8_t *p = buf()->getp(n);
   data.assign(p, n); // assign message buffer sub-area
   buf()->advance(n);
@@ -324,8 +743,17 @@ int SampleProto::from_wire(blob_t& data) const {
 }
 
 int SampleProto::from_wire(string_t& data) const {
-  uint16_t n;
-  from_wire(n);
+  auto n = get_len();
+  if (m_stream && !buf()->getp(n)) { // longer than the stream buffer
+    if (!fits(n))
+      return -1;
+    storage_ptr_t p = std::make_unique<uint8_t []>(n);
+    if (buf()->getn(p.get(), n) != 0)
+      return -1;
+    data.assign((const char *)p.get(), n);
+    data.own();
+    return 0;
+  }
   const char *p = (char *)buf()->getp(n);
   data.assign(p, n); // assign message buffer sub-area
   buf()->advance(n);
@@ -334,8 +762,16 @@ int SampleProto::from_wire(string_t& data) const {
 
 
 int SampleProto::from_wire(std::string& data) const {
-  uint16_t n;
-  from_wire(n);
+  auto n = get_len();
+  if (m_stream && !buf()->getp(n)) { // longer than the stream buffer
+    if (!fits(n))
+      return -1;
+    storage_ptr_t p = std::make_unique<uint8_t []>(n);
+    if (n == 0 || buf()->getn(p.get(), n) != 0)
+      return -1;
+    data.assign((const char *)p.get(), n-1);
+    return 0;
+  }
   const char *p = (const char *)buf()->getp(n);
   // TODO this makes a copy
   // if we want to reuse buffer area for data, string class has to be replaced
@@ -381,8 +817,7 @@ void SampleProto::dump(std::ostream& os, const Parameter& par) const {
     dump(os, *par.group(), par.id());
 
   } else { // variable length parameter
-    uint16_t size = 0;
-    from_wire(size);
+    auto size = get_len();
     uint8_t *p = buf()->getp(size);
     for (auto i=0; i < size; i++, p++)
       os << std::hex << std::setw(2) << int(*p) << ' ';
@@ -393,8 +828,8 @@ void SampleProto::dump(std::ostream& os, const Parameter& par) const {
 
 void SampleProto::dump(std::ostream& os, const Group& group, int id) const {
 
-  uint8_t c;
-  while ( (c = buf()->getc()) != 0xff) {
+  int c;
+  while ( (c = get_id()) != mark(end_mark)) {
 
     if (dynamic_cast<const Message*>(&group))
       // direct parameter
@@ -415,13 +850,17 @@ void SampleProto::dump(std::ostream& os, const Group& group, int id) const {
 void SampleProto::dump(std::ostream& os, const Message& msg) const {
 
   (void)msg;
-  uint16_t id, size; 
+  uint16_t id, narrow_size;
+  uint32_t size;
 
   os << "dump\n";
 
   buf()->reset();
   from_wire(id);
-  from_wire(size);
+  from_wire(narrow_size);
+  size = narrow_size;
+  if (m_wide)
+    from_wire(size);
 
   os << std::setfill('0');
   os << "Message: 0x" << std::hex << std::setw(4) << id;
@@ -0,0 +1,158 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _SAMPLEPROTO_H_
+#define _SAMPLEPROTO_H_
+
+//
+// Sample protocol implementation
+//
+// Message:   | u16 id | u16 size | parameters | end |
+// Parameter: | id | [length] | data |
+// Group:     | parameters | end |
+//
+// Parameter ids are one byte, lengths of variable size data u16 and the
+// end mark is 0xFF. Messages of 64 KiB or more, and messages with
+// parameter ids above 0xFC, use the wide variant:
+//
+// Message:   | u16 id | u16 0 | u32 size | parameters | end |
+//
+// where ids are u16, lengths u32 and the reserved ids are prefixed with
+// 0xFF (end mark 0xFFFF), so parameter ids are below 0xFF00. Values are
+// in network byte order.
+//
+
+#include "migmsg.h"
+#include "msgbuf.h"
+
+namespace mig {
+
+class SampleProto : public WireFormat {
+
+  public:
+    SampleProto(Message& msg);
+    SampleProto(Message& msg, const SampleProto& prev);
+    SampleProto(const Message& baseline, const Message& msg);
+    SampleProto(storage_ptr_t& buf, size_t n);
+    SampleProto(const region_ptr_t& region, size_t offset, size_t n);
+    SampleProto(const uint8_t *p, size_t n); // decode in place
+    ~SampleProto() {}    
+
+    //! decode another frame in place, the buffer object is reused
+    void attach(const uint8_t *p, size_t n);
+
+    // narrow frame
+    static const int par_wire_overhead = 1;
+    static const int msg_wire_overhead = 5;
+
+    // reserved parameter ids
+    static const uint8_t delta_mark = 0xFD; //!< delta message follows the header
+    static const uint8_t clear_mark = 0xFE; //!< parameter cleared in delta message
+    static const uint8_t end_mark = 0xFF;
+
+    //! encode a message to a sink in chunks without a frame sized buffer
+    static int write(const Message&, const sink_t&, size_t chunk = 0x10000);
+    //! decode one message from a source, blobs are read into their own storage
+    static message_ptr_t read(const source_t&, size_t chunk = 0x10000);
+    //! send a message to a descriptor, large data is not copied and
+    //! mapped file regions are sent with sendfile()
+    static int send(const Message&, int fd);
+
+    //! encode a message into memory obtained for its frame size,
+    //! alloc returns nullptr if there is no room
+    static int encode(const Message&, const std::function<uint8_t *(size_t)>& alloc);
+    //! size of the frame starting at p, 0 if n bytes do not hold a valid header
+    static size_t frame_size(const uint8_t *p, size_t n);
+
+    bool is_wide() const { return m_wide; }
+
+    size_t wire_size(const Group&) const override;
+    size_t wire_size(const Message&) const override;
+    size_t wire_size(const Parameter&) const override;
+ 
+    int to_wire(const Message&) override;
+    int to_wire(const Group&) override;
+    int to_wire(const Parameter&) override;
+ 
+    int from_wire(Message&) const override;
+    int from_wire(Group&) const override;
+    int from_wire(blob_t&) const override;
+    int from_wire(string_t&) const override;
+    int from_wire(std::string&) const override;
+
+    int patch(const Message&) override;
+    int locate(const Message&, int) const override;
+    wire_format_ptr_t reencode(Message&) const override;
+    bool is_delta() const override { return m_delta; }
+    bool is_stream() const override { return m_stream; }
+
+    using WireFormat::to_wire;
+    using WireFormat::from_wire;
+
+    void dump(std::ostream&, const Message&) const override;
+    void dump(std::ostream&, const Group&, int) const override;
+    void dump(std::ostream&, const Parameter&) const override;
+
+  private:
+    SampleProto() {} // stream
+
+    static int max_id(const Group&);
+    size_t frame(const Message&);
+    void header(size_t n);
+
+    int header_size() const { return m_wide ? 8 : 4; }
+    int id_size() const { return m_wide ? 2 : 1; }
+    int len_size() const { return m_wide ? 4 : 2; }
+    int mark(uint8_t m) const { return m_wide ? 0xFF00 | m : m; }
+    int put_id(int);
+    int get_id() const;
+    int put_len(size_t);
+    size_t get_len() const;
+    //! n bytes of data fit in the rest of the frame
+    bool fits(size_t n) const { return buf()->offset() + n <= size(); }
+
+    int patch(const Group&);
+    int skip(const Parameter&) const;
+    size_t splice_size(const Group&) const;
+    int splice(const Group&, MsgBuf&);
+    void rebase(const Group&, int);
+
+    enum class Delta { Same, Clear, Full, Nested };
+    Delta delta_op(const Parameter&, const Parameter&) const;
+    size_t delta_size(const Group&, const Group&) const;
+    int delta_to_wire(const Group&, const Group&);
+
+    bool m_wide = false; //!< u32 sizes and u16 parameter ids
+    bool m_delta = false; //!< buffer holds a delta message
+    bool m_spans = true; //!< record parameter locations
+    bool m_stream = false; //!< buffer is read from a source
+
+    mutable std::vector<int> m_offsets; //!< top level data offsets by id
+    mutable int m_walk_end = -1; //!< first id not reached by locate(), -1 if all were
+};
+
+} // namespace mig
+
+#endif // ifndef _SAMPLEPROTO_H_
@@ -0,0 +1,297 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Shared memory message ring
+//
+// - see shmring.h for the layout
+//
+
+#include "shmring.h"
+#include "sampleproto.h"
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+#if ATOMIC_LLONG_LOCK_FREE != 2 || ATOMIC_INT_LOCK_FREE != 2
+#error "shared memory ring needs lock free atomics"
+#endif
+
+namespace mig {
+
+static const char ring_magic[8] = { 'M', 'I', 'G', 'R', 'I', 'N', 'G', '1' };
+static const uint32_t pad_record = 1;
+
+static inline uint64_t record_size(size_t n) { return (ShmRing::record_header + n + 7) & ~(uint64_t)7; }
+
+static long futex(std::atomic<uint32_t> *addr, int op, uint32_t val, const struct timespec *ts) {
+  // not FUTEX_PRIVATE, the word is shared between processes
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), op, val, ts, nullptr, 0);
+}
+
+int ShmRing::create(const char *name, size_t capacity) {
+  close();
+  size_t cap = 4096;
+  while (cap < capacity)
+    cap <<= 1;
+
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    return -1;
+  size_t size = sizeof(ring_header) + cap;
+  void *p = MAP_FAILED;
+  if (ftruncate(fd, size) == 0)
+    p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    shm_unlink(name);
+    return -1;
+  }
+
+  // the object is zero filled, which is the initial state of the atomics
+  m_header = static_cast<ring_header *>(p);
+  m_data = static_cast<uint8_t *>(p) + sizeof(ring_header);
+  m_map_size = size;
+  m_name = name;
+  m_header->capacity = cap;
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(m_header->magic, ring_magic, sizeof(ring_magic));
+  return 0;
+}
+
+int ShmRing::open(const char *name) {
+  close();
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(ring_header))
+    p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+    return -1;
+
+  auto h = static_cast<ring_header *>(p);
+  if (memcmp(h->magic, ring_magic, sizeof(ring_magic)) != 0 ||
+      sizeof(ring_header) + h->capacity != (size_t)st.st_size) {
+    munmap(p, st.st_size);
+    return -1;
+  }
+  m_header = h;
+  m_data = static_cast<uint8_t *>(p) + sizeof(ring_header);
+  m_map_size = st.st_size;
+  return 0;
+}
+
+void ShmRing::close() {
+  if (!m_header)
+    return;
+  release();
+  munmap(m_header, m_map_size);
+  if (!m_name.empty())
+    shm_unlink(m_name.c_str());
+  m_header = nullptr;
+  m_data = nullptr;
+  m_map_size = 0;
+  m_name.clear();
+}
+
+size_t ShmRing::used() const {
+  if (!m_header)
+    return 0;
+  return m_header->reserve.load(std::memory_order_acquire) -
+    m_header->tail.load(std::memory_order_acquire);
+}
+
+int ShmRing::reserve(size_t n, slot& s) {
+  if (!m_header || n > max_frame())
+    return -1;
+
+  uint64_t cap = m_header->capacity;
+  uint64_t need = record_size(n);
+  uint64_t pos = m_header->reserve.load(std::memory_order_relaxed);
+  uint64_t start, end;
+  do {
+    // records do not wrap, the rest of the data is skipped instead
+    uint64_t offset = pos & (cap - 1);
+    start = (offset + need > cap) ? pos + (cap - offset) : pos;
+    end = start + need;
+    if (end - m_header->tail.load(std::memory_order_acquire) > cap)
+      return -1; // full
+  } while (!m_header->reserve.compare_exchange_weak(pos, end,
+        std::memory_order_relaxed, std::memory_order_relaxed));
+
+  if (start != pos) {
+    uint32_t pad[2] = { (uint32_t)(start - pos), pad_record };
+    memcpy(m_data + (pos & (cap - 1)), pad, sizeof(pad));
+  }
+  auto rec = m_data + (start & (cap - 1));
+  uint32_t hdr[2] = { (uint32_t)n, 0 };
+  memcpy(rec, hdr, sizeof(hdr));
+
+  s.data = rec + record_header;
+  s.size = n;
+  s.pos = pos;
+  s.end = end;
+  return 0;
+}
+
+int ShmRing::commit(const slot& s, int timeout) {
+  using clock = std::chrono::steady_clock;
+  auto deadline = clock::now() + std::chrono::milliseconds(timeout);
+
+  // publish in claim order, an earlier claim is being written right now
+  for (int i = 0; m_header->head.load(std::memory_order_acquire) != s.pos; i++)
+    if (i >= 100) {
+      if (timeout >= 0 && clock::now() >= deadline)
+        return -1;
+      sched_yield();
+    }
+  m_header->head.store(s.end, std::memory_order_release);
+  wakeup();
+  return 0;
+}
+
+void ShmRing::wakeup() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_header->sleepers.load(std::memory_order_relaxed) == 0)
+    return;
+  m_header->wake.fetch_add(1, std::memory_order_release);
+  futex(&m_header->wake, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+int ShmRing::write(const Message& msg) {
+  slot s;
+  if (SampleProto::encode(msg, [&](size_t n) { return (reserve(n, s) == 0) ? s.data : nullptr; }) == 0) {
+    commit(s);
+    return 0;
+  }
+  if (s.data) {
+    // space is claimed, publish it as padding to keep the ring going
+    uint32_t pad[2] = { (uint32_t)record_size(s.size), pad_record };
+    memcpy(s.data - record_header, pad, sizeof(pad));
+    commit(s);
+  }
+  return -1;
+}
+
+int ShmRing::write(const uint8_t *frame, size_t n) {
+  slot s;
+  if (reserve(n, s) != 0)
+    return -1;
+  memcpy(s.data, frame, n);
+  commit(s);
+  return 0;
+}
+
+int ShmRing::wait(uint64_t h, int timeout) {
+  for (int i = 0; i < 100; i++)
+    if (m_header->head.load(std::memory_order_acquire) != h)
+      return 0;
+
+  struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+  uint32_t w = m_header->wake.load(std::memory_order_acquire);
+  m_header->sleepers.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int r = 0;
+  if (m_header->head.load(std::memory_order_acquire) == h &&
+      futex(&m_header->wake, FUTEX_WAIT, w, (timeout >= 0) ? &ts : nullptr) < 0 &&
+      errno == ETIMEDOUT)
+    r = -1;
+  m_header->sleepers.fetch_sub(1, std::memory_order_relaxed);
+  return r;
+}
+
+const uint8_t *ShmRing::read(size_t& n, int timeout) {
+  if (!m_header)
+    return nullptr;
+  release();
+
+  using clock = std::chrono::steady_clock;
+  auto deadline = clock::now() + std::chrono::milliseconds(timeout);
+  uint64_t cap = m_header->capacity;
+  uint64_t pos = m_header->tail.load(std::memory_order_relaxed);
+  for (;;) {
+    if (m_header->head.load(std::memory_order_acquire) == pos) {
+      int left = -1;
+      if (timeout >= 0) {
+        auto d = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now());
+        left = (d.count() > 0) ? (int)d.count() : 0;
+      }
+      if (wait(pos, left) < 0 ||
+          (left == 0 && m_header->head.load(std::memory_order_acquire) == pos))
+        return nullptr;
+      continue;
+    }
+
+    auto rec = m_data + (pos & (cap - 1));
+    uint32_t hdr[2];
+    memcpy(hdr, rec, sizeof(hdr));
+    if (hdr[1] & pad_record) {
+      pos += hdr[0];
+      m_header->tail.store(pos, std::memory_order_release);
+      continue;
+    }
+    m_next = pos + record_size(hdr[0]);
+    m_pending = true;
+    n = hdr[0];
+    return rec + record_header;
+  }
+}
+
+void ShmRing::release() {
+  if (m_pending) {
+    m_header->tail.store(m_next, std::memory_order_release);
+    m_pending = false;
+  }
+}
+
+message_ptr_t ShmRing::receive(int timeout) {
+  size_t n;
+  for (;;) {
+    auto p = read(n, timeout);
+    if (!p)
+      return nullptr;
+    wire_format_ptr_t w = std::make_unique<SampleProto>(p, n);
+    auto msg = Message::factory(w);
+    if (msg)
+      return msg;
+    // not a message of this schema, skip it
+  }
+}
+
+} // namespace mig
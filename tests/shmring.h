@@ -0,0 +1,147 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+//
+// Shared memory message ring
+//
+// Segment: | ring_header | data (capacity bytes) |
+// Record:  | u32 size | u32 flags | SampleProto frame | padding to 8 |
+//
+// Producers claim space by advancing the reserve position, encode in
+// place and publish records in claim order by advancing head. A record
+// that would cross the end of the data is preceded by a pad record, so
+// that frames are always contiguous and can be decoded in place. There
+// is a single consumer, it advances tail when it releases a record.
+// Positions only grow, the offset in the data is position % capacity.
+//
+// The consumer sleeps on a futex only when the ring is empty, producers
+// make the system call only when a consumer is sleeping.
+//
+// A producer that dies between reserve() and commit() stalls the ring:
+// its record is never published, so no later record is either. A dead
+// producer cannot be told from a slow one, whose claimed space must not
+// be given away, so the claim is not skipped. commit() with a timeout
+// reports the stall, the ring has to be recreated then.
+//
+
+#include "migmsg.h"
+#include <atomic>
+#include <string>
+
+namespace mig {
+
+struct ring_header {
+  char magic[8];
+  uint64_t capacity; //!< data bytes, a power of two
+  alignas(64) std::atomic<uint64_t> reserve; //!< end of claimed space
+  alignas(64) std::atomic<uint64_t> head; //!< end of published records
+  alignas(64) std::atomic<uint64_t> tail; //!< end of released records
+  alignas(64) std::atomic<uint32_t> wake; //!< futex word, bumped on wakeup
+  std::atomic<uint32_t> sleepers; //!< consumers waiting on wake
+};
+
+//! Shared memory ring, one consumer and any number of producers
+//
+// Both ends map the same POSIX shared memory object by name, the
+// creator removes the name when it closes the ring.
+//
+class ShmRing {
+
+  public:
+    //! claimed space of a record
+    struct slot {
+      uint8_t *data = nullptr; //!< frame
+      size_t size = 0; //!< frame size
+      uint64_t pos = 0; //!< position of the claim
+      uint64_t end = 0; //!< position after the record
+    };
+
+    ShmRing() {}
+    ~ShmRing() { close(); }
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    //! create a ring with at least capacity data bytes
+    int create(const char *name, size_t capacity);
+    //! open an existing ring
+    int open(const char *name);
+    void close();
+
+    size_t capacity() const { return (m_header) ? m_header->capacity : 0; }
+    //! bytes claimed by producers and not yet released
+    size_t used() const;
+
+    //
+    // Producer
+    //
+
+    //! claim space for a frame of n bytes, -1 if the ring is full
+    int reserve(size_t n, slot& s);
+    //! publish a claimed record, waits up to timeout ms (forever if < 0)
+    //! for earlier claims to be published. -1 on timeout, the record is
+    //! not published then and commit has to be called again.
+    int commit(const slot& s, int timeout = -1);
+    //! encode a message directly into the ring, -1 if it does not fit
+    int write(const Message& msg);
+    //! copy a frame to the ring
+    int write(const uint8_t *frame, size_t n);
+
+    //
+    // Consumer
+    //
+
+    //! next frame, waits up to timeout ms (forever if < 0) while the ring
+    //! is empty. The previous frame is released. nullptr on timeout.
+    const uint8_t *read(size_t& n, int timeout = -1);
+    //! release the frame returned by read
+    void release();
+    //! next message decoded in place, its data refers to the ring until
+    //! the next read, receive or release
+    message_ptr_t receive(int timeout = -1);
+
+    //! largest frame that fits in the ring
+    size_t max_frame() const { return capacity() / 2 - record_header; }
+
+    static const size_t record_header = 8;
+
+  private:
+    //! wait until head moves from h
+    int wait(uint64_t h, int timeout);
+    void wakeup();
+
+    ring_header *m_header = nullptr;
+    uint8_t *m_data = nullptr;
+    size_t m_map_size = 0;
+    std::string m_name; //!< set if this end created the ring
+    uint64_t m_next = 0; //!< consumer: end of the current record
+    bool m_pending = false; //!< consumer: a record is not released
+};
+
+} // namespace mig
+
+#endif // ifndef _SHMRING_H_
@@ -0,0 +1,538 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+// 
+// Batched socket transport
+//
+// - see transport.h
+//
+
+#include "transport.h"
+#include "sampleproto.h"
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+extern "C" {
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+namespace mig {
+
+//
+// FrameSplitter
+//
+
+uint8_t *FrameSplitter::space(size_t n) {
+  if (room() < n) {
+    // drop returned frames, keep the incomplete one
+    if (m_begin > 0) {
+      memmove(m_buf.data(), m_buf.data() + m_begin, m_end - m_begin);
+      m_end -= m_begin;
+      m_begin = 0;
+    }
+    if (room() < n)
+      m_buf.resize(m_end + n);
+  }
+  return m_buf.data() + m_end;
+}
+
+void FrameSplitter::feed(const uint8_t *p, size_t n) {
+  memcpy(space(n), p, n);
+  produced(n);
+}
+
+size_t FrameSplitter::missing() const {
+  auto left = m_end - m_begin;
+  auto size = SampleProto::frame_size(m_buf.data() + m_begin, left);
+  if (size == 0)
+    return (left < 4) ? 4 - left : (left < 8) ? 8 - left : 0;
+  return (size > left) ? size - left : 0;
+}
+
+const uint8_t *FrameSplitter::next(size_t& n) {
+  if (m_error)
+    return nullptr;
+  auto p = m_buf.data() + m_begin;
+  auto left = m_end - m_begin;
+  auto size = SampleProto::frame_size(p, left);
+  if (size == 0) {
+    // a header is at most 8 bytes
+    m_error = (left >= 8);
+    return nullptr;
+  }
+  if (size > left)
+    return nullptr;
+  m_begin += size;
+  n = size;
+  return p;
+}
+
+//
+// SharedFrame
+//
+
+SharedFrame SharedFrame::encode(const Message& msg) {
+  SharedFrame f;
+  std::unique_ptr<uint8_t []> p;
+  size_t size = 0;
+  auto r = SampleProto::encode(msg, [&](size_t n) {
+    p.reset(new uint8_t[n]);
+    size = n;
+    return p.get();
+  });
+  if (r == 0) {
+    f.m_data = std::shared_ptr<const uint8_t>(p.release(), std::default_delete<const uint8_t []>());
+    f.m_size = size;
+  }
+  return f;
+}
+
+SharedFrame SharedFrame::copy(const uint8_t *frame, size_t n) {
+  SharedFrame f;
+  auto p = new uint8_t[n];
+  memcpy(p, frame, n);
+  f.m_data = std::shared_ptr<const uint8_t>(p, std::default_delete<const uint8_t []>());
+  f.m_size = n;
+  return f;
+}
+
+int broadcast(const Message& msg, const std::vector<Transport*>& transports) {
+  auto frame = SharedFrame::encode(msg);
+  if (!frame)
+    return -1;
+  return broadcast(frame, transports);
+}
+
+int broadcast(const SharedFrame& frame, const std::vector<Transport*>& transports) {
+  int r = 0;
+  for (auto t : transports)
+    if (t->send(frame) != 0)
+      r = -1;
+  return r;
+}
+
+//
+// Transport
+//
+
+Transport::Transport(int fd, const transport_options& options) :
+  m_fd(fd), m_stream(true), m_options(options), m_in(options.read_size) {
+
+  int type = 0;
+  socklen_t len = sizeof(type);
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0)
+    m_stream = (type == SOCK_STREAM);
+  // not a socket, e.g. a pipe, is a stream
+  if (m_options.batch == 0)
+    m_options.batch = 1;
+}
+
+Transport::~Transport() {
+  if (m_fd >= 0) {
+    flush();
+    close(m_fd);
+  }
+}
+
+uint8_t *Transport::alloc(size_t n) {
+  auto size = m_out.size();
+  m_out.resize(size + n);
+  return m_out.data() + size;
+}
+
+int Transport::queued(size_t n, const SharedFrame& shared) {
+  auto now = clock::now();
+  if (m_frames.empty())
+    m_first = now;
+  m_frames.push_back(m_out.size());
+  if (shared) {
+    // references are only kept once there are shared frames in the batch
+    m_shared.resize(m_frames.size());
+    m_shared.back() = shared;
+    m_shared_count++;
+  }
+  m_bytes += n;
+  m_stats.frames_sent++;
+  m_stats.bytes_sent += n;
+  if (m_frames.size() >= m_options.batch || m_bytes >= m_options.batch_bytes ||
+      now - m_first >= m_options.flush_latency)
+    return flush();
+  return 0;
+}
+
+int Transport::send(const Message& msg) {
+  auto size = m_out.size();
+  if (SampleProto::encode(msg, [&](size_t n) { return alloc(n); }) != 0) {
+    m_out.resize(size);
+    return -1;
+  }
+  return queued(m_out.size() - size);
+}
+
+int Transport::send(const uint8_t *frame, size_t n) {
+  if (SampleProto::frame_size(frame, n) != n)
+    return -1;
+  memcpy(alloc(n), frame, n);
+  return queued(n);
+}
+
+int Transport::send(const SharedFrame& frame) {
+  if (!frame || SampleProto::frame_size(frame.data(), frame.size()) != frame.size())
+    return -1;
+  return queued(frame.size(), frame);
+}
+
+int Transport::flush() {
+  if (m_frames.empty())
+    return 0;
+  int r = (m_stream) ? send_stream() : send_datagrams();
+  m_out.clear();
+  m_frames.clear();
+  m_shared.clear(); // the last transport to send a shared frame frees it
+  m_shared_count = 0;
+  m_bytes = 0;
+  return r;
+}
+
+void Transport::segments(std::vector<struct iovec>& iov, bool merge) const {
+  size_t begin = 0;
+  for (size_t i=0; i<m_frames.size(); i++) {
+    if (i < m_shared.size() && m_shared[i]) {
+      iov.push_back({ (void *)m_shared[i].data(), m_shared[i].size() });
+      continue;
+    }
+    auto p = (uint8_t *)m_out.data() + begin;
+    auto n = m_frames[i] - begin;
+    begin = m_frames[i];
+    if (merge && !iov.empty() && (uint8_t *)iov.back().iov_base + iov.back().iov_len == p)
+      iov.back().iov_len += n; // copied frames are back to back
+    else
+      iov.push_back({ p, n });
+  }
+}
+
+int Transport::poll() {
+  if (m_frames.empty() || clock::now() - m_first < m_options.flush_latency)
+    return 0;
+  return flush();
+}
+
+int Transport::next_flush() const {
+  if (m_frames.empty())
+    return -1;
+  auto left = m_options.flush_latency - (clock::now() - m_first);
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(left).count();
+  return (ms > 0) ? (int)ms : 0;
+}
+
+int Transport::wait(short events, int timeout) {
+  struct pollfd p = { m_fd, events, 0 };
+  for (;;) {
+    int r = ::poll(&p, 1, timeout);
+    if (r < 0 && errno == EINTR)
+      continue;
+    return r;
+  }
+}
+
+int Transport::send_stream() {
+  if (m_shared_count > 0)
+    return send_vector();
+  auto p = m_out.data();
+  size_t left = m_out.size();
+  while (left > 0) {
+    m_stats.send_calls++;
+    auto r = write(m_fd, p, left);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (wait(POLLOUT, -1) < 0)
+        return -1;
+      continue;
+    }
+    if (r <= 0)
+      return -1;
+    p += r;
+    left -= r;
+  }
+  return 0;
+}
+
+int Transport::send_vector() {
+  std::vector<struct iovec> iov;
+  segments(iov, true);
+  size_t i = 0;
+  while (i < iov.size()) {
+    m_stats.send_calls++;
+    auto r = writev(m_fd, &iov[i], (int)std::min(iov.size() - i, (size_t)IOV_MAX));
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (wait(POLLOUT, -1) < 0)
+        return -1;
+      continue;
+    }
+    if (r <= 0)
+      return -1;
+    // skip what was written, a partly written segment is continued
+    size_t done = r;
+    while (i < iov.size() && done >= iov[i].iov_len)
+      done -= iov[i++].iov_len;
+    if (done > 0) {
+      iov[i].iov_base = (uint8_t *)iov[i].iov_base + done;
+      iov[i].iov_len -= done;
+    }
+  }
+  return 0;
+}
+
+int Transport::send_datagrams() {
+  auto n = m_frames.size();
+  std::vector<struct iovec> iov;
+  iov.reserve(n);
+  segments(iov, false);
+  std::vector<struct mmsghdr> msgs(n);
+  for (size_t i=0; i<n; i++) {
+    memset(&msgs[i], 0, sizeof(msgs[i]));
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  for (size_t i=0; i<n; ) {
+    m_stats.send_calls++;
+    int r = sendmmsg(m_fd, &msgs[i], n - i, 0);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (wait(POLLOUT, -1) < 0)
+        return -1;
+      continue;
+    }
+    if (r <= 0)
+      return -1;
+    i += r;
+  }
+  return 0;
+}
+
+int Transport::receive(std::vector<frame_ref>& frames, int timeout) {
+  frames.clear();
+  int r = (m_stream) ? receive_stream(frames, timeout) : receive_datagrams(frames, timeout);
+  if (r > 0) {
+    m_stats.frames_received += r;
+    for (auto& f : frames)
+      m_stats.bytes_received += f.size;
+  }
+  return r;
+}
+
+int Transport::receive(std::vector<message_ptr_t>& msgs, int timeout) {
+  std::vector<frame_ref> frames;
+  msgs.clear();
+  int r = receive(frames, timeout);
+  for (auto& f : frames) {
+    auto p = std::make_unique<uint8_t []>(f.size);
+    memcpy(p.get(), f.data, f.size);
+    wire_format_ptr_t w = std::make_unique<SampleProto>(p, f.size);
+    auto msg = Message::factory(w);
+    if (msg)
+      msgs.push_back(std::move(msg));
+  }
+  return (r < 0) ? r : (int)msgs.size();
+}
+
+int Transport::receive_stream(std::vector<frame_ref>& frames, int timeout) {
+
+// Complete frames left from the last read are returned first, the buffer
+// moves only when it is read into
+
+  for (;;) {
+    size_t n;
+    while (auto p = m_in.next(n))
+      frames.push_back({ p, n });
+    if (m_in.error())
+      return -1;
+    if (!frames.empty())
+      return frames.size();
+
+    int w = wait(POLLIN, timeout);
+    if (w <= 0)
+      return w;
+    auto p = m_in.space(m_options.read_size);
+    ssize_t r;
+    do {
+      m_stats.receive_calls++;
+      r = read(m_fd, p, m_in.room());
+    } while (r < 0 && errno == EINTR);
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+    if (r <= 0)
+      return -1; // end of stream
+    m_in.produced(r);
+  }
+}
+
+int Transport::receive_datagrams(std::vector<frame_ref>& frames, int timeout) {
+  auto n = m_options.batch;
+  auto size = m_options.max_datagram;
+  if (m_datagrams.size() != n * size)
+    m_datagrams.resize(n * size);
+
+  std::vector<struct iovec> iov(n);
+  std::vector<struct mmsghdr> msgs(n);
+  for (size_t i=0; i<n; i++) {
+    iov[i].iov_base = m_datagrams.data() + i * size;
+    iov[i].iov_len = size;
+    memset(&msgs[i], 0, sizeof(msgs[i]));
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int w = wait(POLLIN, timeout);
+  if (w <= 0)
+    return w;
+  int r;
+  do {
+    m_stats.receive_calls++;
+    r = recvmmsg(m_fd, msgs.data(), n, MSG_DONTWAIT, nullptr);
+  } while (r < 0 && errno == EINTR);
+  if (r < 0)
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+  for (int i=0; i<r; i++) {
+    auto p = (const uint8_t *)iov[i].iov_base;
+    auto len = msgs[i].msg_len;
+    if (len == 0 && frames.empty())
+      return -1; // end of a connection
+    // truncated or not a frame, skip it
+    if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || SampleProto::frame_size(p, len) != len)
+      continue;
+    frames.push_back({ p, len });
+  }
+  return frames.size();
+}
+
+//
+// Sockets
+//
+
+static int unix_socket(const char *path, int type, struct sockaddr_un& addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, path);
+  return socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+}
+
+int connect_unix(const char *path, int type) {
+  struct sockaddr_un addr;
+  int fd = unix_socket(path, type, addr);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int listen_unix(const char *path, int type) {
+  struct sockaddr_un addr;
+  int fd = unix_socket(path, type, addr);
+  if (fd < 0)
+    return -1;
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      (type != SOCK_DGRAM && listen(fd, 16) != 0)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int inet_socket(const char *host, int port, int type, bool passive) {
+  struct addrinfo hints, *res = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = type;
+  hints.ai_flags = (passive) ? AI_PASSIVE : 0;
+  if (getaddrinfo(host, std::to_string(port).c_str(), &hints, &res) != 0)
+    return -1;
+
+  int fd = -1;
+  for (auto a = res; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+    if (fd < 0)
+      continue;
+    int one = 1;
+    int r;
+    if (passive) {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      r = bind(fd, a->ai_addr, a->ai_addrlen);
+      if (r == 0 && type == SOCK_STREAM)
+        r = listen(fd, 16);
+    } else {
+      r = connect(fd, a->ai_addr, a->ai_addrlen);
+      // batching is done here, not by Nagle
+      if (r == 0 && type == SOCK_STREAM)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (r != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+int connect_inet(const char *host, int port, int type) {
+  return inet_socket(host, port, type, false);
+}
+
+int listen_inet(const char *host, int port, int type) {
+  return inet_socket(host, port, type, true);
+}
+
+int local_port(int fd) {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(fd, (struct sockaddr *)&addr, &len) != 0)
+    return -1;
+  if (addr.ss_family == AF_INET)
+    return ntohs(((struct sockaddr_in *)&addr)->sin_port);
+  if (addr.ss_family == AF_INET6)
+    return ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+  return -1;
+}
+
+} // namespace mig
@@ -0,0 +1,227 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+//
+// Batched socket transport for SampleProto frames
+//
+// Outgoing frames are encoded back to back into a batch buffer, which
+// is flushed when it holds batch frames or batch_bytes bytes, or when
+// its oldest frame has waited flush_latency. A stream socket sends the
+// batch with one write, a datagram socket sends one frame per datagram
+// with sendmmsg.
+//
+// A stream socket is read in large reads that feed a frame splitter, a
+// datagram socket is read with recvmmsg. Either way the application
+// gets all frames that are available as one batch.
+//
+// There is no timer, an idle sender has to call poll() to get a pending
+// batch out in time, next_flush() tells when.
+//
+// A message for many receivers is encoded once into a SharedFrame. The
+// transports queue a reference to it instead of a copy, and the last one
+// to send it frees it.
+//
+
+#include "migmsg.h"
+#include <chrono>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <sys/socket.h>
+#include <sys/uio.h>
+}
+
+namespace mig {
+
+//! Reassembles frames from a byte stream
+class FrameSplitter {
+
+  public:
+    FrameSplitter(size_t size = 0x10000) : m_buf(size) {}
+
+    //! room for at least n more bytes, previously returned frames move
+    uint8_t *space(size_t n);
+    size_t room() const { return m_buf.size() - m_end; }
+    //! n bytes were written to space()
+    void produced(size_t n) { m_end += n; }
+    //! copy bytes to the splitter
+    void feed(const uint8_t *p, size_t n);
+
+    //! next complete frame, nullptr if more data is needed or on error
+    const uint8_t *next(size_t& n);
+    //! the stream does not hold a valid frame header
+    bool error() const { return this->m_error; }
+    //! bytes missing from the first frame, or from its header if its
+    //! size is not known yet
+    size_t missing() const;
+    //! bytes of an incomplete frame
+    size_t pending() const { return m_end - m_begin; }
+    void clear() { m_begin = m_end = 0; m_error = false; }
+
+  private:
+    std::vector<uint8_t> m_buf;
+    size_t m_begin = 0; //!< start of the first unreturned frame
+    size_t m_end = 0; //!< end of data
+    bool m_error = false;
+};
+
+//! Immutable reference counted SampleProto frame
+class SharedFrame {
+
+  public:
+    SharedFrame() {}
+    //! encode a message, an empty frame if it fails
+    static SharedFrame encode(const Message& msg);
+    //! copy of a frame
+    static SharedFrame copy(const uint8_t *frame, size_t n);
+
+    const uint8_t *data() const { return this->m_data.get(); }
+    size_t size() const { return this->m_size; }
+    explicit operator bool() const { return this->m_data != nullptr; }
+    //! number of holders, the caller included
+    long use_count() const { return this->m_data.use_count(); }
+
+  private:
+    std::shared_ptr<const uint8_t> m_data;
+    size_t m_size = 0;
+};
+
+struct transport_options {
+  size_t batch = 64; //!< frames per batch
+  size_t batch_bytes = 0x10000; //!< bytes per batch, a stream flushes beyond it
+  std::chrono::microseconds flush_latency{1000}; //!< maximum wait of a frame
+  size_t read_size = 0x40000; //!< stream read size
+  size_t max_datagram = 0x10000; //!< datagram receive size
+};
+
+struct transport_stats {
+  uint64_t frames_sent = 0;
+  uint64_t frames_received = 0;
+  uint64_t bytes_sent = 0;
+  uint64_t bytes_received = 0;
+  uint64_t send_calls = 0; //!< system calls
+  uint64_t receive_calls = 0;
+};
+
+//! Batching transport over a connected socket
+class Transport {
+
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    //! the transport owns fd and closes it
+    Transport(int fd, const transport_options& options = transport_options());
+    ~Transport();
+    Transport(const Transport&) = delete;
+    Transport& operator=(const Transport&) = delete;
+
+    int fd() const { return this->m_fd; }
+    bool is_stream() const { return this->m_stream; }
+    const transport_stats& stats() const { return this->m_stats; }
+
+    //
+    // Sending
+    //
+
+    //! queue an encoded message, flushes when the batch is due
+    int send(const Message& msg);
+    //! queue a SampleProto frame
+    int send(const uint8_t *frame, size_t n);
+    //! queue a reference to a shared frame, which is held until it is sent
+    int send(const SharedFrame& frame);
+    //! send all queued frames
+    int flush();
+    //! flush if the oldest queued frame has waited long enough
+    int poll();
+    //! ms until the queued frames are due, -1 if none are queued
+    int next_flush() const;
+    size_t queued() const { return this->m_frames.size(); }
+
+    //
+    // Receiving
+    //
+
+    //! frames available within timeout ms (forever if < 0), they stay valid
+    //! until the next receive. Returns the number of frames, 0 on timeout,
+    //! -1 on error or end of stream.
+    int receive(std::vector<frame_ref>& frames, int timeout = -1);
+    //! messages decoded from the next batch of frames
+    int receive(std::vector<message_ptr_t>& msgs, int timeout = -1);
+
+  private:
+    uint8_t *alloc(size_t n);
+    int queued(size_t n, const SharedFrame& shared = SharedFrame());
+    int send_stream();
+    int send_vector();
+    int send_datagrams();
+    //! iovecs of the queued frames, merging adjacent copied frames
+    void segments(std::vector<struct iovec>& iov, bool merge) const;
+    int wait(short events, int timeout);
+    int receive_stream(std::vector<frame_ref>& frames, int timeout);
+    int receive_datagrams(std::vector<frame_ref>& frames, int timeout);
+
+    int m_fd;
+    bool m_stream;
+    transport_options m_options;
+    transport_stats m_stats;
+
+    std::vector<uint8_t> m_out; //!< queued frames
+    std::vector<size_t> m_frames; //!< end offsets of queued frames in m_out
+    std::vector<SharedFrame> m_shared; //!< shared queued frames, empty for copied ones
+    size_t m_shared_count = 0;
+    size_t m_bytes = 0; //!< queued bytes
+    clock::time_point m_first; //!< when the oldest queued frame was queued
+
+    FrameSplitter m_in;
+    std::vector<uint8_t> m_datagrams; //!< datagram receive buffers
+};
+
+//! Encode a message once and queue it to every transport. Returns -1 if
+//! the encoding or any send fails, the other transports still get it.
+int broadcast(const Message& msg, const std::vector<Transport*>& transports);
+int broadcast(const SharedFrame& frame, const std::vector<Transport*>& transports);
+
+//
+// Socket helpers, they return a socket or -1
+//
+
+//! connect to a Unix domain socket, type is SOCK_STREAM, SOCK_DGRAM or SOCK_SEQPACKET
+int connect_unix(const char *path, int type = SOCK_STREAM);
+//! bind a Unix domain socket, connection oriented sockets listen
+int listen_unix(const char *path, int type = SOCK_STREAM);
+//! connect to host:port over TCP, or UDP if type is SOCK_DGRAM
+int connect_inet(const char *host, int port, int type = SOCK_STREAM);
+//! bind to host:port, port 0 picks a free port, TCP sockets listen
+int listen_inet(const char *host, int port, int type = SOCK_STREAM);
+//! port a socket is bound to, -1 if none
+int local_port(int fd);
+
+} // namespace mig
+
+#endif // ifndef _TRANSPORT_H_
@@ -0,0 +1,131 @@
+/* 
+   Messaging Interface Generator
+
+   Copyright 2019 Olli Vertanen
+
+   Permission is hereby granted, free of charge, to any person obtaining a 
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ 
+*/
+
+//
+// Transport throughput over loopback TCP and Unix domain sockets
+//
+// Usage: transportbench [messages]
+//
+// Each run sends the same message from one thread and receives and
+// decodes it in another, for several batch sizes. Batch 1 is a send
+// per message.
+//
+
+#include "msg_tests.msg.h"
+#include "transport.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <sys/socket.h>
+#include <unistd.h>
+}
+
+//! connected socket pair of a kind
+static bool connect_pair(const std::string& kind, int& a, int& b) {
+  static int n = 0;
+  std::string path = "/tmp/mig_bench_" + std::to_string(getpid()) + "_" + std::to_string(n++);
+  int l = -1;
+  a = b = -1;
+  if (kind == "tcp") {
+    l = ::mig::listen_inet("127.0.0.1", 0);
+    a = (l >= 0) ? ::mig::connect_inet("127.0.0.1", ::mig::local_port(l)) : -1;
+    b = (a >= 0) ? accept(l, nullptr, nullptr) : -1;
+  } else if (kind == "unix") {
+    l = ::mig::listen_unix(path.c_str());
+    a = (l >= 0) ? ::mig::connect_unix(path.c_str()) : -1;
+    b = (a >= 0) ? accept(l, nullptr, nullptr) : -1;
+  } else if (kind == "unix-dgram") {
+    b = ::mig::listen_unix(path.c_str(), SOCK_DGRAM);
+    a = (b >= 0) ? ::mig::connect_unix(path.c_str(), SOCK_DGRAM) : -1;
+  }
+  if (l >= 0)
+    close(l);
+  unlink(path.c_str());
+  return a >= 0 && b >= 0;
+}
+
+static void bench(const std::string& kind, ::mig::Message& msg, int n, size_t batch) {
+  int a, b;
+  if (!connect_pair(kind, a, b)) {
+    std::cerr << kind << ": cannot connect\n";
+    return;
+  }
+
+  ::mig::transport_options o;
+  o.batch = batch;
+  ::mig::Transport rx(b, o);
+  ::mig::transport_stats tx;
+
+  auto t0 = std::chrono::steady_clock::now();
+  std::thread sender([&]() {
+    ::mig::Transport t(a, o);
+    for (auto i=0; i<n; i++)
+      t.send(msg);
+    t.flush();
+    tx = t.stats();
+  });
+  std::vector<::mig::message_ptr_t> msgs;
+  int received = 0;
+  while (received < n && rx.receive(msgs, 5000) > 0)
+    received += msgs.size();
+  auto t1 = std::chrono::steady_clock::now();
+  sender.join();
+
+  auto s = std::chrono::duration<double>(t1 - t0).count();
+  std::cout << std::setw(12) << kind
+            << std::setw(7) << batch
+            << std::setw(12) << std::fixed << std::setprecision(0) << received / s
+            << std::setw(10) << std::setprecision(1) << rx.stats().bytes_received / s / 1e6
+            << std::setw(10) << std::setprecision(3) << (double)tx.send_calls / n
+            << std::setw(10) << (double)rx.stats().receive_calls / n
+            << ((received < n) ? "  incomplete" : "") << '\n';
+}
+
+int main(int argc, char *argv[]) {
+
+  int n = (argc > 1) ? atoi(argv[1]) : 200000;
+
+  TestMessage1003 m3;
+  ::mig::string_t s("sample string");
+  ::mig::blob_t b((const uint8_t *)"\x01\x02\x03\x04", 4);
+  m3.param1.assign(s);
+  m3.param2.assign(b);
+  m3.param3.data().param1.set();
+  m3.param3.data().param2 = 100;
+  m3.param5 = 5;
+  m3.to_wire();
+
+  std::cout << "frame " << m3.wire_format()->size() << " B, " << n << " messages\n"
+            << "      socket  batch     msgs/s      MB/s  sends/msg  recvs/msg\n";
+  for (auto kind : { "tcp", "unix", "unix-dgram" })
+    for (size_t batch : { 1, 8, 64, 256 })
+      bench(kind, m3, n, batch);
+  return 0;
+}